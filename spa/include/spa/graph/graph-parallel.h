@@ -0,0 +1,781 @@
+/* Simple Plugin API
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_GRAPH_PARALLEL_H__
+#define __SPA_GRAPH_PARALLEL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <spa/graph/graph.h>
+
+/* Parallel graph execution.
+ *
+ * When a cycle starts, the driver thread collects the nodes that take part in
+ * it and gives each of them a pending counter with the number of upstream
+ * nodes it waits for. The nodes without pending upstream nodes are queued and
+ * the workers are woken up. Workers run nodes from their own queue or steal
+ * from the queues of the other workers. When a node completes, the counters
+ * of its downstream nodes are decremented and the nodes that reach 0 are
+ * queued. The driver thread works along and returns when all nodes of the
+ * cycle completed. In a pull, the node that triggered the cycle is run last
+ * by the driver.
+ *
+ * Nodes can call into their peers when they run, for example to reuse a
+ * buffer, so two nodes that share a peer must not run at the same time.
+ * Each node has a lock, a node takes the locks of its peers while it runs.
+ * Peers that are linked to only one node and peers with the
+ * SPA_GRAPH_NODE_FLAG_SHARED flag are not locked. The locks are taken in
+ * the order of the nodes in the pool so that they can't deadlock.
+ *
+ * Graphs with cycles and graphs with more nodes or peer locks than fit in
+ * the pool are run with the fallback scheduler. A cycle started from inside
+ * a node is run with the fallback scheduler by the driver after the current
+ * cycle.
+ */
+
+#define SPA_GRAPH_PARALLEL_MAX_WORKERS	32
+#define SPA_GRAPH_PARALLEL_MAX_NODES	1024	/* power of 2 */
+#define SPA_GRAPH_PARALLEL_MAX_LOCKS	(4 * SPA_GRAPH_PARALLEL_MAX_NODES)
+#define SPA_GRAPH_PARALLEL_SPIN		2000
+
+/** Work stealing queue, the owner pushes and pops at the bottom, other
+ * workers steal from the top */
+struct spa_graph_parallel_queue {
+	int64_t top;
+	int64_t bottom;
+	struct spa_graph_node *nodes[SPA_GRAPH_PARALLEL_MAX_NODES];
+};
+
+struct spa_graph_parallel;
+
+struct spa_graph_parallel_node {
+	struct spa_graph_node *node;
+	uint32_t mark;			/**< cycle the node takes part in */
+	uint32_t lock;			/**< held while a peer of the node runs */
+	uint32_t n_peers;		/**< number of linked peers */
+	uint32_t first_lock;		/**< first peer to lock in locks */
+	uint32_t n_locks;		/**< number of peers to lock */
+};
+
+struct spa_graph_parallel_worker {
+	struct spa_graph_parallel *pool;
+	uint32_t id;
+	pthread_t thread;
+	struct spa_graph_parallel_queue queue;
+};
+
+struct spa_graph_parallel {
+	struct spa_graph *graph;
+
+	const struct spa_graph_callbacks *fallback;
+	void *fallback_data;
+
+	uint32_t n_workers;		/**< number of extra threads */
+	bool running;
+	bool busy;			/**< a cycle is running */
+	bool parallel;			/**< graph can run in parallel */
+	uint32_t generation;		/**< generation of parallel */
+
+	uint32_t seq;			/**< changes for each cycle */
+	uint32_t sleeping;		/**< number of sleeping workers */
+	pthread_mutex_t lock;		/**< lock and cond for sleeping workers */
+	pthread_cond_t cond;
+	uint32_t pending;		/**< number of nodes to complete */
+
+	uint32_t cycle;
+	bool pull;
+	struct spa_graph_node *trigger;
+	struct spa_graph_node *deferred;	/**< cycle started from inside a node */
+	bool deferred_pull;
+	struct spa_list nodes;		/**< nodes of the cycle, via ready_link */
+	uint32_t n_nodes;
+
+	pthread_t sched_thread;		/**< driver thread of the scheduling params */
+
+	struct spa_graph_parallel_node nodes_data[SPA_GRAPH_PARALLEL_MAX_NODES];
+	uint32_t locks[SPA_GRAPH_PARALLEL_MAX_LOCKS];	/**< peers to lock, index in nodes_data */
+
+	/* worker 0 is the driver */
+	struct spa_graph_parallel_worker workers[SPA_GRAPH_PARALLEL_MAX_WORKERS + 1];
+};
+
+#define SPA_GRAPH_PARALLEL_MASK		(SPA_GRAPH_PARALLEL_MAX_NODES - 1)
+
+static inline bool
+spa_graph_parallel_queue_push(struct spa_graph_parallel_queue *q, struct spa_graph_node *n)
+{
+	int64_t b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED);
+	int64_t t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+
+	if (b - t >= SPA_GRAPH_PARALLEL_MAX_NODES)
+		return false;
+
+	__atomic_store_n(&q->nodes[b & SPA_GRAPH_PARALLEL_MASK], n, __ATOMIC_RELAXED);
+	__atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static inline struct spa_graph_node *
+spa_graph_parallel_queue_pop(struct spa_graph_parallel_queue *q)
+{
+	struct spa_graph_node *n = NULL;
+	int64_t b, t;
+
+	b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&q->bottom, b, __ATOMIC_SEQ_CST);
+	t = __atomic_load_n(&q->top, __ATOMIC_SEQ_CST);
+
+	if (t <= b) {
+		n = __atomic_load_n(&q->nodes[b & SPA_GRAPH_PARALLEL_MASK], __ATOMIC_RELAXED);
+		if (t == b) {
+			/* last one, race against the thieves */
+			if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, false,
+						__ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+				n = NULL;
+			__atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+		}
+	} else
+		__atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+
+	return n;
+}
+
+static inline struct spa_graph_node *
+spa_graph_parallel_queue_steal(struct spa_graph_parallel_queue *q)
+{
+	struct spa_graph_node *n;
+	int64_t b, t;
+
+	t = __atomic_load_n(&q->top, __ATOMIC_SEQ_CST);
+	b = __atomic_load_n(&q->bottom, __ATOMIC_SEQ_CST);
+
+	if (t >= b)
+		return NULL;
+
+	n = __atomic_load_n(&q->nodes[t & SPA_GRAPH_PARALLEL_MASK], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, false,
+				__ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return NULL;
+
+	return n;
+}
+
+static inline void spa_graph_parallel_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+#define spa_graph_parallel_entry(n)	((struct spa_graph_parallel_node *) (n)->scheduler_data)
+#define spa_graph_parallel_mark(n)	(spa_graph_parallel_entry(n)->mark)
+
+static inline struct spa_graph_node *
+spa_graph_parallel_peer(struct spa_graph_parallel *pool, struct spa_graph_port *port)
+{
+	struct spa_graph_port *peer = port->peer;
+
+	if (peer == NULL || (peer->flags & SPA_GRAPH_PORT_FLAG_DISABLED) ||
+	    peer->node == NULL || peer->node->graph != pool->graph)
+		return NULL;
+
+	return peer->node;
+}
+
+/* the linked peer, also when the port is disabled. Enabling a port doesn't
+ * change the graph generation so the check uses all links. */
+static inline struct spa_graph_node *
+spa_graph_parallel_linked(struct spa_graph_parallel *pool, struct spa_graph_port *port)
+{
+	struct spa_graph_port *peer = port->peer;
+
+	if (peer == NULL || peer->node == NULL || peer->node->graph != pool->graph)
+		return NULL;
+
+	return peer->node;
+}
+
+/* a node takes part in the current cycle when it is marked and waits for
+ * its input */
+static inline bool
+spa_graph_parallel_in_cycle(struct spa_graph_parallel *pool, struct spa_graph_node *n)
+{
+	return spa_graph_parallel_mark(n) == pool->cycle &&
+		n->state == SPA_STATUS_NEED_BUFFER;
+}
+
+static inline bool
+spa_graph_parallel_is_source(struct spa_graph_parallel *pool, struct spa_graph_node *n)
+{
+	struct spa_graph_port *p;
+
+	spa_list_for_each(p, &n->ports[SPA_DIRECTION_INPUT], link) {
+		if (spa_graph_parallel_peer(pool, p))
+			return false;
+	}
+	return true;
+}
+
+static inline bool spa_graph_parallel_has_input(struct spa_graph_node *n)
+{
+	struct spa_graph_port *p;
+
+	spa_list_for_each(p, &n->ports[SPA_DIRECTION_INPUT], link) {
+		if (p->io && p->io->status == SPA_STATUS_HAVE_BUFFER)
+			return true;
+	}
+	return false;
+}
+
+static inline void spa_graph_parallel_lock(uint32_t *lock)
+{
+	uint32_t idle = 0;
+
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+			if (++idle < SPA_GRAPH_PARALLEL_SPIN)
+				spa_graph_parallel_relax();
+			else
+				sched_yield();
+		}
+	}
+}
+
+static inline void spa_graph_parallel_unlock(uint32_t *lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+/* take the locks of the peers that n can share with other nodes */
+static inline void
+spa_graph_parallel_lock_peers(struct spa_graph_parallel *pool, struct spa_graph_node *n)
+{
+	struct spa_graph_parallel_node *e = spa_graph_parallel_entry(n);
+	uint32_t i;
+
+	for (i = 0; i < e->n_locks; i++)
+		spa_graph_parallel_lock(&pool->nodes_data[pool->locks[e->first_lock + i]].lock);
+}
+
+static inline void
+spa_graph_parallel_unlock_peers(struct spa_graph_parallel *pool, struct spa_graph_node *n)
+{
+	struct spa_graph_parallel_node *e = spa_graph_parallel_entry(n);
+	uint32_t i;
+
+	for (i = e->n_locks; i-- > 0;)
+		spa_graph_parallel_unlock(&pool->nodes_data[pool->locks[e->first_lock + i]].lock);
+}
+
+static inline void
+spa_graph_parallel_run_node(struct spa_graph_parallel *pool,
+			    struct spa_graph_parallel_worker *worker,
+			    struct spa_graph_node *n)
+{
+	struct spa_graph_port *p;
+	struct spa_graph_node *pn;
+
+	if (pool->pull && spa_graph_parallel_is_source(pool, n)) {
+		spa_graph_parallel_lock_peers(pool, n);
+		n->state = spa_node_process_output(n->implementation);
+		spa_graph_parallel_unlock_peers(pool, n);
+		spa_debug("worker %d node %p processed out %d", worker->id, n, n->state);
+	}
+	else if (spa_graph_parallel_has_input(n)) {
+		spa_graph_parallel_lock_peers(pool, n);
+		n->state = spa_node_process_input(n->implementation);
+		spa_graph_parallel_unlock_peers(pool, n);
+		spa_debug("worker %d node %p processed in %d", worker->id, n, n->state);
+	}
+
+	spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
+		if ((pn = spa_graph_parallel_peer(pool, p)) == NULL ||
+		    !spa_graph_parallel_in_cycle(pool, pn))
+			continue;
+
+		if (__atomic_sub_fetch(&pn->ready[SPA_DIRECTION_INPUT], 1, __ATOMIC_ACQ_REL) != 0 ||
+		    pn == pool->trigger)
+			continue;
+
+		if (!spa_graph_parallel_queue_push(&worker->queue, pn))
+			spa_graph_parallel_run_node(pool, worker, pn);
+	}
+	__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_RELEASE);
+}
+
+static inline void
+spa_graph_parallel_work(struct spa_graph_parallel *pool,
+			struct spa_graph_parallel_worker *worker)
+{
+	struct spa_graph_node *n;
+	uint32_t i, n_queues = pool->n_workers + 1, idle = 0;
+
+	while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) > 0) {
+		if ((n = spa_graph_parallel_queue_pop(&worker->queue)) == NULL) {
+			for (i = 1; i < n_queues; i++) {
+				struct spa_graph_parallel_worker *w;
+
+				w = &pool->workers[(worker->id + i) % n_queues];
+				if ((n = spa_graph_parallel_queue_steal(&w->queue)) != NULL)
+					break;
+			}
+		}
+		if (n == NULL) {
+			/* give the cpu to the workers that run the nodes we wait
+			 * for when there are more threads than cpus */
+			if (++idle < SPA_GRAPH_PARALLEL_SPIN)
+				spa_graph_parallel_relax();
+			else
+				sched_yield();
+			continue;
+		}
+		idle = 0;
+		spa_graph_parallel_run_node(pool, worker, n);
+	}
+}
+
+static inline void *spa_graph_parallel_thread(void *data)
+{
+	struct spa_graph_parallel_worker *worker = (struct spa_graph_parallel_worker *) data;
+	struct spa_graph_parallel *pool = worker->pool;
+	uint32_t seq = 0, i;
+
+	spa_debug("worker %d: enter thread", worker->id);
+
+	while (true) {
+		/* wait for the next cycle, spin a little before going to sleep */
+		for (i = 0; i < SPA_GRAPH_PARALLEL_SPIN; i++) {
+			if (__atomic_load_n(&pool->seq, __ATOMIC_ACQUIRE) != seq)
+				break;
+			spa_graph_parallel_relax();
+		}
+		if (i == SPA_GRAPH_PARALLEL_SPIN) {
+			pthread_mutex_lock(&pool->lock);
+			__atomic_add_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+			while (__atomic_load_n(&pool->seq, __ATOMIC_SEQ_CST) == seq)
+				pthread_cond_wait(&pool->cond, &pool->lock);
+			__atomic_sub_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&pool->lock);
+		}
+		seq = __atomic_load_n(&pool->seq, __ATOMIC_ACQUIRE);
+
+		if (!__atomic_load_n(&pool->running, __ATOMIC_ACQUIRE))
+			break;
+
+		spa_graph_parallel_work(pool, worker);
+	}
+	spa_debug("worker %d: leave thread", worker->id);
+	return NULL;
+}
+
+static inline void spa_graph_parallel_wakeup(struct spa_graph_parallel *pool)
+{
+	__atomic_add_fetch(&pool->seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pool->sleeping, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+/* make the sorted list of peers that n has to lock when it runs */
+static inline bool
+spa_graph_parallel_add_locks(struct spa_graph_parallel *pool, struct spa_graph_node *n,
+			     uint32_t *n_locks)
+{
+	struct spa_graph_parallel_node *e = spa_graph_parallel_entry(n), *pe;
+	struct spa_graph_port *p;
+	struct spa_graph_node *pn;
+	uint32_t *locks = &pool->locks[*n_locks];
+	uint32_t i, j, d, idx;
+
+	e->first_lock = *n_locks;
+	e->n_locks = 0;
+
+	for (d = 0; d < 2; d++) {
+		spa_list_for_each(p, &n->ports[d], link) {
+			if ((pn = spa_graph_parallel_linked(pool, p)) == NULL ||
+			    (pn->flags & SPA_GRAPH_NODE_FLAG_SHARED))
+				continue;
+			pe = spa_graph_parallel_entry(pn);
+			if (pe->n_peers < 2)
+				continue;
+
+			idx = pe - pool->nodes_data;
+			for (i = 0; i < e->n_locks && locks[i] < idx; i++);
+			if (i < e->n_locks && locks[i] == idx)
+				continue;
+			if (*n_locks + e->n_locks >= SPA_GRAPH_PARALLEL_MAX_LOCKS)
+				return false;
+			for (j = e->n_locks; j > i; j--)
+				locks[j] = locks[j - 1];
+			locks[i] = idx;
+			e->n_locks++;
+		}
+	}
+	*n_locks += e->n_locks;
+	return true;
+}
+
+/* give the nodes an entry in the pool and check for cycles in the graph with
+ * Kahn's algorithm, ready[OUTPUT] is used for the number of upstream nodes */
+static inline bool spa_graph_parallel_check(struct spa_graph_parallel *pool)
+{
+	struct spa_graph *graph = pool->graph;
+	struct spa_graph_node *n, *pn, *t;
+	struct spa_graph_port *p;
+	struct spa_list queue;
+	uint32_t n_nodes = 0, n_sorted = 0, n_locks = 0, d;
+
+	pool->generation = graph->generation;
+	pool->parallel = false;
+
+	spa_list_for_each(n, &graph->nodes, link)
+		n_nodes++;
+	if (n_nodes > SPA_GRAPH_PARALLEL_MAX_NODES) {
+		spa_debug("graph %p has more than %d nodes", graph, SPA_GRAPH_PARALLEL_MAX_NODES);
+		return false;
+	}
+
+	n_nodes = 0;
+	spa_list_for_each(n, &graph->nodes, link) {
+		struct spa_graph_parallel_node *e = &pool->nodes_data[n_nodes++];
+
+		spa_zero(*e);
+		e->node = n;
+		n->scheduler_data = e;
+	}
+
+	spa_list_init(&queue);
+
+	spa_list_for_each(n, &graph->nodes, link) {
+		n->ready[SPA_DIRECTION_OUTPUT] = 0;
+		for (d = 0; d < 2; d++) {
+			spa_list_for_each(p, &n->ports[d], link) {
+				if (spa_graph_parallel_linked(pool, p) == NULL)
+					continue;
+				spa_graph_parallel_entry(n)->n_peers++;
+				if (d == SPA_DIRECTION_INPUT)
+					n->ready[SPA_DIRECTION_OUTPUT]++;
+			}
+		}
+	}
+	spa_list_for_each(n, &graph->nodes, link) {
+		if (n->ready[SPA_DIRECTION_OUTPUT] == 0)
+			spa_list_append(&queue, &n->ready_link);
+	}
+	spa_list_for_each(n, &queue, ready_link) {
+		n_sorted++;
+		spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
+			if ((pn = spa_graph_parallel_linked(pool, p)) == NULL)
+				continue;
+			if (--pn->ready[SPA_DIRECTION_OUTPUT] == 0)
+				spa_list_append(&queue, &pn->ready_link);
+		}
+	}
+	spa_list_for_each_safe(n, t, &queue, ready_link)
+		n->ready_link.next = NULL;
+
+	spa_list_for_each(n, &graph->nodes, link)
+		n->ready[SPA_DIRECTION_OUTPUT] = 0;
+
+	if (n_sorted != n_nodes) {
+		spa_debug("graph %p has cycles", graph);
+		return false;
+	}
+
+	spa_list_for_each(n, &graph->nodes, link) {
+		if (!spa_graph_parallel_add_locks(pool, n, &n_locks)) {
+			spa_debug("graph %p needs more than %d locks", graph,
+					SPA_GRAPH_PARALLEL_MAX_LOCKS);
+			return false;
+		}
+	}
+	pool->parallel = true;
+
+	spa_debug("graph %p nodes %d locks %d parallel %d", graph,
+			n_nodes, n_locks, pool->parallel);
+
+	return pool->parallel;
+}
+
+static inline void
+spa_graph_parallel_add_node(struct spa_graph_parallel *pool, struct spa_graph_node *n, int state)
+{
+	spa_graph_parallel_mark(n) = pool->cycle;
+	n->state = state;
+	spa_list_append(&pool->nodes, &n->ready_link);
+	pool->n_nodes++;
+}
+
+/* collect the upstream nodes of the trigger. Nodes with inputs are asked for
+ * output, the sources are run in parallel later. */
+static inline void spa_graph_parallel_collect_pull(struct spa_graph_parallel *pool)
+{
+	struct spa_graph_node *n, *pn;
+	struct spa_graph_port *p;
+
+	spa_list_for_each(n, &pool->nodes, ready_link) {
+		if (n != pool->trigger && !spa_graph_parallel_is_source(pool, n)) {
+			n->state = spa_node_process_output(n->implementation);
+			spa_debug("node %p processed out %d", n, n->state);
+			if (n->state != SPA_STATUS_NEED_BUFFER)
+				continue;
+		}
+		spa_list_for_each(p, &n->ports[SPA_DIRECTION_INPUT], link) {
+			if ((pn = spa_graph_parallel_peer(pool, p)) == NULL ||
+			    p->io->status != SPA_STATUS_NEED_BUFFER ||
+			    spa_graph_parallel_mark(pn) == pool->cycle)
+				continue;
+			/* sources stay pending until they run */
+			spa_graph_parallel_add_node(pool, pn, SPA_STATUS_NEED_BUFFER);
+		}
+	}
+}
+
+static inline void spa_graph_parallel_collect_push(struct spa_graph_parallel *pool)
+{
+	struct spa_graph_node *n, *pn;
+	struct spa_graph_port *p;
+
+	spa_list_for_each(n, &pool->nodes, ready_link) {
+		spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
+			if ((pn = spa_graph_parallel_peer(pool, p)) == NULL ||
+			    spa_graph_parallel_mark(pn) == pool->cycle)
+				continue;
+			spa_graph_parallel_add_node(pool, pn, SPA_STATUS_NEED_BUFFER);
+		}
+	}
+}
+
+static inline void spa_graph_parallel_sched(struct spa_graph_parallel *pool)
+{
+	pthread_t self = pthread_self();
+	struct sched_param sp;
+	uint32_t i;
+	int policy;
+
+	/* let the workers follow the scheduling class of the driver */
+	if (pthread_equal(pool->sched_thread, self))
+		return;
+	pool->sched_thread = self;
+
+	if (pthread_getschedparam(self, &policy, &sp) != 0)
+		return;
+	for (i = 1; i <= pool->n_workers; i++)
+		pthread_setschedparam(pool->workers[i].thread, policy, &sp);
+}
+
+static inline int spa_graph_parallel_cycle(struct spa_graph_parallel *pool,
+					   struct spa_graph_node *node, bool pull)
+{
+	struct spa_graph_parallel_worker *driver = &pool->workers[0];
+	struct spa_graph_node *n, *t, *pn;
+	struct spa_graph_port *p;
+	uint32_t pending = 0;
+
+	if (pool->busy) {
+		struct spa_graph_node *none = NULL;
+
+		/* started from inside a node, the workers are still running nodes
+		 * so run it after the cycle */
+		if (!__atomic_compare_exchange_n(&pool->deferred, &none, node, false,
+						 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return -EBUSY;
+		pool->deferred_pull = pull;
+		return 0;
+	}
+
+	if (pool->generation != pool->graph->generation)
+		spa_graph_parallel_check(pool);
+
+	if (!pool->parallel || pool->n_workers == 0) {
+		if (pull)
+			return pool->fallback->need_input(pool->fallback_data, node);
+		else
+			return pool->fallback->have_output(pool->fallback_data, node);
+	}
+
+	pool->busy = true;
+	if (++pool->cycle == 0)
+		pool->cycle = 1;
+	pool->pull = pull;
+	pool->trigger = node;
+	spa_list_init(&pool->nodes);
+	pool->n_nodes = 0;
+
+	spa_debug("graph %p start %s cycle %d", pool->graph, pull ? "pull" : "push", pool->cycle);
+
+	if (pull) {
+		spa_graph_parallel_add_node(pool, node, SPA_STATUS_NEED_BUFFER);
+		spa_graph_parallel_collect_pull(pool);
+	} else {
+		spa_graph_parallel_add_node(pool, node, SPA_STATUS_HAVE_BUFFER);
+		spa_graph_parallel_collect_push(pool);
+	}
+
+	/* count the upstream nodes that each node waits for */
+	spa_list_for_each(n, &pool->nodes, ready_link) {
+		n->required[SPA_DIRECTION_INPUT] = 0;
+		spa_list_for_each(p, &n->ports[SPA_DIRECTION_INPUT], link) {
+			if ((pn = spa_graph_parallel_peer(pool, p)) != NULL &&
+			    spa_graph_parallel_in_cycle(pool, pn))
+				n->required[SPA_DIRECTION_INPUT]++;
+		}
+		n->ready[SPA_DIRECTION_INPUT] = n->required[SPA_DIRECTION_INPUT];
+	}
+
+	/* ready[OUTPUT] marks the nodes that can start right away */
+	spa_list_for_each(n, &pool->nodes, ready_link) {
+		n->ready[SPA_DIRECTION_OUTPUT] = 0;
+		if (n == node || !spa_graph_parallel_in_cycle(pool, n))
+			continue;
+		pending++;
+		if (n->ready[SPA_DIRECTION_INPUT] == 0)
+			n->ready[SPA_DIRECTION_OUTPUT] = 1;
+	}
+
+	if (pending > 0) {
+		/* workers that are late for the previous cycle can start stealing
+		 * as soon as the first node is queued, only the driver pushes on
+		 * its own queue */
+		__atomic_store_n(&pool->pending, pending, __ATOMIC_RELEASE);
+		spa_list_for_each(n, &pool->nodes, ready_link) {
+			if (n->ready[SPA_DIRECTION_OUTPUT])
+				spa_graph_parallel_queue_push(&driver->queue, n);
+		}
+		spa_graph_parallel_sched(pool);
+		spa_graph_parallel_wakeup(pool);
+		spa_graph_parallel_work(pool, driver);
+	}
+
+	if (pull && node->ready[SPA_DIRECTION_INPUT] == 0 &&
+	    spa_graph_parallel_has_input(node)) {
+		node->state = spa_node_process_input(node->implementation);
+		spa_debug("node %p processed in %d", node, node->state);
+	}
+
+	spa_list_for_each_safe(n, t, &pool->nodes, ready_link)
+		n->ready_link.next = NULL;
+	spa_list_init(&pool->nodes);
+	pool->busy = false;
+
+	spa_debug("graph %p end cycle %d", pool->graph, pool->cycle);
+
+	if ((n = __atomic_exchange_n(&pool->deferred, NULL, __ATOMIC_ACQ_REL)) != NULL) {
+		spa_debug("graph %p run deferred %s of %p", pool->graph,
+				pool->deferred_pull ? "pull" : "push", n);
+		if (pool->deferred_pull)
+			pool->fallback->need_input(pool->fallback_data, n);
+		else
+			pool->fallback->have_output(pool->fallback_data, n);
+	}
+	return 0;
+}
+
+static inline int spa_graph_parallel_need_input(void *data, struct spa_graph_node *node)
+{
+	return spa_graph_parallel_cycle((struct spa_graph_parallel *) data, node, true);
+}
+
+static inline int spa_graph_parallel_have_output(void *data, struct spa_graph_node *node)
+{
+	return spa_graph_parallel_cycle((struct spa_graph_parallel *) data, node, false);
+}
+
+static const struct spa_graph_callbacks spa_graph_parallel_callbacks = {
+	SPA_VERSION_GRAPH_CALLBACKS,
+	.need_input = spa_graph_parallel_need_input,
+	.have_output = spa_graph_parallel_have_output,
+};
+
+/** Initialize \a pool to run \a graph with \a n_workers extra threads. The
+ * \a fallback callbacks are used when the graph can't be run in parallel. */
+static inline void spa_graph_parallel_init(struct spa_graph_parallel *pool,
+					   struct spa_graph *graph,
+					   uint32_t n_workers,
+					   const struct spa_graph_callbacks *fallback,
+					   void *fallback_data)
+{
+	uint32_t i;
+
+	spa_zero(*pool);
+	pool->graph = graph;
+	pool->fallback = fallback;
+	pool->fallback_data = fallback_data;
+	pool->n_workers = SPA_MIN(n_workers, SPA_GRAPH_PARALLEL_MAX_WORKERS);
+	pool->generation = graph->generation - 1;
+	spa_list_init(&pool->nodes);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	for (i = 0; i <= pool->n_workers; i++) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].id = i;
+	}
+}
+
+/** Start the worker threads */
+static inline int spa_graph_parallel_start(struct spa_graph_parallel *pool)
+{
+	uint32_t i;
+	int res;
+
+	pool->running = true;
+	for (i = 1; i <= pool->n_workers; i++) {
+		struct spa_graph_parallel_worker *w = &pool->workers[i];
+
+		if ((res = pthread_create(&w->thread, NULL, spa_graph_parallel_thread, w)) != 0) {
+			/* run with the threads we have */
+			pool->n_workers = i - 1;
+			return -res;
+		}
+	}
+	return 0;
+}
+
+/** Stop and join the worker threads */
+static inline void spa_graph_parallel_stop(struct spa_graph_parallel *pool)
+{
+	uint32_t i;
+
+	__atomic_store_n(&pool->running, false, __ATOMIC_RELEASE);
+	spa_graph_parallel_wakeup(pool);
+
+	for (i = 1; i <= pool->n_workers; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* __SPA_GRAPH_PARALLEL_H__ */
@@ -0,0 +1,319 @@
+/* Simple Plugin API
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_GRAPH_SCHEDULER_H__
+#define __SPA_GRAPH_SCHEDULER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <errno.h>
+
+#include <spa/graph/graph.h>
+
+/* Iterative scheduler.
+ *
+ * The nodes of the graph are kept in topological order in a flat array. The
+ * order is only recomputed when the generation of the graph changes. Each
+ * node has an entry in the array with the cycle it takes part in and its
+ * dependency counters, scheduler_data of the node points to its entry.
+ * The entries are walked in array order, so a cycle only touches the graph
+ * nodes that take part in it.
+ *
+ * A pull (need_input) walks the order backwards from the node and asks the
+ * upstream nodes for output, then walks forwards and runs the nodes as soon
+ * as all the inputs they asked for are available. A push (have_output) walks
+ * the order forwards and runs the downstream nodes when all their inputs are
+ * ready. The ready counter of an entry is reset when its node runs.
+ *
+ * Graphs with more than SPA_GRAPH_DATA_MAX_NODES nodes are not run.
+ */
+
+#define SPA_GRAPH_DATA_MAX_NODES	1024
+
+struct spa_graph_data_node {
+	struct spa_graph_node *node;
+	uint32_t mark;			/**< cycle the node takes part in */
+	uint32_t required;		/**< number of inputs the node waits for */
+	uint32_t ready;			/**< number of inputs with data */
+};
+
+struct spa_graph_data {
+	struct spa_graph *graph;
+	uint32_t generation;		/**< graph generation of order */
+	uint32_t cycle;			/**< current cycle number */
+	uint32_t n_nodes;		/**< number of nodes, 0 when they don't fit */
+	struct spa_graph_data_node nodes[SPA_GRAPH_DATA_MAX_NODES];	/**< in topological order */
+};
+
+static inline void spa_graph_data_init(struct spa_graph_data *data,
+				       struct spa_graph *graph)
+{
+	data->graph = graph;
+	data->generation = graph->generation - 1;
+	data->cycle = 0;
+	data->n_nodes = 0;
+}
+
+#define spa_graph_data_entry(n)	((struct spa_graph_data_node *) (n)->scheduler_data)
+
+static inline struct spa_graph_data_node *
+spa_graph_data_peer(struct spa_graph_data *data, struct spa_graph_port *port)
+{
+	struct spa_graph_port *peer = port->peer;
+
+	if (peer == NULL || (peer->flags & SPA_GRAPH_PORT_FLAG_DISABLED) ||
+	    peer->node == NULL || peer->node->graph != data->graph)
+		return NULL;
+
+	return spa_graph_data_entry(peer->node);
+}
+
+static inline void spa_graph_data_add(struct spa_graph_data *data, struct spa_graph_node *n)
+{
+	struct spa_graph_data_node *e = &data->nodes[data->n_nodes++];
+
+	e->node = n;
+	e->mark = 0;
+	e->required = e->ready = 0;
+	n->scheduler_data = e;
+}
+
+/* Kahn's algorithm, the array is used as the queue and the ready counters
+ * of the graph nodes count the upstream nodes that are not sorted yet.
+ * Nodes that are part of a cycle are added at the end in graph order. */
+static inline void spa_graph_data_sort(struct spa_graph_data *data)
+{
+	struct spa_graph *graph = data->graph;
+	struct spa_graph_node *n, *pn;
+	struct spa_graph_port *p;
+	uint32_t i, n_nodes = 0;
+
+	spa_debug("graph %p sort generation %d", graph, graph->generation);
+
+	data->generation = graph->generation;
+	data->n_nodes = 0;
+
+	spa_list_for_each(n, &graph->nodes, link) {
+		n->scheduler_data = NULL;
+		n->ready[SPA_DIRECTION_INPUT] = 0;
+		spa_list_for_each(p, &n->ports[SPA_DIRECTION_INPUT], link) {
+			if (p->peer && p->peer->node && p->peer->node->graph == graph)
+				n->ready[SPA_DIRECTION_INPUT]++;
+		}
+		n_nodes++;
+	}
+	if (n_nodes > SPA_GRAPH_DATA_MAX_NODES) {
+		spa_debug("graph %p has more than %d nodes", graph, SPA_GRAPH_DATA_MAX_NODES);
+		return;
+	}
+	spa_list_for_each(n, &graph->nodes, link) {
+		if (n->ready[SPA_DIRECTION_INPUT] == 0)
+			spa_graph_data_add(data, n);
+	}
+	for (i = 0; i < data->n_nodes; i++) {
+		n = data->nodes[i].node;
+		spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
+			if (p->peer == NULL || (pn = p->peer->node) == NULL ||
+			    pn->graph != graph || pn->scheduler_data != NULL)
+				continue;
+			if (--pn->ready[SPA_DIRECTION_INPUT] == 0)
+				spa_graph_data_add(data, pn);
+		}
+	}
+	spa_list_for_each(n, &graph->nodes, link) {
+		n->ready[SPA_DIRECTION_INPUT] = 0;
+		if (n->scheduler_data == NULL) {
+			spa_debug("node %p is part of a cycle", n);
+			spa_graph_data_add(data, n);
+		}
+	}
+}
+
+static inline uint32_t spa_graph_data_next_cycle(struct spa_graph_data *data)
+{
+	if (data->generation != data->graph->generation)
+		spa_graph_data_sort(data);
+
+	if (++data->cycle == 0)
+		data->cycle = 1;
+	return data->cycle;
+}
+
+/* deliver the output of e to its downstream peers. When pulling, only the
+ * nodes that asked for input in this cycle are updated. When pushing, the
+ * number of inputs a node waits for is counted when it is first reached. */
+static inline void spa_graph_data_deliver(struct spa_graph_data *data,
+					  struct spa_graph_data_node *e, uint32_t cycle,
+					  bool pull)
+{
+	struct spa_graph_port *p, *pp;
+	struct spa_graph_data_node *pe;
+
+	spa_list_for_each(p, &e->node->ports[SPA_DIRECTION_OUTPUT], link) {
+		if ((pe = spa_graph_data_peer(data, p)) == NULL ||
+		    p->peer->io->status != SPA_STATUS_HAVE_BUFFER)
+			continue;
+		if (pe->mark != cycle) {
+			if (pull)
+				continue;
+			pe->ready = 0;
+			pe->required = 0;
+			/* most nodes have only the input we deliver to */
+			if (p->peer->link.next == p->peer->link.prev)
+				pe->required = 1;
+			else {
+				spa_list_for_each(pp, &pe->node->ports[SPA_DIRECTION_INPUT], link) {
+					if (spa_graph_data_peer(data, pp) != NULL)
+						pe->required++;
+				}
+			}
+			pe->mark = cycle;
+		}
+		pe->ready++;
+
+		spa_debug("node %p deliver to %p %d/%d", e->node, pe->node,
+			  pe->ready, pe->required);
+	}
+}
+
+static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *node)
+{
+	struct spa_graph_data *d = (struct spa_graph_data *) data;
+	struct spa_graph_data_node *e, *pe, *te;
+	struct spa_graph_port *p;
+	uint32_t cycle, i, first;
+
+	spa_debug("node %p start pull", node);
+
+	cycle = spa_graph_data_next_cycle(d);
+	if (d->n_nodes == 0)
+		return -ENOSPC;
+
+	te = spa_graph_data_entry(node);
+	te->mark = cycle;
+	first = te - d->nodes;
+
+	/* walk upstream and ask the nodes for output. The downstream nodes
+	 * already know what they need so output is delivered right away and
+	 * only the nodes that need input have to be run in the second walk. */
+	for (i = first + 1; i-- > 0;) {
+		e = &d->nodes[i];
+		if (e->mark != cycle)
+			continue;
+
+		if (e != te) {
+			e->node->state = spa_node_process_output(e->node->implementation);
+			spa_debug("node %p processed out %d", e->node, e->node->state);
+			if (e->node->state == SPA_STATUS_HAVE_BUFFER)
+				spa_graph_data_deliver(d, e, cycle, true);
+			if (e->node->state != SPA_STATUS_NEED_BUFFER)
+				continue;
+		} else
+			e->node->state = SPA_STATUS_NEED_BUFFER;
+
+		first = i;
+
+		e->ready = 0;
+		e->required = 0;
+		spa_list_for_each(p, &e->node->ports[SPA_DIRECTION_INPUT], link) {
+			if ((pe = spa_graph_data_peer(d, p)) == NULL ||
+			    p->io->status != SPA_STATUS_NEED_BUFFER)
+				continue;
+			e->required++;
+			pe->mark = cycle;
+		}
+	}
+
+	/* walk downstream from the first node that needed input and run the
+	 * nodes that have all their input */
+	for (i = first; i < d->n_nodes; i++) {
+		e = &d->nodes[i];
+		if (e->mark != cycle ||
+		    e->node->state != SPA_STATUS_NEED_BUFFER)
+			continue;
+
+		if (e->required == 0 || e->ready < e->required) {
+			if (e == te)
+				break;
+			continue;
+		}
+		e->ready = 0;
+		e->node->state = spa_node_process_input(e->node->implementation);
+		spa_debug("node %p processed in %d", e->node, e->node->state);
+
+		if (e == te)
+			break;
+
+		if (e->node->state == SPA_STATUS_HAVE_BUFFER)
+			spa_graph_data_deliver(d, e, cycle, true);
+	}
+	spa_debug("node %p end pull", node);
+	return 0;
+}
+
+static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *node)
+{
+	struct spa_graph_data *d = (struct spa_graph_data *) data;
+	struct spa_graph_data_node *e, *te;
+	uint32_t cycle, i;
+
+	spa_debug("node %p start push", node);
+
+	cycle = spa_graph_data_next_cycle(d);
+	if (d->n_nodes == 0)
+		return -ENOSPC;
+
+	te = spa_graph_data_entry(node);
+	te->mark = cycle;
+	node->state = SPA_STATUS_HAVE_BUFFER;
+
+	for (i = te - d->nodes; i < d->n_nodes; i++) {
+		e = &d->nodes[i];
+		if (e->mark != cycle)
+			continue;
+
+		if (e != te) {
+			/* wait for all the inputs of the node */
+			if (e->ready < e->required)
+				continue;
+
+			e->ready = 0;
+			e->node->state = spa_node_process_input(e->node->implementation);
+			spa_debug("node %p processed in %d", e->node, e->node->state);
+		}
+		if (e->node->state == SPA_STATUS_HAVE_BUFFER)
+			spa_graph_data_deliver(d, e, cycle, false);
+	}
+	spa_debug("node %p end push", node);
+	return 0;
+}
+
+static const struct spa_graph_callbacks spa_graph_impl_default = {
+	SPA_VERSION_GRAPH_CALLBACKS,
+	.need_input = spa_graph_impl_need_input,
+	.have_output = spa_graph_impl_have_output,
+};
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* __SPA_GRAPH_SCHEDULER_H__ */
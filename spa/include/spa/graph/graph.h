@@ -49,6 +49,7 @@ struct spa_graph {
 	struct spa_list nodes;
 	const struct spa_graph_callbacks *callbacks;
 	void *callbacks_data;
+	uint32_t generation;		/**< changes when nodes or links change */
 };
 
 #define spa_graph_need_input(g,n)	((g)->callbacks->need_input((g)->callbacks_data, (n)))
@@ -61,6 +62,7 @@ struct spa_graph_node {
 	struct spa_list ports[2];	/**< list of input and output ports */
 	struct spa_list ready_link;	/**< link for scheduler */
 #define SPA_GRAPH_NODE_FLAG_ASYNC	(1 << 0)
+#define SPA_GRAPH_NODE_FLAG_SHARED	(1 << 1)	/**< can be called by several peers at once */
 	uint32_t flags;			/**< node flags */
 	uint32_t required[2];		/**< required number of ports */
 	uint32_t ready[2];		/**< number of ports with data */
@@ -84,6 +86,13 @@ struct spa_graph_port {
 static inline void spa_graph_init(struct spa_graph *graph)
 {
 	spa_list_init(&graph->nodes);
+	graph->generation = 0;
+}
+
+static inline void spa_graph_node_changed(struct spa_graph_node *node)
+{
+	if (node != NULL && node->graph != NULL)
+		node->graph->generation++;
 }
 
 static inline void
@@ -100,6 +109,7 @@ spa_graph_node_init(struct spa_graph_node *node)
 {
 	spa_list_init(&node->ports[SPA_DIRECTION_INPUT]);
 	spa_list_init(&node->ports[SPA_DIRECTION_OUTPUT]);
+	node->graph = NULL;
 	node->flags = 0;
 	node->required[SPA_DIRECTION_INPUT] = node->ready[SPA_DIRECTION_INPUT] = 0;
 	node->required[SPA_DIRECTION_OUTPUT] = node->ready[SPA_DIRECTION_OUTPUT] = 0;
@@ -121,6 +131,7 @@ spa_graph_node_add(struct spa_graph *graph,
 	node->state = SPA_STATUS_OK;
 	node->ready_link.next = NULL;
 	spa_list_append(&graph->nodes, &node->link);
+	graph->generation++;
 	spa_debug("node %p add", node);
 }
 
@@ -136,6 +147,8 @@ spa_graph_port_init(struct spa_graph_port *port,
 	port->port_id = port_id;
 	port->flags = flags;
 	port->io = io;
+	port->node = NULL;
+	port->peer = NULL;
 }
 
 static inline void
@@ -147,6 +160,7 @@ spa_graph_port_add(struct spa_graph_node *node,
 	spa_list_append(&node->ports[port->direction], &port->link);
 	if (!(port->flags & SPA_PORT_INFO_FLAG_OPTIONAL))
 		node->required[port->direction]++;
+	spa_graph_node_changed(node);
 }
 
 static inline void spa_graph_node_remove(struct spa_graph_node *node)
@@ -155,6 +169,9 @@ static inline void spa_graph_node_remove(struct spa_graph_node *node)
 	spa_list_remove(&node->link);
 	if (node->ready_link.next)
 		spa_list_remove(&node->ready_link);
+	node->ready_link.next = NULL;
+	spa_graph_node_changed(node);
+	node->graph = NULL;
 }
 
 static inline void spa_graph_port_remove(struct spa_graph_port *port)
@@ -165,6 +182,7 @@ static inline void spa_graph_port_remove(struct spa_graph_port *port)
 	    port->node->required[port->direction] > 0) {
 		port->node->required[port->direction]--;
 	}
+	spa_graph_node_changed(port->node);
 }
 
 static inline void
@@ -173,6 +191,8 @@ spa_graph_port_link(struct spa_graph_port *out, struct spa_graph_port *in)
 	spa_debug("port %p link to %p", out, in);
 	out->peer = in;
 	in->peer = out;
+	spa_graph_node_changed(out->node);
+	spa_graph_node_changed(in->node);
 }
 
 static inline void
@@ -180,9 +200,11 @@ spa_graph_port_unlink(struct spa_graph_port *port)
 {
 	spa_debug("port %p unlink from %p", port, port->peer);
 	if (port->peer) {
+		spa_graph_node_changed(port->peer->node);
 		port->peer->peer = NULL;
 		port->peer = NULL;
 	}
+	spa_graph_node_changed(port->node);
 }
 
 #ifdef __cplusplus
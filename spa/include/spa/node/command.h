@@ -89,6 +89,9 @@ spa_type_command_node_map(struct spa_type_map *map, struct spa_type_command_node
  *          and @monotonic_time in nanoseconds
  * @scale: update to the speed stored as Q16.16, @change_mask = 1<<1
  * @state: the new clock state, when @change_mask = 1<<2
+ * @flags: flags for the clock
+ * @latency: the latency of the graph in nanoseconds, when @change_mask = 1<<3.
+ *           Nodes should process in chunks of this duration.
  */
 struct spa_command_node_clock_update_body {
 	struct spa_pod_object_body body;
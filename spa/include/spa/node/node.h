@@ -49,7 +49,10 @@ struct spa_port_info {
 #define SPA_PORT_INFO_FLAG_CAN_ALLOC_BUFFERS	(1<<2)	/**< the port can allocate buffer data */
 #define SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS	(1<<3)	/**< the port can use a provided buffer */
 #define SPA_PORT_INFO_FLAG_IN_PLACE		(1<<4)	/**< the port can process data in-place and
-							 *   will need a writable input buffer */
+							 *   will need a writable input buffer. An
+							 *   output port with this flag can use the
+							 *   buffers of the input port and forward
+							 *   them */
 #define SPA_PORT_INFO_FLAG_NO_REF		(1<<5)	/**< the port does not keep a ref on the buffer */
 #define SPA_PORT_INFO_FLAG_LIVE			(1<<6)	/**< output buffers from this port are
 							 *   timestamped against a live clock. */
@@ -41,6 +41,7 @@ extern "C" {
 
 #define SPA_TYPE_PROPS__minLatency	SPA_TYPE_PROPS_BASE "minLatency"
 #define SPA_TYPE_PROPS__maxLatency	SPA_TYPE_PROPS_BASE "maxLatency"
+#define SPA_TYPE_PROPS__targetLatency	SPA_TYPE_PROPS_BASE "targetLatency"
 #define SPA_TYPE_PROPS__periods		SPA_TYPE_PROPS_BASE "periods"
 #define SPA_TYPE_PROPS__periodSize	SPA_TYPE_PROPS_BASE "periodSize"
 #define SPA_TYPE_PROPS__periodEvent	SPA_TYPE_PROPS_BASE "periodEvent"
@@ -50,6 +51,7 @@ extern "C" {
 #define SPA_TYPE_PROPS__frequency	SPA_TYPE_PROPS_BASE "frequency"
 #define SPA_TYPE_PROPS__volume		SPA_TYPE_PROPS_BASE "volume"
 #define SPA_TYPE_PROPS__mute		SPA_TYPE_PROPS_BASE "mute"
+#define SPA_TYPE_PROPS__channelVolumes	SPA_TYPE_PROPS_BASE "channelVolumes"
 #define SPA_TYPE_PROPS__patternType	SPA_TYPE_PROPS_BASE "patternType"
 
 #define SPA_TYPE_PROPS__brightness	SPA_TYPE_PROPS_BASE "brightness"
@@ -46,6 +46,14 @@ enum spa_io {
 	SPA_IO_ERR = (1 << 3),
 };
 
+/** Priority of a source. When several sources are ready in the same
+ * iteration, sources with a higher priority are dispatched first. */
+enum spa_source_priority {
+	SPA_SOURCE_PRIORITY_LOW = -1,		/**< idle work that can wait */
+	SPA_SOURCE_PRIORITY_DEFAULT = 0,
+	SPA_SOURCE_PRIORITY_RT = 1,		/**< realtime data processing */
+};
+
 struct spa_source;
 
 typedef void (*spa_source_func_t) (struct spa_source *source);
@@ -57,6 +65,7 @@ struct spa_source {
 	int fd;
 	enum spa_io mask;
 	enum spa_io rmask;
+	enum spa_source_priority priority;
 };
 
 typedef int (*spa_invoke_func_t) (struct spa_loop *loop,
@@ -101,18 +110,32 @@ struct spa_loop {
 #define spa_loop_invoke(l,...)		(l)->invoke((l),__VA_ARGS__)
 
 
+/** Statistics of one loop iteration */
+struct spa_loop_stats {
+	uint32_t n_events;		/**< number of dispatched events */
+	uint32_t max_events;		/**< size of the event array */
+	uint64_t wait_time;		/**< time spent waiting for events in nsec */
+	uint64_t dispatch_time;		/**< time spent dispatching in nsec */
+	struct spa_source *slowest;	/**< source that took the most time */
+	uint64_t slowest_time;		/**< time spent in \a slowest in nsec */
+};
+
 /** Control hooks */
 struct spa_loop_control_hooks {
-#define SPA_VERSION_LOOP_CONTROL_HOOKS	0
+#define SPA_VERSION_LOOP_CONTROL_HOOKS	1
 	uint32_t version;
 	/** Executed right before waiting for events */
 	void (*before) (void *data);
 	/** Executed right after waiting for events */
 	void (*after) (void *data);
+	/** Executed after dispatching the events, since version 1.
+	 * Only when this hook is set, the loop measures the time. */
+	void (*stats) (void *data, const struct spa_loop_stats *stats);
 };
 
 #define spa_loop_control_hook_before(l) spa_hook_list_call(l, struct spa_loop_control_hooks, before, 0)
 #define spa_loop_control_hook_after(l) spa_hook_list_call(l, struct spa_loop_control_hooks, after, 0)
+#define spa_loop_control_hook_stats(l,...) spa_hook_list_call(l, struct spa_loop_control_hooks, stats, 1, __VA_ARGS__)
 
 /**
  * Control an event loop
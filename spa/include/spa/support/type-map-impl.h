@@ -24,11 +24,19 @@
 extern "C" {
 #endif
 
+#include <string.h>
+
+#include <spa/utils/hash.h>
 #include <spa/support/type-map.h>
 
+/* with an index, the ids of the types are also stored in 2 * max_types
+ * slots, hashed on the type name with linear probing. Without an index the
+ * types are looked up one by one. */
 struct spa_type_map_impl_data {
 	struct spa_type_map map;
 	unsigned int n_types;
+	unsigned int max_types;		/**< 0 when the map has no index */
+	uint32_t *index;		/**< 2 * max_types slots or NULL */
 	char *types[1];
 };
 
@@ -36,15 +44,32 @@ static inline uint32_t
 spa_type_map_impl_get_id (struct spa_type_map *map, const char *type)
 {
 	struct spa_type_map_impl_data *impl = (struct spa_type_map_impl_data *) map;
-	uint32_t i = 0;
+	uint32_t size = 2 * impl->max_types, i, id;
+
+	if (type == NULL)
+		return SPA_ID_INVALID;
+
+	if (impl->index == NULL) {
+		for (i = 1; i <= impl->n_types; i++) {
+			if (strcmp(impl->types[i], type) == 0)
+				return i;
+		}
+		impl->types[i] = (char *) type;
+		impl->n_types++;
+		return i;
+	}
 
-	for (i = 1; i <= impl->n_types; i++) {
-		if (strcmp(impl->types[i], type) == 0)
-			return i;
+	for (i = spa_hash_string(type) % size; (id = impl->index[i]) != 0; i = (i + 1) % size) {
+		if (strcmp(impl->types[id], type) == 0)
+			return id;
 	}
-	impl->types[i] = (char *) type;
-	impl->n_types++;
-        return i;
+	if (impl->n_types + 1 >= impl->max_types)
+		return SPA_ID_INVALID;
+
+	id = ++impl->n_types;
+	impl->types[id] = (char *) type;
+	impl->index[i] = id;
+        return id;
 }
 
 static inline const char *
@@ -66,19 +91,33 @@ static inline size_t spa_type_map_impl_get_size (const struct spa_type_map *map)
 struct  {					\
 	struct spa_type_map map;		\
 	unsigned int n_types;			\
+	unsigned int max_types;			\
+	uint32_t *index;			\
 	char *types[maxtypes];			\
+	uint32_t index_data[2 * (maxtypes)];	\
 } name
 
+/* a map without an index, the caller makes sure it does not get more types
+ * than it was defined with */
 #define SPA_TYPE_MAP_IMPL_INIT			\
 	{ { SPA_VERSION_TYPE_MAP,		\
 	    NULL,				\
 	    spa_type_map_impl_get_id,		\
 	    spa_type_map_impl_get_type,		\
 	    spa_type_map_impl_get_size,},	\
-	  0, { NULL, } }
+	  0, 0, NULL, { NULL, } }
+
+/* a map with an index for \a name, defined with SPA_TYPE_MAP_IMPL_DEFINE */
+#define SPA_TYPE_MAP_IMPL_INIT_INDEX(name,maxtypes)	\
+	{ { SPA_VERSION_TYPE_MAP,		\
+	    NULL,				\
+	    spa_type_map_impl_get_id,		\
+	    spa_type_map_impl_get_type,		\
+	    spa_type_map_impl_get_size,},	\
+	  0, maxtypes, (name).index_data, { NULL, } }
 
 #define SPA_TYPE_MAP_IMPL(name,maxtypes)		\
-	SPA_TYPE_MAP_IMPL_DEFINE(name,maxtypes) = SPA_TYPE_MAP_IMPL_INIT
+	SPA_TYPE_MAP_IMPL_DEFINE(name,maxtypes) = SPA_TYPE_MAP_IMPL_INIT_INDEX(name,maxtypes)
 
 #ifdef __cplusplus
 }  /* extern "C" */
@@ -0,0 +1,915 @@
+/* Simple Plugin API
+ * Copyright (C) 2017 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_UTILS_MIX_OPS_H__
+#define __SPA_UTILS_MIX_OPS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <spa/utils/defs.h>
+
+/* Functions to mix S16 and F32 samples, used by the audiomixer plugin and
+ * the port mixers of pipewire. spa_mix_get_ops() selects the fastest
+ * implementation for the running CPU. The SIMD functions are compiled with a
+ * target attribute so that no special compiler flags are needed. */
+
+#if defined (__GNUC__) && (defined (__i386__) || defined (__x86_64__))
+#include <immintrin.h>
+#define SPA_MIX_HAVE_SSE2
+#define SPA_MIX_HAVE_AVX2
+#define SPA_MIX_TARGET(t)	__attribute__((target(t)))
+#elif defined (__ARM_NEON)
+#include <arm_neon.h>
+#define SPA_MIX_HAVE_NEON
+#endif
+
+typedef void (*spa_mix_clear_func_t) (void *dst, int n_bytes);
+typedef void (*spa_mix_func_t) (void *dst, const void *src, int n_bytes);
+typedef void (*spa_mix_scale_func_t) (void *dst, const void *src, const double scale, int n_bytes);
+typedef void (*spa_mix_i_func_t) (void *dst, int dst_stride,
+				  const void *src, int src_stride, int n_bytes);
+typedef void (*spa_mix_scale_i_func_t) (void *dst, int dst_stride,
+					const void *src, int src_stride, const double scale, int n_bytes);
+
+struct spa_mix_ops;
+
+/** mix \a n_src sources with their \a scale into \a dst in one pass over \a dst.
+ * The first source is copied, the others are added. When \a n_src is 0, \a dst
+ * is cleared. */
+typedef void (*spa_mix_n_func_t) (const struct spa_mix_ops *ops, void *dst,
+				  const void *src[], const double scale[], uint32_t n_src, int n_bytes);
+
+enum {
+	SPA_MIX_FMT_S16,
+	SPA_MIX_FMT_F32,
+	SPA_MIX_FMT_MAX,
+};
+
+struct spa_mix_ops {
+	spa_mix_clear_func_t clear[SPA_MIX_FMT_MAX];
+	spa_mix_func_t copy[SPA_MIX_FMT_MAX];
+	spa_mix_func_t add[SPA_MIX_FMT_MAX];
+	spa_mix_scale_func_t copy_scale[SPA_MIX_FMT_MAX];
+	spa_mix_scale_func_t add_scale[SPA_MIX_FMT_MAX];
+	spa_mix_i_func_t copy_i[SPA_MIX_FMT_MAX];
+	spa_mix_i_func_t add_i[SPA_MIX_FMT_MAX];
+	spa_mix_scale_i_func_t copy_scale_i[SPA_MIX_FMT_MAX];
+	spa_mix_scale_i_func_t add_scale_i[SPA_MIX_FMT_MAX];
+	spa_mix_n_func_t mix_n[SPA_MIX_FMT_MAX];
+};
+
+#define SPA_MIX_CPU_FLAG_SSE2	(1 << 0)
+#define SPA_MIX_CPU_FLAG_AVX2	(1 << 1)
+#define SPA_MIX_CPU_FLAG_NEON	(1 << 2)
+
+static inline void
+spa_mix_clear_s16(void *dst, int n_bytes)
+{
+	memset(dst, 0, n_bytes);
+}
+
+static inline void
+spa_mix_clear_f32(void *dst, int n_bytes)
+{
+	memset(dst, 0, n_bytes);
+}
+
+static inline void
+spa_mix_copy_s16(void *dst, const void *src, int n_bytes)
+{
+	memcpy(dst, src, n_bytes);
+}
+
+static inline void
+spa_mix_copy_f32(void *dst, const void *src, int n_bytes)
+{
+	memcpy(dst, src, n_bytes);
+}
+
+static inline void
+spa_mix_add_s16(void *dst, const void *src, int n_bytes)
+{
+	const int16_t *s = (const int16_t *) src;
+	int16_t *d = (int16_t *) dst;
+	int32_t t;
+
+	n_bytes /= sizeof(int16_t);
+	while (n_bytes--) {
+		t = *d + *s;
+		*d = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+		d++;
+		s++;
+	}
+}
+
+static inline void
+spa_mix_add_f32(void *dst, const void *src, int n_bytes)
+{
+	const float *s = (const float *) src;
+	float *d = (float *) dst;
+
+	n_bytes /= sizeof(float);
+	while (n_bytes--) {
+		*d += *s;
+		d++;
+		s++;
+	}
+}
+
+static inline void
+spa_mix_copy_scale_s16(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = (const int16_t *) src;
+	int16_t *d = (int16_t *) dst;
+	int32_t v = scale * (1 << 11), t;
+
+	n_bytes /= sizeof(int16_t);
+	while (n_bytes--) {
+		t = (*s * v) >> 11;
+		*d = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+		d++;
+		s++;
+	}
+}
+
+static inline void
+spa_mix_copy_scale_f32(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = (const float *) src;
+	float *d = (float *) dst;
+	float v = scale;
+
+	n_bytes /= sizeof(float);
+	while (n_bytes--) {
+		*d = *s * v;
+		d++;
+		s++;
+	}
+}
+
+static inline void
+spa_mix_add_scale_s16(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = (const int16_t *) src;
+	int16_t *d = (int16_t *) dst;
+	int32_t v = scale * (1 << 11), t;
+
+	n_bytes /= sizeof(int16_t);
+	while (n_bytes--) {
+		t = *d + ((*s * v) >> 11);
+		*d = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+		d++;
+		s++;
+	}
+}
+
+static inline void
+spa_mix_add_scale_f32(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = (const float *) src;
+	float *d = (float *) dst;
+	float v = scale;
+
+	n_bytes /= sizeof(float);
+	while (n_bytes--) {
+		*d += *s * v;
+		d++;
+		s++;
+	}
+}
+
+static inline void
+spa_mix_copy_s16_i(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const int16_t *s = (const int16_t *) src;
+	int16_t *d = (int16_t *) dst;
+
+	n_bytes /= sizeof(int16_t);
+	while (n_bytes--) {
+		*d = *s;
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static inline void
+spa_mix_copy_f32_i(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const float *s = (const float *) src;
+	float *d = (float *) dst;
+
+	n_bytes /= sizeof(float);
+	while (n_bytes--) {
+		*d = *s;
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static inline void
+spa_mix_add_s16_i(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const int16_t *s = (const int16_t *) src;
+	int16_t *d = (int16_t *) dst;
+	int32_t t;
+
+	n_bytes /= sizeof(int16_t);
+	while (n_bytes--) {
+		t = *d + *s;
+		*d = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static inline void
+spa_mix_add_f32_i(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const float *s = (const float *) src;
+	float *d = (float *) dst;
+
+	n_bytes /= sizeof(float);
+	while (n_bytes--) {
+		*d += *s;
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static inline void
+spa_mix_copy_scale_s16_i(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const int16_t *s = (const int16_t *) src;
+	int16_t *d = (int16_t *) dst;
+	int32_t v = scale * (1 << 11), t;
+
+	n_bytes /= sizeof(int16_t);
+	while (n_bytes--) {
+		t = (*s * v) >> 11;
+		*d = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static inline void
+spa_mix_copy_scale_f32_i(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const float *s = (const float *) src;
+	float *d = (float *) dst;
+	float v = scale;
+
+	n_bytes /= sizeof(float);
+	while (n_bytes--) {
+		*d = *s * v;
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static inline void
+spa_mix_add_scale_s16_i(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const int16_t *s = (const int16_t *) src;
+	int16_t *d = (int16_t *) dst;
+	int32_t v = scale * (1 << 11), t;
+
+	n_bytes /= sizeof(int16_t);
+	while (n_bytes--) {
+		t = *d + ((*s * v) >> 11);
+		*d = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static inline void
+spa_mix_add_scale_f32_i(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const float *s = (const float *) src;
+	float *d = (float *) dst;
+	float v = scale;
+
+	n_bytes /= sizeof(float);
+	while (n_bytes--) {
+		*d += *s * v;
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+/* the s16 scale is a Q11 fixed point factor, it needs to fit in a 16 bit
+ * lane for the multiply, bigger volumes use the plain C loop */
+#define SPA_MIX_SCALE_S16_OK(v)	((v) >= INT16_MIN && (v) <= INT16_MAX)
+
+#if defined (SPA_MIX_HAVE_SSE2)
+SPA_MIX_TARGET("sse2")
+static inline __m128i spa_mix_mul_shift_lo_s16_sse2(__m128i s, __m128i v)
+{
+	__m128i lo = _mm_mullo_epi16(s, v);
+	__m128i hi = _mm_mulhi_epi16(s, v);
+	return _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 11);
+}
+
+SPA_MIX_TARGET("sse2")
+static inline __m128i spa_mix_mul_shift_hi_s16_sse2(__m128i s, __m128i v)
+{
+	__m128i lo = _mm_mullo_epi16(s, v);
+	__m128i hi = _mm_mulhi_epi16(s, v);
+	return _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 11);
+}
+
+SPA_MIX_TARGET("sse2")
+static inline void
+spa_mix_add_s16_sse2(void *dst, const void *src, int n_bytes)
+{
+	const int16_t *s = (const int16_t *) src;
+	int16_t *d = (int16_t *) dst;
+	int n, unrolled;
+	int32_t t;
+
+	n_bytes /= sizeof(int16_t);
+	unrolled = n_bytes & ~7;
+
+	for (n = 0; n < unrolled; n += 8) {
+		__m128i in = _mm_loadu_si128((__m128i *)(s + n));
+		__m128i out = _mm_loadu_si128((__m128i *)(d + n));
+		_mm_storeu_si128((__m128i *)(d + n), _mm_adds_epi16(out, in));
+	}
+	for (; n < n_bytes; n++) {
+		t = d[n] + s[n];
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+SPA_MIX_TARGET("sse2")
+static inline void
+spa_mix_add_f32_sse2(void *dst, const void *src, int n_bytes)
+{
+	const float *s = (const float *) src;
+	float *d = (float *) dst;
+	int n, unrolled;
+
+	n_bytes /= sizeof(float);
+	unrolled = n_bytes & ~7;
+
+	for (n = 0; n < unrolled; n += 8) {
+		__m128 in0 = _mm_loadu_ps(s + n);
+		__m128 in1 = _mm_loadu_ps(s + n + 4);
+		__m128 out0 = _mm_loadu_ps(d + n);
+		__m128 out1 = _mm_loadu_ps(d + n + 4);
+		_mm_storeu_ps(d + n, _mm_add_ps(out0, in0));
+		_mm_storeu_ps(d + n + 4, _mm_add_ps(out1, in1));
+	}
+	for (; n < n_bytes; n++)
+		d[n] += s[n];
+}
+
+SPA_MIX_TARGET("sse2")
+static inline void
+spa_mix_copy_scale_s16_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = (const int16_t *) src;
+	int16_t *d = (int16_t *) dst;
+	int32_t v = scale * (1 << 11), t;
+	int n, unrolled;
+	__m128i vv = _mm_set1_epi16(v);
+
+	n_bytes /= sizeof(int16_t);
+	unrolled = SPA_MIX_SCALE_S16_OK(v) ? n_bytes & ~7 : 0;
+
+	for (n = 0; n < unrolled; n += 8) {
+		__m128i in = _mm_loadu_si128((__m128i *)(s + n));
+		_mm_storeu_si128((__m128i *)(d + n),
+				_mm_packs_epi32(spa_mix_mul_shift_lo_s16_sse2(in, vv),
+						spa_mix_mul_shift_hi_s16_sse2(in, vv)));
+	}
+	for (; n < n_bytes; n++) {
+		t = (s[n] * v) >> 11;
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+SPA_MIX_TARGET("sse2")
+static inline void
+spa_mix_copy_scale_f32_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = (const float *) src;
+	float *d = (float *) dst;
+	float v = scale;
+	int n, unrolled;
+	__m128 vv = _mm_set1_ps(v);
+
+	n_bytes /= sizeof(float);
+	unrolled = n_bytes & ~7;
+
+	for (n = 0; n < unrolled; n += 8) {
+		_mm_storeu_ps(d + n, _mm_mul_ps(_mm_loadu_ps(s + n), vv));
+		_mm_storeu_ps(d + n + 4, _mm_mul_ps(_mm_loadu_ps(s + n + 4), vv));
+	}
+	for (; n < n_bytes; n++)
+		d[n] = s[n] * v;
+}
+
+SPA_MIX_TARGET("sse2")
+static inline void
+spa_mix_add_scale_s16_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = (const int16_t *) src;
+	int16_t *d = (int16_t *) dst;
+	int32_t v = scale * (1 << 11), t;
+	int n, unrolled;
+	__m128i vv = _mm_set1_epi16(v);
+
+	n_bytes /= sizeof(int16_t);
+	unrolled = SPA_MIX_SCALE_S16_OK(v) ? n_bytes & ~7 : 0;
+
+	for (n = 0; n < unrolled; n += 8) {
+		__m128i in = _mm_loadu_si128((__m128i *)(s + n));
+		__m128i out = _mm_loadu_si128((__m128i *)(d + n));
+		/* sign extend the destination to 32 bits */
+		__m128i out_lo = _mm_srai_epi32(_mm_unpacklo_epi16(out, out), 16);
+		__m128i out_hi = _mm_srai_epi32(_mm_unpackhi_epi16(out, out), 16);
+
+		out_lo = _mm_add_epi32(out_lo, spa_mix_mul_shift_lo_s16_sse2(in, vv));
+		out_hi = _mm_add_epi32(out_hi, spa_mix_mul_shift_hi_s16_sse2(in, vv));
+		_mm_storeu_si128((__m128i *)(d + n), _mm_packs_epi32(out_lo, out_hi));
+	}
+	for (; n < n_bytes; n++) {
+		t = d[n] + ((s[n] * v) >> 11);
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+SPA_MIX_TARGET("sse2")
+static inline void
+spa_mix_add_scale_f32_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = (const float *) src;
+	float *d = (float *) dst;
+	float v = scale;
+	int n, unrolled;
+	__m128 vv = _mm_set1_ps(v);
+
+	n_bytes /= sizeof(float);
+	unrolled = n_bytes & ~7;
+
+	for (n = 0; n < unrolled; n += 8) {
+		__m128 in0 = _mm_mul_ps(_mm_loadu_ps(s + n), vv);
+		__m128 in1 = _mm_mul_ps(_mm_loadu_ps(s + n + 4), vv);
+		_mm_storeu_ps(d + n, _mm_add_ps(_mm_loadu_ps(d + n), in0));
+		_mm_storeu_ps(d + n + 4, _mm_add_ps(_mm_loadu_ps(d + n + 4), in1));
+	}
+	for (; n < n_bytes; n++)
+		d[n] += s[n] * v;
+}
+#endif
+
+#if defined (SPA_MIX_HAVE_AVX2)
+/* unpack and pack work per 128 bit lane, the lo/hi halves end up in the
+ * right order again after _mm256_packs_epi32 */
+SPA_MIX_TARGET("avx2")
+static inline __m256i spa_mix_mul_shift_lo_s16_avx2(__m256i s, __m256i v)
+{
+	__m256i lo = _mm256_mullo_epi16(s, v);
+	__m256i hi = _mm256_mulhi_epi16(s, v);
+	return _mm256_srai_epi32(_mm256_unpacklo_epi16(lo, hi), 11);
+}
+
+SPA_MIX_TARGET("avx2")
+static inline __m256i spa_mix_mul_shift_hi_s16_avx2(__m256i s, __m256i v)
+{
+	__m256i lo = _mm256_mullo_epi16(s, v);
+	__m256i hi = _mm256_mulhi_epi16(s, v);
+	return _mm256_srai_epi32(_mm256_unpackhi_epi16(lo, hi), 11);
+}
+
+SPA_MIX_TARGET("avx2")
+static inline void
+spa_mix_add_s16_avx2(void *dst, const void *src, int n_bytes)
+{
+	const int16_t *s = (const int16_t *) src;
+	int16_t *d = (int16_t *) dst;
+	int n, unrolled;
+	int32_t t;
+
+	n_bytes /= sizeof(int16_t);
+	unrolled = n_bytes & ~15;
+
+	for (n = 0; n < unrolled; n += 16) {
+		__m256i in = _mm256_loadu_si256((__m256i *)(s + n));
+		__m256i out = _mm256_loadu_si256((__m256i *)(d + n));
+		_mm256_storeu_si256((__m256i *)(d + n), _mm256_adds_epi16(out, in));
+	}
+	for (; n < n_bytes; n++) {
+		t = d[n] + s[n];
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+SPA_MIX_TARGET("avx2")
+static inline void
+spa_mix_add_f32_avx2(void *dst, const void *src, int n_bytes)
+{
+	const float *s = (const float *) src;
+	float *d = (float *) dst;
+	int n, unrolled;
+
+	n_bytes /= sizeof(float);
+	unrolled = n_bytes & ~15;
+
+	for (n = 0; n < unrolled; n += 16) {
+		__m256 in0 = _mm256_loadu_ps(s + n);
+		__m256 in1 = _mm256_loadu_ps(s + n + 8);
+		__m256 out0 = _mm256_loadu_ps(d + n);
+		__m256 out1 = _mm256_loadu_ps(d + n + 8);
+		_mm256_storeu_ps(d + n, _mm256_add_ps(out0, in0));
+		_mm256_storeu_ps(d + n + 8, _mm256_add_ps(out1, in1));
+	}
+	for (; n < n_bytes; n++)
+		d[n] += s[n];
+}
+
+SPA_MIX_TARGET("avx2")
+static inline void
+spa_mix_copy_scale_s16_avx2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = (const int16_t *) src;
+	int16_t *d = (int16_t *) dst;
+	int32_t v = scale * (1 << 11), t;
+	int n, unrolled;
+	__m256i vv = _mm256_set1_epi16(v);
+
+	n_bytes /= sizeof(int16_t);
+	unrolled = SPA_MIX_SCALE_S16_OK(v) ? n_bytes & ~15 : 0;
+
+	for (n = 0; n < unrolled; n += 16) {
+		__m256i in = _mm256_loadu_si256((__m256i *)(s + n));
+		_mm256_storeu_si256((__m256i *)(d + n),
+				_mm256_packs_epi32(spa_mix_mul_shift_lo_s16_avx2(in, vv),
+						   spa_mix_mul_shift_hi_s16_avx2(in, vv)));
+	}
+	for (; n < n_bytes; n++) {
+		t = (s[n] * v) >> 11;
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+SPA_MIX_TARGET("avx2")
+static inline void
+spa_mix_copy_scale_f32_avx2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = (const float *) src;
+	float *d = (float *) dst;
+	float v = scale;
+	int n, unrolled;
+	__m256 vv = _mm256_set1_ps(v);
+
+	n_bytes /= sizeof(float);
+	unrolled = n_bytes & ~15;
+
+	for (n = 0; n < unrolled; n += 16) {
+		_mm256_storeu_ps(d + n, _mm256_mul_ps(_mm256_loadu_ps(s + n), vv));
+		_mm256_storeu_ps(d + n + 8, _mm256_mul_ps(_mm256_loadu_ps(s + n + 8), vv));
+	}
+	for (; n < n_bytes; n++)
+		d[n] = s[n] * v;
+}
+
+SPA_MIX_TARGET("avx2")
+static inline void
+spa_mix_add_scale_s16_avx2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = (const int16_t *) src;
+	int16_t *d = (int16_t *) dst;
+	int32_t v = scale * (1 << 11), t;
+	int n, unrolled;
+	__m256i vv = _mm256_set1_epi16(v);
+
+	n_bytes /= sizeof(int16_t);
+	unrolled = SPA_MIX_SCALE_S16_OK(v) ? n_bytes & ~15 : 0;
+
+	for (n = 0; n < unrolled; n += 16) {
+		__m256i in = _mm256_loadu_si256((__m256i *)(s + n));
+		__m256i out = _mm256_loadu_si256((__m256i *)(d + n));
+		/* sign extend the destination to 32 bits */
+		__m256i out_lo = _mm256_srai_epi32(_mm256_unpacklo_epi16(out, out), 16);
+		__m256i out_hi = _mm256_srai_epi32(_mm256_unpackhi_epi16(out, out), 16);
+
+		out_lo = _mm256_add_epi32(out_lo, spa_mix_mul_shift_lo_s16_avx2(in, vv));
+		out_hi = _mm256_add_epi32(out_hi, spa_mix_mul_shift_hi_s16_avx2(in, vv));
+		_mm256_storeu_si256((__m256i *)(d + n), _mm256_packs_epi32(out_lo, out_hi));
+	}
+	for (; n < n_bytes; n++) {
+		t = d[n] + ((s[n] * v) >> 11);
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+SPA_MIX_TARGET("avx2")
+static inline void
+spa_mix_add_scale_f32_avx2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = (const float *) src;
+	float *d = (float *) dst;
+	float v = scale;
+	int n, unrolled;
+	__m256 vv = _mm256_set1_ps(v);
+
+	n_bytes /= sizeof(float);
+	unrolled = n_bytes & ~15;
+
+	for (n = 0; n < unrolled; n += 16) {
+		__m256 in0 = _mm256_mul_ps(_mm256_loadu_ps(s + n), vv);
+		__m256 in1 = _mm256_mul_ps(_mm256_loadu_ps(s + n + 8), vv);
+		_mm256_storeu_ps(d + n, _mm256_add_ps(_mm256_loadu_ps(d + n), in0));
+		_mm256_storeu_ps(d + n + 8, _mm256_add_ps(_mm256_loadu_ps(d + n + 8), in1));
+	}
+	for (; n < n_bytes; n++)
+		d[n] += s[n] * v;
+}
+#endif
+
+#if defined (SPA_MIX_HAVE_NEON)
+static inline void
+spa_mix_add_s16_neon(void *dst, const void *src, int n_bytes)
+{
+	const int16_t *s = (const int16_t *) src;
+	int16_t *d = (int16_t *) dst;
+	int n, unrolled;
+	int32_t t;
+
+	n_bytes /= sizeof(int16_t);
+	unrolled = n_bytes & ~7;
+
+	for (n = 0; n < unrolled; n += 8)
+		vst1q_s16(d + n, vqaddq_s16(vld1q_s16(d + n), vld1q_s16(s + n)));
+
+	for (; n < n_bytes; n++) {
+		t = d[n] + s[n];
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static inline void
+spa_mix_add_f32_neon(void *dst, const void *src, int n_bytes)
+{
+	const float *s = (const float *) src;
+	float *d = (float *) dst;
+	int n, unrolled;
+
+	n_bytes /= sizeof(float);
+	unrolled = n_bytes & ~3;
+
+	for (n = 0; n < unrolled; n += 4)
+		vst1q_f32(d + n, vaddq_f32(vld1q_f32(d + n), vld1q_f32(s + n)));
+
+	for (; n < n_bytes; n++)
+		d[n] += s[n];
+}
+
+static inline void
+spa_mix_copy_scale_s16_neon(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = (const int16_t *) src;
+	int16_t *d = (int16_t *) dst;
+	int32_t v = scale * (1 << 11), t;
+	int n, unrolled;
+	int16x4_t vv = vdup_n_s16(v);
+
+	n_bytes /= sizeof(int16_t);
+	unrolled = SPA_MIX_SCALE_S16_OK(v) ? n_bytes & ~7 : 0;
+
+	for (n = 0; n < unrolled; n += 8) {
+		int16x8_t in = vld1q_s16(s + n);
+		int32x4_t lo = vshrq_n_s32(vmull_s16(vget_low_s16(in), vv), 11);
+		int32x4_t hi = vshrq_n_s32(vmull_s16(vget_high_s16(in), vv), 11);
+		vst1q_s16(d + n, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+	}
+	for (; n < n_bytes; n++) {
+		t = (s[n] * v) >> 11;
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static inline void
+spa_mix_copy_scale_f32_neon(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = (const float *) src;
+	float *d = (float *) dst;
+	float v = scale;
+	int n, unrolled;
+
+	n_bytes /= sizeof(float);
+	unrolled = n_bytes & ~3;
+
+	for (n = 0; n < unrolled; n += 4)
+		vst1q_f32(d + n, vmulq_n_f32(vld1q_f32(s + n), v));
+
+	for (; n < n_bytes; n++)
+		d[n] = s[n] * v;
+}
+
+static inline void
+spa_mix_add_scale_s16_neon(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = (const int16_t *) src;
+	int16_t *d = (int16_t *) dst;
+	int32_t v = scale * (1 << 11), t;
+	int n, unrolled;
+	int16x4_t vv = vdup_n_s16(v);
+
+	n_bytes /= sizeof(int16_t);
+	unrolled = SPA_MIX_SCALE_S16_OK(v) ? n_bytes & ~7 : 0;
+
+	for (n = 0; n < unrolled; n += 8) {
+		int16x8_t in = vld1q_s16(s + n);
+		int16x8_t out = vld1q_s16(d + n);
+		int32x4_t lo = vshrq_n_s32(vmull_s16(vget_low_s16(in), vv), 11);
+		int32x4_t hi = vshrq_n_s32(vmull_s16(vget_high_s16(in), vv), 11);
+
+		lo = vaddw_s16(lo, vget_low_s16(out));
+		hi = vaddw_s16(hi, vget_high_s16(out));
+		vst1q_s16(d + n, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+	}
+	for (; n < n_bytes; n++) {
+		t = d[n] + ((s[n] * v) >> 11);
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static inline void
+spa_mix_add_scale_f32_neon(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = (const float *) src;
+	float *d = (float *) dst;
+	float v = scale;
+	int n, unrolled;
+
+	n_bytes /= sizeof(float);
+	unrolled = n_bytes & ~3;
+
+	for (n = 0; n < unrolled; n += 4) {
+		float32x4_t in = vmulq_n_f32(vld1q_f32(s + n), v);
+		vst1q_f32(d + n, vaddq_f32(vld1q_f32(d + n), in));
+	}
+	for (; n < n_bytes; n++)
+		d[n] += s[n] * v;
+}
+#endif
+
+/* the destination is processed in tiles of this size so that it stays in the
+ * L1 cache while all the sources are added to it */
+#define SPA_MIX_TILE_BYTES	4096
+
+static inline bool spa_mix_is_unity(double scale)
+{
+	return scale >= 0.999 && scale <= 1.001;
+}
+
+static inline void
+spa_mix_n(const struct spa_mix_ops *ops, int fmt, void *dst,
+	  const void *src[], const double scale[], uint32_t n_src, int n_bytes)
+{
+	int offset, len;
+	uint32_t i;
+
+	if (n_src == 0) {
+		ops->clear[fmt](dst, n_bytes);
+		return;
+	}
+
+	for (offset = 0; offset < n_bytes; offset += len) {
+		void *d = SPA_MEMBER(dst, offset, void);
+
+		len = SPA_MIN(n_bytes - offset, SPA_MIX_TILE_BYTES);
+
+		if (spa_mix_is_unity(scale[0]))
+			ops->copy[fmt](d, SPA_MEMBER(src[0], offset, void), len);
+		else
+			ops->copy_scale[fmt](d, SPA_MEMBER(src[0], offset, void), scale[0], len);
+
+		for (i = 1; i < n_src; i++) {
+			if (spa_mix_is_unity(scale[i]))
+				ops->add[fmt](d, SPA_MEMBER(src[i], offset, void), len);
+			else
+				ops->add_scale[fmt](d, SPA_MEMBER(src[i], offset, void), scale[i], len);
+		}
+	}
+}
+
+static inline void
+spa_mix_n_s16(const struct spa_mix_ops *ops, void *dst,
+	      const void *src[], const double scale[], uint32_t n_src, int n_bytes)
+{
+	spa_mix_n(ops, SPA_MIX_FMT_S16, dst, src, scale, n_src, n_bytes);
+}
+
+static inline void
+spa_mix_n_f32(const struct spa_mix_ops *ops, void *dst,
+	      const void *src[], const double scale[], uint32_t n_src, int n_bytes)
+{
+	spa_mix_n(ops, SPA_MIX_FMT_F32, dst, src, scale, n_src, n_bytes);
+}
+
+/** get the SIMD features of the running CPU that we have optimized ops for */
+static inline uint32_t spa_mix_get_cpu_flags(void)
+{
+	uint32_t flags = 0;
+#if defined (__i386__) || defined (__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		flags |= SPA_MIX_CPU_FLAG_SSE2;
+	if (__builtin_cpu_supports("avx2"))
+		flags |= SPA_MIX_CPU_FLAG_AVX2;
+#elif defined (__ARM_NEON) || defined (__aarch64__)
+	flags |= SPA_MIX_CPU_FLAG_NEON;
+#endif
+	return flags;
+}
+
+/** fill \a ops with the best implementations available for \a cpu_flags.
+ * Passing 0 for \a cpu_flags selects the plain C reference functions. */
+static inline void spa_mix_get_ops(struct spa_mix_ops *ops, uint32_t cpu_flags)
+{
+	ops->clear[SPA_MIX_FMT_S16] = spa_mix_clear_s16;
+	ops->clear[SPA_MIX_FMT_F32] = spa_mix_clear_f32;
+	ops->copy[SPA_MIX_FMT_S16] = spa_mix_copy_s16;
+	ops->copy[SPA_MIX_FMT_F32] = spa_mix_copy_f32;
+	ops->add[SPA_MIX_FMT_S16] = spa_mix_add_s16;
+	ops->add[SPA_MIX_FMT_F32] = spa_mix_add_f32;
+	ops->copy_scale[SPA_MIX_FMT_S16] = spa_mix_copy_scale_s16;
+	ops->copy_scale[SPA_MIX_FMT_F32] = spa_mix_copy_scale_f32;
+	ops->add_scale[SPA_MIX_FMT_S16] = spa_mix_add_scale_s16;
+	ops->add_scale[SPA_MIX_FMT_F32] = spa_mix_add_scale_f32;
+	ops->copy_i[SPA_MIX_FMT_S16] = spa_mix_copy_s16_i;
+	ops->copy_i[SPA_MIX_FMT_F32] = spa_mix_copy_f32_i;
+	ops->add_i[SPA_MIX_FMT_S16] = spa_mix_add_s16_i;
+	ops->add_i[SPA_MIX_FMT_F32] = spa_mix_add_f32_i;
+	ops->copy_scale_i[SPA_MIX_FMT_S16] = spa_mix_copy_scale_s16_i;
+	ops->copy_scale_i[SPA_MIX_FMT_F32] = spa_mix_copy_scale_f32_i;
+	ops->add_scale_i[SPA_MIX_FMT_S16] = spa_mix_add_scale_s16_i;
+	ops->add_scale_i[SPA_MIX_FMT_F32] = spa_mix_add_scale_f32_i;
+	ops->mix_n[SPA_MIX_FMT_S16] = spa_mix_n_s16;
+	ops->mix_n[SPA_MIX_FMT_F32] = spa_mix_n_f32;
+
+	/* the wider implementations override the narrower ones */
+#if defined (SPA_MIX_HAVE_SSE2)
+	if (cpu_flags & SPA_MIX_CPU_FLAG_SSE2) {
+		ops->add[SPA_MIX_FMT_S16] = spa_mix_add_s16_sse2;
+		ops->add[SPA_MIX_FMT_F32] = spa_mix_add_f32_sse2;
+		ops->copy_scale[SPA_MIX_FMT_S16] = spa_mix_copy_scale_s16_sse2;
+		ops->copy_scale[SPA_MIX_FMT_F32] = spa_mix_copy_scale_f32_sse2;
+		ops->add_scale[SPA_MIX_FMT_S16] = spa_mix_add_scale_s16_sse2;
+		ops->add_scale[SPA_MIX_FMT_F32] = spa_mix_add_scale_f32_sse2;
+	}
+#endif
+#if defined (SPA_MIX_HAVE_AVX2)
+	if (cpu_flags & SPA_MIX_CPU_FLAG_AVX2) {
+		ops->add[SPA_MIX_FMT_S16] = spa_mix_add_s16_avx2;
+		ops->add[SPA_MIX_FMT_F32] = spa_mix_add_f32_avx2;
+		ops->copy_scale[SPA_MIX_FMT_S16] = spa_mix_copy_scale_s16_avx2;
+		ops->copy_scale[SPA_MIX_FMT_F32] = spa_mix_copy_scale_f32_avx2;
+		ops->add_scale[SPA_MIX_FMT_S16] = spa_mix_add_scale_s16_avx2;
+		ops->add_scale[SPA_MIX_FMT_F32] = spa_mix_add_scale_f32_avx2;
+	}
+#endif
+#if defined (SPA_MIX_HAVE_NEON)
+	if (cpu_flags & SPA_MIX_CPU_FLAG_NEON) {
+		ops->add[SPA_MIX_FMT_S16] = spa_mix_add_s16_neon;
+		ops->add[SPA_MIX_FMT_F32] = spa_mix_add_f32_neon;
+		ops->copy_scale[SPA_MIX_FMT_S16] = spa_mix_copy_scale_s16_neon;
+		ops->copy_scale[SPA_MIX_FMT_F32] = spa_mix_copy_scale_f32_neon;
+		ops->add_scale[SPA_MIX_FMT_S16] = spa_mix_add_scale_s16_neon;
+		ops->add_scale[SPA_MIX_FMT_F32] = spa_mix_add_scale_f32_neon;
+	}
+#endif
+}
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* __SPA_UTILS_MIX_OPS_H__ */
@@ -70,6 +70,7 @@ struct impl {
 	snd_ctl_t *ctl_hndl;
 	struct udev_device *dev;
 	char card_name[16];
+	char group_name[64];
 	int dev_idx;
 	int stream_idx;
 
@@ -165,6 +166,9 @@ fill_item(struct impl *this, snd_ctl_card_info_t *card_info, snd_pcm_info_t *dev
 		"s", "alsa.pcm.subname",     "s", snd_pcm_info_get_subdevice_name(dev_info),
 		NULL);
 
+	if (this->group_name[0] != '\0')
+		spa_pod_builder_add(builder, "s", "alsa.group", "s", this->group_name, NULL);
+
 	if ((str = udev_device_get_property_value(dev, "SOUND_CLASS")) && *str) {
 		spa_pod_builder_add(builder, "s", "device.class", "s", str, NULL);
 	}
@@ -517,6 +521,11 @@ impl_init(const struct spa_handle_factory *factory,
 
 	this->monitor = impl_monitor;
 
+	for (i = 0; info && i < info->n_items; i++) {
+		if (!strcmp(info->items[i].key, "alsa.group"))
+			snprintf(this->group_name, 63, "%s", info->items[i].value);
+	}
+
 	return 0;
 }
 
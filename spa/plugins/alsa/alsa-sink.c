@@ -34,12 +34,14 @@
 static const char default_device[] = "hw:0";
 static const uint32_t default_min_latency = 128;
 static const uint32_t default_max_latency = 1024;
+static const uint32_t default_target_latency = 0;
 
 static void reset_props(struct props *props)
 {
 	strncpy(props->device, default_device, 64);
 	props->min_latency = default_min_latency;
 	props->max_latency = default_max_latency;
+	props->target_latency = default_target_latency;
 }
 
 static int impl_node_enum_params(struct spa_node *node,
@@ -115,6 +117,15 @@ static int impl_node_enum_params(struct spa_node *node,
 				":", t->param.propType, "ir", p->max_latency,
 					SPA_POD_PROP_MIN_MAX(1, INT32_MAX));
 			break;
+		case 5:
+			param = spa_pod_builder_object(&b,
+				id, t->param.PropInfo,
+				":", t->param.propId,   "I", t->prop_target_latency,
+				":", t->param.propName, "s", "Follow the rate of the data and keep "
+								"this latency, 0 to disable",
+				":", t->param.propType, "ir", p->target_latency,
+					SPA_POD_PROP_MIN_MAX(0, INT32_MAX));
+			break;
 		default:
 			return 0;
 		}
@@ -130,7 +141,8 @@ static int impl_node_enum_params(struct spa_node *node,
 				":", t->prop_device_name, "S-r", p->device_name, sizeof(p->device_name),
 				":", t->prop_card_name,   "S-r", p->card_name, sizeof(p->card_name),
 				":", t->prop_min_latency, "i",   p->min_latency,
-				":", t->prop_max_latency, "i",   p->max_latency);
+				":", t->prop_max_latency, "i",   p->max_latency,
+				":", t->prop_target_latency, "i", p->target_latency);
 			break;
 		default:
 			return 0;
@@ -168,7 +180,8 @@ static int impl_node_set_param(struct spa_node *node, uint32_t id, uint32_t flag
 		spa_pod_object_parse(param,
 			":", t->prop_device,      "?S", p->device, sizeof(p->device),
 			":", t->prop_min_latency, "?i", &p->min_latency,
-			":", t->prop_max_latency, "?i", &p->max_latency, NULL);
+			":", t->prop_max_latency, "?i", &p->max_latency,
+			":", t->prop_target_latency, "?i", &p->target_latency, NULL);
 	}
 	else
 		return -ENOENT;
@@ -197,6 +210,11 @@ static int impl_node_send_command(struct spa_node *node, const struct spa_comman
 	} else if (SPA_COMMAND_TYPE(command) == this->type.command_node.Pause) {
 		if ((res = spa_alsa_pause(this, false)) < 0)
 			return res;
+	} else if (SPA_COMMAND_TYPE(command) == this->type.command_node.ClockUpdate) {
+		struct spa_command_node_clock_update *cu = (__typeof__(cu)) command;
+
+		if (cu->body.change_mask.value & SPA_COMMAND_NODE_CLOCK_UPDATE_LATENCY)
+			spa_alsa_set_quantum(this, cu->body.latency.value);
 	} else
 		return -ENOTSUP;
 
@@ -712,6 +730,8 @@ impl_init(const struct spa_handle_factory *factory,
 	for (i = 0; info && i < info->n_items; i++) {
 		if (!strcmp(info->items[i].key, "alsa.card")) {
 			snprintf(this->props.device, 63, "%s", info->items[i].value);
+		} else if (!strcmp(info->items[i].key, "alsa.group")) {
+			snprintf(this->group_name, 63, "%s", info->items[i].value);
 		}
 	}
 
@@ -185,6 +185,11 @@ static int impl_node_send_command(struct spa_node *node, const struct spa_comman
 	} else if (SPA_COMMAND_TYPE(command) == this->type.command_node.Pause) {
 		if ((res = spa_alsa_pause(this, false)) < 0)
 			return res;
+	} else if (SPA_COMMAND_TYPE(command) == this->type.command_node.ClockUpdate) {
+		struct spa_command_node_clock_update *cu = (__typeof__(cu)) command;
+
+		if (cu->body.change_mask.value & SPA_COMMAND_NODE_CLOCK_UPDATE_LATENCY)
+			spa_alsa_set_quantum(this, cu->body.latency.value);
 	} else
 		return -ENOTSUP;
 
@@ -778,6 +783,8 @@ impl_init(const struct spa_handle_factory *factory,
 	for (i = 0; info && i < info->n_items; i++) {
 		if (!strcmp(info->items[i].key, "alsa.card")) {
 			snprintf(this->props.device, 63, "%s", info->items[i].value);
+		} else if (!strcmp(info->items[i].key, "alsa.group")) {
+			snprintf(this->group_name, 63, "%s", info->items[i].value);
 		}
 	}
 	return 0;
@@ -5,6 +5,7 @@
 #include <errno.h>
 #include <getopt.h>
 #include <sys/time.h>
+#include <inttypes.h>
 #include <math.h>
 #include <limits.h>
 #include <sys/timerfd.h>
@@ -352,6 +353,34 @@ static inline void try_pull(struct state *state, snd_pcm_uframes_t frames,
 	}
 }
 
+/* resample the frames of \a d at \a index into \a dst, returns the number of
+ * frames written and the number of bytes used from \a d in \a n_bytes */
+static inline uint32_t
+resample_frames(struct state *state, uint8_t *dst, uint32_t n_dst,
+		struct spa_data *d, uint32_t index, uint32_t n_src, size_t *n_bytes)
+{
+	uint32_t offs, n, n_out = 0, consumed, total = 0;
+
+	while (n_src > 0 && n_out < n_dst) {
+		/* the source can wrap around */
+		offs = index % d->maxsize;
+		if ((n = SPA_MIN(n_src, (d->maxsize - offs) / state->frame_size)) == 0)
+			break;
+
+		n_out += resample_process(&state->resample,
+					  dst + n_out * state->frame_size, n_dst - n_out,
+					  SPA_MEMBER(d->data, offs, void), n, &consumed);
+
+		index += consumed * state->frame_size;
+		total += consumed;
+		n_src -= consumed;
+		if (consumed < n)
+			break;
+	}
+	*n_bytes = total * state->frame_size;
+	return n_out;
+}
+
 static inline snd_pcm_uframes_t
 pull_frames(struct state *state,
 	    const snd_pcm_channel_area_t *my_areas,
@@ -381,16 +410,21 @@ pull_frames(struct state *state,
 		avail = d[0].chunk->size - state->ready_offset;
 		avail /= state->frame_size;
 
-		n_frames = SPA_MIN(avail, to_write);
-		n_bytes = n_frames * state->frame_size;
+		if (state->follow) {
+			n_frames = resample_frames(state, dst, to_write, &d[0], index,
+						   avail, &n_bytes);
+		} else {
+			n_frames = SPA_MIN(avail, to_write);
+			n_bytes = n_frames * state->frame_size;
 
-		offs = index % d[0].maxsize;
-		l0 = SPA_MIN(n_bytes, d[0].maxsize - offs);
-		l1 = n_bytes - l0;
+			offs = index % d[0].maxsize;
+			l0 = SPA_MIN(n_bytes, d[0].maxsize - offs);
+			l1 = n_bytes - l0;
 
-		memcpy(dst, src + offs, l0);
-		if (l1 > 0)
-			memcpy(dst + l0, src, l1);
+			memcpy(dst, src + offs, l0);
+			if (l1 > 0)
+				memcpy(dst + l0, src, l1);
+		}
 
 		state->ready_offset += n_bytes;
 
@@ -499,26 +533,49 @@ static int alsa_try_resume(struct state *state)
 	return res;
 }
 
-static void alsa_on_playback_timeout_event(struct spa_source *source)
+static inline uint32_t ready_frames(struct state *state)
+{
+	struct buffer *b;
+	size_t n_bytes = 0;
+
+	spa_list_for_each(b, &state->ready, link)
+		n_bytes += b->outbuf->datas[0].chunk->size;
+
+	return (n_bytes - state->ready_offset) / state->frame_size;
+}
+
+/* the frames in the device and the frames that we still have to write
+ * should stay at the target latency. When the data comes in faster or slower
+ * than the device plays it, the DLL changes the resampler rate. */
+static void update_rate(struct state *state)
+{
+	double err, corr;
+
+	err = (double) (state->filled + ready_frames(state)) - state->props.target_latency;
+	corr = spa_dll_update(&state->dll, err);
+
+	state->rate_corr = SPA_CLAMP(corr, 0.95, 1.05);
+	state->resample.ratio = 1.0 / state->rate_corr;
+
+	spa_log_trace(state->log, "alsa-util %p: err %f corr %f", state, err, state->rate_corr);
+}
+
+/* write to the device when it is filled below the threshold plus \a slack
+ * frames and return the time of the next wakeup in \a next */
+static int playback_wakeup(struct state *state, int slack, struct timespec *next)
 {
-	uint64_t exp;
 	int res;
-	struct state *state = source->data;
 	snd_pcm_t *hndl = state->hndl;
 	snd_pcm_sframes_t avail;
-	struct itimerspec ts;
 	snd_pcm_uframes_t total_written = 0;
 	const snd_pcm_channel_area_t *my_areas;
 	snd_pcm_status_t *status;
 
-	if (state->started && read(state->timerfd, &exp, sizeof(uint64_t)) != sizeof(uint64_t))
-		spa_log_warn(state->log, "error reading timerfd: %s", strerror(errno));
-
 	snd_pcm_status_alloca(&status);
 
 	if ((res = snd_pcm_status(hndl, status)) < 0) {
 		spa_log_error(state->log, "snd_pcm_status error: %s", snd_strerror(res));
-		return;
+		return res;
 	}
 
 	avail = snd_pcm_status_get_avail(status);
@@ -535,23 +592,26 @@ static void alsa_on_playback_timeout_event(struct spa_source *source)
 	spa_log_trace(state->log, "timeout %ld %d %ld %ld %ld", state->filled, state->threshold,
 		      state->sample_count, state->now.tv_sec, state->now.tv_nsec);
 
-	if (state->filled > state->threshold) {
+	if (state->filled > state->threshold + slack) {
 		if (snd_pcm_state(hndl) == SND_PCM_STATE_SUSPENDED) {
 			spa_log_error(state->log, "suspended: try resume");
 			if ((res = alsa_try_resume(state)) < 0)
-				return;
+				return res;
 		}
 	} else {
 		snd_pcm_uframes_t to_write = avail;
 		bool do_pull = true;
 
+		if (state->follow)
+			update_rate(state);
+
 		while (total_written < to_write) {
 			snd_pcm_uframes_t written, frames, offset;
 
 			frames = to_write - total_written;
 			if ((res = snd_pcm_mmap_begin(hndl, &my_areas, &offset, &frames)) < 0) {
 				spa_log_error(state->log, "snd_pcm_mmap_begin error: %s", snd_strerror(res));
-				return;
+				return res;
 			}
 			spa_log_trace(state->log, "begin %ld %ld", offset, frames);
 
@@ -563,7 +623,7 @@ static void alsa_on_playback_timeout_event(struct spa_source *source)
 			if ((res = snd_pcm_mmap_commit(hndl, offset, written)) < 0) {
 				spa_log_error(state->log, "snd_pcm_mmap_commit error: %s", snd_strerror(res));
 				if (res != -EPIPE && res != -ESTRPIPE)
-					return;
+					return res;
 			}
 			total_written += written;
 			state->sample_count += written;
@@ -575,40 +635,34 @@ static void alsa_on_playback_timeout_event(struct spa_source *source)
 		spa_log_trace(state->log, "snd_pcm_start");
 		if ((res = snd_pcm_start(state->hndl)) < 0) {
 			spa_log_error(state->log, "snd_pcm_start: %s", snd_strerror(res));
-			return;
+			return res;
 		}
 		state->alsa_started = true;
 	}
 
-	calc_timeout(state->filled, state->threshold, state->rate, &state->now, &ts.it_value);
+	calc_timeout(state->filled, state->threshold, state->rate, &state->now, next);
 
-	ts.it_interval.tv_sec = 0;
-	ts.it_interval.tv_nsec = 0;
-	timerfd_settime(state->timerfd, TFD_TIMER_ABSTIME, &ts, NULL);
+	return 0;
 }
 
 
-static void alsa_on_capture_timeout_event(struct spa_source *source)
+/* read from the device when it has at least the threshold minus \a slack
+ * frames and return the time of the next wakeup in \a next */
+static int capture_wakeup(struct state *state, int slack, struct timespec *next)
 {
-	uint64_t exp;
 	int res;
-	struct state *state = source->data;
 	snd_pcm_t *hndl = state->hndl;
 	snd_pcm_sframes_t avail;
 	snd_pcm_uframes_t total_read = 0;
-	struct itimerspec ts;
 	const snd_pcm_channel_area_t *my_areas;
 	snd_pcm_status_t *status;
 	snd_htimestamp_t htstamp;
 
-	if (state->started && read(state->timerfd, &exp, sizeof(uint64_t)) != sizeof(uint64_t))
-		spa_log_warn(state->log, "error reading timerfd: %s", strerror(errno));
-
 	snd_pcm_status_alloca(&status);
 
 	if ((res = snd_pcm_status(hndl, status)) < 0) {
 		spa_log_error(state->log, "snd_pcm_status error: %s", snd_strerror(res));
-		return;
+		return res;
 	}
 
 	avail = snd_pcm_status_get_avail(status);
@@ -620,11 +674,11 @@ static void alsa_on_capture_timeout_event(struct spa_source *source)
 	spa_log_trace(state->log, "timeout %ld %d %ld %ld %ld", avail, state->threshold,
 		      state->sample_count, htstamp.tv_sec, htstamp.tv_nsec);
 
-	if (avail < state->threshold) {
+	if (avail + slack < state->threshold) {
 		if (snd_pcm_state(hndl) == SND_PCM_STATE_SUSPENDED) {
 			spa_log_error(state->log, "suspended: try resume");
 			if ((res = alsa_try_resume(state)) < 0)
-				return;
+				return res;
 		}
 	} else {
 		snd_pcm_uframes_t to_read = avail;
@@ -635,7 +689,7 @@ static void alsa_on_capture_timeout_event(struct spa_source *source)
 			frames = to_read - total_read;
 			if ((res = snd_pcm_mmap_begin(hndl, &my_areas, &offset, &frames)) < 0) {
 				spa_log_error(state->log, "snd_pcm_mmap_begin error: %s", snd_strerror(res));
-				return;
+				return res;
 			}
 
 			read = push_frames(state, my_areas, offset, frames);
@@ -645,17 +699,235 @@ static void alsa_on_capture_timeout_event(struct spa_source *source)
 			if ((res = snd_pcm_mmap_commit(hndl, offset, read)) < 0) {
 				spa_log_error(state->log, "snd_pcm_mmap_commit error: %s", snd_strerror(res));
 				if (res != -EPIPE && res != -ESTRPIPE)
-					return;
+					return res;
 			}
 			total_read += read;
 		}
 		state->sample_count += total_read;
 	}
-	calc_timeout(state->threshold, avail - total_read, state->rate, &htstamp, &ts.it_value);
+	calc_timeout(state->threshold, avail - total_read, state->rate, &htstamp, next);
 
+	return 0;
+}
+
+static int alsa_wakeup(struct state *state, int slack, struct timespec *next)
+{
+	if (state->stream == SND_PCM_STREAM_PLAYBACK)
+		return playback_wakeup(state, slack, next);
+	else
+		return capture_wakeup(state, slack, next);
+}
+
+static void set_timeout(int timerfd, const struct timespec *next)
+{
+	struct itimerspec ts;
+
+	ts.it_value = *next;
 	ts.it_interval.tv_sec = 0;
 	ts.it_interval.tv_nsec = 0;
-	timerfd_settime(state->timerfd, TFD_TIMER_ABSTIME, &ts, NULL);
+	timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &ts, NULL);
+}
+
+static void alsa_on_timeout_event(struct spa_source *source)
+{
+	uint64_t exp;
+	struct state *state = source->data;
+	struct timespec next;
+
+	if (state->started && read(state->timerfd, &exp, sizeof(uint64_t)) != sizeof(uint64_t))
+		spa_log_warn(state->log, "error reading timerfd: %s", strerror(errno));
+
+	if (alsa_wakeup(state, 0, &next) == 0)
+		set_timeout(state->timerfd, &next);
+}
+
+static enum resample_format resample_format(snd_pcm_format_t format)
+{
+	switch (format) {
+	case SND_PCM_FORMAT_S16:
+		return RESAMPLE_FORMAT_S16;
+	case SND_PCM_FORMAT_S32:
+		return RESAMPLE_FORMAT_S32;
+	case SND_PCM_FORMAT_FLOAT:
+		return RESAMPLE_FORMAT_F32;
+	default:
+		return RESAMPLE_FORMAT_UNKNOWN;
+	}
+}
+
+/* the frames that fit in the negotiated buffers */
+static uint32_t buffer_frames(struct state *state)
+{
+	if (state->n_buffers == 0)
+		return state->props.min_latency;
+
+	return state->buffers[0].outbuf->datas[0].maxsize / state->frame_size;
+}
+
+/* The wakeup threshold for the quantum of the graph. The buffers are not
+ * renegotiated when the quantum changes, the quantum is clamped to what
+ * the device can do with them:
+ *
+ *  - the sink keeps between min_latency and max_latency frames queued in
+ *    the device, the size of the buffers does not matter.
+ *  - the source reads one buffer per wakeup and can not wake up later than
+ *    it takes to fill a buffer, min_latency frames by default.
+ */
+static int get_threshold(struct state *state)
+{
+	int64_t frames;
+
+	if (state->quantum <= 0)
+		return state->props.min_latency;
+
+	frames = state->quantum * state->rate / SPA_NSEC_PER_SEC;
+
+	if (state->stream == SND_PCM_STREAM_PLAYBACK)
+		return SPA_CLAMP(frames, state->props.min_latency, state->props.max_latency);
+	else
+		return SPA_CLAMP(frames, 1, buffer_frames(state));
+}
+
+/* The devices of a group are serviced from one timer. On a wakeup all
+ * devices that are within half a threshold of their own wakeup are
+ * serviced, so devices with the same quantum are serviced together. The
+ * timer is set to the earliest wakeup of the devices. */
+struct alsa_group {
+	struct spa_list link;
+	char name[64];
+	struct spa_loop *data_loop;
+	struct spa_log *log;
+	int timerfd;
+	struct spa_source source;
+	struct spa_list states;
+	uint32_t n_states;
+};
+
+static struct spa_list groups = { &groups, &groups };
+
+static inline bool timespec_before(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void group_on_timeout_event(struct spa_source *source)
+{
+	uint64_t exp;
+	struct alsa_group *group = source->data;
+	struct state *state;
+	struct timespec next, first;
+	bool have_first = false;
+
+	if (read(group->timerfd, &exp, sizeof(uint64_t)) != sizeof(uint64_t))
+		spa_log_warn(group->log, "error reading timerfd: %s", strerror(errno));
+
+	spa_list_for_each(state, &group->states, group_link) {
+		if (alsa_wakeup(state, state->threshold / 2, &next) < 0)
+			continue;
+		if (!have_first || timespec_before(&next, &first)) {
+			first = next;
+			have_first = true;
+		}
+	}
+	if (have_first)
+		set_timeout(group->timerfd, &first);
+}
+
+static struct alsa_group *group_get(struct state *state)
+{
+	struct alsa_group *group;
+
+	spa_list_for_each(group, &groups, link) {
+		if (group->data_loop == state->data_loop &&
+		    strcmp(group->name, state->group_name) == 0)
+			return group;
+	}
+
+	group = calloc(1, sizeof(struct alsa_group));
+	if (group == NULL)
+		return NULL;
+
+	group->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (group->timerfd < 0) {
+		spa_log_error(state->log, "alsa %p: can't create timerfd: %s", state, strerror(errno));
+		free(group);
+		return NULL;
+	}
+
+	snprintf(group->name, sizeof(group->name), "%s", state->group_name);
+	group->data_loop = state->data_loop;
+	group->log = state->log;
+	spa_list_init(&group->states);
+
+	group->source.func = group_on_timeout_event;
+	group->source.data = group;
+	group->source.fd = group->timerfd;
+	group->source.mask = SPA_IO_IN;
+	group->source.rmask = 0;
+	group->source.priority = SPA_SOURCE_PRIORITY_RT;
+
+	spa_list_append(&groups, &group->link);
+
+	spa_log_debug(state->log, "alsa %p: new group '%s'", state, group->name);
+
+	return group;
+}
+
+static void group_free(struct alsa_group *group)
+{
+	spa_list_remove(&group->link);
+	close(group->timerfd);
+	free(group);
+}
+
+static int do_group_add(struct spa_loop *loop,
+			bool async,
+			uint32_t seq,
+			const void *data,
+			size_t size,
+			void *user_data)
+{
+	struct state *state = user_data;
+	struct alsa_group *group = state->group;
+	struct itimerspec ts;
+
+	if (group->n_states++ == 0)
+		spa_loop_add_source(group->data_loop, &group->source);
+	spa_list_append(&group->states, &state->group_link);
+
+	/* service the new device right away */
+	ts.it_value.tv_sec = 0;
+	ts.it_value.tv_nsec = 1;
+	ts.it_interval.tv_sec = 0;
+	ts.it_interval.tv_nsec = 0;
+	timerfd_settime(group->timerfd, 0, &ts, NULL);
+
+	return 0;
+}
+
+static int do_group_remove(struct spa_loop *loop,
+			   bool async,
+			   uint32_t seq,
+			   const void *data,
+			   size_t size,
+			   void *user_data)
+{
+	struct state *state = user_data;
+	struct alsa_group *group = state->group;
+	struct itimerspec ts;
+
+	spa_list_remove(&state->group_link);
+	if (--group->n_states > 0)
+		return 0;
+
+	spa_loop_remove_source(group->data_loop, &group->source);
+	ts.it_value.tv_sec = 0;
+	ts.it_value.tv_nsec = 0;
+	ts.it_interval.tv_sec = 0;
+	ts.it_interval.tv_nsec = 0;
+	timerfd_settime(group->timerfd, 0, &ts, NULL);
+
+	return 0;
 }
 
 int spa_alsa_start(struct state *state, bool xrun_recover)
@@ -677,18 +949,21 @@ int spa_alsa_start(struct state *state, bool xrun_recover)
 		return err;
 	}
 
-	if (state->stream == SND_PCM_STREAM_PLAYBACK) {
-		state->source.func = alsa_on_playback_timeout_event;
-	} else {
-		state->source.func = alsa_on_capture_timeout_event;
+	state->threshold = get_threshold(state);
+
+	state->follow = false;
+	state->rate_corr = 1.0;
+	if (state->stream == SND_PCM_STREAM_PLAYBACK && state->props.target_latency > 0) {
+		if (resample_init(&state->resample, resample_format(state->format),
+				  state->channels) < 0) {
+			spa_log_warn(state->log, "alsa %p: can't resample %s, not following the rate",
+				     state, snd_pcm_format_name(state->format));
+		} else {
+			spa_dll_init(&state->dll);
+			spa_dll_set_bw(&state->dll, SPA_DLL_BW_MIN, state->threshold, state->rate);
+			state->follow = true;
+		}
 	}
-	state->source.data = state;
-	state->source.fd = state->timerfd;
-	state->source.mask = SPA_IO_IN;
-	state->source.rmask = 0;
-	spa_loop_add_source(state->data_loop, &state->source);
-
-	state->threshold = state->props.min_latency;
 
 	if (state->stream == SND_PCM_STREAM_PLAYBACK) {
 		state->alsa_started = false;
@@ -700,11 +975,29 @@ int spa_alsa_start(struct state *state, bool xrun_recover)
 		state->alsa_started = true;
 	}
 
-	ts.it_value.tv_sec = 0;
-	ts.it_value.tv_nsec = 1;
-	ts.it_interval.tv_sec = 0;
-	ts.it_interval.tv_nsec = 0;
-	timerfd_settime(state->timerfd, 0, &ts, NULL);
+	/* nothing can fail after this, a new group or our source would
+	 * otherwise have to be undone */
+	state->group = NULL;
+	if (state->group_name[0] != '\0' && (state->group = group_get(state)) == NULL)
+		spa_log_warn(state->log, "alsa %p: can't join group '%s'", state, state->group_name);
+
+	if (state->group) {
+		spa_loop_invoke(state->data_loop, do_group_add, 0, NULL, 0, true, state);
+	} else {
+		state->source.func = alsa_on_timeout_event;
+		state->source.data = state;
+		state->source.fd = state->timerfd;
+		state->source.mask = SPA_IO_IN;
+		state->source.rmask = 0;
+		state->source.priority = SPA_SOURCE_PRIORITY_RT;
+		spa_loop_add_source(state->data_loop, &state->source);
+
+		ts.it_value.tv_sec = 0;
+		ts.it_value.tv_nsec = 1;
+		ts.it_interval.tv_sec = 0;
+		ts.it_interval.tv_nsec = 0;
+		timerfd_settime(state->timerfd, 0, &ts, NULL);
+	}
 
 	state->started = true;
 
@@ -740,7 +1033,14 @@ int spa_alsa_pause(struct state *state, bool xrun_recover)
 
 	spa_log_debug(state->log, "alsa %p: pause", state);
 
-	spa_loop_invoke(state->data_loop, do_remove_source, 0, NULL, 0, true, state);
+	if (state->group) {
+		spa_loop_invoke(state->data_loop, do_group_remove, 0, NULL, 0, true, state);
+		if (state->group->n_states == 0)
+			group_free(state->group);
+		state->group = NULL;
+	} else {
+		spa_loop_invoke(state->data_loop, do_remove_source, 0, NULL, 0, true, state);
+	}
 
 	if ((err = snd_pcm_drop(state->hndl)) < 0)
 		spa_log_error(state->log, "snd_pcm_drop %s", snd_strerror(err));
@@ -749,3 +1049,37 @@ int spa_alsa_pause(struct state *state, bool xrun_recover)
 
 	return 0;
 }
+
+static int do_set_threshold(struct spa_loop *loop,
+			    bool async,
+			    uint32_t seq,
+			    const void *data,
+			    size_t size,
+			    void *user_data)
+{
+	struct state *state = user_data;
+
+	state->threshold = get_threshold(state);
+	if (state->follow)
+		spa_dll_set_bw(&state->dll, state->dll.bw, state->threshold, state->rate);
+
+	return 0;
+}
+
+int spa_alsa_set_quantum(struct state *state, int64_t quantum)
+{
+	if (state->quantum == quantum)
+		return 0;
+
+	state->quantum = quantum;
+
+	if (!state->started)
+		return 0;
+
+	spa_log_debug(state->log, "alsa %p: quantum %" PRIi64 "ns", state, quantum);
+
+	/* the next wakeup uses the new threshold, the device stays open */
+	spa_loop_invoke(state->data_loop, do_set_threshold, 0, NULL, 0, true, state);
+
+	return 0;
+}
@@ -32,6 +32,7 @@ extern "C" {
 #include <spa/support/loop.h>
 #include <spa/support/log.h>
 #include <spa/utils/list.h>
+#include <spa/utils/dll.h>
 
 #include <spa/clock/clock.h>
 #include <spa/node/node.h>
@@ -40,12 +41,15 @@ extern "C" {
 #include <spa/param/meta.h>
 #include <spa/param/audio/format-utils.h>
 
+#include "resample.h"
+
 struct props {
 	char device[64];
 	char device_name[128];
 	char card_name[128];
 	uint32_t min_latency;
 	uint32_t max_latency;
+	uint32_t target_latency;
 };
 
 #define MAX_BUFFERS 32
@@ -67,6 +71,7 @@ struct type {
 	uint32_t prop_card_name;
 	uint32_t prop_min_latency;
 	uint32_t prop_max_latency;
+	uint32_t prop_target_latency;
 	struct spa_type_io io;
 	struct spa_type_param param;
 	struct spa_type_meta meta;
@@ -93,6 +98,7 @@ static inline void init_type(struct type *type, struct spa_type_map *map)
 	type->prop_card_name = spa_type_map_get_id(map, SPA_TYPE_PROPS__cardName);
 	type->prop_min_latency = spa_type_map_get_id(map, SPA_TYPE_PROPS__minLatency);
 	type->prop_max_latency = spa_type_map_get_id(map, SPA_TYPE_PROPS__maxLatency);
+	type->prop_target_latency = spa_type_map_get_id(map, SPA_TYPE_PROPS__targetLatency);
 
 	spa_type_io_map(map, &type->io);
 	spa_type_param_map(map, &type->param);
@@ -160,6 +166,14 @@ struct state {
 	int timerfd;
 	bool alsa_started;
 	int threshold;
+	int64_t quantum;	/* quantum of the graph in nanoseconds, 0 when unknown.
+				 * The threshold follows it within the limits of
+				 * the device, see get_threshold() */
+
+	/* devices with the same group name share one timer */
+	char group_name[64];
+	struct alsa_group *group;
+	struct spa_list group_link;
 
 	snd_htimestamp_t now;
 	int64_t sample_count;
@@ -168,6 +182,13 @@ struct state {
 	int64_t last_monotonic;
 
 	uint64_t underrun;
+
+	/* when following the rate of the data, the queued frames are kept at
+	 * the target latency with a DLL that drives the resampler */
+	bool follow;
+	struct spa_dll dll;
+	struct resample resample;
+	double rate_corr;
 };
 
 int
@@ -181,6 +202,7 @@ int spa_alsa_set_format(struct state *state, struct spa_audio_info *info, uint32
 
 int spa_alsa_start(struct state *state, bool xrun_recover);
 int spa_alsa_pause(struct state *state, bool xrun_recover);
+int spa_alsa_set_quantum(struct state *state, int64_t quantum);
 int spa_alsa_close(struct state *state);
 
 #ifdef __cplusplus
@@ -0,0 +1,136 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_ALSA_RESAMPLE_H__
+#define __SPA_ALSA_RESAMPLE_H__
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <spa/utils/defs.h>
+
+/* an adaptive resampler for small rate changes. It interpolates linearly
+ * between the frames, which is fine for the ratios that a drifting clock
+ * needs, a ratio very close to 1.0. */
+
+#define RESAMPLE_MAX_CHANNELS	64
+
+enum resample_format {
+	RESAMPLE_FORMAT_UNKNOWN,
+	RESAMPLE_FORMAT_S16,
+	RESAMPLE_FORMAT_S32,
+	RESAMPLE_FORMAT_F32,
+};
+
+struct resample {
+	enum resample_format format;
+	uint32_t channels;
+	double ratio;		/* input frames per output frame */
+	double pos;		/* position of the next output frame in the input,
+				 * -1.0 is the last frame of the previous input */
+	double history[RESAMPLE_MAX_CHANNELS];
+};
+
+static inline int resample_init(struct resample *r, enum resample_format format,
+				uint32_t channels)
+{
+	if (format == RESAMPLE_FORMAT_UNKNOWN || channels == 0 ||
+	    channels > RESAMPLE_MAX_CHANNELS)
+		return -ENOTSUP;
+
+	r->format = format;
+	r->channels = channels;
+	r->ratio = 1.0;
+	r->pos = 0.0;
+	memset(r->history, 0, sizeof(r->history));
+	return 0;
+}
+
+static inline double resample_read(struct resample *r, const void *src, uint32_t i)
+{
+	switch (r->format) {
+	case RESAMPLE_FORMAT_S16:
+		return ((const int16_t *) src)[i];
+	case RESAMPLE_FORMAT_S32:
+		return ((const int32_t *) src)[i];
+	default:
+		return ((const float *) src)[i];
+	}
+}
+
+static inline void resample_write(struct resample *r, void *dst, uint32_t i, double v)
+{
+	switch (r->format) {
+	case RESAMPLE_FORMAT_S16:
+		((int16_t *) dst)[i] = (int16_t) SPA_CLAMP(lrint(v), INT16_MIN, INT16_MAX);
+		break;
+	case RESAMPLE_FORMAT_S32:
+		((int32_t *) dst)[i] = (int32_t) SPA_CLAMP(llrint(v), INT32_MIN, INT32_MAX);
+		break;
+	default:
+		((float *) dst)[i] = v;
+		break;
+	}
+}
+
+/** resample at most \a n_src frames from \a src into at most \a n_dst
+ * frames in \a dst. Returns the number of frames written and the number of
+ * frames used from \a src in \a consumed. The frames that are not consumed
+ * should be given again in the next call. */
+static inline uint32_t resample_process(struct resample *r,
+					void *dst, uint32_t n_dst,
+					const void *src, uint32_t n_src,
+					uint32_t *consumed)
+{
+	uint32_t c, n_out = 0, channels = r->channels, used;
+	double pos = r->pos, a, b, f;
+	int32_t index;
+
+	while (n_out < n_dst) {
+		index = (int32_t) floor(pos);
+		if (index + 1 >= (int32_t) n_src)
+			break;
+
+		f = pos - index;
+		for (c = 0; c < channels; c++) {
+			a = index < 0 ? r->history[c] :
+				resample_read(r, src, index * channels + c);
+			b = resample_read(r, src, (index + 1) * channels + c);
+			resample_write(r, dst, n_out * channels + c, a + (b - a) * f);
+		}
+		n_out++;
+		pos += r->ratio;
+	}
+
+	/* keep the frame before the next output frame */
+	used = SPA_MIN((uint32_t) (floor(pos) + 1), n_src);
+	if (used > 0) {
+		for (c = 0; c < channels; c++)
+			r->history[c] = resample_read(r, src, (used - 1) * channels + c);
+	}
+	r->pos = pos - used;
+	*consumed = used;
+
+	return n_out;
+}
+
+#endif /* __SPA_ALSA_RESAMPLE_H__ */
@@ -24,6 +24,7 @@
 #include <spa/support/log.h>
 #include <spa/support/type-map.h>
 #include <spa/utils/list.h>
+#include <spa/utils/mix-ops.h>
 #include <spa/node/node.h>
 #include <spa/node/io.h>
 #include <spa/param/audio/format-utils.h>
@@ -32,8 +33,6 @@
 #include <spa/param/io.h>
 #include <spa/pod/filter.h>
 
-#include "mix-ops.h"
-
 #define NAME "audiomixer"
 
 #define MAX_BUFFERS     64
@@ -134,7 +133,8 @@ struct impl {
 	struct spa_type_map *map;
 	struct spa_log *log;
 
-	struct spa_audiomixer_ops ops;
+	uint32_t cpu_flags;
+	struct spa_mix_ops ops;
 
 	const struct spa_node_callbacks *callbacks;
 	void *user_data;
@@ -149,11 +149,8 @@ struct impl {
 	struct spa_audio_info format;
 	uint32_t bpf;
 
-	mix_clear_func_t clear;
-	mix_func_t copy;
-	mix_func_t add;
-	mix_scale_func_t copy_scale;
-	mix_scale_func_t add_scale;
+	spa_mix_n_func_t mix_n;
+	spa_mix_clear_func_t clear;
 
 	bool started;
 };
@@ -617,19 +614,13 @@ static int port_set_format(struct spa_node *node,
 				return -EINVAL;
 		} else {
 			if (info.info.raw.format == t->audio_format.S16) {
-				this->clear = this->ops.clear[FMT_S16];
-				this->copy = this->ops.copy[FMT_S16];
-				this->add = this->ops.add[FMT_S16];
-				this->copy_scale = this->ops.copy_scale[FMT_S16];
-				this->add_scale = this->ops.add_scale[FMT_S16];
+				this->mix_n = this->ops.mix_n[SPA_MIX_FMT_S16];
+				this->clear = this->ops.clear[SPA_MIX_FMT_S16];
 				this->bpf = sizeof(int16_t) * info.info.raw.channels;
 			}
 			else if (info.info.raw.format == t->audio_format.F32) {
-				this->clear = this->ops.clear[FMT_F32];
-				this->copy = this->ops.copy[FMT_F32];
-				this->add = this->ops.add[FMT_F32];
-				this->copy_scale = this->ops.copy_scale[FMT_F32];
-				this->add_scale = this->ops.add_scale[FMT_F32];
+				this->mix_n = this->ops.mix_n[SPA_MIX_FMT_F32];
+				this->clear = this->ops.clear[SPA_MIX_FMT_F32];
 				this->bpf = sizeof(float) * info.info.raw.channels;
 			}
 			else
@@ -816,78 +807,94 @@ impl_node_port_send_command(struct spa_node *node,
 	return -ENOTSUP;
 }
 
-static inline void
-add_port_data(struct impl *this, void *out, size_t outsize, struct port *port, int layer)
+static inline void *
+port_data(struct port *port, uint32_t *avail)
 {
-	size_t insize;
 	struct buffer *b;
-	uint32_t index, offset, len1, len2, maxsize;
 	struct spa_data *d;
-	void *data;
-	double volume = *port->io_volume;
-	bool mute = *port->io_mute;
+	uint32_t index, offset, maxsize, insize;
 
 	b = spa_list_first(&port->queue, struct buffer, link);
-
 	d = b->outbuf->datas;
 
 	maxsize = d[0].maxsize;
-	data = d[0].data;
-
 	insize = SPA_MIN(d[0].chunk->size, maxsize);
-	outsize = SPA_MIN(outsize, insize);
 
 	index = d[0].chunk->offset + (insize - port->queued_bytes);
 	offset = index % maxsize;
 
-	len1 = SPA_MIN(outsize, maxsize - offset);
-	len2 = outsize - len1;
+	*avail = SPA_MIN(port->queued_bytes, maxsize - offset);
 
-	if (volume < 0.001 || mute) {
-		/* silence, for the first layer clear, otherwise do nothing */
-		if (layer == 0) {
-			this->clear(out, len1);
-			if (len2 > 0)
-				this->clear(out + len1, len2);
-		}
-	}
-	else if (volume < 0.999 || volume > 1.001) {
-		mix_scale_func_t mix = layer == 0 ? this->copy_scale : this->add_scale;
+	return SPA_MEMBER(d[0].data, offset, void);
+}
 
-		mix(out, SPA_MEMBER(data, offset, void), volume, len1);
-		if (len2 > 0)
-			mix(out + len1, data, volume, len2);
-	}
-	else {
-		mix_func_t mix = layer == 0 ? this->copy : this->add;
+static inline void
+consume_port_data(struct impl *this, struct port *port, size_t n_bytes)
+{
+	struct buffer *b;
 
-		mix(out, SPA_MEMBER(data, offset, void), len1);
-		if (len2 > 0)
-			mix(out + len1, data, len2);
-	}
+	port->queued_bytes -= n_bytes;
+
+	if (port->queued_bytes > 0)
+		return;
 
-	port->queued_bytes -= outsize;
+	b = spa_list_first(&port->queue, struct buffer, link);
 
-	if (port->queued_bytes == 0) {
-		spa_log_trace(this->log, NAME " %p: return buffer %d on port %p %zd",
-			      this, b->outbuf->id, port, outsize);
-		port->io->buffer_id = b->outbuf->id;
-		spa_list_remove(&b->link);
-		b->outstanding = true;
-	} else {
-		spa_log_trace(this->log, NAME " %p: keeping buffer %d on port %p %zd %zd",
-			      this, b->outbuf->id, port, port->queued_bytes, outsize);
+	spa_log_trace(this->log, NAME " %p: return buffer %d on port %p",
+		      this, b->outbuf->id, port);
+	port->io->buffer_id = b->outbuf->id;
+	spa_list_remove(&b->link);
+	b->outstanding = true;
+}
+
+/* mix all the ports into out in one pass. The input ringbuffers can wrap at
+ * different places so we mix in segments that are contiguous in all inputs. */
+static inline void
+mix_port_data(struct impl *this, void *out, size_t outsize, struct port **ports, uint32_t n_ports)
+{
+	const void *src[MAX_PORTS];
+	double scale[MAX_PORTS];
+	uint32_t i, n_src, avail, len, pos;
+
+	for (pos = 0; pos < outsize; pos += len) {
+		len = outsize - pos;
+
+		for (i = 0, n_src = 0; i < n_ports; i++) {
+			struct port *port = ports[i];
+			double volume = *port->io_volume;
+			bool mute = *port->io_mute;
+			void *data = port_data(port, &avail);
+
+			len = SPA_MIN(len, avail);
+
+			/* silent ports are skipped, they only consume data */
+			if (volume < 0.001 || mute)
+				continue;
+
+			src[n_src] = data;
+			scale[n_src] = volume;
+			n_src++;
+		}
+
+		if (n_src == 0)
+			this->clear(SPA_MEMBER(out, pos, void), len);
+		else
+			this->mix_n(&this->ops, SPA_MEMBER(out, pos, void), src, scale, n_src, len);
+
+		for (i = 0; i < n_ports; i++)
+			consume_port_data(this, ports[i], len);
 	}
 }
 
 static int mix_output(struct impl *this, size_t n_bytes)
 {
 	struct buffer *outbuf;
-	int i, layer;
+	int i;
 	struct port *outport;
 	struct spa_io_buffers *outio;
 	struct spa_data *od;
-	uint32_t avail, index, maxsize, len1, len2, offset;
+	struct port *ports[MAX_PORTS];
+	uint32_t n_ports, avail, index, maxsize, len1, len2, offset;
 
 	outport = GET_OUT_PORT(this, 0);
 	outio = outport->io;
@@ -915,7 +922,7 @@ static int mix_output(struct impl *this, size_t n_bytes)
 	spa_log_trace(this->log, NAME " %p: dequeue output buffer %d %zd %d %d %d",
 		      this, outbuf->outbuf->id, n_bytes, offset, len1, len2);
 
-	for (layer = 0, i = 0; i < this->last_port; i++) {
+	for (n_ports = 0, i = 0; i < this->last_port; i++) {
 		struct port *in_port = GET_IN_PORT(this, i);
 
 		if (in_port->io == NULL || in_port->n_buffers == 0)
@@ -925,13 +932,13 @@ static int mix_output(struct impl *this, size_t n_bytes)
 			spa_log_warn(this->log, NAME " %p: underrun stream %d", this, i);
 			continue;
 		}
-
-		add_port_data(this, SPA_MEMBER(od[0].data, offset, void), len1, in_port, layer);
-		if (len2 > 0)
-			add_port_data(this, od[0].data, len2, in_port, layer);
-		layer++;
+		ports[n_ports++] = in_port;
 	}
 
+	mix_port_data(this, SPA_MEMBER(od[0].data, offset, void), len1, ports, n_ports);
+	if (len2 > 0)
+		mix_port_data(this, od[0].data, len2, ports, n_ports);
+
 	od[0].chunk->offset = index;
 	od[0].chunk->size = n_bytes;
 	od[0].chunk->stride = 0;
@@ -1145,7 +1152,9 @@ impl_init(const struct spa_handle_factory *factory,
 	    SPA_PORT_INFO_FLAG_NO_REF;
 	spa_list_init(&port->queue);
 
-	spa_audiomixer_get_ops(&this->ops);
+	this->cpu_flags = spa_mix_get_cpu_flags();
+	spa_mix_get_ops(&this->ops, this->cpu_flags);
+	spa_log_debug(this->log, NAME " %p: using cpu flags %08x", this, this->cpu_flags);
 
 	return 0;
 }
@@ -148,6 +148,7 @@ struct impl {
 	struct spa_source source;
 	int timerfd;
 	int threshold;
+	int64_t quantum;
 	struct spa_source flush_source;
 
 	sbc_t sbc;
@@ -788,6 +789,7 @@ static int do_start(struct impl *this)
 	this->source.func = a2dp_on_timeout;
 	this->source.mask = SPA_IO_IN;
 	this->source.rmask = 0;
+	this->source.priority = SPA_SOURCE_PRIORITY_RT;
 	spa_loop_add_source(this->data_loop, &this->source);
 
 	this->flush_source.data = this;
@@ -847,6 +849,57 @@ static int do_stop(struct impl *this)
 	return res;
 }
 
+/* the frames that fit in the negotiated buffers */
+static uint32_t buffer_frames(struct impl *this)
+{
+	if (this->n_buffers == 0)
+		return this->props.min_latency;
+
+	return this->buffers[0].outbuf->datas[0].maxsize / this->frame_size;
+}
+
+/* The amount of frames to pull for the quantum of the graph. The buffers
+ * are not renegotiated when the quantum changes, like the ALSA source the
+ * quantum is clamped to the frames that fit in one buffer. */
+static int get_threshold(struct impl *this)
+{
+	int64_t frames;
+
+	if (this->quantum <= 0)
+		return this->props.min_latency;
+
+	frames = this->quantum * this->current_format.info.raw.rate / SPA_NSEC_PER_SEC;
+	return SPA_CLAMP(frames, 1, buffer_frames(this));
+}
+
+static int do_set_threshold(struct spa_loop *loop,
+			    bool async,
+			    uint32_t seq,
+			    const void *data,
+			    size_t size,
+			    void *user_data)
+{
+	struct impl *this = user_data;
+	this->threshold = get_threshold(this);
+	return 0;
+}
+
+static void set_quantum(struct impl *this, int64_t quantum)
+{
+	if (this->quantum == quantum)
+		return;
+
+	this->quantum = quantum;
+
+	if (!this->have_format)
+		return;
+
+	if (this->started)
+		spa_loop_invoke(this->data_loop, do_set_threshold, 0, NULL, 0, true, this);
+	else
+		this->threshold = get_threshold(this);
+}
+
 static int impl_node_send_command(struct spa_node *node, const struct spa_command *command)
 {
 	struct impl *this;
@@ -869,6 +922,11 @@ static int impl_node_send_command(struct spa_node *node, const struct spa_comman
 	} else if (SPA_COMMAND_TYPE(command) == this->type.command_node.Pause) {
 		if ((res = do_stop(this)) < 0)
 			return res;
+	} else if (SPA_COMMAND_TYPE(command) == this->type.command_node.ClockUpdate) {
+		struct spa_command_node_clock_update *cu = (__typeof__(cu)) command;
+
+		if (cu->body.change_mask.value & SPA_COMMAND_NODE_CLOCK_UPDATE_LATENCY)
+			set_quantum(this, cu->body.latency.value);
 	} else
 		return -ENOTSUP;
 
@@ -1115,8 +1173,8 @@ static int port_set_format(struct spa_node *node,
 			return -EINVAL;
 
 		this->frame_size = info.info.raw.channels * 2;
-		this->threshold = this->props.min_latency;
 		this->current_format = info;
+		this->threshold = get_threshold(this);
 		this->have_format = true;
 	}
 
@@ -1190,6 +1248,7 @@ impl_node_port_use_buffers(struct spa_node *node,
 		}
 	}
 	this->n_buffers = n_buffers;
+	this->threshold = get_threshold(this);
 
 	return 0;
 }
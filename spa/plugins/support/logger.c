@@ -219,6 +219,7 @@ impl_init(const struct spa_handle_factory *factory,
 		this->source.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
 		this->source.mask = SPA_IO_IN;
 		this->source.rmask = 0;
+		this->source.priority = SPA_SOURCE_PRIORITY_LOW;
 		spa_loop_add_source(loop, &this->source);
 		this->have_source = true;
 	}
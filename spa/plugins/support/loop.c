@@ -40,17 +40,28 @@
 
 #define DATAS_SIZE (4096 * 8)
 
+#define MIN_EVENTS	32
+#define MAX_EVENTS	1024
+
 /** \cond */
 
+#define ITEM_ALIGN 8
+
+struct invoke_ack {
+	int res;
+	bool done;
+};
+
 struct invoke_item {
 	size_t item_size;
+	bool committed;			/**< the item in the ring can be invoked */
+	struct invoke_item *next;	/**< in the overflow list */
 	spa_invoke_func_t func;
 	uint32_t seq;
 	void *data;
 	size_t size;
-	bool block;
 	void *user_data;
-	int res;
+	struct invoke_ack *ack;		/**< result of a blocking invoke */
 };
 
 struct type {
@@ -84,12 +95,21 @@ struct impl {
 
 	int epoll_fd;
 	pthread_t thread;
+	struct epoll_event *ep;
+	int n_ep;
 
 	struct spa_source *wakeup;
-	int ack_fd;
+	pthread_mutex_t ack_lock;
+	pthread_cond_t ack_cond;
 
-	struct spa_ringbuffer buffer;
-	uint8_t buffer_data[DATAS_SIZE];
+	struct spa_ringbuffer buffer;	/**< the write index is reserved by the producers,
+					  *  the items are invoked when committed */
+	uint8_t buffer_data[DATAS_SIZE] __attribute__ ((aligned (ITEM_ALIGN)));
+
+	struct invoke_item *overflow;	/**< items that did not fit in the ring */
+	uint32_t n_overflow;
+	struct invoke_item *pending;	/**< overflow items taken by the loop */
+	uint32_t pending_index;		/**< ring items before this index go first */
 };
 
 struct source_impl {
@@ -191,6 +211,77 @@ static void loop_remove_source(struct spa_source *source)
 	source->loop = NULL;
 }
 
+/* reserve space for an item in the ring, many threads can do this at
+ * the same time. The item is published with commit_item(). */
+static bool reserve_item(struct impl *impl, size_t size, uint32_t *idx, uint32_t *item_size,
+			 uint32_t *data_offset)
+{
+	uint32_t index, offset, l0, isize, dsize;
+	int32_t filled;
+
+	dsize = SPA_ROUND_UP_N(size, ITEM_ALIGN);
+
+	index = __atomic_load_n(&impl->buffer.writeindex, __ATOMIC_RELAXED);
+	do {
+		filled = index - __atomic_load_n(&impl->buffer.readindex, __ATOMIC_ACQUIRE);
+		if (filled < 0 || filled > DATAS_SIZE) {
+			spa_log_warn(impl->log, NAME " %p: queue xrun %d", impl, filled);
+			return false;
+		}
+		offset = index & (DATAS_SIZE - 1);
+		l0 = DATAS_SIZE - offset;
+
+		if (l0 >= sizeof(struct invoke_item) + dsize) {
+			*data_offset = offset + sizeof(struct invoke_item);
+			isize = sizeof(struct invoke_item) + dsize;
+			/* no room for the next header, skip to the start */
+			if (l0 - isize < sizeof(struct invoke_item))
+				isize = l0;
+		} else {
+			*data_offset = 0;
+			isize = l0 + dsize;
+		}
+		if (isize > DATAS_SIZE - filled ||
+		    DATAS_SIZE - dsize < sizeof(struct invoke_item))
+			return false;
+	} while (!__atomic_compare_exchange_n(&impl->buffer.writeindex, &index, index + isize,
+				true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+	*idx = index;
+	*item_size = isize;
+	return true;
+}
+
+/* the producers don't wait for each other, the loop invokes the items up
+ * to the first one that is not committed yet. Its producer wakes up the
+ * loop again when it commits. */
+static void commit_item(struct invoke_item *item)
+{
+	__atomic_store_n(&item->committed, true, __ATOMIC_RELEASE);
+}
+
+/* used when the ring is full or when there are items pending in the
+ * overflow list, so that nothing is lost */
+static struct invoke_item *alloc_item(size_t size)
+{
+	struct invoke_item *item;
+
+	item = malloc(sizeof(struct invoke_item) + size);
+	if (item == NULL)
+		return NULL;
+
+	item->item_size = 0;
+	item->data = SPA_MEMBER(item, sizeof(struct invoke_item), void);
+	return item;
+}
+
+static void queue_overflow(struct impl *impl, struct invoke_item *item)
+{
+	item->next = __atomic_load_n(&impl->overflow, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&impl->overflow, &item->next, item,
+				true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
 static int
 loop_invoke(struct spa_loop *loop,
 	    spa_invoke_func_t func,
@@ -203,62 +294,57 @@ loop_invoke(struct spa_loop *loop,
 	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
 	bool in_thread = pthread_equal(impl->thread, pthread_self());
 	struct invoke_item *item;
+	struct invoke_ack ack = { 0, false };
 	int res;
 
 	if (in_thread) {
 		res = func(loop, false, seq, data, size, user_data);
 	} else {
-		int32_t filled, avail;
-		uint32_t idx, offset, l0;
+		uint32_t idx, item_size, data_offset;
+		bool ring;
 
-		filled = spa_ringbuffer_get_write_index(&impl->buffer, &idx);
-		if (filled < 0 || filled > DATAS_SIZE) {
-			spa_log_warn(impl->log, NAME " %p: queue xrun %d", impl, filled);
-			return -EPIPE;
-		}
-		avail = DATAS_SIZE - filled;
-		if (avail < sizeof(struct invoke_item)) {
-			spa_log_warn(impl->log, NAME " %p: queue full %d", impl, avail);
-			return -EPIPE;
-		}
-		offset = idx & (DATAS_SIZE - 1);
+		/* keep the order with the items in the overflow list */
+		ring = __atomic_load_n(&impl->n_overflow, __ATOMIC_ACQUIRE) == 0 &&
+		    reserve_item(impl, size, &idx, &item_size, &data_offset);
 
-		l0 = DATAS_SIZE - offset;
-
-		item = SPA_MEMBER(impl->buffer_data, offset, struct invoke_item);
+		if (ring) {
+			item = SPA_MEMBER(impl->buffer_data, idx & (DATAS_SIZE - 1), struct invoke_item);
+			item->item_size = item_size;
+			item->data = SPA_MEMBER(impl->buffer_data, data_offset, void);
+		} else {
+			__atomic_add_fetch(&impl->n_overflow, 1, __ATOMIC_ACQ_REL);
+			if ((item = alloc_item(size)) == NULL) {
+				__atomic_sub_fetch(&impl->n_overflow, 1, __ATOMIC_RELEASE);
+				spa_log_warn(impl->log, NAME " %p: can't allocate item", impl);
+				return -ENOMEM;
+			}
+		}
 		item->func = func;
 		item->seq = seq;
 		item->size = size;
-		item->block = block;
 		item->user_data = user_data;
+		item->ack = block ? &ack : NULL;
+		if (size > 0)
+			memcpy(item->data, data, size);
 
-		if (l0 > sizeof(struct invoke_item) + size) {
-			item->data = SPA_MEMBER(item, sizeof(struct invoke_item), void);
-			item->item_size = sizeof(struct invoke_item) + size;
-			if (l0 < sizeof(struct invoke_item) + item->item_size)
-				item->item_size = l0;
-		} else {
-			item->data = impl->buffer_data;
-			item->item_size = l0 + size;
-		}
-		memcpy(item->data, data, size);
-
-		spa_ringbuffer_write_update(&impl->buffer, idx + item->item_size);
+		if (ring)
+			commit_item(item);
+		else
+			queue_overflow(impl, item);
 
 		spa_loop_utils_signal_event(&impl->utils, impl->wakeup);
 
 		if (block) {
-			uint64_t count = 1;
-
 			spa_loop_control_hook_before(&impl->hooks_list);
 
-			if (read(impl->ack_fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
-				spa_log_warn(impl->log, NAME " %p: failed to read event fd: %s",
-						impl, strerror(errno));
+			pthread_mutex_lock(&impl->ack_lock);
+			while (!ack.done)
+				pthread_cond_wait(&impl->ack_cond, &impl->ack_lock);
+			pthread_mutex_unlock(&impl->ack_lock);
 
 			spa_loop_control_hook_after(&impl->hooks_list);
 
-			res = item->res;
+			res = ack.res;
 		}
 		else {
 			if (seq != SPA_ID_INVALID)
@@ -270,24 +356,86 @@ loop_invoke(struct spa_loop *loop,
 	return res;
 }
 
+static void invoke_item(struct impl *impl, struct invoke_item *item)
+{
+	int res;
+
+	res = item->func(&impl->loop, true, item->seq, item->data, item->size,
+			 item->user_data);
+
+	if (item->ack) {
+		pthread_mutex_lock(&impl->ack_lock);
+		item->ack->res = res;
+		item->ack->done = true;
+		pthread_cond_broadcast(&impl->ack_cond);
+		pthread_mutex_unlock(&impl->ack_lock);
+	}
+}
+
+/* clear a consumed item so that a header reserved later at any of its
+ * offsets reads as not committed until its producer commits it */
+static void clear_item(struct impl *impl, uint32_t index, uint32_t item_size)
+{
+	uint32_t offset, l0;
+
+	offset = index & (DATAS_SIZE - 1);
+	l0 = SPA_MIN(item_size, DATAS_SIZE - offset);
+	memset(SPA_MEMBER(impl->buffer_data, offset, void), 0, l0);
+	memset(impl->buffer_data, 0, item_size - l0);
+}
+
 static void wakeup_func(void *data, uint64_t count)
 {
 	struct impl *impl = data;
-	uint32_t index;
-	while (spa_ringbuffer_get_read_index(&impl->buffer, &index) > 0) {
-		struct invoke_item *item =
-		    SPA_MEMBER(impl->buffer_data, index & (DATAS_SIZE - 1), struct invoke_item);
-		item->res = item->func(&impl->loop, true, item->seq, item->data, item->size,
-			   item->user_data);
-		spa_ringbuffer_read_update(&impl->buffer, index + item->item_size);
-
-		if (item->block) {
-			uint64_t count = 1;
-			if (write(impl->ack_fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
-				spa_log_warn(impl->log, NAME " %p: failed to write event fd: %s",
-						impl, strerror(errno));
+	struct invoke_item *list, *item, *next;
+	uint32_t index, start, end, item_size;
+	int32_t avail;
+	bool flushed;
+
+	do {
+		/* take a new overflow list after the previous one ran. A producer
+		 * reserves its ring items before it queues to the list, so the ring
+		 * items up to the write index at this point are invoked first. */
+		if (impl->pending == NULL) {
+			list = __atomic_exchange_n(&impl->overflow, NULL, __ATOMIC_ACQUIRE);
+			/* the list is in LIFO order, reverse it */
+			for (item = NULL; list; list = next) {
+				next = list->next;
+				list->next = item;
+				item = list;
+			}
+			impl->pending = item;
+			impl->pending_index = __atomic_load_n(&impl->buffer.writeindex,
+							      __ATOMIC_ACQUIRE);
 		}
-	}
+
+		avail = spa_ringbuffer_get_read_index(&impl->buffer, &index);
+
+		/* drain the committed items of the ring in one batch */
+		for (start = index, end = index + SPA_MAX(avail, 0); index != end; index += item_size) {
+			item = SPA_MEMBER(impl->buffer_data, index & (DATAS_SIZE - 1),
+					struct invoke_item);
+			if (!__atomic_load_n(&item->committed, __ATOMIC_ACQUIRE))
+				break;
+			item_size = item->item_size;
+			invoke_item(impl, item);
+			clear_item(impl, index, item_size);
+		}
+		if (index != start)
+			spa_ringbuffer_read_update(&impl->buffer, index);
+
+		/* the list waits for the ring items that were reserved before it */
+		flushed = impl->pending != NULL && (int32_t) (index - impl->pending_index) >= 0;
+		if (flushed) {
+			for (item = impl->pending; item; item = next) {
+				next = item->next;
+				invoke_item(impl, item);
+				free(item);
+				__atomic_sub_fetch(&impl->n_overflow, 1, __ATOMIC_RELEASE);
+			}
+			impl->pending = NULL;
+		}
+	} while (index != start || flushed);
 }
 
 static int loop_get_fd(struct spa_loop_control *ctrl)
@@ -328,16 +476,82 @@ static void process_destroy(struct impl *impl)
 	spa_list_init(&impl->destroy_list);
 }
 
+static inline uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_TIME(&ts);
+}
+
+static bool have_stats_hook(struct impl *impl)
+{
+	struct spa_hook *h;
+
+	spa_list_for_each(h, &impl->hooks_list.list, link) {
+		const struct spa_loop_control_hooks *hooks = h->funcs;
+		if (hooks && hooks->version >= 1 && hooks->stats)
+			return true;
+	}
+	return false;
+}
+
+static inline int source_priority(struct epoll_event *ep)
+{
+	struct spa_source *s = ep->data.ptr;
+	return s->priority;
+}
+
+/* stable sort on priority, the array is small and mostly sorted so
+ * this is usually a single pass */
+static void sort_events(struct epoll_event *ep, int nfds)
+{
+	int i, j;
+
+	for (i = 1; i < nfds; i++) {
+		struct epoll_event tmp = ep[i];
+		int prio = source_priority(&tmp);
+
+		for (j = i; j > 0 && source_priority(&ep[j - 1]) < prio; j--)
+			ep[j] = ep[j - 1];
+		ep[j] = tmp;
+	}
+}
+
+/* the array was full, there might be more events pending. Make it
+ * bigger for the next iteration. */
+static void grow_events(struct impl *impl)
+{
+	struct epoll_event *ep;
+	int n_ep = impl->n_ep * 2;
+
+	if (n_ep > MAX_EVENTS)
+		return;
+
+	ep = realloc(impl->ep, n_ep * sizeof(struct epoll_event));
+	if (ep == NULL)
+		return;
+
+	spa_log_debug(impl->log, NAME " %p: event array size %d", impl, n_ep);
+	impl->ep = ep;
+	impl->n_ep = n_ep;
+}
+
 static int loop_iterate(struct spa_loop_control *ctrl, int timeout)
 {
 	struct impl *impl = SPA_CONTAINER_OF(ctrl, struct impl, control);
 	struct spa_loop *loop = &impl->loop;
-	struct epoll_event ep[32];
+	struct epoll_event *ep = impl->ep;
+	struct spa_loop_stats stats;
+	uint64_t t1 = 0, t2, t3;
 	int i, nfds, save_errno = 0;
+	bool do_stats;
+
+	if ((do_stats = have_stats_hook(impl)))
+		t1 = get_time();
 
 	spa_loop_control_hook_before(&impl->hooks_list);
 
-	if (SPA_UNLIKELY((nfds = epoll_wait(impl->epoll_fd, ep, SPA_N_ELEMENTS(ep), timeout)) < 0))
+	if (SPA_UNLIKELY((nfds = epoll_wait(impl->epoll_fd, ep, impl->n_ep, timeout)) < 0))
 		save_errno = errno;
 
 	spa_loop_control_hook_after(&impl->hooks_list);
@@ -352,13 +566,43 @@ static int loop_iterate(struct spa_loop_control *ctrl, int timeout)
 		struct spa_source *s = ep[i].data.ptr;
 		s->rmask = spa_epoll_to_io(ep[i].events);
 	}
-	for (i = 0; i < nfds; i++) {
-		struct spa_source *s = ep[i].data.ptr;
-		if (s->rmask && s->fd != -1 && s->loop == loop)
-			s->func(s);
+	/* realtime sources first, low priority sources last */
+	sort_events(ep, nfds);
+
+	if (SPA_UNLIKELY(do_stats)) {
+		spa_zero(stats);
+		t2 = t3 = get_time();
+		for (i = 0; i < nfds; i++) {
+			struct spa_source *s = ep[i].data.ptr;
+			uint64_t t;
+
+			if (s->rmask && s->fd != -1 && s->loop == loop)
+				s->func(s);
+
+			t = get_time();
+			if (t - t3 > stats.slowest_time) {
+				stats.slowest = s;
+				stats.slowest_time = t - t3;
+			}
+			t3 = t;
+		}
+		stats.n_events = nfds;
+		stats.max_events = impl->n_ep;
+		stats.wait_time = t2 - t1;
+		stats.dispatch_time = t3 - t2;
+		spa_loop_control_hook_stats(&impl->hooks_list, &stats);
+	} else {
+		for (i = 0; i < nfds; i++) {
+			struct spa_source *s = ep[i].data.ptr;
+			if (s->rmask && s->fd != -1 && s->loop == loop)
+				s->func(s);
+		}
 	}
 	process_destroy(impl);
 
+	if (SPA_UNLIKELY(nfds == impl->n_ep))
+		grow_events(impl);
+
 	return 0;
 }
 
@@ -426,6 +670,7 @@ static struct spa_source *loop_add_idle(struct spa_loop_utils *utils,
 	source->impl = impl;
 	source->close = true;
 	source->source.mask = SPA_IO_IN;
+	source->source.priority = SPA_SOURCE_PRIORITY_LOW;
 	source->func.idle = func;
 
 	spa_loop_add_source(&impl->loop, &source->source);
@@ -697,7 +942,19 @@ static int impl_clear(struct spa_handle *handle)
 
 	process_destroy(impl);
 
-	close(impl->ack_fd);
+	while (impl->overflow) {
+		struct invoke_item *item = impl->overflow;
+		impl->overflow = item->next;
+		free(item);
+	}
+	while (impl->pending) {
+		struct invoke_item *item = impl->pending;
+		impl->pending = item->next;
+		free(item);
+	}
+	pthread_cond_destroy(&impl->ack_cond);
+	pthread_mutex_destroy(&impl->ack_lock);
+	free(impl->ep);
 	close(impl->epoll_fd);
 
 	return 0;
@@ -740,14 +997,27 @@ impl_init(const struct spa_handle_factory *factory,
 	if (impl->epoll_fd == -1)
 		return errno;
 
+	impl->n_ep = MIN_EVENTS;
+	impl->ep = malloc(impl->n_ep * sizeof(struct epoll_event));
+	if (impl->ep == NULL) {
+		close(impl->epoll_fd);
+		return -ENOMEM;
+	}
+
 	spa_list_init(&impl->source_list);
 	spa_list_init(&impl->destroy_list);
 	spa_hook_list_init(&impl->hooks_list);
 
 	spa_ringbuffer_init(&impl->buffer);
+	/* any offset in the ring can hold the header of an item */
+	memset(impl->buffer_data, 0, sizeof(impl->buffer_data));
+	impl->overflow = NULL;
+	impl->n_overflow = 0;
+	impl->pending = NULL;
+	pthread_mutex_init(&impl->ack_lock, NULL);
+	pthread_cond_init(&impl->ack_cond, NULL);
 
 	impl->wakeup = spa_loop_utils_add_event(&impl->utils, wakeup_func, impl);
-	impl->ack_fd = eventfd(0, EFD_SEMAPHORE | EFD_CLOEXEC);
 
 	spa_log_debug(impl->log, NAME " %p: initialized", impl);
 
@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <sys/eventfd.h>
 
+#include <spa/utils/hash.h>
 #include <spa/support/type-map.h>
 #include <spa/support/plugin.h>
 
@@ -44,6 +45,11 @@ struct array {
 	void *data;
 };
 
+struct entry {
+	uint32_t hash;
+	uint32_t id;
+};
+
 struct impl {
 	struct spa_handle handle;
 	struct spa_type_map map;
@@ -52,6 +58,9 @@ struct impl {
 
 	struct array types;
 	struct array strings;
+
+	struct entry *index;	/**< open addressing index on the type hash */
+	uint32_t index_mask;	/**< size of the index - 1, a power of 2 */
 };
 
 static inline void * alloc_size(struct array *array, size_t size, size_t extend)
@@ -66,22 +75,82 @@ static inline void * alloc_size(struct array *array, size_t size, size_t extend)
 	return res;
 }
 
+static inline uint32_t n_types(struct impl *impl)
+{
+	return impl->types.size / sizeof(off_t);
+}
+
+static inline struct entry *find_entry(struct impl *impl, uint32_t hash, const char *type)
+{
+	uint32_t i;
+	struct entry *e;
+
+	for (i = hash & impl->index_mask;; i = (i + 1) & impl->index_mask) {
+		e = &impl->index[i];
+		if (e->id == SPA_ID_INVALID)
+			return e;
+		if (e->hash == hash) {
+			off_t o = ((off_t *)impl->types.data)[e->id];
+			if (strcmp(SPA_MEMBER(impl->strings.data, o, char), type) == 0)
+				return e;
+		}
+	}
+}
+
+/* keep the index at most half full */
+static int ensure_index(struct impl *impl)
+{
+	struct entry *old = impl->index, *e;
+	uint32_t i, j, old_size = old ? impl->index_mask + 1 : 0, size;
+
+	if (2 * (n_types(impl) + 1) <= old_size)
+		return 0;
+
+	size = old_size ? old_size * 2 : 256;
+	if ((impl->index = malloc(size * sizeof(struct entry))) == NULL) {
+		impl->index = old;
+		return -ENOMEM;
+	}
+	impl->index_mask = size - 1;
+
+	for (i = 0; i < size; i++)
+		impl->index[i].id = SPA_ID_INVALID;
+
+	for (i = 0; i < old_size; i++) {
+		if (old[i].id == SPA_ID_INVALID)
+			continue;
+		for (j = old[i].hash & impl->index_mask;; j = (j + 1) & impl->index_mask) {
+			e = &impl->index[j];
+			if (e->id == SPA_ID_INVALID) {
+				*e = old[i];
+				break;
+			}
+		}
+	}
+	free(old);
+	return 0;
+}
+
 static uint32_t
 impl_type_map_get_id(struct spa_type_map *map, const char *type)
 {
 	struct impl *impl = SPA_CONTAINER_OF(map, struct impl, map);
-	uint32_t i, len;
+	uint32_t i, len, hash;
 	void *p;
-	off_t o, *off;
+	off_t *off;
+	struct entry *e;
 
 	if (type == NULL)
 		return SPA_ID_INVALID;
 
-	for (i = 0; i < impl->types.size / sizeof(off_t); i++) {
-		o = ((off_t *)impl->types.data)[i];
-		if (strcmp(SPA_MEMBER(impl->strings.data, o, char), type) == 0)
-			return i;
-	}
+	if (ensure_index(impl) < 0)
+		return SPA_ID_INVALID;
+
+	hash = spa_hash_string(type);
+	e = find_entry(impl, hash, type);
+	if (e->id != SPA_ID_INVALID)
+		return e->id;
+
 	len = strlen(type);
 	p = alloc_size(&impl->strings, len+1, 1024);
 	memcpy(p, type, len + 1);
@@ -90,6 +159,9 @@ impl_type_map_get_id(struct spa_type_map *map, const char *type)
 	*off = SPA_PTRDIFF(p, impl->strings.data);
 	i = SPA_PTRDIFF(off, impl->types.data) / sizeof(off_t);
 
+	e->hash = hash;
+	e->id = i;
+
 	return i;
 
 }
@@ -99,7 +171,7 @@ impl_type_map_get_type(const struct spa_type_map *map, uint32_t id)
 {
 	struct impl *impl = SPA_CONTAINER_OF(map, struct impl, map);
 
-	if (id < impl->types.size / sizeof(off_t)) {
+	if (id < n_types(impl)) {
 		off_t o = ((off_t *)impl->types.data)[id];
 		return SPA_MEMBER(impl->strings.data, o, char);
 	}
@@ -110,7 +182,7 @@ static size_t
 impl_type_map_get_size(const struct spa_type_map *map)
 {
 	struct impl *impl = SPA_CONTAINER_OF(map, struct impl, map);
-	return impl->types.size / sizeof(off_t);
+	return n_types(impl);
 }
 
 static const struct spa_type_map impl_type_map = {
@@ -150,6 +222,8 @@ static int impl_clear(struct spa_handle *handle)
 		free(impl->types.data);
 	if (impl->strings.data)
 		free(impl->strings.data);
+	if (impl->index)
+		free(impl->index);
 
 	return 0;
 }
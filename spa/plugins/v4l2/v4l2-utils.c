@@ -95,6 +95,7 @@ static int spa_v4l2_open(struct impl *this)
 	port->source.fd = port->fd;
 	port->source.mask = SPA_IO_IN | SPA_IO_ERR;
 	port->source.rmask = 0;
+	port->source.priority = SPA_SOURCE_PRIORITY_RT;
 
 	port->opened = true;
 
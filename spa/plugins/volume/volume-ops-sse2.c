@@ -0,0 +1,247 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include <emmintrin.h>
+
+#include "volume-ops.h"
+
+/* the channels of the samples repeat every lcm(4, n_channels) samples. This
+ * period is made of whole vectors and whole frames, the volume of vector k
+ * of a period is volume[k] */
+struct period {
+	uint32_t n_vectors;
+	float n_frames;				/* frames in a period */
+	__m128 volume[VOLUME_MAX_CHANNELS];
+	__m128 step[VOLUME_MAX_CHANNELS];
+	__m128 frame[VOLUME_MAX_CHANNELS];	/* frame of each lane in the period */
+};
+
+static inline void init_period(struct period *p, const float *volume, const float *step,
+			       uint32_t n_channels)
+{
+	float v[4], st[4], f[4];
+	uint32_t k, l, n;
+
+	for (n = n_channels; n % 4; n += n_channels);
+
+	p->n_vectors = n / 4;
+	p->n_frames = n / n_channels;
+
+	for (k = 0, n = 0; k < p->n_vectors; k++) {
+		for (l = 0; l < 4; l++, n++) {
+			v[l] = volume[n % n_channels];
+			st[l] = step ? step[n % n_channels] : 0.0f;
+			f[l] = n / n_channels;
+		}
+		p->volume[k] = _mm_loadu_ps(v);
+		p->step[k] = _mm_loadu_ps(st);
+		p->frame[k] = _mm_loadu_ps(f);
+	}
+}
+
+static inline uint32_t next_vector(const struct period *p, uint32_t k)
+{
+	return k + 1 == p->n_vectors ? 0 : k + 1;
+}
+
+/* a new period starts when the next vector is the first one */
+static inline __m128 next_base(const struct period *p, uint32_t k, __m128 base)
+{
+	return k == 0 ? _mm_add_ps(base, _mm_set1_ps(p->n_frames)) : base;
+}
+
+/* the volume of vector k of the period that starts at frame base */
+static inline __m128 ramp_volume(const struct period *p, uint32_t k, __m128 base)
+{
+	return _mm_add_ps(p->volume[k], _mm_mul_ps(p->step[k], _mm_add_ps(base, p->frame[k])));
+}
+
+static inline __m128i scale_s16_sse2(__m128i in, __m128 v_lo, __m128 v_hi)
+{
+	/* sign extend to 32 bits, scale as float and pack with saturation */
+	__m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(in, in), 16));
+	__m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(in, in), 16));
+	return _mm_packs_epi32(_mm_cvttps_epi32(_mm_mul_ps(lo, v_lo)),
+			       _mm_cvttps_epi32(_mm_mul_ps(hi, v_hi)));
+}
+
+static inline __m128i scale_s32_sse2(__m128i in, __m128 v)
+{
+	const __m128d min = _mm_set1_pd(INT32_MIN), max = _mm_set1_pd(INT32_MAX);
+	__m128d lo = _mm_cvtepi32_pd(in);
+	__m128d hi = _mm_cvtepi32_pd(_mm_shuffle_epi32(in, _MM_SHUFFLE(3, 2, 3, 2)));
+
+	lo = _mm_mul_pd(lo, _mm_cvtps_pd(v));
+	hi = _mm_mul_pd(hi, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+	lo = _mm_min_pd(_mm_max_pd(lo, min), max);
+	hi = _mm_min_pd(_mm_max_pd(hi, min), max);
+
+	return _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo), _mm_cvttpd_epi32(hi));
+}
+
+static inline int32_t scale_s32(int32_t s, float v)
+{
+	double t = s * (double) v;
+	return (int32_t) SPA_CLAMP(t, (double) INT32_MIN, (double) INT32_MAX);
+}
+
+void
+volume_s16_sse2(void *dst, const void *src, const float *volume,
+		uint32_t n_channels, uint32_t n_frames)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	uint32_t n, k, k1, n_samples = n_frames * n_channels, unrolled = n_samples & ~7;
+	struct period p;
+	int32_t t;
+
+	init_period(&p, volume, NULL, n_channels);
+
+	for (n = 0, k = 0; n < unrolled; n += 8) {
+		__m128i in = _mm_loadu_si128((__m128i *)(s + n));
+		k1 = next_vector(&p, k);
+		_mm_storeu_si128((__m128i *)(d + n), scale_s16_sse2(in, p.volume[k], p.volume[k1]));
+		k = next_vector(&p, k1);
+	}
+	for (; n < n_samples; n++) {
+		t = s[n] * volume[n % n_channels];
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+void
+volume_s32_sse2(void *dst, const void *src, const float *volume,
+		uint32_t n_channels, uint32_t n_frames)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	uint32_t n, k, n_samples = n_frames * n_channels, unrolled = n_samples & ~3;
+	struct period p;
+
+	init_period(&p, volume, NULL, n_channels);
+
+	for (n = 0, k = 0; n < unrolled; n += 4) {
+		__m128i in = _mm_loadu_si128((__m128i *)(s + n));
+		_mm_storeu_si128((__m128i *)(d + n), scale_s32_sse2(in, p.volume[k]));
+		k = next_vector(&p, k);
+	}
+	for (; n < n_samples; n++)
+		d[n] = scale_s32(s[n], volume[n % n_channels]);
+}
+
+void
+volume_f32_sse2(void *dst, const void *src, const float *volume,
+		uint32_t n_channels, uint32_t n_frames)
+{
+	const float *s = src;
+	float *d = dst;
+	uint32_t n, k, n_samples = n_frames * n_channels, unrolled = n_samples & ~3;
+	struct period p;
+
+	init_period(&p, volume, NULL, n_channels);
+
+	for (n = 0, k = 0; n < unrolled; n += 4) {
+		_mm_storeu_ps(d + n, _mm_mul_ps(_mm_loadu_ps(s + n), p.volume[k]));
+		k = next_vector(&p, k);
+	}
+	for (; n < n_samples; n++)
+		d[n] = s[n] * volume[n % n_channels];
+}
+
+void
+ramp_s16_sse2(void *dst, const void *src, const float *volume, const float *step,
+	      uint32_t n_channels, uint32_t n_frames)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	uint32_t n, k, k1, n_samples = n_frames * n_channels, unrolled = n_samples & ~7;
+	__m128 base = _mm_setzero_ps(), base1;
+	struct period p;
+	int32_t t;
+
+	init_period(&p, volume, step, n_channels);
+
+	for (n = 0, k = 0; n < unrolled; n += 8) {
+		__m128i in = _mm_loadu_si128((__m128i *)(s + n));
+
+		k1 = next_vector(&p, k);
+		base1 = next_base(&p, k1, base);
+		_mm_storeu_si128((__m128i *)(d + n), scale_s16_sse2(in,
+					ramp_volume(&p, k, base),
+					ramp_volume(&p, k1, base1)));
+		k = next_vector(&p, k1);
+		base = next_base(&p, k, base1);
+	}
+	for (; n < n_samples; n++) {
+		uint32_t c = n % n_channels;
+		t = s[n] * (volume[c] + step[c] * (float) (n / n_channels));
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+void
+ramp_s32_sse2(void *dst, const void *src, const float *volume, const float *step,
+	      uint32_t n_channels, uint32_t n_frames)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	uint32_t n, k, n_samples = n_frames * n_channels, unrolled = n_samples & ~3;
+	__m128 base = _mm_setzero_ps();
+	struct period p;
+
+	init_period(&p, volume, step, n_channels);
+
+	for (n = 0, k = 0; n < unrolled; n += 4) {
+		__m128i in = _mm_loadu_si128((__m128i *)(s + n));
+
+		_mm_storeu_si128((__m128i *)(d + n), scale_s32_sse2(in,
+					ramp_volume(&p, k, base)));
+		k = next_vector(&p, k);
+		base = next_base(&p, k, base);
+	}
+	for (; n < n_samples; n++) {
+		uint32_t c = n % n_channels;
+		d[n] = scale_s32(s[n], volume[c] + step[c] * (float) (n / n_channels));
+	}
+}
+
+void
+ramp_f32_sse2(void *dst, const void *src, const float *volume, const float *step,
+	      uint32_t n_channels, uint32_t n_frames)
+{
+	const float *s = src;
+	float *d = dst;
+	uint32_t n, k, n_samples = n_frames * n_channels, unrolled = n_samples & ~3;
+	__m128 base = _mm_setzero_ps();
+	struct period p;
+
+	init_period(&p, volume, step, n_channels);
+
+	for (n = 0, k = 0; n < unrolled; n += 4) {
+		_mm_storeu_ps(d + n, _mm_mul_ps(_mm_loadu_ps(s + n),
+					ramp_volume(&p, k, base)));
+		k = next_vector(&p, k);
+		base = next_base(&p, k, base);
+	}
+	for (; n < n_samples; n++) {
+		uint32_t c = n % n_channels;
+		d[n] = s[n] * (volume[c] + step[c] * (float) (n / n_channels));
+	}
+}
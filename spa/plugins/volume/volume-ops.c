@@ -0,0 +1,302 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "volume-ops.h"
+
+/* s32 samples don't fit in the mantissa of a float, they are scaled
+ * in double precision */
+static inline int32_t scale_s32(int32_t s, float v)
+{
+	double t = s * (double) v;
+	return (int32_t) SPA_CLAMP(t, (double) INT32_MIN, (double) INT32_MAX);
+}
+
+/* The loops below go over the samples without looking at the channels, the
+ * volume of each sample comes from a table with the volumes of the channels
+ * repeated for a block of samples. A block starts in the table at the
+ * channel of its first sample. Frames with more channels than fit in the
+ * table use a loop over the channels. */
+#define BLOCK_SAMPLES	256
+#define TABLE_SIZE	(BLOCK_SAMPLES + VOLUME_MAX_CHANNELS)
+
+struct table {
+	float volume[TABLE_SIZE];
+	float step[TABLE_SIZE];
+	uint32_t frame[TABLE_SIZE];	/* frame of the sample in the table */
+};
+
+static inline bool init_table(struct table *t, const float *volume, const float *step,
+			      uint32_t n_channels, uint32_t n_samples)
+{
+	uint32_t i, c, f;
+
+	if (n_channels > VOLUME_MAX_CHANNELS || n_samples < BLOCK_SAMPLES)
+		return false;
+
+	for (i = 0, c = 0, f = 0; i < BLOCK_SAMPLES + n_channels; i++) {
+		t->volume[i] = volume[c];
+		t->step[i] = step ? step[c] : 0.0f;
+		t->frame[i] = f;
+		if (++c == n_channels) {
+			c = 0;
+			f++;
+		}
+	}
+	return true;
+}
+
+/* call \a func for the blocks of \a n_samples samples, with \a o the
+ * offset of the block in the table and \a f the frame of the table start */
+#define FOR_BLOCKS(n_samples,n_channels,func)					\
+do {										\
+	uint32_t n, l, o = 0, f = 0;						\
+	for (n = 0; n < n_samples; n += l) {					\
+		l = SPA_MIN(n_samples - n, BLOCK_SAMPLES);			\
+		func;								\
+		f += (o + l) / n_channels;					\
+		o = (o + l) % n_channels;					\
+	}									\
+} while (0)
+
+static inline void
+scale_s16(int16_t *d, const int16_t *s, const float *v, uint32_t n_samples)
+{
+	uint32_t i;
+	int32_t t;
+
+	for (i = 0; i < n_samples; i++) {
+		t = s[i] * v[i];
+		d[i] = SPA_MIN(SPA_MAX(t, INT16_MIN), INT16_MAX);
+	}
+}
+
+static inline void
+ramp_block_s16(int16_t *d, const int16_t *s, const float *v, const float *st,
+	       const uint32_t *fr, uint32_t f, uint32_t n_samples)
+{
+	uint32_t i;
+	int32_t t;
+
+	for (i = 0; i < n_samples; i++) {
+		t = s[i] * (v[i] + st[i] * (float) (f + fr[i]));
+		d[i] = SPA_MIN(SPA_MAX(t, INT16_MIN), INT16_MAX);
+	}
+}
+
+static void
+volume_s16(void *dst, const void *src, const float *volume,
+	   uint32_t n_channels, uint32_t n_frames)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	uint32_t i, c, n_samples = n_frames * n_channels;
+	int32_t t;
+	struct table tab;
+
+	if (init_table(&tab, volume, NULL, n_channels, n_samples)) {
+		FOR_BLOCKS(n_samples, n_channels,
+			   scale_s16(&d[n], &s[n], &tab.volume[o], l));
+		return;
+	}
+	for (i = 0; i < n_frames; i++) {
+		for (c = 0; c < n_channels; c++) {
+			t = *s++ * volume[c];
+			*d++ = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+		}
+	}
+}
+
+static inline void
+scale_s32_block(int32_t *d, const int32_t *s, const float *v, uint32_t n_samples)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_samples; i++)
+		d[i] = scale_s32(s[i], v[i]);
+}
+
+static void
+volume_s32(void *dst, const void *src, const float *volume,
+	   uint32_t n_channels, uint32_t n_frames)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	uint32_t i, c, n_samples = n_frames * n_channels;
+	struct table tab;
+
+	if (init_table(&tab, volume, NULL, n_channels, n_samples)) {
+		FOR_BLOCKS(n_samples, n_channels,
+			   scale_s32_block(&d[n], &s[n], &tab.volume[o], l));
+		return;
+	}
+	for (i = 0; i < n_frames; i++) {
+		for (c = 0; c < n_channels; c++)
+			*d++ = scale_s32(*s++, volume[c]);
+	}
+}
+
+static inline void
+scale_f32(float *d, const float *s, const float *v, uint32_t n_samples)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_samples; i++)
+		d[i] = s[i] * v[i];
+}
+
+static void
+volume_f32(void *dst, const void *src, const float *volume,
+	   uint32_t n_channels, uint32_t n_frames)
+{
+	const float *s = src;
+	float *d = dst;
+	uint32_t i, c, n_samples = n_frames * n_channels;
+	struct table tab;
+
+	if (init_table(&tab, volume, NULL, n_channels, n_samples)) {
+		FOR_BLOCKS(n_samples, n_channels,
+			   scale_f32(&d[n], &s[n], &tab.volume[o], l));
+		return;
+	}
+	for (i = 0; i < n_frames; i++) {
+		for (c = 0; c < n_channels; c++)
+			*d++ = *s++ * volume[c];
+	}
+}
+
+static void
+ramp_s16(void *dst, const void *src, const float *volume, const float *step,
+	 uint32_t n_channels, uint32_t n_frames)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	uint32_t i, c, n_samples = n_frames * n_channels;
+	int32_t t;
+	struct table tab;
+
+	if (init_table(&tab, volume, step, n_channels, n_samples)) {
+		FOR_BLOCKS(n_samples, n_channels,
+			   ramp_block_s16(&d[n], &s[n], &tab.volume[o], &tab.step[o],
+					  &tab.frame[o], f, l));
+		return;
+	}
+	for (i = 0; i < n_frames; i++) {
+		for (c = 0; c < n_channels; c++) {
+			t = *s++ * (volume[c] + step[c] * (float) i);
+			*d++ = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+		}
+	}
+}
+
+static inline void
+ramp_block_s32(int32_t *d, const int32_t *s, const float *v, const float *st,
+	       const uint32_t *fr, uint32_t f, uint32_t n_samples)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_samples; i++)
+		d[i] = scale_s32(s[i], v[i] + st[i] * (float) (f + fr[i]));
+}
+
+static void
+ramp_s32(void *dst, const void *src, const float *volume, const float *step,
+	 uint32_t n_channels, uint32_t n_frames)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	uint32_t i, c, n_samples = n_frames * n_channels;
+	struct table tab;
+
+	if (init_table(&tab, volume, step, n_channels, n_samples)) {
+		FOR_BLOCKS(n_samples, n_channels,
+			   ramp_block_s32(&d[n], &s[n], &tab.volume[o], &tab.step[o],
+					  &tab.frame[o], f, l));
+		return;
+	}
+	for (i = 0; i < n_frames; i++) {
+		for (c = 0; c < n_channels; c++)
+			*d++ = scale_s32(*s++, volume[c] + step[c] * (float) i);
+	}
+}
+
+static inline void
+ramp_block_f32(float *d, const float *s, const float *v, const float *st,
+	       const uint32_t *fr, uint32_t f, uint32_t n_samples)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_samples; i++)
+		d[i] = s[i] * (v[i] + st[i] * (float) (f + fr[i]));
+}
+
+static void
+ramp_f32(void *dst, const void *src, const float *volume, const float *step,
+	 uint32_t n_channels, uint32_t n_frames)
+{
+	const float *s = src;
+	float *d = dst;
+	uint32_t i, c, n_samples = n_frames * n_channels;
+	struct table tab;
+
+	if (init_table(&tab, volume, step, n_channels, n_samples)) {
+		FOR_BLOCKS(n_samples, n_channels,
+			   ramp_block_f32(&d[n], &s[n], &tab.volume[o], &tab.step[o],
+					  &tab.frame[o], f, l));
+		return;
+	}
+	for (i = 0; i < n_frames; i++) {
+		for (c = 0; c < n_channels; c++)
+			*d++ = *s++ * (volume[c] + step[c] * (float) i);
+	}
+}
+
+uint32_t spa_volume_get_cpu_flags(void)
+{
+	uint32_t flags = 0;
+#if defined (__i386__) || defined (__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		flags |= VOLUME_CPU_FLAG_SSE2;
+#endif
+	return flags;
+}
+
+void spa_volume_get_ops(struct spa_volume_ops *ops, uint32_t cpu_flags, uint32_t n_channels)
+{
+	ops->volume[FMT_S16] = volume_s16;
+	ops->volume[FMT_S32] = volume_s32;
+	ops->volume[FMT_F32] = volume_f32;
+	ops->ramp[FMT_S16] = ramp_s16;
+	ops->ramp[FMT_S32] = ramp_s32;
+	ops->ramp[FMT_F32] = ramp_f32;
+
+	if (n_channels == 0 || n_channels > VOLUME_MAX_CHANNELS)
+		return;
+
+#if defined (HAVE_SSE2)
+	if (cpu_flags & VOLUME_CPU_FLAG_SSE2) {
+		ops->volume[FMT_S16] = volume_s16_sse2;
+		ops->volume[FMT_S32] = volume_s32_sse2;
+		ops->volume[FMT_F32] = volume_f32_sse2;
+		ops->ramp[FMT_S16] = ramp_s16_sse2;
+		ops->ramp[FMT_S32] = ramp_s32_sse2;
+		ops->ramp[FMT_F32] = ramp_f32_sse2;
+	}
+#endif
+}
@@ -0,0 +1,77 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <spa/utils/defs.h>
+
+/** multiply \a n_frames frames of \a n_channels interleaved channels from \a src
+ * with the \a volume of their channel and write them to \a dst. Integer samples
+ * are clamped. \a dst can be the same as \a src. */
+typedef void (*volume_func_t) (void *dst, const void *src, const float *volume,
+			       uint32_t n_channels, uint32_t n_frames);
+
+/** like volume_func_t but the volume of channel c at frame i is
+ * volume[c] + step[c] * i */
+typedef void (*volume_ramp_func_t) (void *dst, const void *src, const float *volume,
+				    const float *step, uint32_t n_channels, uint32_t n_frames);
+
+enum {
+	FMT_S16,
+	FMT_S32,
+	FMT_F32,
+	FMT_MAX,
+};
+
+struct spa_volume_ops {
+	volume_func_t volume[FMT_MAX];
+	volume_ramp_func_t ramp[FMT_MAX];
+};
+
+#define VOLUME_CPU_FLAG_SSE2	(1 << 0)
+
+/** the SIMD implementations handle up to this many channels */
+#define VOLUME_MAX_CHANNELS	64
+
+/** get the SIMD features of the running CPU that we have optimized ops for */
+uint32_t spa_volume_get_cpu_flags(void);
+
+/** fill \a ops with the best implementations available for \a cpu_flags and
+ * frames of \a n_channels. The SIMD implementations work on vectors with a
+ * pattern of channels that repeats every lcm(4, n_channels) samples and are
+ * used for up to VOLUME_MAX_CHANNELS channels. Passing 0 for \a cpu_flags
+ * selects the plain C reference functions. */
+void spa_volume_get_ops(struct spa_volume_ops *ops, uint32_t cpu_flags, uint32_t n_channels);
+
+#if defined (HAVE_SSE2)
+void volume_s16_sse2(void *dst, const void *src, const float *volume,
+		     uint32_t n_channels, uint32_t n_frames);
+void volume_s32_sse2(void *dst, const void *src, const float *volume,
+		     uint32_t n_channels, uint32_t n_frames);
+void volume_f32_sse2(void *dst, const void *src, const float *volume,
+		     uint32_t n_channels, uint32_t n_frames);
+void ramp_s16_sse2(void *dst, const void *src, const float *volume, const float *step,
+		   uint32_t n_channels, uint32_t n_frames);
+void ramp_s32_sse2(void *dst, const void *src, const float *volume, const float *step,
+		   uint32_t n_channels, uint32_t n_frames);
+void ramp_f32_sse2(void *dst, const void *src, const float *volume, const float *step,
+		   uint32_t n_channels, uint32_t n_frames);
+#endif
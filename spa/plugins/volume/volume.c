@@ -32,20 +32,30 @@
 #include <spa/param/io.h>
 #include <spa/pod/filter.h>
 
+#include "volume-ops.h"
+
 #define NAME "volume"
 
+#define MAX_CHANNELS	64
+
 #define DEFAULT_VOLUME 1.0
 #define DEFAULT_MUTE false
 
+/* volume changes are ramped over this time */
+#define RAMP_MSEC	10
+
 struct props {
 	double volume;
 	bool mute;
+	uint32_t n_channel_volumes;
+	float channel_volumes[MAX_CHANNELS];
 };
 
 static void reset_props(struct props *props)
 {
 	props->volume = DEFAULT_VOLUME;
 	props->mute = DEFAULT_MUTE;
+	props->n_channel_volumes = 0;
 }
 
 #define MAX_BUFFERS     16
@@ -78,6 +88,7 @@ struct type {
 	uint32_t props;
 	uint32_t prop_volume;
 	uint32_t prop_mute;
+	uint32_t prop_channel_volumes;
 	struct spa_type_io io;
 	struct spa_type_param param;
 	struct spa_type_meta meta;
@@ -100,6 +111,7 @@ static inline void init_type(struct type *type, struct spa_type_map *map)
 	type->props = spa_type_map_get_id(map, SPA_TYPE__Props);
 	type->prop_volume = spa_type_map_get_id(map, SPA_TYPE_PROPS__volume);
 	type->prop_mute = spa_type_map_get_id(map, SPA_TYPE_PROPS__mute);
+	type->prop_channel_volumes = spa_type_map_get_id(map, SPA_TYPE_PROPS__channelVolumes);
 	spa_type_io_map(map, &type->io);
 	spa_type_param_map(map, &type->param);
 	spa_type_meta_map(map, &type->meta);
@@ -124,15 +136,32 @@ struct impl {
 	struct spa_log *log;
 
 	struct props props;
+	bool props_changed;
 
 	const struct spa_node_callbacks *callbacks;
 	void *callbacks_data;
 
+	uint32_t cpu_flags;
+
 	struct spa_audio_info current_format;
 	int bpf;
+	uint32_t n_channels;
+	bool planar;
+
+	volume_func_t volume;
+	volume_ramp_func_t ramp;
+
+	float target[MAX_CHANNELS];
+	float ramp_start[MAX_CHANNELS];
+	float ramp_step[MAX_CHANNELS];
+	uint32_t ramp_pos;
+	uint32_t ramp_len;
+	uint32_t ramp_frames;
 
 	struct port in_ports[1];
 	struct port out_ports[1];
+	/* the output port uses the buffers of the input port */
+	bool in_place;
 
 	bool started;
 };
@@ -195,6 +224,14 @@ static int impl_node_enum_params(struct spa_node *node,
 				":", t->param.propName, "s", "Mute",
 				":", t->param.propType, "b", p->mute);
 			break;
+		case 2:
+			param = spa_pod_builder_object(&b,
+				id, t->param.PropInfo,
+				":", t->param.propId,   "I", t->prop_channel_volumes,
+				":", t->param.propName, "s", "The volume of each channel",
+				":", t->param.propType, "a", sizeof(float), SPA_POD_TYPE_FLOAT,
+					p->n_channel_volumes, p->channel_volumes);
+			break;
 		default:
 			return 0;
 		}
@@ -205,7 +242,9 @@ static int impl_node_enum_params(struct spa_node *node,
 			param = spa_pod_builder_object(&b,
 				id, t->props,
 				":", t->prop_volume, "d", p->volume,
-				":", t->prop_mute,   "b", p->mute);
+				":", t->prop_mute,   "b", p->mute,
+				":", t->prop_channel_volumes, "a", sizeof(float), SPA_POD_TYPE_FLOAT,
+					p->n_channel_volumes, p->channel_volumes);
 			break;
 		default:
 			return 0;
@@ -222,6 +261,25 @@ static int impl_node_enum_params(struct spa_node *node,
 	return 1;
 }
 
+static void set_channel_volumes(struct props *p, const struct spa_pod *pod)
+{
+	const struct spa_pod_array *array = (const struct spa_pod_array *) pod;
+	float *v;
+	uint32_t n = 0;
+
+	if (SPA_POD_TYPE(pod) != SPA_POD_TYPE_ARRAY ||
+	    array->body.child.type != SPA_POD_TYPE_FLOAT ||
+	    array->body.child.size != sizeof(float))
+		return;
+
+	SPA_POD_ARRAY_BODY_FOREACH(&array->body, SPA_POD_BODY_SIZE(pod), v) {
+		if (n == MAX_CHANNELS)
+			break;
+		p->channel_volumes[n++] = SPA_CLAMP(*v, 0.0f, 10.0f);
+	}
+	p->n_channel_volumes = n;
+}
+
 static int impl_node_set_param(struct spa_node *node, uint32_t id, uint32_t flags,
 			       const struct spa_pod *param)
 {
@@ -235,14 +293,22 @@ static int impl_node_set_param(struct spa_node *node, uint32_t id, uint32_t flag
 
 	if (id == t->param.idProps) {
 		struct props *p = &this->props;
+		struct spa_pod *channel_volumes = NULL;
 
 		if (param == NULL) {
 			reset_props(p);
+			this->props_changed = true;
 			return 0;
 		}
 		spa_pod_object_parse(param,
 			":", t->prop_volume, "?d", &p->volume,
-			":", t->prop_mute,   "?b", &p->mute, NULL);
+			":", t->prop_mute,   "?b", &p->mute,
+			":", t->prop_channel_volumes, "?P", &channel_volumes, NULL);
+
+		if (channel_volumes)
+			set_channel_volumes(p, channel_volumes);
+
+		this->props_changed = true;
 	}
 	else
 		return -ENOENT;
@@ -375,12 +441,16 @@ static int port_enum_formats(struct spa_node *node,
 			"I", t->media_type.audio,
 			"I", t->media_subtype.raw,
 			":", t->format_audio.format,  "Ieu", t->audio_format.S16,
-				SPA_POD_PROP_ENUM(2, t->audio_format.S16,
-						     t->audio_format.S32),
+				SPA_POD_PROP_ENUM(3, t->audio_format.S16,
+						     t->audio_format.S32,
+						     t->audio_format.F32),
+			":", t->format_audio.layout,  "ieu", SPA_AUDIO_LAYOUT_INTERLEAVED,
+				SPA_POD_PROP_ENUM(2, SPA_AUDIO_LAYOUT_INTERLEAVED,
+						     SPA_AUDIO_LAYOUT_NON_INTERLEAVED),
 			":", t->format_audio.rate,    "iru", 44100,
 				SPA_POD_PROP_MIN_MAX(1, INT32_MAX),
 			":", t->format_audio.channels,"iru", 2,
-				SPA_POD_PROP_MIN_MAX(1, INT32_MAX));
+				SPA_POD_PROP_MIN_MAX(1, MAX_CHANNELS));
 		break;
 	default:
 		return 0;
@@ -411,6 +481,7 @@ static int port_get_format(struct spa_node *node,
 	                "I", t->media_type.audio,
 			"I", t->media_subtype.raw,
 			":", t->format_audio.format,   "I", this->current_format.info.raw.format,
+			":", t->format_audio.layout,   "i", this->current_format.info.raw.layout,
 			":", t->format_audio.rate,     "i", this->current_format.info.raw.rate,
 			":", t->format_audio.channels, "i", this->current_format.info.raw.channels);
 
@@ -538,6 +609,93 @@ static int clear_buffers(struct impl *this, struct port *port)
 		port->n_buffers = 0;
 		spa_list_init(&port->empty);
 	}
+	/* the output buffers are gone with the input buffers */
+	if (this->in_place) {
+		this->in_place = false;
+		clear_buffers(this, GET_OUT_PORT(this, 0));
+	}
+	return 0;
+}
+
+static void check_in_place(struct impl *this)
+{
+	struct port *in_port = GET_IN_PORT(this, 0), *out_port = GET_OUT_PORT(this, 0);
+	uint32_t i;
+
+	this->in_place = in_port->n_buffers > 0 && in_port->n_buffers == out_port->n_buffers;
+	for (i = 0; this->in_place && i < in_port->n_buffers; i++)
+		this->in_place = in_port->buffers[i].outbuf == out_port->buffers[i].outbuf;
+
+	spa_log_debug(this->log, NAME " %p: in place %d", this, this->in_place);
+}
+
+/* the volume of channel \a c at the current position of the ramp */
+static inline float get_volume(struct impl *this, uint32_t c)
+{
+	if (this->ramp_pos < this->ramp_len)
+		return this->ramp_start[c] + this->ramp_step[c] * this->ramp_pos;
+	return this->target[c];
+}
+
+/* set the target volumes from the props, with a ramp from the current
+ * volumes when \a ramp is true */
+static void update_volume(struct impl *this, bool ramp)
+{
+	struct props *p = &this->props;
+	uint32_t c;
+	float current, target;
+	bool ramping = false;
+
+	for (c = 0; c < this->n_channels; c++) {
+		current = get_volume(this, c);
+
+		target = p->mute ? 0.0f : p->volume;
+		if (c < p->n_channel_volumes)
+			target *= p->channel_volumes[c];
+
+		this->target[c] = target;
+		this->ramp_start[c] = current;
+		this->ramp_step[c] = (target - current) / this->ramp_frames;
+		ramping |= target != current;
+	}
+	this->ramp_pos = 0;
+	this->ramp_len = ramp && ramping ? this->ramp_frames : 0;
+}
+
+static int setup_volume(struct impl *this, struct spa_audio_info_raw *info)
+{
+	struct type *t = &this->type;
+	struct spa_volume_ops ops;
+	int fmt, sample_size;
+
+	if (info->format == t->audio_format.S16) {
+		fmt = FMT_S16;
+		sample_size = sizeof(int16_t);
+	} else if (info->format == t->audio_format.S32) {
+		fmt = FMT_S32;
+		sample_size = sizeof(int32_t);
+	} else if (info->format == t->audio_format.F32) {
+		fmt = FMT_F32;
+		sample_size = sizeof(float);
+	} else
+		return -EINVAL;
+
+	if (info->channels == 0 || info->channels > MAX_CHANNELS || info->rate == 0)
+		return -EINVAL;
+
+	this->n_channels = info->channels;
+	this->planar = info->layout == SPA_AUDIO_LAYOUT_NON_INTERLEAVED;
+	this->bpf = sample_size * (this->planar ? 1 : this->n_channels);
+
+	/* each plane has one channel */
+	spa_volume_get_ops(&ops, this->cpu_flags, this->planar ? 1 : this->n_channels);
+	this->volume = ops.volume[fmt];
+	this->ramp = ops.ramp[fmt];
+
+	this->ramp_frames = SPA_MAX(info->rate * RAMP_MSEC / 1000, 1u);
+	this->props_changed = false;
+	update_volume(this, false);
+
 	return 0;
 }
 
@@ -568,7 +726,9 @@ static int port_set_format(struct spa_node *node,
 		if (spa_format_audio_raw_parse(format, &info.info.raw, &this->type.format_audio) < 0)
 			return -EINVAL;
 
-		this->bpf = 2 * info.info.raw.channels;
+		if (setup_volume(this, &info.info.raw) < 0)
+			return -EINVAL;
+
 		this->current_format = info;
 		port->have_format = true;
 	}
@@ -647,6 +807,8 @@ impl_node_port_use_buffers(struct spa_node *node,
 	}
 	port->n_buffers = n_buffers;
 
+	check_in_place(this);
+
 	return 0;
 }
 
@@ -724,6 +886,13 @@ static int impl_node_port_reuse_buffer(struct spa_node *node, uint32_t port_id,
 	if (buffer_id >= port->n_buffers)
 		return -EINVAL;
 
+	/* the buffer belongs to the input */
+	if (this->in_place) {
+		if (this->callbacks && this->callbacks->reuse_buffer)
+			this->callbacks->reuse_buffer(this->callbacks_data, 0, buffer_id);
+		return 0;
+	}
+
 	recycle_buffer(this, buffer_id);
 
 	return 0;
@@ -752,50 +921,95 @@ static struct spa_buffer *find_free_buffer(struct impl *this, struct port *port)
 	return b->outbuf;
 }
 
+/* the first \a n_ramp frames of the buffer are on the ramp, \a start has the
+ * volumes at the first frame of the buffer */
+static void
+apply_volume(struct impl *this, void *dst, const void *src, uint32_t channel,
+	     uint32_t n_channels, uint32_t frame, uint32_t n_frames,
+	     uint32_t n_ramp, const float *start)
+{
+	float volume[MAX_CHANNELS];
+	uint32_t c, n;
+
+	if (frame < n_ramp) {
+		n = SPA_MIN(n_frames, n_ramp - frame);
+		for (c = 0; c < n_channels; c++)
+			volume[c] = start[channel + c] + this->ramp_step[channel + c] * frame;
+
+		this->ramp(dst, src, volume, &this->ramp_step[channel], n_channels, n);
+
+		dst = SPA_MEMBER(dst, n * this->bpf, void);
+		src = SPA_MEMBER(src, n * this->bpf, void);
+		n_frames -= n;
+	}
+	if (n_frames > 0)
+		this->volume(dst, src, &this->target[channel], n_channels, n_frames);
+}
+
 static void do_volume(struct impl *this, struct spa_buffer *dbuf, struct spa_buffer *sbuf)
 {
-	uint32_t i, n_samples, n_bytes;
 	struct spa_data *sd, *dd;
-	int16_t *src, *dst;
-	double volume;
-	uint32_t written, towrite, savail, davail;
-	uint32_t sindex, dindex;
-
-	volume = this->props.volume;
+	uint32_t i, n_planes, n_channels, n_frames, n_ramp, frame, n;
+	uint32_t savail, davail, sindex, soffset, dindex;
+	float start[MAX_CHANNELS];
+	bool in_place = dbuf == sbuf;
+
+	if (this->props_changed) {
+		this->props_changed = false;
+		update_volume(this, true);
+	}
 
-	sd = sbuf->datas;
-	dd = dbuf->datas;
+	/* planar audio has one channel in each data */
+	n_planes = this->planar ? this->n_channels : 1;
+	n_planes = SPA_MIN(n_planes, SPA_MIN(sbuf->n_datas, dbuf->n_datas));
+	n_channels = this->planar ? 1 : this->n_channels;
+
+	n_frames = UINT32_MAX;
+	for (i = 0; i < n_planes; i++) {
+		sd = &sbuf->datas[i];
+		dd = &dbuf->datas[i];
+		savail = SPA_MIN(sd->chunk->size, sd->maxsize);
+		davail = dd->maxsize;
+		n_frames = SPA_MIN(n_frames, SPA_MIN(savail, davail) / this->bpf);
+	}
+	if (n_planes == 0)
+		return;
 
-	savail = SPA_MIN(sd[0].chunk->size, sd[0].maxsize);
-	sindex = sd[0].chunk->offset;
-	davail = 0;
-	dindex = 0;
-	davail = dd[0].maxsize - davail;
+	n_ramp = this->ramp_len - this->ramp_pos;
+	n_ramp = SPA_MIN(n_ramp, n_frames);
+	for (i = 0; i < this->n_channels; i++)
+		start[i] = get_volume(this, i);
 
-	towrite = SPA_MIN(savail, davail);
-	written = 0;
+	for (i = 0; i < n_planes; i++) {
+		sd = &sbuf->datas[i];
+		dd = &dbuf->datas[i];
 
-	while (written < towrite) {
-		uint32_t soffset = sindex % sd[0].maxsize;
-		uint32_t doffset = dindex % dd[0].maxsize;
+		sindex = sd->chunk->offset;
+		dindex = 0;
 
-		src = SPA_MEMBER(sd[0].data, soffset, int16_t);
-		dst = SPA_MEMBER(dd[0].data, doffset, int16_t);
+		for (frame = 0; frame < n_frames; frame += n) {
+			soffset = sindex % sd->maxsize;
 
-		n_bytes = SPA_MIN(towrite, sd[0].maxsize - soffset);
-		n_bytes = SPA_MIN(n_bytes, dd[0].maxsize - doffset);
+			/* the source can wrap around */
+			n = SPA_MIN(n_frames - frame, (sd->maxsize - soffset) / this->bpf);
+			if (n == 0)
+				break;
 
-		n_samples = n_bytes / sizeof(int16_t);
-		for (i = 0; i < n_samples; i++)
-			dst[i] = src[i] * volume;
+			/* in place, the samples are written where they are */
+			apply_volume(this, SPA_MEMBER(dd->data, in_place ? soffset : dindex, void),
+				     SPA_MEMBER(sd->data, soffset, void),
+				     i * n_channels, n_channels, frame, n, n_ramp, start);
 
-		sindex += n_bytes;
-		dindex += n_bytes;
-		written += n_bytes;
+			sindex += n * this->bpf;
+			dindex += n * this->bpf;
+		}
+		dd->chunk->size = dindex;
+		if (!in_place) {
+			dd->chunk->offset = 0;
+			dd->chunk->stride = 0;
+		}
 	}
-	dd[0].chunk->offset = 0;
-	dd[0].chunk->size = written;
-	dd[0].chunk->stride = 0;
+	this->ramp_pos += n_ramp;
 }
 
 static int impl_node_process_input(struct spa_node *node)
@@ -825,19 +1039,27 @@ static int impl_node_process_input(struct spa_node *node)
 		return -EINVAL;
 	}
 
-	if ((dbuf = find_free_buffer(this, out_port)) == NULL) {
+	sbuf = in_port->buffers[input->buffer_id].outbuf;
+
+	if (this->in_place)
+		dbuf = sbuf;
+	else if ((dbuf = find_free_buffer(this, out_port)) == NULL) {
                 spa_log_error(this->log, NAME " %p: out of buffers", this);
 		return -EPIPE;
 	}
 
-	sbuf = in_port->buffers[input->buffer_id].outbuf;
-
 	input->status = SPA_STATUS_OK;
 
 	spa_log_trace(this->log, NAME " %p: do volume %d -> %d", this, sbuf->id, dbuf->id);
 	do_volume(this, dbuf, sbuf);
 
-	output->buffer_id = dbuf->id;
+	if (this->in_place) {
+		/* we pass the input buffer on, it goes back upstream when it
+		 * is reused */
+		output->buffer_id = input->buffer_id;
+		input->buffer_id = SPA_ID_INVALID;
+	} else
+		output->buffer_id = dbuf->id;
 	output->status = SPA_STATUS_HAVE_BUFFER;
 
 	return SPA_STATUS_HAVE_BUFFER;
@@ -860,16 +1082,19 @@ static int impl_node_process_output(struct spa_node *node)
 	if (output->status == SPA_STATUS_HAVE_BUFFER)
 		return SPA_STATUS_HAVE_BUFFER;
 
-	/* recycle */
-	if (output->buffer_id < out_port->n_buffers) {
-		recycle_buffer(this, output->buffer_id);
-		output->buffer_id = SPA_ID_INVALID;
-	}
-
 	in_port = GET_IN_PORT(this, 0);
 	input = in_port->io;
 	spa_return_val_if_fail(input != NULL, -EIO);
 
+	/* recycle, in place the buffer is given back to the input */
+	if (output->buffer_id < out_port->n_buffers) {
+		if (this->in_place)
+			input->buffer_id = output->buffer_id;
+		else
+			recycle_buffer(this, output->buffer_id);
+		output->buffer_id = SPA_ID_INVALID;
+	}
+
 	if (in_port->range && out_port->range)
 		*in_port->range = *out_port->range;
 	input->status = SPA_STATUS_NEED_BUFFER;
@@ -955,11 +1180,15 @@ impl_init(const struct spa_handle_factory *factory,
 	this->node = impl_node;
 	reset_props(&this->props);
 
+	this->cpu_flags = spa_volume_get_cpu_flags();
+	spa_log_debug(this->log, NAME " %p: using cpu flags %08x", this, this->cpu_flags);
+
 	this->in_ports[0].info.flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS |
 	    SPA_PORT_INFO_FLAG_IN_PLACE;
 	spa_list_init(&this->in_ports[0].empty);
 
 	this->out_ports[0].info.flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS |
+	    SPA_PORT_INFO_FLAG_IN_PLACE |
 	    SPA_PORT_INFO_FLAG_NO_REF;
 	spa_list_init(&this->out_ports[0].empty);
 
@@ -0,0 +1,217 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Many threads invoke on one loop at the same time, with a slow loop so
+ * that the queue fills up. Every invoke must arrive, in the order it was
+ * made by each thread. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
+
+#include <spa/support/plugin.h>
+#include <spa/support/loop.h>
+#include <spa/support/type-map-impl.h>
+
+#define N_THREADS	8
+#define N_INVOKES	20000
+#define MAX_PAYLOAD	1024
+
+static SPA_TYPE_MAP_IMPL(type_map, 4096);
+
+struct payload {
+	uint32_t thread;
+	uint32_t seq;
+	uint8_t data[MAX_PAYLOAD];
+};
+
+struct data {
+	struct spa_loop *loop;
+	struct spa_loop_control *control;
+	pthread_t thread;
+	bool running;
+
+	uint32_t next_seq[N_THREADS];
+	uint32_t n_received;
+	uint32_t n_errors;
+	uint32_t n_failed;
+};
+
+struct producer {
+	struct data *data;
+	uint32_t id;
+	pthread_t thread;
+};
+
+static int do_receive(struct spa_loop *loop, bool async, uint32_t seq,
+		      const void *data, size_t size, void *user_data)
+{
+	struct data *d = user_data;
+	const struct payload *p = data;
+
+	if (p->thread >= N_THREADS || p->seq != d->next_seq[p->thread] ||
+	    size != offsetof(struct payload, data) + (p->seq % MAX_PAYLOAD))
+		d->n_errors++;
+	else
+		d->next_seq[p->thread]++;
+
+	d->n_received++;
+
+	/* be slow now and then so that the queue fills up */
+	if ((d->n_received & 1023) == 0)
+		usleep(1000);
+
+	return p->seq;
+}
+
+static int do_stop(struct spa_loop *loop, bool async, uint32_t seq,
+		   const void *data, size_t size, void *user_data)
+{
+	struct data *d = user_data;
+	d->running = false;
+	return 0;
+}
+
+static void *loop_thread(void *user_data)
+{
+	struct data *d = user_data;
+
+	spa_loop_control_enter(d->control);
+	while (d->running)
+		spa_loop_control_iterate(d->control, -1);
+	spa_loop_control_leave(d->control);
+
+	return NULL;
+}
+
+static void *producer_thread(void *user_data)
+{
+	struct producer *p = user_data;
+	struct data *d = p->data;
+	struct payload payload;
+	uint32_t i;
+	int res;
+
+	payload.thread = p->id;
+	memset(payload.data, p->id, sizeof(payload.data));
+
+	for (i = 0; i < N_INVOKES; i++) {
+		bool block = (i % 1000) == 999;
+
+		payload.seq = i;
+		res = spa_loop_invoke(d->loop, do_receive, i, &payload,
+				offsetof(struct payload, data) + (i % MAX_PAYLOAD),
+				block, d);
+
+		if ((block && res != (int) i) || (!block && res < 0))
+			__atomic_add_fetch(&d->n_failed, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static int make_loop(const char *lib, struct spa_handle **handle, struct data *d)
+{
+	const struct spa_handle_factory *factory = NULL;
+	spa_handle_factory_enum_func_t enum_func;
+	struct spa_support support[1];
+	uint32_t i;
+	void *hnd, *iface;
+	int res;
+
+	if ((hnd = dlopen(lib, RTLD_NOW)) == NULL) {
+		printf("can't load %s: %s\n", lib, dlerror());
+		return -ENOENT;
+	}
+	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
+		printf("can't find enum function\n");
+		return -ENOENT;
+	}
+	for (i = 0; enum_func(&factory, &i) > 0;) {
+		if (strcmp(factory->name, "loop") == 0)
+			break;
+		factory = NULL;
+	}
+	if (factory == NULL) {
+		printf("can't find loop factory\n");
+		return -ENOENT;
+	}
+
+	support[0].type = SPA_TYPE__TypeMap;
+	support[0].data = &type_map.map;
+
+	*handle = calloc(1, factory->size);
+	if ((res = spa_handle_factory_init(factory, *handle, NULL, support, 1)) < 0) {
+		printf("can't make factory instance: %d\n", res);
+		return res;
+	}
+
+	if ((res = spa_handle_get_interface(*handle,
+			spa_type_map_get_id(&type_map.map, SPA_TYPE__Loop), &iface)) < 0)
+		return res;
+	d->loop = iface;
+
+	if ((res = spa_handle_get_interface(*handle,
+			spa_type_map_get_id(&type_map.map, SPA_TYPE__LoopControl), &iface)) < 0)
+		return res;
+	d->control = iface;
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *lib = argc > 1 ? argv[1] : "build/spa/plugins/support/libspa-support.so";
+	struct data data = { 0, };
+	struct producer producers[N_THREADS];
+	struct spa_handle *handle = NULL;
+	uint32_t i;
+	int res;
+
+	if ((res = make_loop(lib, &handle, &data)) < 0)
+		return 1;
+
+	data.running = true;
+	pthread_create(&data.thread, NULL, loop_thread, &data);
+
+	for (i = 0; i < N_THREADS; i++) {
+		producers[i].data = &data;
+		producers[i].id = i;
+		pthread_create(&producers[i].thread, NULL, producer_thread, &producers[i]);
+	}
+	for (i = 0; i < N_THREADS; i++)
+		pthread_join(producers[i].thread, NULL);
+
+	spa_loop_invoke(data.loop, do_stop, 0, NULL, 0, true, &data);
+	pthread_join(data.thread, NULL);
+
+	printf("%u threads: %u invokes, %u received, %u out of order, %u failed\n",
+			N_THREADS, N_THREADS * N_INVOKES, data.n_received,
+			data.n_errors, data.n_failed);
+
+	spa_handle_clear(handle);
+	free(handle);
+
+	return data.n_received == N_THREADS * N_INVOKES &&
+		data.n_errors == 0 && data.n_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* A capture device pushes chunks of frames to a playback device with a
+ * clock that drifts. The playback side resamples with the rate from the
+ * DLL and should keep its queue at the target without xruns. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <spa/utils/dll.h>
+
+#include "resample.h"
+
+#define RATE		48000
+#define CHANNELS	2
+#define CHUNK		1024
+#define PERIOD		256
+#define TARGET		(CHUNK + PERIOD)
+#define MAX_QUEUE	(8 * CHUNK)
+#define SECONDS		600
+
+static int n_failed;
+
+static void test_identity(void)
+{
+	struct resample r;
+	int16_t src[100 * CHANNELS], dst[100 * CHANNELS];
+	uint32_t i, n_out, total = 0, consumed, used = 0;
+
+	for (i = 0; i < SPA_N_ELEMENTS(src); i++)
+		src[i] = i * 300 - 15000;
+
+	resample_init(&r, RESAMPLE_FORMAT_S16, CHANNELS);
+
+	/* in odd sizes, the last frame of a call is only written in the next
+	 * call so we get one frame less */
+	while (used < 100) {
+		n_out = resample_process(&r, &dst[total * CHANNELS], 100 - total,
+					 &src[used * CHANNELS], SPA_MIN(7u, 100 - used), &consumed);
+		total += n_out;
+		used += consumed;
+	}
+	if (total != 99 || memcmp(src, dst, total * CHANNELS * sizeof(int16_t)) != 0) {
+		printf("FAIL: identity resample, %u frames\n", total);
+		n_failed++;
+	}
+}
+
+static void test_drift(double drift)
+{
+	static int16_t queue[MAX_QUEUE * CHANNELS], out[PERIOD * CHANNELS];
+	struct spa_dll dll;
+	struct resample r;
+	uint32_t i, c, n_queue, n_out, consumed, n_xrun = 0;
+	uint64_t produced = 0, phase = 0;
+	double corr = 1.0, t, err, max_err = 0.0, sum_ratio = 0.0;
+	uint32_t n_settled = 0;
+
+	spa_dll_init(&dll);
+	spa_dll_set_bw(&dll, SPA_DLL_BW_MIN, PERIOD, RATE);
+	resample_init(&r, RESAMPLE_FORMAT_S16, CHANNELS);
+
+	memset(queue, 0, sizeof(queue));
+	n_queue = TARGET;
+
+	for (i = 0; i < (uint64_t) SECONDS * RATE / PERIOD; i++) {
+		t = (double) (i + 1) * PERIOD / RATE;
+
+		/* the capture side delivers whole chunks at its own rate */
+		while (produced + CHUNK <= t * RATE * (1.0 + drift)) {
+			if (n_queue + CHUNK > MAX_QUEUE) {
+				n_xrun++;
+				break;
+			}
+			for (c = 0; c < CHUNK * CHANNELS; c++)
+				queue[n_queue * CHANNELS + c] = (phase++ * 97) & 0x7fff;
+			n_queue += CHUNK;
+			produced += CHUNK;
+		}
+
+		/* the playback side takes a period */
+		n_out = 0;
+		while (n_out < PERIOD) {
+			uint32_t n = resample_process(&r, &out[n_out * CHANNELS], PERIOD - n_out,
+						      queue, n_queue, &consumed);
+			memmove(queue, &queue[consumed * CHANNELS],
+				(n_queue - consumed) * CHANNELS * sizeof(int16_t));
+			n_queue -= consumed;
+			n_out += n;
+			if (n == 0)
+				break;
+		}
+		if (n_out < PERIOD)
+			n_xrun++;
+
+		err = (double) n_queue - TARGET;
+		corr = spa_dll_update(&dll, err);
+		corr = SPA_CLAMP(corr, 0.95, 1.05);
+		r.ratio = 1.0 / corr;
+
+		/* after the loop has settled */
+		if (t > SECONDS / 4) {
+			max_err = SPA_MAX(max_err, fabs(err));
+			sum_ratio += r.ratio;
+			n_settled++;
+		}
+	}
+	sum_ratio /= n_settled;
+
+	printf("drift %+5.0f ppm: ratio %.6f, max error %.0f frames, %u xruns\n",
+			drift * 1e6, sum_ratio, max_err, n_xrun);
+
+	if (n_xrun > 0 || max_err > CHUNK || fabs(sum_ratio - (1.0 + drift)) > 1e-5) {
+		printf("FAIL: drift %+.0f ppm\n", drift * 1e6);
+		n_failed++;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	static const double drifts[] = { 0.0, 0.0001, -0.0001, 0.0005, -0.0005, 0.002 };
+	uint32_t i;
+
+	test_identity();
+	for (i = 0; i < SPA_N_ELEMENTS(drifts); i++)
+		test_drift(drifts[i]);
+
+	return n_failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,277 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <spa/node/node.h>
+#include <spa/node/io.h>
+
+#include <spa/graph/graph.h>
+#include <spa/graph/graph-scheduler6.h>
+#include <spa/graph/graph-parallel.h>
+
+#define MAX_NODES	64
+#define MAX_PORTS	64
+#define N_SAMPLES	1024
+#define N_CYCLES	500
+
+struct node {
+	struct spa_node node;
+	struct spa_graph_node gnode;
+	struct spa_io_buffers *in[MAX_PORTS];
+	uint32_t n_in;
+	struct spa_io_buffers *out[MAX_PORTS];
+	uint32_t n_out;
+	float samples[N_SAMPLES];
+};
+
+struct link {
+	struct spa_graph_port out;
+	struct spa_graph_port in;
+	struct spa_io_buffers io;
+};
+
+struct data {
+	struct spa_graph graph;
+	struct spa_graph_parallel pool;
+
+	struct node nodes[MAX_NODES];
+	uint32_t n_nodes;
+	struct link links[MAX_NODES];
+	uint32_t n_links;
+
+	uint32_t hub;
+	uint32_t work;
+	uint32_t processed;
+	uint32_t active;		/**< nodes running next to the hub */
+	uint32_t max_active;
+};
+
+static struct data data;
+
+/* some DSP work, a cascade of one pole filters */
+static void node_work(struct node *n)
+{
+	uint32_t i, j, active = 0, max;
+	float s = 0.0f;
+
+	if (n != &data.nodes[data.hub]) {
+		active = __atomic_add_fetch(&data.active, 1, __ATOMIC_SEQ_CST);
+		max = __atomic_load_n(&data.max_active, __ATOMIC_RELAXED);
+		while (active > max &&
+		       !__atomic_compare_exchange_n(&data.max_active, &max, active, false,
+						    __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	}
+
+	for (j = 0; j < data.work; j++) {
+		for (i = 0; i < N_SAMPLES; i++) {
+			s = s * 0.99f + n->samples[i] * 0.01f;
+			n->samples[i] = s;
+		}
+	}
+	if (active > 0)
+		__atomic_sub_fetch(&data.active, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&data.processed, 1, __ATOMIC_RELAXED);
+}
+
+static int node_process_input(struct spa_node *node)
+{
+	struct node *n = SPA_CONTAINER_OF(node, struct node, node);
+	uint32_t i;
+
+	node_work(n);
+
+	for (i = 0; i < n->n_in; i++)
+		n->in[i]->status = SPA_STATUS_NEED_BUFFER;
+	if (n->n_out == 0)
+		return SPA_STATUS_OK;
+
+	for (i = 0; i < n->n_out; i++)
+		n->out[i]->status = SPA_STATUS_HAVE_BUFFER;
+	return SPA_STATUS_HAVE_BUFFER;
+}
+
+static int node_process_output(struct spa_node *node)
+{
+	struct node *n = SPA_CONTAINER_OF(node, struct node, node);
+	uint32_t i;
+
+	if (n->n_in > 0) {
+		for (i = 0; i < n->n_in; i++)
+			n->in[i]->status = SPA_STATUS_NEED_BUFFER;
+		return SPA_STATUS_NEED_BUFFER;
+	}
+	node_work(n);
+
+	for (i = 0; i < n->n_out; i++)
+		n->out[i]->status = SPA_STATUS_HAVE_BUFFER;
+	return SPA_STATUS_HAVE_BUFFER;
+}
+
+static const struct spa_node dummy_node = {
+	SPA_VERSION_NODE,
+	NULL,
+	.process_input = node_process_input,
+	.process_output = node_process_output,
+};
+
+static void make_graph(uint32_t n_nodes, uint32_t n_workers, uint32_t hub, bool shared)
+{
+	uint32_t i;
+
+	spa_graph_init(&data.graph);
+	spa_graph_parallel_init(&data.pool, &data.graph, n_workers,
+				&spa_graph_impl_default, NULL);
+	spa_graph_set_callbacks(&data.graph, &spa_graph_parallel_callbacks, &data.pool);
+
+	for (i = 0; i < n_nodes; i++) {
+		struct node *n = &data.nodes[i];
+
+		n->node = dummy_node;
+		n->n_in = n->n_out = 0;
+		spa_graph_node_init(&n->gnode);
+		spa_graph_node_set_implementation(&n->gnode, &n->node);
+		spa_graph_node_add(&data.graph, &n->gnode);
+	}
+	data.n_nodes = n_nodes;
+	data.n_links = 0;
+	data.hub = hub;
+	if (shared)
+		data.nodes[hub].gnode.flags |= SPA_GRAPH_NODE_FLAG_SHARED;
+}
+
+static void link_nodes(uint32_t out, uint32_t in)
+{
+	struct node *o = &data.nodes[out], *i = &data.nodes[in];
+	struct link *l = &data.links[data.n_links++];
+
+	l->io = SPA_IO_BUFFERS_INIT;
+	l->io.status = SPA_STATUS_NEED_BUFFER;
+
+	spa_graph_port_init(&l->out, SPA_DIRECTION_OUTPUT, o->n_out, 0, &l->io);
+	spa_graph_port_add(&o->gnode, &l->out);
+	o->out[o->n_out++] = &l->io;
+
+	spa_graph_port_init(&l->in, SPA_DIRECTION_INPUT, i->n_in, 0, &l->io);
+	spa_graph_port_add(&i->gnode, &l->in);
+	i->in[i->n_in++] = &l->io;
+
+	spa_graph_port_link(&l->out, &l->in);
+}
+
+/* one source pushing to n_nodes - 1 sinks */
+static void make_fan_out(uint32_t n_nodes, uint32_t n_workers, bool shared)
+{
+	uint32_t i;
+
+	make_graph(n_nodes, n_workers, 0, shared);
+	for (i = 1; i < n_nodes; i++)
+		link_nodes(0, i);
+}
+
+/* n_nodes - 1 sources pulled by one sink */
+static void make_fan_in(uint32_t n_nodes, uint32_t n_workers, bool shared)
+{
+	uint32_t i;
+
+	make_graph(n_nodes, n_workers, n_nodes - 1, shared);
+	for (i = 0; i < n_nodes - 1; i++)
+		link_nodes(i, n_nodes - 1);
+}
+
+static void push(void)
+{
+	struct node *n = &data.nodes[0];
+	uint32_t i;
+
+	node_work(n);
+	for (i = 0; i < n->n_out; i++)
+		n->out[i]->status = SPA_STATUS_HAVE_BUFFER;
+	spa_graph_have_output(&data.graph, &n->gnode);
+}
+
+static void pull(void)
+{
+	struct node *n = &data.nodes[data.n_nodes - 1];
+	spa_graph_need_input(&data.graph, &n->gnode);
+}
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_TIME(&ts);
+}
+
+static int run_test(const char *name, void (*make) (uint32_t, uint32_t, bool),
+		void (*cycle) (void), uint32_t n_nodes, uint32_t n_workers, bool shared)
+{
+	uint64_t start, stop;
+	uint32_t i;
+	int res = 0;
+
+	make(n_nodes, n_workers, shared);
+	spa_graph_parallel_start(&data.pool);
+
+	data.processed = 0;
+	data.max_active = 0;
+	start = get_time();
+	for (i = 0; i < N_CYCLES; i++)
+		cycle();
+	stop = get_time();
+
+	spa_graph_parallel_stop(&data.pool);
+
+	if (data.processed != n_nodes * N_CYCLES) {
+		printf("%-8s %2d nodes %d workers: processed %d nodes, expected %d\n",
+				name, n_nodes, n_workers, data.processed, n_nodes * N_CYCLES);
+		res = -1;
+	}
+	/* the nodes share the hub as peer, they must not run at the same time
+	 * unless the hub allows it */
+	if (!shared && data.max_active > 1) {
+		printf("%-8s %2d nodes %d workers: %d nodes of the hub ran at the same time\n",
+				name, n_nodes, n_workers, data.max_active);
+		res = -1;
+	}
+	printf("%-8s %2d nodes %d workers %-8s: %8.1f us/cycle\n", name, n_nodes, n_workers,
+			shared ? "shared" : "locked", (double)(stop - start) / N_CYCLES / 1000.0);
+	return res;
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint32_t workers[] = { 0, 1, 3, 7 };
+	uint32_t i, s;
+	int res = 0;
+
+	data.work = argc > 1 ? atoi(argv[1]) : 4;
+
+	for (s = 0; s < 2; s++) {
+		for (i = 0; i < SPA_N_ELEMENTS(workers); i++)
+			res |= run_test("fan-out", make_fan_out, push, 17, workers[i], s);
+		for (i = 0; i < SPA_N_ELEMENTS(workers); i++)
+			res |= run_test("fan-in", make_fan_in, pull, 17, workers[i], s);
+	}
+
+	return res == 0 ? 0 : 1;
+}
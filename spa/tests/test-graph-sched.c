@@ -0,0 +1,254 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <spa/node/node.h>
+#include <spa/node/io.h>
+
+#include <spa/graph/graph.h>
+#if SCHEDULER_VERSION == 7
+#include <spa/graph/graph-scheduler7.h>
+#else
+#include <spa/graph/graph-scheduler6.h>
+#endif
+
+#define MAX_NODES	1000
+#define N_CYCLES	2000
+#define N_RUNS		7
+
+struct node {
+	struct spa_node node;
+	struct spa_graph_node gnode;
+	struct spa_io_buffers *in[MAX_NODES];
+	uint32_t n_in;
+	struct spa_io_buffers *out[MAX_NODES];
+	uint32_t n_out;
+};
+
+struct link {
+	struct spa_graph_port out;
+	struct spa_graph_port in;
+	struct spa_io_buffers io;
+};
+
+struct data {
+	struct spa_graph graph;
+	struct spa_graph_data graph_data;
+
+	struct node nodes[MAX_NODES];
+	uint32_t n_nodes;
+	struct link links[MAX_NODES];
+	uint32_t n_links;
+
+	uint32_t processed;
+};
+
+static struct data data;
+
+static int node_process_input(struct spa_node *node)
+{
+	struct node *n = SPA_CONTAINER_OF(node, struct node, node);
+	uint32_t i;
+
+	data.processed++;
+
+	for (i = 0; i < n->n_in; i++)
+		n->in[i]->status = SPA_STATUS_NEED_BUFFER;
+	if (n->n_out == 0)
+		return SPA_STATUS_OK;
+
+	for (i = 0; i < n->n_out; i++)
+		n->out[i]->status = SPA_STATUS_HAVE_BUFFER;
+	return SPA_STATUS_HAVE_BUFFER;
+}
+
+static int node_process_output(struct spa_node *node)
+{
+	struct node *n = SPA_CONTAINER_OF(node, struct node, node);
+	uint32_t i;
+
+	if (n->n_in > 0) {
+		for (i = 0; i < n->n_in; i++)
+			n->in[i]->status = SPA_STATUS_NEED_BUFFER;
+		return SPA_STATUS_NEED_BUFFER;
+	}
+	data.processed++;
+
+	for (i = 0; i < n->n_out; i++)
+		n->out[i]->status = SPA_STATUS_HAVE_BUFFER;
+	return SPA_STATUS_HAVE_BUFFER;
+}
+
+static const struct spa_node dummy_node = {
+	SPA_VERSION_NODE,
+	NULL,
+	.process_input = node_process_input,
+	.process_output = node_process_output,
+};
+
+static void reset_graph(uint32_t n_nodes)
+{
+	uint32_t i;
+
+	spa_graph_init(&data.graph);
+	spa_graph_data_init(&data.graph_data, &data.graph);
+	spa_graph_set_callbacks(&data.graph, &spa_graph_impl_default, &data.graph_data);
+
+	for (i = 0; i < n_nodes; i++) {
+		struct node *n = &data.nodes[i];
+
+		n->node = dummy_node;
+		n->n_in = n->n_out = 0;
+		spa_graph_node_init(&n->gnode);
+		spa_graph_node_set_implementation(&n->gnode, &n->node);
+		spa_graph_node_add(&data.graph, &n->gnode);
+	}
+	data.n_nodes = n_nodes;
+	data.n_links = 0;
+}
+
+static void link_nodes(uint32_t out, uint32_t in)
+{
+	struct node *o = &data.nodes[out], *i = &data.nodes[in];
+	struct link *l = &data.links[data.n_links++];
+
+	l->io = SPA_IO_BUFFERS_INIT;
+	l->io.status = SPA_STATUS_NEED_BUFFER;
+
+	spa_graph_port_init(&l->out, SPA_DIRECTION_OUTPUT, o->n_out, 0, &l->io);
+	spa_graph_port_add(&o->gnode, &l->out);
+	o->out[o->n_out++] = &l->io;
+
+	spa_graph_port_init(&l->in, SPA_DIRECTION_INPUT, i->n_in, 0, &l->io);
+	spa_graph_port_add(&i->gnode, &l->in);
+	i->in[i->n_in++] = &l->io;
+
+	spa_graph_port_link(&l->out, &l->in);
+}
+
+static void make_chain(uint32_t n_nodes)
+{
+	uint32_t i;
+
+	reset_graph(n_nodes);
+	for (i = 0; i < n_nodes - 1; i++)
+		link_nodes(i, i + 1);
+}
+
+static void make_fan_in(uint32_t n_nodes)
+{
+	uint32_t i;
+
+	reset_graph(n_nodes);
+	for (i = 0; i < n_nodes - 1; i++)
+		link_nodes(i, n_nodes - 1);
+}
+
+static void make_fan_out(uint32_t n_nodes)
+{
+	uint32_t i;
+
+	reset_graph(n_nodes);
+	for (i = 1; i < n_nodes; i++)
+		link_nodes(0, i);
+}
+
+static void pull(void)
+{
+	struct node *n = &data.nodes[data.n_nodes - 1];
+	spa_graph_need_input(&data.graph, &n->gnode);
+}
+
+static void push(void)
+{
+	struct node *n = &data.nodes[0];
+	uint32_t i;
+
+	data.processed++;
+	for (i = 0; i < n->n_out; i++)
+		n->out[i]->status = SPA_STATUS_HAVE_BUFFER;
+	spa_graph_have_output(&data.graph, &n->gnode);
+}
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_TIME(&ts);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double da = *(const double *) a, db = *(const double *) b;
+	return da < db ? -1 : da > db ? 1 : 0;
+}
+
+static int run_test(const char *name, void (*make) (uint32_t), void (*cycle) (void), uint32_t n_nodes)
+{
+	uint64_t start, stop;
+	uint32_t i, r;
+	double t[N_RUNS];
+
+	make(n_nodes);
+
+	/* warm up and check that all nodes run once per cycle */
+	data.processed = 0;
+	cycle();
+	if (data.processed != n_nodes) {
+		printf("%-8s %4d nodes: processed %d nodes, expected %d\n",
+				name, n_nodes, data.processed, n_nodes);
+		return -1;
+	}
+
+	/* report the best of a few runs, the others are disturbed by the
+	 * rest of the system */
+	for (r = 0; r < N_RUNS; r++) {
+		start = get_time();
+		for (i = 0; i < N_CYCLES; i++)
+			cycle();
+		stop = get_time();
+
+		t[r] = (double)(stop - start) / N_CYCLES;
+	}
+	qsort(t, N_RUNS, sizeof(double), compare_double);
+
+	printf("%-8s %4d nodes: %8.1f ns/cycle (median %8.1f)\n", name, n_nodes,
+			t[0], t[N_RUNS / 2]);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint32_t sizes[] = { 10, 100, 1000 };
+	uint32_t i;
+	int res = 0;
+
+	printf("scheduler %d\n", SCHEDULER_VERSION);
+
+	for (i = 0; i < SPA_N_ELEMENTS(sizes); i++) {
+		res |= run_test("chain", make_chain, pull, sizes[i]);
+		res |= run_test("fan-in", make_fan_in, pull, sizes[i]);
+		res |= run_test("fan-out", make_fan_out, push, sizes[i]);
+	}
+	return res == 0 ? 0 : 1;
+}
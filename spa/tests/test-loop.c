@@ -0,0 +1,198 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/eventfd.h>
+
+#include <spa/support/plugin.h>
+#include <spa/support/loop.h>
+#include <spa/support/type-map-impl.h>
+
+#define N_SOURCES	200
+
+static SPA_TYPE_MAP_IMPL(type_map, 4096);
+
+struct data {
+	struct spa_loop *loop;
+	struct spa_loop_control *control;
+
+	struct spa_source sources[N_SOURCES];
+	uint32_t n_dispatched;
+	int last_priority;
+	uint32_t n_errors;
+
+	struct spa_hook hook;
+	struct spa_loop_stats stats;
+};
+
+static void on_event(struct spa_source *source)
+{
+	struct data *d = source->data;
+	uint64_t count;
+
+	if (read(source->fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
+		d->n_errors++;
+
+	if (source->priority > d->last_priority)
+		d->n_errors++;
+	d->last_priority = source->priority;
+	d->n_dispatched++;
+}
+
+static void on_stats(void *data, const struct spa_loop_stats *stats)
+{
+	struct data *d = data;
+	d->stats = *stats;
+}
+
+static const struct spa_loop_control_hooks hooks = {
+	SPA_VERSION_LOOP_CONTROL_HOOKS,
+	.stats = on_stats,
+};
+
+static int make_loop(const char *lib, struct spa_handle **handle, struct data *d)
+{
+	const struct spa_handle_factory *factory = NULL;
+	spa_handle_factory_enum_func_t enum_func;
+	struct spa_support support[1];
+	uint32_t i;
+	void *hnd, *iface;
+	int res;
+
+	if ((hnd = dlopen(lib, RTLD_NOW)) == NULL) {
+		printf("can't load %s: %s\n", lib, dlerror());
+		return -ENOENT;
+	}
+	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
+		printf("can't find enum function\n");
+		return -ENOENT;
+	}
+	for (i = 0; enum_func(&factory, &i) > 0;) {
+		if (strcmp(factory->name, "loop") == 0)
+			break;
+		factory = NULL;
+	}
+	if (factory == NULL) {
+		printf("can't find loop factory\n");
+		return -ENOENT;
+	}
+
+	support[0].type = SPA_TYPE__TypeMap;
+	support[0].data = &type_map.map;
+
+	*handle = calloc(1, factory->size);
+	if ((res = spa_handle_factory_init(factory, *handle, NULL, support, 1)) < 0) {
+		printf("can't make factory instance: %d\n", res);
+		return res;
+	}
+
+	if ((res = spa_handle_get_interface(*handle,
+			spa_type_map_get_id(&type_map.map, SPA_TYPE__Loop), &iface)) < 0)
+		return res;
+	d->loop = iface;
+
+	if ((res = spa_handle_get_interface(*handle,
+			spa_type_map_get_id(&type_map.map, SPA_TYPE__LoopControl), &iface)) < 0)
+		return res;
+	d->control = iface;
+
+	return 0;
+}
+
+static void signal_all(struct data *d)
+{
+	uint64_t count = 1;
+	uint32_t i;
+
+	for (i = 0; i < N_SOURCES; i++) {
+		if (write(d->sources[i].fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
+			d->n_errors++;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const char *lib = argc > 1 ? argv[1] : "build/spa/plugins/support/libspa-support.so";
+	struct data data = { 0, };
+	struct spa_handle *handle = NULL;
+	uint32_t i, n_rounds, n_iterations = 0;
+	int res = 0;
+
+	if (make_loop(lib, &handle, &data) < 0)
+		return 1;
+
+	spa_loop_control_add_hook(data.control, &data.hook, &hooks, &data);
+
+	for (i = 0; i < N_SOURCES; i++) {
+		struct spa_source *s = &data.sources[i];
+
+		s->func = on_event;
+		s->data = &data;
+		s->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		s->mask = SPA_IO_IN;
+		s->priority = (i % 3) - 1;
+		spa_loop_add_source(data.loop, s);
+	}
+
+	spa_loop_control_enter(data.control);
+
+	/* the array grows when it was full, until all events fit in one
+	 * iteration. Each iteration dispatches in priority order. */
+	for (n_rounds = 0; n_rounds < 10; n_rounds++) {
+		data.n_dispatched = 0;
+		signal_all(&data);
+
+		for (n_iterations = 0; data.n_dispatched < N_SOURCES; n_iterations++) {
+			data.last_priority = SPA_SOURCE_PRIORITY_RT;
+			spa_loop_control_iterate(data.control, 0);
+			printf("round %u: %u/%u events, dispatch %"PRIu64" ns, slowest %"PRIu64" ns\n",
+					n_rounds, data.stats.n_events, data.stats.max_events,
+					data.stats.dispatch_time, data.stats.slowest_time);
+		}
+		if (n_iterations == 1)
+			break;
+	}
+
+	if (n_iterations != 1) {
+		printf("events don't fit in one iteration\n");
+		res = 1;
+	}
+	if (data.n_errors > 0) {
+		printf("%u errors\n", data.n_errors);
+		res = 1;
+	}
+
+	spa_loop_control_leave(data.control);
+
+	for (i = 0; i < N_SOURCES; i++) {
+		spa_loop_remove_source(data.loop, &data.sources[i]);
+		close(data.sources[i].fd);
+	}
+	spa_hook_remove(&data.hook);
+	spa_handle_clear(handle);
+	free(handle);
+
+	return res;
+}
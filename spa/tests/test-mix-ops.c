@@ -0,0 +1,238 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include <spa/utils/mix-ops.h>
+
+#define MAX_SAMPLES	1029
+#define MAX_OFFSET	7
+
+static const double scales[] = { 0.0, 0.25, 0.5, 0.999, 1.0, 1.3, 4.0, 15.9, 20.0, -0.7 };
+
+static int16_t s16_src[MAX_SAMPLES + MAX_OFFSET];
+static int16_t s16_ref[MAX_SAMPLES + MAX_OFFSET];
+static int16_t s16_dst[MAX_SAMPLES + MAX_OFFSET];
+static float f32_src[MAX_SAMPLES + MAX_OFFSET];
+static float f32_ref[MAX_SAMPLES + MAX_OFFSET];
+static float f32_dst[MAX_SAMPLES + MAX_OFFSET];
+
+static int n_failed;
+
+static void fill_data(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_SAMPLES + MAX_OFFSET; i++) {
+		/* plenty of values near the edges to exercise the clamping */
+		s16_src[i] = (rand() % 4) == 0 ? (rand() & 1 ? INT16_MAX : INT16_MIN) : rand();
+		s16_ref[i] = s16_dst[i] = rand();
+		f32_src[i] = (rand() / (float) RAND_MAX) * 2.0f - 1.0f;
+		f32_ref[i] = f32_dst[i] = (rand() / (float) RAND_MAX) * 2.0f - 1.0f;
+	}
+}
+
+static void check(const char *name, int fmt, int n_samples, int offset, double scale,
+		  const void *ref, const void *dst, size_t sample_size)
+{
+	if (memcmp(ref, dst, (MAX_SAMPLES + MAX_OFFSET) * sample_size) == 0)
+		return;
+
+	printf("FAIL: %s %s samples:%d offset:%d scale:%f\n", name,
+	       fmt == SPA_MIX_FMT_S16 ? "s16" : "f32", n_samples, offset, scale);
+	n_failed++;
+}
+
+static void test_mix(const struct spa_mix_ops *ref_ops,
+		     const struct spa_mix_ops *ops,
+		     int n_samples, int offset)
+{
+	int fmt;
+	size_t i;
+
+	for (fmt = 0; fmt < SPA_MIX_FMT_MAX; fmt++) {
+		size_t ss = fmt == SPA_MIX_FMT_S16 ? sizeof(int16_t) : sizeof(float);
+		void *src = fmt == SPA_MIX_FMT_S16 ? (void*)s16_src : (void*)f32_src;
+		void *ref = fmt == SPA_MIX_FMT_S16 ? (void*)s16_ref : (void*)f32_ref;
+		void *dst = fmt == SPA_MIX_FMT_S16 ? (void*)s16_dst : (void*)f32_dst;
+		void *s = SPA_MEMBER(src, offset * ss, void);
+		void *r = SPA_MEMBER(ref, offset * ss, void);
+		void *d = SPA_MEMBER(dst, offset * ss, void);
+		int n_bytes = n_samples * ss;
+
+		fill_data();
+		ref_ops->add[fmt](r, s, n_bytes);
+		ops->add[fmt](d, s, n_bytes);
+		check("add", fmt, n_samples, offset, 1.0, ref, dst, ss);
+
+		for (i = 0; i < SPA_N_ELEMENTS(scales); i++) {
+			fill_data();
+			ref_ops->copy_scale[fmt](r, s, scales[i], n_bytes);
+			ops->copy_scale[fmt](d, s, scales[i], n_bytes);
+			check("copy_scale", fmt, n_samples, offset, scales[i], ref, dst, ss);
+
+			fill_data();
+			ref_ops->add_scale[fmt](r, s, scales[i], n_bytes);
+			ops->add_scale[fmt](d, s, scales[i], n_bytes);
+			check("add_scale", fmt, n_samples, offset, scales[i], ref, dst, ss);
+		}
+	}
+}
+
+#define MIX_N_SRC	5
+
+static void test_mix_n(const struct spa_mix_ops *ref_ops,
+		       const struct spa_mix_ops *ops,
+		       int n_samples)
+{
+	static const double mix_scales[MIX_N_SRC] = { 1.0, 0.5, 1.3, 1.0, 0.25 };
+	const void *srcs[MIX_N_SRC];
+	int fmt, n_bytes;
+	uint32_t i, n_src;
+
+	for (fmt = 0; fmt < SPA_MIX_FMT_MAX; fmt++) {
+		size_t ss = fmt == SPA_MIX_FMT_S16 ? sizeof(int16_t) : sizeof(float);
+		void *src = fmt == SPA_MIX_FMT_S16 ? (void*)s16_src : (void*)f32_src;
+		void *ref = fmt == SPA_MIX_FMT_S16 ? (void*)s16_ref : (void*)f32_ref;
+		void *dst = fmt == SPA_MIX_FMT_S16 ? (void*)s16_dst : (void*)f32_dst;
+
+		n_bytes = n_samples * ss;
+
+		/* use shifted views of the source as the different streams */
+		for (i = 0; i < MIX_N_SRC; i++)
+			srcs[i] = SPA_MEMBER(src, i * ss, void);
+
+		for (n_src = 0; n_src <= MIX_N_SRC; n_src++) {
+			fill_data();
+			if (n_src == 0)
+				ref_ops->clear[fmt](ref, n_bytes);
+			for (i = 0; i < n_src; i++) {
+				if (i == 0)
+					ref_ops->copy_scale[fmt](ref, srcs[i], mix_scales[i], n_bytes);
+				else
+					ref_ops->add_scale[fmt](ref, srcs[i], mix_scales[i], n_bytes);
+			}
+			ops->mix_n[fmt](ops, dst, srcs, mix_scales, n_src, n_bytes);
+			check("mix_n", fmt, n_samples, 0, n_src, ref, dst, ss);
+		}
+	}
+}
+
+static void test_ops(const char *name, uint32_t cpu_flags)
+{
+	struct spa_mix_ops ref_ops, ops;
+	int n_samples, offset, failed = n_failed;
+
+	spa_mix_get_ops(&ref_ops, 0);
+	spa_mix_get_ops(&ops, cpu_flags);
+
+	for (n_samples = 0; n_samples <= MAX_SAMPLES; n_samples += n_samples < 67 ? 1 : 137)
+		for (offset = 0; offset < MAX_OFFSET; offset++)
+			test_mix(&ref_ops, &ops, n_samples, offset);
+
+	for (n_samples = 0; n_samples < MAX_SAMPLES - MAX_OFFSET; n_samples += 61)
+		test_mix_n(&ref_ops, &ops, n_samples);
+
+	printf("%s: %s\n", name, failed == n_failed ? "OK" : "FAILED");
+}
+
+#define BENCH_STREAMS	64
+#define BENCH_SAMPLES	(8192 * 2)
+#define BENCH_LOOPS	200
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * SPA_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* compare mixing the streams with one pass per stream over the destination
+ * against a single tiled pass with mix_n */
+static void bench_mix_n(const char *name, uint32_t cpu_flags)
+{
+	struct spa_mix_ops ops;
+	const void *srcs[BENCH_STREAMS];
+	double mix_scales[BENCH_STREAMS];
+	size_t n_bytes = BENCH_SAMPLES * sizeof(float);
+	float *data, *dst;
+	uint64_t t1, t2, t3;
+	double traffic;
+	int i, j;
+
+	spa_mix_get_ops(&ops, cpu_flags);
+
+	data = malloc(BENCH_STREAMS * n_bytes);
+	dst = malloc(n_bytes);
+	for (i = 0; i < BENCH_STREAMS * BENCH_SAMPLES; i++)
+		data[i] = (rand() / (float) RAND_MAX) * 2.0f - 1.0f;
+	for (i = 0; i < BENCH_STREAMS; i++) {
+		srcs[i] = data + i * BENCH_SAMPLES;
+		mix_scales[i] = 0.5;
+	}
+
+	t1 = get_time_ns();
+	for (j = 0; j < BENCH_LOOPS; j++) {
+		ops.copy_scale[SPA_MIX_FMT_F32](dst, srcs[0], mix_scales[0], n_bytes);
+		for (i = 1; i < BENCH_STREAMS; i++)
+			ops.add_scale[SPA_MIX_FMT_F32](dst, srcs[i], mix_scales[i], n_bytes);
+	}
+	t2 = get_time_ns();
+	for (j = 0; j < BENCH_LOOPS; j++)
+		ops.mix_n[SPA_MIX_FMT_F32](&ops, dst, srcs, mix_scales, BENCH_STREAMS, n_bytes);
+	t3 = get_time_ns();
+
+	/* the sources are read once by both, pairwise also reads and writes the
+	 * destination once per stream while mix_n keeps each tile in cache */
+	traffic = (double) BENCH_LOOPS * BENCH_STREAMS * n_bytes;
+	printf("%s: %d streams pairwise: %"PRIu64" ns/cycle (%.2f GB/s), "
+	       "mix_n: %"PRIu64" ns/cycle (%.2f GB/s), dst traffic %d -> 1 passes\n",
+	       name, BENCH_STREAMS,
+	       (t2 - t1) / BENCH_LOOPS, traffic / (t2 - t1),
+	       (t3 - t2) / BENCH_LOOPS, traffic / (t3 - t2),
+	       2 * BENCH_STREAMS - 1);
+
+	free(data);
+	free(dst);
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t cpu_flags = spa_mix_get_cpu_flags();
+
+	test_ops("c", 0);
+	if (cpu_flags & SPA_MIX_CPU_FLAG_SSE2)
+		test_ops("sse2", SPA_MIX_CPU_FLAG_SSE2);
+	if (cpu_flags & SPA_MIX_CPU_FLAG_AVX2)
+		test_ops("avx2", SPA_MIX_CPU_FLAG_AVX2);
+	if (cpu_flags & SPA_MIX_CPU_FLAG_NEON)
+		test_ops("neon", SPA_MIX_CPU_FLAG_NEON);
+
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		bench_mix_n("c", 0);
+		bench_mix_n("simd", cpu_flags);
+	}
+
+	return n_failed ? -1 : 0;
+}
@@ -0,0 +1,181 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dlfcn.h>
+
+#include <spa/support/plugin.h>
+#include <spa/support/type-map.h>
+#include <spa/support/type-map-impl.h>
+
+#define MAX_TYPES	10000
+
+static SPA_TYPE_MAP_IMPL(map_1k, 1000 + 1);
+static SPA_TYPE_MAP_IMPL(map_5k, 5000 + 1);
+static SPA_TYPE_MAP_IMPL(map_10k, 10000 + 1);
+
+static char names[MAX_TYPES][64];
+
+/* the lookup we had before, a strcmp on all registered types */
+struct linear_map {
+	struct spa_type_map map;
+	uint32_t n_types;
+	const char *types[MAX_TYPES + 1];
+};
+
+static uint32_t linear_get_id(struct spa_type_map *map, const char *type)
+{
+	struct linear_map *l = SPA_CONTAINER_OF(map, struct linear_map, map);
+	uint32_t i;
+
+	for (i = 1; i <= l->n_types; i++) {
+		if (strcmp(l->types[i], type) == 0)
+			return i;
+	}
+	l->types[i] = type;
+	l->n_types++;
+	return i;
+}
+
+static const char *linear_get_type(const struct spa_type_map *map, uint32_t id)
+{
+	struct linear_map *l = SPA_CONTAINER_OF(map, struct linear_map, map);
+	return id <= l->n_types ? l->types[id] : NULL;
+}
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_TIME(&ts);
+}
+
+static int run(const char *name, struct spa_type_map *map, uint32_t n_types)
+{
+	uint64_t t1, t2, t3;
+	uint32_t i, *ids;
+	int res = 0;
+
+	ids = alloca(n_types * sizeof(uint32_t));
+
+	t1 = get_time();
+	for (i = 0; i < n_types; i++)
+		ids[i] = spa_type_map_get_id(map, names[i]);
+	t2 = get_time();
+	for (i = 0; i < n_types; i++) {
+		if (spa_type_map_get_id(map, names[i]) != ids[i])
+			res = -EINVAL;
+	}
+	t3 = get_time();
+
+	for (i = 0; i < n_types; i++) {
+		const char *type = spa_type_map_get_type(map, ids[i]);
+		if (type == NULL || strcmp(type, names[i]) != 0)
+			res = -EINVAL;
+	}
+
+	printf("%-8s %6u types: register %8.3f ms, lookup %8.3f ms%s\n",
+			name, n_types,
+			(t2 - t1) / 1000000.0, (t3 - t2) / 1000000.0,
+			res < 0 ? " FAILED" : "");
+	return res;
+}
+
+static const struct spa_handle_factory *find_mapper(const char *lib)
+{
+	const struct spa_handle_factory *factory;
+	spa_handle_factory_enum_func_t enum_func;
+	uint32_t i;
+	void *hnd;
+
+	if ((hnd = dlopen(lib, RTLD_NOW)) == NULL) {
+		printf("can't load %s: %s\n", lib, dlerror());
+		return NULL;
+	}
+	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
+		printf("can't find enum function\n");
+		return NULL;
+	}
+	for (i = 0; enum_func(&factory, &i) > 0;) {
+		if (strcmp(factory->name, "mapper") == 0)
+			return factory;
+	}
+	return NULL;
+}
+
+static int run_mapper(const struct spa_handle_factory *factory, uint32_t n_types)
+{
+	struct spa_handle *handle;
+	void *iface;
+	int res;
+
+	handle = calloc(1, factory->size);
+	if ((res = spa_handle_factory_init(factory, handle, NULL, NULL, 0)) < 0) {
+		printf("can't make factory instance: %d\n", res);
+		goto exit;
+	}
+	/* we don't have a type map yet to look up the interface type */
+	if ((res = spa_handle_get_interface(handle, 0, &iface)) < 0)
+		printf("can't get interface %d\n", res);
+	else
+		res = run("mapper", iface, n_types);
+
+	spa_handle_clear(handle);
+      exit:
+	free(handle);
+	return res;
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint32_t sizes[] = { 1000, 5000, 10000 };
+	struct spa_type_map *maps[] = {
+		&map_1k.map, &map_5k.map, &map_10k.map
+	};
+	const char *lib = argc > 1 ? argv[1] : "build/spa/plugins/support/libspa-support.so";
+	const struct spa_handle_factory *mapper;
+	struct linear_map *linear;
+	uint32_t i;
+	int res = 0;
+
+	for (i = 0; i < MAX_TYPES; i++)
+		snprintf(names[i], sizeof(names[i]), SPA_TYPE_POINTER_BASE "Test:Type:%05u", i);
+
+	linear = calloc(1, sizeof(struct linear_map));
+	linear->map.get_id = linear_get_id;
+	linear->map.get_type = linear_get_type;
+
+	mapper = find_mapper(lib);
+
+	for (i = 0; i < SPA_N_ELEMENTS(sizes); i++) {
+		linear->n_types = 0;
+		res |= run("linear", &linear->map, sizes[i]);
+		res |= run("impl", maps[i], sizes[i]);
+		if (mapper)
+			res |= run_mapper(mapper, sizes[i]);
+	}
+
+	free(linear);
+
+	return res < 0 ? 1 : 0;
+}
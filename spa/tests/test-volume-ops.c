@@ -0,0 +1,223 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "volume-ops.h"
+
+#define MAX_CHANNELS	8
+#define MAX_FRAMES	259
+#define MAX_OFFSET	3
+#define MAX_SAMPLES	(MAX_FRAMES * MAX_CHANNELS + MAX_OFFSET)
+
+static const float volumes[][MAX_CHANNELS] = {
+	{ 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f },
+	{ 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f },
+	{ 0.5f, 0.25f, 0.999f, 1.3f, 0.1f, 2.0f, 0.75f, 0.01f },
+	{ 4.0f, 10.0f, 0.0f, 0.7f, 1.0f, 0.3f, 6.0f, 0.9f },
+};
+
+static const float steps[][MAX_CHANNELS] = {
+	{ 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f },
+	{ 0.01f, -0.01f, 0.002f, -0.003f, 0.004f, 0.0f, -0.02f, 0.001f },
+};
+
+static int16_t s16_src[MAX_SAMPLES], s16_ref[MAX_SAMPLES], s16_dst[MAX_SAMPLES];
+static int32_t s32_src[MAX_SAMPLES], s32_ref[MAX_SAMPLES], s32_dst[MAX_SAMPLES];
+static float f32_src[MAX_SAMPLES], f32_ref[MAX_SAMPLES], f32_dst[MAX_SAMPLES];
+
+static const char *fmt_names[] = { "s16", "s32", "f32" };
+
+static int n_failed;
+
+static void fill_data(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_SAMPLES; i++) {
+		/* plenty of values near the edges to exercise the clamping */
+		s16_src[i] = (rand() % 4) == 0 ? (rand() & 1 ? INT16_MAX : INT16_MIN) : rand();
+		s32_src[i] = (rand() % 4) == 0 ? (rand() & 1 ? INT32_MAX : INT32_MIN) :
+			(int32_t) ((uint32_t) rand() << 16 ^ rand());
+		f32_src[i] = (rand() / (float) RAND_MAX) * 2.0f - 1.0f;
+		s16_ref[i] = s16_dst[i] = rand();
+		s32_ref[i] = s32_dst[i] = rand();
+		f32_ref[i] = f32_dst[i] = rand();
+	}
+}
+
+static void get_data(int fmt, void **src, void **ref, void **dst, size_t *sample_size)
+{
+	switch (fmt) {
+	case FMT_S16:
+		*src = s16_src, *ref = s16_ref, *dst = s16_dst;
+		*sample_size = sizeof(int16_t);
+		break;
+	case FMT_S32:
+		*src = s32_src, *ref = s32_ref, *dst = s32_dst;
+		*sample_size = sizeof(int32_t);
+		break;
+	default:
+		*src = f32_src, *ref = f32_ref, *dst = f32_dst;
+		*sample_size = sizeof(float);
+		break;
+	}
+}
+
+static void check(const char *name, int fmt, uint32_t n_channels, uint32_t n_frames,
+		  int offset, int index, const void *ref, const void *dst, size_t sample_size)
+{
+	if (memcmp(ref, dst, MAX_SAMPLES * sample_size) == 0)
+		return;
+
+	printf("FAIL: %s %s channels:%u frames:%u offset:%d volume:%d\n", name,
+	       fmt_names[fmt], n_channels, n_frames, offset, index);
+	n_failed++;
+}
+
+static void test_volume(uint32_t cpu_flags, uint32_t n_channels, uint32_t n_frames, int offset)
+{
+	struct spa_volume_ops ref_ops, ops;
+	void *src, *ref, *dst, *s, *r, *d;
+	size_t ss, i, j;
+	int fmt;
+
+	spa_volume_get_ops(&ref_ops, 0, n_channels);
+	spa_volume_get_ops(&ops, cpu_flags, n_channels);
+
+	for (fmt = 0; fmt < FMT_MAX; fmt++) {
+		get_data(fmt, &src, &ref, &dst, &ss);
+		s = SPA_MEMBER(src, offset * ss, void);
+		r = SPA_MEMBER(ref, offset * ss, void);
+		d = SPA_MEMBER(dst, offset * ss, void);
+
+		for (i = 0; i < SPA_N_ELEMENTS(volumes); i++) {
+			fill_data();
+			ref_ops.volume[fmt](r, s, volumes[i], n_channels, n_frames);
+			ops.volume[fmt](d, s, volumes[i], n_channels, n_frames);
+			check("volume", fmt, n_channels, n_frames, offset, i, ref, dst, ss);
+
+			/* in place */
+			fill_data();
+			memcpy(ref, src, MAX_SAMPLES * ss);
+			memcpy(dst, src, MAX_SAMPLES * ss);
+			ref_ops.volume[fmt](r, r, volumes[i], n_channels, n_frames);
+			ops.volume[fmt](d, d, volumes[i], n_channels, n_frames);
+			check("volume in place", fmt, n_channels, n_frames, offset, i, ref, dst, ss);
+
+			for (j = 0; j < SPA_N_ELEMENTS(steps); j++) {
+				fill_data();
+				ref_ops.ramp[fmt](r, s, volumes[i], steps[j], n_channels, n_frames);
+				ops.ramp[fmt](d, s, volumes[i], steps[j], n_channels, n_frames);
+				check("ramp", fmt, n_channels, n_frames, offset, i, ref, dst, ss);
+			}
+		}
+	}
+}
+
+static void test_ops(const char *name, uint32_t cpu_flags)
+{
+	static const uint32_t channels[] = { 1, 2, 3, 4, 5, 6, 8 };
+	uint32_t i, n_frames;
+	int offset, failed = n_failed;
+
+	for (i = 0; i < SPA_N_ELEMENTS(channels); i++)
+		for (n_frames = 0; n_frames <= MAX_FRAMES; n_frames += n_frames < 19 ? 1 : 60)
+			for (offset = 0; offset < MAX_OFFSET; offset++)
+				test_volume(cpu_flags, channels[i], n_frames, offset);
+
+	printf("%s: %s\n", name, failed == n_failed ? "OK" : "FAILED");
+}
+
+#define BENCH_FRAMES	4096
+#define BENCH_LOOPS	2000
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * SPA_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* the loop we had before, a double multiply per sample without clamping.
+ * Not inlined so that the compiler does not drop the repeated calls. */
+static void __attribute__((noinline)) volume_s16_old(int16_t *dst, const int16_t *src, double volume, uint32_t n_samples)
+{
+	uint32_t i;
+	for (i = 0; i < n_samples; i++)
+		dst[i] = src[i] * volume;
+}
+
+static void bench(uint32_t cpu_flags, uint32_t n_channels)
+{
+	static int16_t src[BENCH_FRAMES * MAX_CHANNELS], dst[BENCH_FRAMES * MAX_CHANNELS];
+	float volume[MAX_CHANNELS], step[MAX_CHANNELS];
+	uint32_t i, n_samples = BENCH_FRAMES * n_channels;
+	struct spa_volume_ops ref_ops, ops;
+	uint64_t t[5];
+
+	spa_volume_get_ops(&ref_ops, 0, n_channels);
+	spa_volume_get_ops(&ops, cpu_flags, n_channels);
+
+	for (i = 0; i < n_channels; i++) {
+		volume[i] = 0.5f;
+		step[i] = 0.0001f;
+	}
+	for (i = 0; i < n_samples; i++)
+		src[i] = rand();
+
+	t[0] = get_time_ns();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		volume_s16_old(dst, src, 0.5, n_samples);
+	t[1] = get_time_ns();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		ref_ops.volume[FMT_S16](dst, src, volume, n_channels, BENCH_FRAMES);
+	t[2] = get_time_ns();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		ops.volume[FMT_S16](dst, src, volume, n_channels, BENCH_FRAMES);
+	t[3] = get_time_ns();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		ops.ramp[FMT_S16](dst, src, volume, step, n_channels, BENCH_FRAMES);
+	t[4] = get_time_ns();
+
+#define PER_SAMPLE(t)	((double)(t) / ((uint64_t) BENCH_LOOPS * n_samples))
+	printf("s16 %u channels: old %.3f ns, c %.3f ns, simd %.3f ns, simd ramp %.3f ns per sample\n",
+			n_channels, PER_SAMPLE(t[1] - t[0]), PER_SAMPLE(t[2] - t[1]),
+			PER_SAMPLE(t[3] - t[2]), PER_SAMPLE(t[4] - t[3]));
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t cpu_flags = spa_volume_get_cpu_flags();
+
+	printf("cpu flags %08x\n", cpu_flags);
+
+	test_ops("c", 0);
+#if defined (HAVE_SSE2)
+	if (cpu_flags & VOLUME_CPU_FLAG_SSE2)
+		test_ops("sse2", VOLUME_CPU_FLAG_SSE2);
+#endif
+	bench(cpu_flags, 2);
+	bench(cpu_flags, 6);
+
+	return n_failed > 0 ? 1 : 0;
+}
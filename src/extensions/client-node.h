@@ -24,6 +24,8 @@
 extern "C" {
 #endif
 
+#include <time.h>
+
 #include <spa/utils/defs.h>
 #include <spa/param/param.h>
 #include <spa/node/node.h>
@@ -34,7 +36,11 @@ struct pw_client_node_proxy;
 
 #define PW_TYPE_INTERFACE__ClientNode		PW_TYPE_INTERFACE_BASE "ClientNode"
 
-#define PW_VERSION_CLIENT_NODE			0
+#define PW_VERSION_CLIENT_NODE			1
+
+/** since this version, the transport has an activation record and the
+ * process messages are exchanged as flags in it */
+#define PW_VERSION_CLIENT_NODE_ACTIVATION	1
 
 struct pw_client_node_message;
 
@@ -100,6 +106,10 @@ struct pw_client_node_transport {
 	 * Use this function after \ref next_message().
 	 */
 	int (*parse_message) (struct pw_client_node_transport *trans, void *message);
+
+	struct pw_client_node_activation *activation;	/**< the activation record or NULL
+							  *  when the other side is older than
+							  *  PW_VERSION_CLIENT_NODE_ACTIVATION */
 };
 
 #define pw_client_node_transport_destroy(t)		((t)->destroy((t)))
@@ -152,6 +162,81 @@ struct pw_client_node_message_port_reuse_buffer {
 		SPA_POD_INT_INIT(port_id),							\
 		SPA_POD_INT_INIT(buffer_id))
 
+/** \class pw_client_node_activation
+ *
+ * The activation record is shared between the server and the client. It is
+ * used to exchange the process messages (HAVE_OUTPUT, NEED_INPUT,
+ * PROCESS_INPUT and PROCESS_OUTPUT) as flags in shared memory.
+ *
+ * A side that is awake polls its pending flags, the peer then does not need
+ * to be woken up with the eventfd.
+ *
+ * The server only adds the record to the transport of clients that create
+ * the client node with PW_VERSION_CLIENT_NODE_ACTIVATION or later. Without
+ * it, the process messages go through the transport ringbuffers.
+ */
+struct pw_client_node_activation {
+#define PW_CLIENT_NODE_ACTIVATION_SERVER	0
+#define PW_CLIENT_NODE_ACTIVATION_CLIENT	1
+	uint32_t pending[2];		/**< pending (1 << message type) flags */
+	uint32_t awake[2];		/**< side is polling the pending flags */
+	uint64_t signal_time[2];	/**< time of the last signal to a side */
+	uint64_t awake_time[2];		/**< time a side woke up for it */
+};
+
+static inline uint64_t pw_client_node_activation_get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_TIME(&ts);
+}
+
+/** Signal \a message to side \a peer
+ * \return true when \a peer is not awake and needs to be woken up
+ * \memberof pw_client_node_activation
+ */
+static inline bool
+pw_client_node_activation_signal(struct pw_client_node_activation *a, int peer,
+				 enum pw_client_node_message_type message)
+{
+	a->signal_time[peer] = pw_client_node_activation_get_time();
+	__atomic_or_fetch(&a->pending[peer], 1 << message, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&a->awake[peer], __ATOMIC_SEQ_CST) == 0;
+}
+
+/** Mark side \a self awake, the peer will not wake it up until
+ * \ref pw_client_node_activation_poll() returned 0
+ * \memberof pw_client_node_activation
+ */
+static inline void
+pw_client_node_activation_wakeup(struct pw_client_node_activation *a, int self)
+{
+	__atomic_store_n(&a->awake[self], 1, __ATOMIC_SEQ_CST);
+	a->awake_time[self] = pw_client_node_activation_get_time();
+}
+
+/** Take the pending flags of side \a self
+ * \return the pending flags. When there are none, \a self is no longer
+ *	awake and needs to be woken up for new messages.
+ * \memberof pw_client_node_activation
+ */
+static inline uint32_t
+pw_client_node_activation_poll(struct pw_client_node_activation *a, int self)
+{
+	uint32_t flags;
+
+	if ((flags = __atomic_exchange_n(&a->pending[self], 0, __ATOMIC_SEQ_CST)) != 0)
+		return flags;
+
+	__atomic_store_n(&a->awake[self], 0, __ATOMIC_SEQ_CST);
+
+	/* the peer might have signaled before it saw us going to sleep */
+	if ((flags = __atomic_exchange_n(&a->pending[self], 0, __ATOMIC_SEQ_CST)) != 0)
+		__atomic_store_n(&a->awake[self], 1, __ATOMIC_SEQ_CST);
+
+	return flags;
+}
+
 /** information about a buffer */
 struct pw_client_node_buffer {
 	uint32_t mem_id;		/**< the memory id for the metadata */
@@ -299,7 +384,8 @@ pw_client_node_proxy_destroy(struct pw_client_node_proxy *p)
 #define PW_CLIENT_NODE_PROXY_EVENT_PORT_USE_BUFFERS	8
 #define PW_CLIENT_NODE_PROXY_EVENT_PORT_COMMAND		9
 #define PW_CLIENT_NODE_PROXY_EVENT_PORT_SET_IO		10
-#define PW_CLIENT_NODE_PROXY_EVENT_NUM			11
+#define PW_CLIENT_NODE_PROXY_EVENT_PORT_SET_PEER	11
+#define PW_CLIENT_NODE_PROXY_EVENT_NUM			12
 
 /** \ref pw_client_node events */
 struct pw_client_node_proxy_events {
@@ -446,6 +532,26 @@ struct pw_client_node_proxy_events {
 			     uint32_t mem_id,
 			     uint32_t offset,
 			     uint32_t size);
+	/**
+	 * Link a port directly to a port of another client node
+	 *
+	 * The io of the port is exchanged with the peer port through the
+	 * transport of the peer and the peer is woken up with \a signalfd,
+	 * without going through the server. When \a transport is NULL, the
+	 * direct link is removed and the server is signaled again.
+	 *
+	 * \param direction the direction of the port
+	 * \param port_id the port id
+	 * \param peer_port_id the port id on the peer
+	 * \param signalfd fd to wake up the peer
+	 * \param transport the transport area of the peer or NULL
+	 */
+	void (*port_set_peer) (void *object,
+			       enum spa_direction direction,
+			       uint32_t port_id,
+			       uint32_t peer_port_id,
+			       int signalfd,
+			       struct pw_client_node_transport *transport);
 };
 
 static inline void
@@ -479,6 +585,8 @@ pw_client_node_proxy_add_listener(struct pw_client_node_proxy *p,
 	pw_resource_notify(r,struct pw_client_node_proxy_events,port_command,__VA_ARGS__)
 #define pw_client_node_resource_port_set_io(r,...)	\
 	pw_resource_notify(r,struct pw_client_node_proxy_events,port_set_io,__VA_ARGS__)
+#define pw_client_node_resource_port_set_peer(r,...)	\
+	pw_resource_notify(r,struct pw_client_node_proxy_events,port_set_peer,__VA_ARGS__)
 
 #ifdef __cplusplus
 }  /* extern "C" */
@@ -92,6 +92,13 @@ struct port {
 
 	uint32_t n_buffers;
 	struct buffer buffers[MAX_BUFFERS];
+
+	struct impl *impl;
+	struct pw_port *port;
+	struct spa_hook port_listener;
+	struct pw_link *link;		/**< output link that can be direct */
+	struct spa_hook link_listener;
+	bool direct;			/**< the peers of the link signal each other */
 };
 
 struct node {
@@ -128,6 +135,7 @@ struct impl {
 	struct pw_client_node this;
 
 	bool client_reuse;
+	bool client_direct;		/**< the client can be linked directly */
 
 	struct pw_core *core;
 	struct pw_type *t;
@@ -272,6 +280,21 @@ static inline void do_flush(struct node *this)
 
 }
 
+static inline void do_signal(struct node *this, enum pw_client_node_message_type message)
+{
+	struct impl *impl = this->impl;
+	struct pw_client_node_activation *a = impl->transport->activation;
+
+	/* clients older than PW_VERSION_CLIENT_NODE_ACTIVATION get a message */
+	if (a == NULL) {
+		pw_client_node_transport_add_message(impl->transport,
+				&PW_CLIENT_NODE_MESSAGE_INIT(message));
+		do_flush(this);
+	}
+	else if (pw_client_node_activation_signal(a, PW_CLIENT_NODE_ACTIVATION_CLIENT, message))
+		do_flush(this);
+}
+
 static int impl_node_send_command(struct spa_node *node, const struct spa_command *command)
 {
 	struct node *this;
@@ -623,7 +646,7 @@ impl_node_port_set_io(struct spa_node *node,
 			return -EINVAL;
 
 		mem_offset += mem->offset;
-		m = ensure_mem(impl, mem->fd, t->data.MemFd, mem->flags);
+		m = ensure_mem(impl, pw_memblock_export(mem), t->data.MemFd, mem->flags);
 		memid = m->id;
 	}
 	else {
@@ -715,12 +738,12 @@ impl_node_port_use_buffers(struct spa_node *node,
 				data_size += d->maxsize;
 		}
 
-		m = ensure_mem(impl, mem->fd, t->data.MemFd, mem->flags);
+		m = ensure_mem(impl, pw_memblock_export(mem), t->data.MemFd, mem->flags);
 		b->memid = m->id;
 
 		mb[i].buffer = &b->buffer;
 		mb[i].mem_id = b->memid;
-		mb[i].offset = SPA_PTRDIFF(baseptr, mem->ptr + mem->offset);
+		mb[i].offset = SPA_PTRDIFF(baseptr, mem->ptr) + mem->offset;
 		mb[i].size = data_size;
 
 		for (j = 0; j < buffers[i]->n_metas; j++)
@@ -851,9 +874,15 @@ static int impl_node_process_input(struct spa_node *node)
 		res = SPA_STATUS_NEED_BUFFER;
 	}
 	else {
+		bool signal = spa_list_is_empty(&n->ports[SPA_DIRECTION_INPUT]);
+
 		spa_list_for_each(p, &n->ports[SPA_DIRECTION_INPUT], link) {
 			struct spa_io_buffers *io = p->io;
 
+			/* the peer of a direct link signals the client */
+			if (GET_IN_PORT(this, p->port_id)->direct)
+				continue;
+
 			pw_log_trace("set io status to %d %d", io->status, io->buffer_id);
 			impl->transport->inputs[p->port_id] = *io;
 
@@ -861,10 +890,10 @@ static int impl_node_process_input(struct spa_node *node)
 			if (!client_reuse && (pp = p->peer))
 		                spa_node_port_reuse_buffer(pp->node->implementation,
 						pp->port_id, io->buffer_id);
+			signal = true;
 		}
-		pw_client_node_transport_add_message(impl->transport,
-			       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT));
-		do_flush(this);
+		if (signal)
+			do_signal(this, PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT);
 
 		impl->input_ready--;
 		res = SPA_STATUS_OK;
@@ -878,30 +907,35 @@ static int impl_node_process_output(struct spa_node *node)
 	struct impl *impl;
 	struct spa_graph_node *n;
 	struct spa_graph_port *p;
+	bool signal;
 
 	this = SPA_CONTAINER_OF(node, struct node, node);
 	impl = this->impl;
 	n = &impl->this.node->rt.node;
-
-	if (impl->out_pending)
-		goto done;
-
-	impl->out_pending = true;
+	signal = spa_list_is_empty(&n->ports[SPA_DIRECTION_OUTPUT]);
 
 	spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
 		struct spa_io_buffers *io = p->io;
 
+		/* the io of a direct link is owned by the peer */
+		if (GET_OUT_PORT(this, p->port_id)->direct)
+			continue;
+
+		signal = true;
+		if (impl->out_pending)
+			continue;
+
 		impl->transport->outputs[p->port_id] = *io;
 
 		pw_log_trace("%d %d -> %d %d", io->status, io->buffer_id,
 				impl->transport->outputs[p->port_id].status,
 				impl->transport->outputs[p->port_id].buffer_id);
 	}
+	if (!signal)
+		return SPA_STATUS_OK;
 
-      done:
-	pw_client_node_transport_add_message(impl->transport,
-			       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT));
-	do_flush(this);
+	impl->out_pending = true;
+	do_signal(this, PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT);
 
 	return SPA_STATUS_OK;
 }
@@ -917,6 +951,8 @@ static int handle_node_message(struct node *this, struct pw_client_node_message
 	switch (PW_CLIENT_NODE_MESSAGE_TYPE(message)) {
 	case PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT:
 		spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
+			if (GET_OUT_PORT(this, p->port_id)->direct)
+				continue;
 			*p->io = impl->transport->outputs[p->port_id];
 			pw_log_trace("have output %d %d", p->io->status, p->io->buffer_id);
 		}
@@ -926,6 +962,8 @@ static int handle_node_message(struct node *this, struct pw_client_node_message
 
 	case PW_CLIENT_NODE_MESSAGE_NEED_INPUT:
 		spa_list_for_each(p, &n->ports[SPA_DIRECTION_INPUT], link) {
+			if (GET_IN_PORT(this, p->port_id)->direct)
+				continue;
 			*p->io = impl->transport->inputs[p->port_id];
 			pw_log_trace("need input %d %d", p->io->status, p->io->buffer_id);
 		}
@@ -949,13 +987,51 @@ static int handle_node_message(struct node *this, struct pw_client_node_message
 	return 0;
 }
 
+static void process_messages(struct node *this)
+{
+	struct impl *impl = this->impl;
+	struct pw_client_node_activation *a = impl->transport->activation;
+	struct pw_client_node_message message;
+	uint32_t flags = 0;
+
+	if (a)
+		pw_client_node_activation_wakeup(a, PW_CLIENT_NODE_ACTIVATION_SERVER);
+	do {
+		if (a)
+			flags = pw_client_node_activation_poll(a, PW_CLIENT_NODE_ACTIVATION_SERVER);
+
+		/* handle the messages that were added before the flags */
+		while (pw_client_node_transport_next_message(impl->transport, &message) == 1) {
+			struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
+			pw_client_node_transport_parse_message(impl->transport, msg);
+			handle_node_message(this, msg);
+		}
+		if (flags == 0)
+			break;
+
+		pw_log_trace("client-node %p: client woke up in %"PRIu64" ns, done in %"PRIu64" ns", impl,
+			     a->awake_time[PW_CLIENT_NODE_ACTIVATION_CLIENT] -
+			     a->signal_time[PW_CLIENT_NODE_ACTIVATION_CLIENT],
+			     a->signal_time[PW_CLIENT_NODE_ACTIVATION_SERVER] -
+			     a->awake_time[PW_CLIENT_NODE_ACTIVATION_CLIENT]);
+
+		if (flags & (1 << PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT))
+			handle_node_message(this,
+				&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT));
+		if (flags & (1 << PW_CLIENT_NODE_MESSAGE_NEED_INPUT))
+			handle_node_message(this,
+				&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_NEED_INPUT));
+	} while (true);
+}
+
 static void setup_transport(struct impl *impl)
 {
 	uint32_t max_inputs = 0, max_outputs = 0, n_inputs = 0, n_outputs = 0;
 
 	spa_node_get_n_ports(&impl->node.node, &n_inputs, &max_inputs, &n_outputs, &max_outputs);
 
-	impl->transport = pw_client_node_transport_new(max_inputs, max_outputs);
+	impl->transport = pw_client_node_transport_new(max_inputs, max_outputs,
+			impl->this.resource->version >= PW_VERSION_CLIENT_NODE_ACTIVATION);
 	impl->transport->area->n_input_ports = n_inputs;
 	impl->transport->area->n_output_ports = n_outputs;
 }
@@ -1066,7 +1142,6 @@ static struct pw_client_node_proxy_methods client_node_methods = {
 static void node_on_data_fd_events(struct spa_source *source)
 {
 	struct node *this = source->data;
-	struct impl *impl = this->impl;
 
 	if (source->rmask & (SPA_IO_ERR | SPA_IO_HUP)) {
 		spa_log_warn(this->log, "node %p: got error", this);
@@ -1074,18 +1149,13 @@ static void node_on_data_fd_events(struct spa_source *source)
 	}
 
 	if (source->rmask & SPA_IO_IN) {
-		struct pw_client_node_message message;
 		uint64_t cmd;
 
 		if (read(this->data_source.fd, &cmd, sizeof(uint64_t)) != sizeof(uint64_t))
 			spa_log_warn(this->log, "node %p: error reading message: %s",
 					this, strerror(errno));
 
-		while (pw_client_node_transport_next_message(impl->transport, &message) == 1) {
-			struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
-			pw_client_node_transport_parse_message(impl->transport, msg);
-			handle_node_message(this, msg);
-		}
+		process_messages(this);
 	}
 }
 
@@ -1142,8 +1212,10 @@ node_init(struct node *this,
 	this->data_source.func = node_on_data_fd_events;
 	this->data_source.data = this;
 	this->data_source.fd = -1;
+	this->writefd = -1;
 	this->data_source.mask = SPA_IO_IN | SPA_IO_ERR | SPA_IO_HUP;
 	this->data_source.rmask = 0;
+	this->data_source.priority = SPA_SOURCE_PRIORITY_RT;
 
 	this->seq = 1;
 
@@ -1248,10 +1320,211 @@ static void node_free(void *data)
 	free(impl);
 }
 
+static struct impl *node_get_client_node(struct pw_node *node)
+{
+	struct node *n;
+
+	if (node == NULL || node->node == NULL ||
+	    node->node->process_input != impl_node_process_input)
+		return NULL;
+
+	n = SPA_CONTAINER_OF(node->node, struct node, node);
+	return n->impl;
+}
+
+static inline bool is_only_link(struct spa_list *link, struct spa_list *list)
+{
+	return list->next == link && list->prev == link;
+}
+
+/* a direct link gives each client the transport and eventfd of the other,
+ * only do that for clients that asked for it and run as the same user */
+static bool can_link_direct(struct impl *impl, struct impl *peer)
+{
+	const struct ucred *u1, *u2;
+
+	if (!impl->client_direct || !peer->client_direct ||
+	    impl->node.resource == NULL || peer->node.resource == NULL)
+		return false;
+
+	u1 = pw_client_get_ucred(pw_resource_get_client(impl->node.resource));
+	u2 = pw_client_get_ucred(pw_resource_get_client(peer->node.resource));
+
+	return u1 != NULL && u2 != NULL && u1->uid == u2->uid;
+}
+
+static void set_direct(struct port *p, bool direct)
+{
+	struct impl *impl = p->impl, *peer;
+	struct pw_link *link = p->link;
+	struct pw_port *output = link->output, *input = link->input;
+
+	if (p->direct == direct)
+		return;
+
+	p->direct = direct;
+	peer = node_get_client_node(input->node);
+	if (peer)
+		peer->node.in_ports[input->port_id].direct = direct;
+
+	pw_log_debug("client-node %p: link %p %s direct to %p", impl, link,
+		     direct ? "is" : "no longer", peer);
+
+	if (impl->node.resource)
+		pw_client_node_resource_port_set_peer(impl->node.resource,
+						      SPA_DIRECTION_OUTPUT, output->port_id,
+						      input->port_id,
+						      direct ? peer->node.writefd : -1,
+						      direct ? peer->transport : NULL);
+	if (peer && peer->node.resource)
+		pw_client_node_resource_port_set_peer(peer->node.resource,
+						      SPA_DIRECTION_INPUT, input->port_id,
+						      output->port_id,
+						      direct ? impl->node.writefd : -1,
+						      direct ? impl->transport : NULL);
+}
+
+/* A link between two client nodes that is the only link on both of its
+ * ports uses the same buffers on both sides. The clients can then exchange
+ * the io and wake each other up without the server data loop. */
+static void update_direct(struct port *p)
+{
+	struct impl *impl = p->impl, *peer;
+	struct pw_link *link = p->link;
+	bool direct;
+
+	if (link == NULL)
+		return;
+
+	peer = link->input ? node_get_client_node(link->input->node) : NULL;
+
+	direct = peer != NULL &&
+		 link->state >= PW_LINK_STATE_PAUSED &&
+		 can_link_direct(impl, peer) &&
+		 impl->node.writefd != -1 && peer->node.writefd != -1 &&
+		 /* the clients signal each other with the activation record */
+		 impl->transport->activation != NULL && peer->transport->activation != NULL &&
+		 link->output->port_id < impl->transport->area->max_output_ports &&
+		 link->input->port_id < peer->transport->area->max_input_ports &&
+		 is_only_link(&link->output_link, &link->output->links) &&
+		 is_only_link(&link->input_link, &link->input->links) &&
+		 link->input->mix_allocation.n_buffers == 0;
+
+	set_direct(p, direct);
+}
+
+static void update_port_links(struct pw_port *port)
+{
+	struct pw_link *link;
+	struct impl *impl;
+	struct port *p;
+
+	if (port->direction == PW_DIRECTION_OUTPUT) {
+		spa_list_for_each(link, &port->links, output_link) {
+			if ((impl = node_get_client_node(link->output->node)) == NULL)
+				continue;
+			p = &impl->node.out_ports[link->output->port_id];
+			if (p->link == link)
+				update_direct(p);
+		}
+	} else {
+		spa_list_for_each(link, &port->links, input_link) {
+			if (link->output == NULL ||
+			    (impl = node_get_client_node(link->output->node)) == NULL)
+				continue;
+			p = &impl->node.out_ports[link->output->port_id];
+			if (p->link == link)
+				update_direct(p);
+		}
+	}
+}
+
+static void link_state_changed(void *data, enum pw_link_state old,
+			       enum pw_link_state state, const char *error)
+{
+	update_direct(data);
+}
+
+static void link_destroy(void *data)
+{
+	struct port *p = data;
+
+	set_direct(p, false);
+	spa_hook_remove(&p->link_listener);
+	p->link = NULL;
+}
+
+static const struct pw_link_events link_events = {
+	PW_VERSION_LINK_EVENTS,
+	.destroy = link_destroy,
+	.state_changed = link_state_changed,
+};
+
+static void watch_link(struct port *p, struct pw_link *link)
+{
+	p->link = link;
+	p->direct = false;
+	pw_link_add_listener(link, &p->link_listener, &link_events, p);
+}
+
+static void port_link_added(void *data, struct pw_link *link)
+{
+	struct port *p = data;
+
+	if (p->port->direction == PW_DIRECTION_OUTPUT && p->link == NULL)
+		watch_link(p, link);
+
+	update_port_links(p->port);
+}
+
+static void port_link_removed(void *data, struct pw_link *link)
+{
+	struct port *p = data;
+	struct pw_port *port = p->port;
+
+	if (port->direction == PW_DIRECTION_OUTPUT && p->link == NULL &&
+	    !spa_list_is_empty(&port->links))
+		watch_link(p, spa_list_first(&port->links, struct pw_link, output_link));
+
+	update_port_links(port);
+}
+
+static void port_destroy(void *data)
+{
+	struct port *p = data;
+
+	spa_hook_remove(&p->port_listener);
+	p->port = NULL;
+}
+
+static const struct pw_port_events port_events = {
+	PW_VERSION_PORT_EVENTS,
+	.destroy = port_destroy,
+	.link_added = port_link_added,
+	.link_removed = port_link_removed,
+};
+
+static void node_port_added(void *data, struct pw_port *port)
+{
+	struct impl *impl = data;
+	struct node *this = &impl->node;
+	enum spa_direction direction = port->direction;
+	struct port *p;
+
+	if (!CHECK_PORT_ID(this, direction, port->port_id))
+		return;
+
+	p = GET_PORT(this, direction, port->port_id);
+	p->impl = impl;
+	p->port = port;
+	pw_port_add_listener(port, &p->port_listener, &port_events, p);
+}
+
 static const struct pw_node_events node_events = {
 	PW_VERSION_NODE_EVENTS,
 	.free = node_free,
 	.initialized = node_initialized,
+	.port_added = node_port_added,
 };
 
 static const struct pw_resource_events resource_events = {
@@ -1318,6 +1591,9 @@ struct pw_client_node *pw_client_node_new(struct pw_resource *resource,
 	str = pw_properties_get(properties, "pipewire.client.reuse");
 	impl->client_reuse = str && pw_properties_parse_bool(str);
 
+	str = pw_properties_get(properties, "pipewire.client.direct");
+	impl->client_direct = str && pw_properties_parse_bool(str);
+
 	pw_resource_add_listener(this->resource,
 				 &impl->resource_listener,
 				 &resource_events,
@@ -18,6 +18,7 @@
  */
 
 #include <errno.h>
+#include <unistd.h>
 
 #include <spa/pod/parser.h>
 
@@ -439,6 +440,46 @@ static int client_node_demarshal_port_set_io(void *object, void *data, size_t si
 	return 0;
 }
 
+static int client_node_demarshal_port_set_peer(void *object, void *data, size_t size)
+{
+	struct pw_proxy *proxy = object;
+	struct spa_pod_parser prs;
+	uint32_t direction, port_id, peer_port_id, sidx, memfd_idx;
+	int signalfd;
+	struct pw_client_node_transport_info info;
+	struct pw_client_node_transport *transport = NULL;
+
+	spa_pod_parser_init(&prs, data, size, 0);
+	if (spa_pod_parser_get(&prs,
+			"["
+			"i", &direction,
+			"i", &port_id,
+			"i", &peer_port_id,
+			"i", &sidx,
+			"i", &memfd_idx,
+			"i", &info.offset,
+			"i", &info.size, NULL) < 0)
+		return -EINVAL;
+
+	signalfd = pw_protocol_native_get_proxy_fd(proxy, sidx);
+	info.memfd = pw_protocol_native_get_proxy_fd(proxy, memfd_idx);
+
+	if (signalfd != -1 && info.memfd != -1)
+		transport = pw_client_node_transport_new_from_info(&info);
+
+	if (transport == NULL && signalfd != -1) {
+		close(signalfd);
+		signalfd = -1;
+	}
+
+	pw_proxy_notify(proxy, struct pw_client_node_proxy_events, port_set_peer, 0,
+							direction, port_id,
+							peer_port_id,
+							signalfd,
+							transport);
+	return 0;
+}
+
 static void
 client_node_marshal_add_mem(void *object,
 			    uint32_t mem_id,
@@ -681,6 +722,35 @@ client_node_marshal_port_set_io(void *object,
 	pw_protocol_native_end_resource(resource, b);
 }
 
+static void
+client_node_marshal_port_set_peer(void *object,
+				  uint32_t direction,
+				  uint32_t port_id,
+				  uint32_t peer_port_id,
+				  int signalfd,
+				  struct pw_client_node_transport *transport)
+{
+	struct pw_resource *resource = object;
+	struct spa_pod_builder *b;
+	struct pw_client_node_transport_info info = { -1, };
+
+	if (transport)
+		pw_client_node_transport_get_info(transport, &info);
+
+	b = pw_protocol_native_begin_resource(resource, PW_CLIENT_NODE_PROXY_EVENT_PORT_SET_PEER);
+
+	spa_pod_builder_struct(b,
+			       "i", direction,
+			       "i", port_id,
+			       "i", peer_port_id,
+			       "i", transport ? pw_protocol_native_add_resource_fd(resource, signalfd) : -1,
+			       "i", transport ? pw_protocol_native_add_resource_fd(resource, info.memfd) : -1,
+			       "i", info.offset,
+			       "i", info.size);
+
+	pw_protocol_native_end_resource(resource, b);
+}
+
 
 static int client_node_demarshal_done(void *object, void *data, size_t size)
 {
@@ -867,6 +937,7 @@ static const struct pw_client_node_proxy_events pw_protocol_native_client_node_e
 	&client_node_marshal_port_use_buffers,
 	&client_node_marshal_port_command,
 	&client_node_marshal_port_set_io,
+	&client_node_marshal_port_set_peer,
 };
 
 static const struct pw_protocol_native_demarshal pw_protocol_native_client_node_event_demarshal[] = {
@@ -881,6 +952,7 @@ static const struct pw_protocol_native_demarshal pw_protocol_native_client_node_
 	{ &client_node_demarshal_port_use_buffers, PW_PROTOCOL_NATIVE_REMAP },
 	{ &client_node_demarshal_port_command, PW_PROTOCOL_NATIVE_REMAP },
 	{ &client_node_demarshal_port_set_io, PW_PROTOCOL_NATIVE_REMAP },
+	{ &client_node_demarshal_port_set_peer, 0 },
 };
 
 static const struct pw_protocol_marshal pw_protocol_native_client_node_marshal = {
@@ -57,7 +57,9 @@ static size_t area_get_size(struct pw_client_node_area *area)
 	return size;
 }
 
-static void transport_setup_area(void *p, struct pw_client_node_transport *trans)
+/* the activation record comes after the area when the transport has one */
+static void transport_setup_area(void *p, struct pw_client_node_transport *trans,
+				 bool activation)
 {
 	struct pw_client_node_area *a;
 
@@ -81,6 +83,8 @@ static void transport_setup_area(void *p, struct pw_client_node_transport *trans
 
 	trans->output_data = p;
 	p = SPA_MEMBER(p, OUTPUT_BUFFER_SIZE, void);
+
+	trans->activation = activation ? p : NULL;
 }
 
 static void transport_reset_area(struct pw_client_node_transport *trans)
@@ -98,6 +102,8 @@ static void transport_reset_area(struct pw_client_node_transport *trans)
 	}
 	spa_ringbuffer_init(trans->input_buffer);
 	spa_ringbuffer_init(trans->output_buffer);
+	if (trans->activation)
+		memset(trans->activation, 0, sizeof(struct pw_client_node_activation));
 }
 
 static void destroy(struct pw_client_node_transport *trans)
@@ -179,15 +185,18 @@ static int parse_message(struct pw_client_node_transport *trans, void *message)
 /** Create a new transport
  * \param max_input_ports maximum number of input_ports
  * \param max_output_ports maximum number of output_ports
+ * \param activation add an activation record
  * \return a newly allocated \ref pw_client_node_transport
  * \memberof pw_client_node_transport
  */
 struct pw_client_node_transport *
-pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports)
+pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports,
+			     bool activation)
 {
 	struct transport *impl;
 	struct pw_client_node_transport *trans;
 	struct pw_client_node_area area = { 0 };
+	size_t size;
 
 	area.max_input_ports = max_input_ports;
 	area.n_input_ports = 0;
@@ -201,17 +210,22 @@ pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports
 	pw_log_debug("transport %p: new %d %d", impl, max_input_ports, max_output_ports);
 
 	trans = &impl->trans;
-	impl->offset = 0;
+
+	size = area_get_size(&area);
+	if (activation)
+		size += sizeof(struct pw_client_node_activation);
 
 	if (pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
 			  PW_MEMBLOCK_FLAG_MAP_READWRITE |
 			  PW_MEMBLOCK_FLAG_SEAL,
-			  area_get_size(&area),
+			  size,
 			  &impl->mem) < 0)
 		return NULL;
 
+	impl->offset = impl->mem->offset;
+
 	memcpy(impl->mem->ptr, &area, sizeof(struct pw_client_node_area));
-	transport_setup_area(impl->mem->ptr, trans);
+	transport_setup_area(impl->mem->ptr, trans, activation);
 	transport_reset_area(trans);
 
 	trans->destroy = destroy;
@@ -249,7 +263,10 @@ pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *inf
 
 	impl->offset = info->offset;
 
-	transport_setup_area(impl->mem->ptr, trans);
+	/* older servers don't add the activation record */
+	transport_setup_area(impl->mem->ptr, trans,
+			     info->size >= area_get_size(impl->mem->ptr) +
+					   sizeof(struct pw_client_node_activation));
 
 	tmp = trans->output_buffer;
 	trans->output_buffer = trans->input_buffer;
@@ -287,7 +304,7 @@ int pw_client_node_transport_get_info(struct pw_client_node_transport *trans,
 {
 	struct transport *impl = (struct transport *) trans;
 
-	info->memfd = impl->mem->fd;
+	info->memfd = pw_memblock_export(impl->mem);
 	info->offset = impl->offset;
 	info->size = impl->mem->size;
 
@@ -78,6 +78,7 @@ struct client {
         struct spa_hook conn_listener;
 
         bool disconnecting;
+	bool blocked;
 	bool flush_signaled;
         struct spa_source *flush_event;
 };
@@ -100,6 +101,7 @@ struct client_data {
 	struct spa_source *source;
 	struct pw_protocol_native_connection *connection;
 	bool busy;
+	bool blocked;
 };
 
 static bool pod_remap_data(uint32_t type, void *body, uint32_t size, struct pw_map *types)
@@ -248,20 +250,44 @@ process_messages(struct client_data *data)
 	goto done;
 }
 
+static void update_io(struct client_data *c)
+{
+	struct pw_client *client = c->client;
+	enum spa_io mask = SPA_IO_ERR | SPA_IO_HUP;
+
+	if (!c->busy)
+		mask |= SPA_IO_IN;
+	if (c->blocked)
+		mask |= SPA_IO_OUT;
+
+	pw_loop_update_io(client->core->main_loop, c->source, mask);
+}
+
+/* write the queued messages, wait for the socket to become writable when
+ * it is full */
+static void flush_client(struct client_data *c)
+{
+	bool blocked;
+
+	pw_protocol_native_connection_flush(c->connection);
+
+	blocked = pw_protocol_native_connection_is_blocked(c->connection);
+	if (blocked != c->blocked) {
+		c->blocked = blocked;
+		update_io(c);
+	}
+}
+
 static void
 client_busy_changed(void *data, bool busy)
 {
 	struct client_data *c = data;
 	struct pw_client *client = c->client;
-	enum spa_io mask = SPA_IO_ERR | SPA_IO_HUP;
 
 	c->busy = busy;
 
-	if (!busy)
-		mask |= SPA_IO_IN;
-
 	pw_log_debug("protocol-native %p: busy changed %d", client->protocol, busy);
-	pw_loop_update_io(client->core->main_loop, c->source, mask);
+	update_io(c);
 
 	if (!busy)
 		process_messages(c);
@@ -280,6 +306,9 @@ connection_data(void *data, int fd, enum spa_io mask)
 		return;
 	}
 
+	if (mask & SPA_IO_OUT)
+		flush_client(this);
+
 	if (mask & SPA_IO_IN)
 		process_messages(this);
 }
@@ -311,6 +340,7 @@ static struct pw_client *client_new(struct server *s, int fd)
 	struct ucred ucred, *ucredp;
 	struct pw_core *core = protocol->core;
 	struct pw_properties *props;
+	const char *str;
 
 	len = sizeof(ucred);
 	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &ucred, &len) < 0) {
@@ -342,6 +372,10 @@ static struct pw_client *client_new(struct server *s, int fd)
 	if (this->connection == NULL)
 		goto no_connection;
 
+	str = pw_properties_get(pw_core_get_properties(core), PW_CORE_PROP_PROTOCOL_RING);
+	if (str != NULL && atoi(str) > 0)
+		pw_protocol_native_connection_accept_ring(this->connection, atoi(str));
+
 	client->protocol = protocol;
 	spa_list_append(&s->this.client_list, &client->protocol_link);
 
@@ -500,6 +534,26 @@ static int impl_steal_fd(struct pw_protocol_client *client)
 	return fd;
 }
 
+static void flush_remote(struct client *impl)
+{
+	struct pw_remote *remote = impl->this.remote;
+	bool blocked;
+
+	if (!pw_protocol_native_connection_flush(impl->connection)) {
+		impl->this.disconnect(&impl->this);
+		return;
+	}
+
+	/* wait for the socket to become writable when it is full */
+	blocked = pw_protocol_native_connection_is_blocked(impl->connection);
+	if (blocked != impl->blocked && impl->source) {
+		impl->blocked = blocked;
+		pw_loop_update_io(remote->core->main_loop, impl->source,
+				  SPA_IO_IN | SPA_IO_HUP | SPA_IO_ERR |
+				  (blocked ? SPA_IO_OUT : 0));
+	}
+}
+
 static void
 on_remote_data(void *data, int fd, enum spa_io mask)
 {
@@ -516,6 +570,12 @@ on_remote_data(void *data, int fd, enum spa_io mask)
 		return;
         }
 
+	if (mask & SPA_IO_OUT) {
+		flush_remote(impl);
+		if (impl->connection == NULL)
+			return;
+	}
+
         if (mask & SPA_IO_IN) {
                 uint8_t opcode;
                 uint32_t id;
@@ -578,8 +638,7 @@ static void do_flush_event(void *data, uint64_t count)
         struct client *impl = data;
 	impl->flush_signaled = false;
         if (impl->connection)
-                if (!pw_protocol_native_connection_flush(impl->connection))
-                        impl->this.disconnect(&impl->this);
+		flush_remote(impl);
 }
 
 static void on_need_flush(void *data)
@@ -602,8 +661,10 @@ static int impl_connect_fd(struct pw_protocol_client *client, int fd)
 {
 	struct client *impl = SPA_CONTAINER_OF(client, struct client, this);
 	struct pw_remote *remote = client->remote;
+	const char *str;
 
 	impl->disconnecting = false;
+	impl->blocked = false;
 
 	impl->connection = pw_protocol_native_connection_new(remote->core, fd);
 	if (impl->connection == NULL)
@@ -614,6 +675,11 @@ static int impl_connect_fd(struct pw_protocol_client *client, int fd)
 						   &conn_events,
 						   impl);
 
+	str = pw_properties_get(pw_remote_get_properties(remote), PW_REMOTE_PROP_PROTOCOL_RING);
+	if (str != NULL && atoi(str) > 0 &&
+	    pw_protocol_native_connection_enable_ring(impl->connection, atoi(str)) < 0)
+		pw_log_warn("protocol-native %p: can't enable ring", client->protocol);
+
         impl->source = pw_loop_add_io(remote->core->main_loop,
                                       fd,
                                       SPA_IO_IN | SPA_IO_HUP | SPA_IO_ERR,
@@ -730,7 +796,7 @@ static void on_before_hook(void *_data)
 
 	spa_list_for_each_safe(client, tmp, &this->client_list, protocol_link) {
 		data = client->user_data;
-		pw_protocol_native_connection_flush(data->connection);
+		flush_client(data);
 	}
 }
 
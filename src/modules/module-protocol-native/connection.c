@@ -23,9 +23,13 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 
 #include <spa/debug/pod.h>
+#include <spa/pod/parser.h>
+#include <spa/utils/ringbuffer.h>
 
 #include <pipewire/pipewire.h>
 #include <pipewire/private.h>
@@ -34,32 +38,115 @@
 
 #define MAX_BUFFER_SIZE (1024 * 32)
 #define MAX_FDS 28
+/* fds of a partially received batch and of the next one */
+#define MAX_IN_FDS (MAX_FDS * 2)
+
+#define CHUNK_SIZE (1024 * 32)
+#define MAX_FREE_CHUNKS 4
+#define MAX_IOV 64
+
+/* 4 for dest_id, 1 for opcode, 3 for size, 4 for seq and 4 for n_fds */
+#define HDR_SIZE 16
+
+/* messages for the connection itself */
+#define CONTROL_ID		SPA_ID_INVALID
+#define CONTROL_ENABLE_RING	0
+
+#define RING_DATA_OFFSET 64
+#define MAX_RING_SIZE (16 * 1024 * 1024)
+
+#ifndef F_GET_SEALS
+#define F_GET_SEALS	(1024 + 10)
+#define F_SEAL_SHRINK	0x0002
+#define F_SEAL_GROW	0x0004
+#endif
 
 static bool debug_messages = 0;
 
+/** shared memory in front of a ring */
+struct ring_header {
+	struct spa_ringbuffer rb;
+	int32_t reader_waiting;	/**< the reader wants a wakeup when data is written */
+	int32_t writer_waiting;	/**< the writer wants a wakeup when data is read */
+};
+
+/** a ring in shared memory that carries the messages of one direction.
+ * The socket then only carries wakeups and fds. */
+struct ring {
+	struct pw_memblock *mem;
+	struct ring_header *hdr;
+	void *data;
+	uint32_t size;
+};
+
 struct buffer {
 	uint8_t *buffer_data;
 	size_t buffer_size;
 	size_t buffer_maxsize;
-	int fds[MAX_FDS];
+	int fds[MAX_IN_FDS];
 	uint32_t n_fds;
 
 	size_t offset;
 	void *data;
 	size_t size;
+	uint32_t msg_fds;	/**< fds of the current message */
 
 	bool update;
+
+	struct ring ring;
+	bool drain;		/**< read wakeups from the socket */
+
+	uint32_t seq;		/**< seq of the next message */
+};
+
+/** a piece of the output queue, messages don't cross chunks */
+struct chunk {
+	struct spa_list link;
+	size_t size;		/**< bytes of complete messages */
+	size_t maxsize;
+	uint8_t data[0];
+};
+
+/** fds of a queued message */
+struct fd_group {
+	uint64_t pos;		/**< position of the message in the stream */
+	uint32_t n_fds;
+};
+
+struct out_buffer {
+	struct spa_list chunks;
+	struct spa_list free;	/**< spare chunks */
+	uint32_t n_free;
+	size_t offset;		/**< bytes sent from the first chunk */
+
+	uint64_t queued;	/**< stream position of queued and sent bytes */
+	uint64_t sent;
+	uint64_t fds_end;	/**< position after the last message with sent fds */
+
+	struct pw_array fds;	/**< all queued fds */
+	struct pw_array groups;	/**< fd_group for each message with fds */
+	uint32_t msg_fds;	/**< first fd of the message being written */
+
+	uint32_t seq;
+
+	struct ring ring;
+	uint64_t ring_start;	/**< position of the first message in the ring */
+	bool wakeup;		/**< a wakeup for the peer is pending */
+	bool blocked;		/**< the socket was full on the last flush */
 };
 
 struct impl {
 	struct pw_protocol_native_connection this;
 
-	struct buffer in, out;
+	struct buffer in;
+	struct out_buffer out;
 
 	uint32_t dest_id;
 	uint8_t opcode;
 	struct spa_pod_builder builder;
 
+	uint32_t max_peer_ring;	/**< max size of a ring of the peer, 0 refuses */
+
 	struct pw_core *core;
 };
 
@@ -71,13 +158,15 @@ struct impl {
  * \param index the index of the fd to get
  * \return the fd at \a index or -1 when no such fd exists
  *
+ * The index is relative to the fds of the current message.
+ *
  * \memberof pw_protocol_native_connection
  */
 int pw_protocol_native_connection_get_fd(struct pw_protocol_native_connection *conn, uint32_t index)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
 
-	if (index >= impl->in.n_fds)
+	if (index >= impl->in.msg_fds)
 		return -1;
 
 	return impl->in.fds[index];
@@ -89,26 +178,31 @@ int pw_protocol_native_connection_get_fd(struct pw_protocol_native_connection *c
  * \param fd the fd to add
  * \return the index of the fd or -1 when an error occured
  *
+ * The fd is sent along with the message that is being written.
+ *
  * \memberof pw_protocol_native_connection
  */
 uint32_t pw_protocol_native_connection_add_fd(struct pw_protocol_native_connection *conn, int fd)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
-	uint32_t index, i;
+	struct out_buffer *buf = &impl->out;
+	uint32_t index, i, n_fds = pw_array_get_len(&buf->fds, int);
+	int *fds = buf->fds.data, *p;
 
-	for (i = 0; i < impl->out.n_fds; i++) {
-		if (impl->out.fds[i] == fd)
-			return i;
+	for (i = buf->msg_fds; i < n_fds; i++) {
+		if (fds[i] == fd)
+			return i - buf->msg_fds;
 	}
 
-	index = impl->out.n_fds;
+	index = n_fds - buf->msg_fds;
 	if (index >= MAX_FDS) {
 		pw_log_error("connection %p: too many fds", conn);
 		return -1;
 	}
 
-	impl->out.fds[index] = fd;
-	impl->out.n_fds++;
+	if ((p = pw_array_add(&buf->fds, sizeof(int))) == NULL)
+		return -1;
+	*p = fd;
 
 	return index;
 }
@@ -129,16 +223,70 @@ static void *connection_ensure_size(struct pw_protocol_native_connection *conn,
 	return (uint8_t *) buf->buffer_data + buf->buffer_size;
 }
 
-static bool refill_buffer(struct pw_protocol_native_connection *conn, struct buffer *buf)
+static void add_in_fds(struct pw_protocol_native_connection *conn, struct buffer *buf,
+		       const int *fds, uint32_t n_fds)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_fds; i++) {
+		if (buf->n_fds < MAX_IN_FDS) {
+			buf->fds[buf->n_fds++] = fds[i];
+		} else {
+			pw_log_error("connection %p: too many fds, closing %d", conn, fds[i]);
+			close(fds[i]);
+		}
+	}
+}
+
+static int init_ring(struct ring *r, struct pw_memblock *mem, uint32_t size)
+{
+	if (size == 0 || (size & (size - 1)) != 0 || size > MAX_RING_SIZE ||
+	    mem->size < RING_DATA_OFFSET + size)
+		return -EINVAL;
+
+	r->mem = mem;
+	r->hdr = mem->ptr;
+	r->data = SPA_MEMBER(mem->ptr, RING_DATA_OFFSET, void);
+	r->size = size;
+
+	return 0;
+}
+
+/* the peer can write in the ring at any time, make sure it can't shrink the
+ * memory under us or make it larger than what we map */
+static bool check_ring_fd(int fd, uint32_t size)
+{
+	struct stat st;
+	int seals;
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) (RING_DATA_OFFSET + size))
+		return false;
+
+	seals = fcntl(fd, F_GET_SEALS);
+	if (seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW))
+		return false;
+
+	return true;
+}
+
+static void clear_ring(struct ring *r)
+{
+	pw_memblock_free(r->mem);
+	spa_zero(*r);
+}
+
+static ssize_t read_socket(struct pw_protocol_native_connection *conn, struct buffer *buf,
+			   void *data, size_t size)
 {
 	ssize_t len;
 	struct cmsghdr *cmsg;
 	struct msghdr msg = { 0 };
 	struct iovec iov[1];
 	char cmsgbuf[CMSG_SPACE(MAX_FDS * sizeof(int))];
+	uint32_t n_fds = buf->n_fds;
 
-	iov[0].iov_base = buf->buffer_data + buf->buffer_size;
-	iov[0].iov_len = buf->buffer_maxsize - buf->buffer_size;
+	iov[0].iov_base = data;
+	iov[0].iov_len = size;
 	msg.msg_iov = iov;
 	msg.msg_iovlen = 1;
 	msg.msg_control = cmsgbuf;
@@ -152,42 +300,198 @@ static bool refill_buffer(struct pw_protocol_native_connection *conn, struct buf
 				continue;
 			if (errno != EAGAIN || errno != EWOULDBLOCK)
 				goto recv_error;
-			return false;
+			return -1;
 		}
 		break;
 	}
 
-	buf->buffer_size += len;
-
-	/* handle control messages */
-	buf->n_fds = 0;
+	/* handle control messages, the fds are queued until the messages
+	 * that use them are read */
 	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
 		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
 			continue;
 
-		buf->n_fds =
-		    (cmsg->cmsg_len - ((char *) CMSG_DATA(cmsg) - (char *) cmsg)) / sizeof(int);
-		memcpy(buf->fds, CMSG_DATA(cmsg), buf->n_fds * sizeof(int));
+		add_in_fds(conn, buf, (int *) CMSG_DATA(cmsg),
+		    (cmsg->cmsg_len - ((char *) CMSG_DATA(cmsg) - (char *) cmsg)) / sizeof(int));
 	}
 	pw_log_trace("connection %p: %d read %zd bytes and %d fds", conn, conn->fd, len,
-		     buf->n_fds);
+		     buf->n_fds - n_fds);
 
-	return true;
+	return len;
 
 	/* ERRORS */
       recv_error:
 	pw_log_error("could not recvmsg on fd %d: %s", conn->fd, strerror(errno));
-	return false;
+	return -1;
+}
+
+static bool send_wakeup(struct pw_protocol_native_connection *conn, const int *fds, uint32_t n_fds)
+{
+	struct msghdr msg = { 0 };
+	struct iovec iov[1];
+	struct cmsghdr *cmsg;
+	char cmsgbuf[CMSG_SPACE(MAX_FDS * sizeof(int))];
+	uint8_t wakeup = 1;
+	ssize_t len;
+
+	iov[0].iov_base = &wakeup;
+	iov[0].iov_len = 1;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 1;
+
+	if (n_fds > 0) {
+		msg.msg_control = cmsgbuf;
+		msg.msg_controllen = CMSG_SPACE(n_fds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(n_fds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, n_fds * sizeof(int));
+		msg.msg_controllen = cmsg->cmsg_len;
+	}
+
+	while (true) {
+		len = sendmsg(conn->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			/* when the socket is full, the peer has wakeups to read */
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				pw_log_error("could not send wakeup: %s", strerror(errno));
+			return false;
+		}
+		break;
+	}
+	pw_log_trace("connection %p: %d sent wakeup with %u fds", conn, conn->fd, n_fds);
+	return true;
+}
+
+/* wake up the peer when it waits for room in our in ring. The wakeup
+ * can only go out after the messages that were sent before our ring. */
+static void wakeup_peer(struct impl *impl)
+{
+	struct out_buffer *buf = &impl->out;
+
+	if (buf->ring.hdr != NULL && buf->sent >= buf->ring_start) {
+		send_wakeup(&impl->this, NULL, 0);
+	} else {
+		buf->wakeup = true;
+		spa_hook_list_call(&impl->this.listener_list,
+				struct pw_protocol_native_connection_events, need_flush, 0);
+	}
+}
+
+/* read the wakeups and the fds that the peer sent on the socket */
+static void read_wakeups(struct impl *impl)
+{
+	struct buffer *buf = &impl->in;
+	uint8_t wakeups[256];
+
+	while (read_socket(&impl->this, buf, wakeups, sizeof(wakeups)) > 0);
+
+	/* the peer made room in its ring */
+	if (impl->out.sent < impl->out.queued || impl->out.wakeup)
+		spa_hook_list_call(&impl->this.listener_list,
+				struct pw_protocol_native_connection_events, need_flush, 0);
+}
+
+static bool refill_ring(struct impl *impl, struct buffer *buf)
+{
+	struct ring *r = &buf->ring;
+	uint32_t index, len;
+	int32_t avail;
+
+	avail = spa_ringbuffer_get_read_index(&r->hdr->rb, &index);
+	if (avail == 0) {
+		/* ask for a wakeup and check again for data that was
+		 * written in the meantime */
+		__atomic_store_n(&r->hdr->reader_waiting, 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		avail = spa_ringbuffer_get_read_index(&r->hdr->rb, &index);
+		if (avail == 0)
+			return false;
+	}
+	if (avail < 0 || avail > (int32_t) r->size) {
+		pw_log_error("connection %p: invalid ring state %d", impl, avail);
+		return false;
+	}
+
+	len = SPA_MIN((uint32_t) avail, buf->buffer_maxsize - buf->buffer_size);
+	spa_ringbuffer_read_data(&r->hdr->rb, r->data, r->size, index & (r->size - 1),
+				 buf->buffer_data + buf->buffer_size, len);
+	spa_ringbuffer_read_update(&r->hdr->rb, index + len);
+	buf->buffer_size += len;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&r->hdr->writer_waiting, 0, __ATOMIC_SEQ_CST))
+		wakeup_peer(impl);
+
+	pw_log_trace("connection %p: read %u bytes from ring", impl, len);
+
+	return true;
+}
+
+static bool refill_buffer(struct pw_protocol_native_connection *conn, struct buffer *buf)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	ssize_t len;
+
+	if (buf->ring.hdr != NULL)
+		return refill_ring(impl, buf);
+
+	len = read_socket(conn, buf, buf->buffer_data + buf->buffer_size,
+			  buf->buffer_maxsize - buf->buffer_size);
+	if (len < 0)
+		return false;
+
+	buf->buffer_size += len;
+
+	return true;
 }
 
 static void clear_buffer(struct buffer *buf)
 {
-	buf->n_fds = 0;
 	buf->offset = 0;
 	buf->size = 0;
 	buf->buffer_size = 0;
 }
 
+/* move the partial message at the read offset to the start of the buffer */
+static void compact_buffer(struct buffer *buf)
+{
+	if (buf->offset == 0)
+		return;
+
+	memmove(buf->buffer_data, buf->buffer_data + buf->offset,
+		buf->buffer_size - buf->offset);
+	buf->buffer_size -= buf->offset;
+	buf->offset = 0;
+}
+
+static void release_chunk(struct out_buffer *buf, struct chunk *c)
+{
+	spa_list_remove(&c->link);
+	if (buf->n_free < MAX_FREE_CHUNKS && c->maxsize == CHUNK_SIZE) {
+		spa_list_append(&buf->free, &c->link);
+		buf->n_free++;
+	} else
+		free(c);
+}
+
+static void clear_out_buffer(struct out_buffer *buf)
+{
+	struct chunk *c, *t;
+
+	spa_list_for_each_safe(c, t, &buf->chunks, link)
+		release_chunk(buf, c);
+	buf->offset = 0;
+	buf->sent = buf->queued;
+	buf->fds.size = 0;
+	buf->groups.size = 0;
+	buf->msg_fds = 0;
+	buf->blocked = false;
+}
+
 /** Make a new connection object for the given socket
  *
  * \param fd the socket
@@ -213,21 +517,21 @@ struct pw_protocol_native_connection *pw_protocol_native_connection_new(struct p
 	this->fd = fd;
 	spa_hook_list_init(&this->listener_list);
 
-	impl->out.buffer_data = malloc(MAX_BUFFER_SIZE);
-	impl->out.buffer_maxsize = MAX_BUFFER_SIZE;
+	spa_list_init(&impl->out.chunks);
+	spa_list_init(&impl->out.free);
+	pw_array_init(&impl->out.fds, 32 * sizeof(int));
+	pw_array_init(&impl->out.groups, 32 * sizeof(struct fd_group));
 	impl->in.buffer_data = malloc(MAX_BUFFER_SIZE);
 	impl->in.buffer_maxsize = MAX_BUFFER_SIZE;
 	impl->in.update = true;
 	impl->core = core;
 
-	if (impl->out.buffer_data == NULL || impl->in.buffer_data == NULL)
+	if (impl->in.buffer_data == NULL)
 		goto no_mem;
 
 	return this;
 
       no_mem:
-	free(impl->out.buffer_data);
-	free(impl->in.buffer_data);
 	free(impl);
 	return NULL;
 }
@@ -241,16 +545,90 @@ struct pw_protocol_native_connection *pw_protocol_native_connection_new(struct p
 void pw_protocol_native_connection_destroy(struct pw_protocol_native_connection *conn)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	struct chunk *c, *t;
 
 	pw_log_debug("connection %p: destroy", conn);
 
 	spa_hook_list_call(&conn->listener_list, struct pw_protocol_native_connection_events, destroy, 0);
 
-	free(impl->out.buffer_data);
+	clear_out_buffer(&impl->out);
+	spa_list_for_each_safe(c, t, &impl->out.free, link)
+		free(c);
+	if (impl->out.ring.mem)
+		clear_ring(&impl->out.ring);
+	if (impl->in.ring.mem)
+		clear_ring(&impl->in.ring);
+	pw_array_clear(&impl->out.fds);
+	pw_array_clear(&impl->out.groups);
 	free(impl->in.buffer_data);
 	free(impl);
 }
 
+static void handle_control(struct impl *impl, uint8_t opcode, void *data, uint32_t size)
+{
+	struct pw_protocol_native_connection *conn = &impl->this;
+	struct buffer *buf = &impl->in;
+	struct spa_pod_parser prs;
+	struct pw_memblock *mem;
+	uint32_t index, ring_size;
+	int fd, res;
+
+	switch (opcode) {
+	case CONTROL_ENABLE_RING:
+		spa_pod_parser_init(&prs, data, size, 0);
+		if (spa_pod_parser_get(&prs,
+				"["
+				"i", &index,
+				"i", &ring_size, NULL) < 0)
+			goto invalid;
+
+		if ((fd = pw_protocol_native_connection_get_fd(conn, index)) < 0)
+			goto invalid;
+
+		if (ring_size == 0 || ring_size > impl->max_peer_ring ||
+		    !check_ring_fd(fd, ring_size)) {
+			close(fd);
+			goto refuse;
+		}
+
+		if (buf->ring.hdr != NULL ||
+		    (res = pw_memblock_import(PW_MEMBLOCK_FLAG_WITH_FD |
+					      PW_MEMBLOCK_FLAG_MAP_READWRITE,
+					      fd, 0, RING_DATA_OFFSET + ring_size, &mem)) < 0) {
+			close(fd);
+			goto invalid;
+		}
+		if (init_ring(&buf->ring, mem, ring_size) < 0) {
+			pw_memblock_free(mem);
+			goto invalid;
+		}
+		pw_log_debug("connection %p: peer enabled ring of %u bytes", conn, ring_size);
+
+		/* the rest of the socket are wakeups now */
+		buf->buffer_size = buf->offset + buf->size;
+		buf->drain = true;
+
+		/* answer with a ring for the other direction */
+		if (impl->out.ring.hdr == NULL &&
+		    (res = pw_protocol_native_connection_enable_ring(conn, ring_size)) < 0)
+			spa_hook_list_call(&conn->listener_list,
+					struct pw_protocol_native_connection_events, error, 0, res);
+		break;
+	default:
+		goto invalid;
+	}
+	return;
+
+      invalid:
+	pw_log_error("connection %p: invalid control message %u", conn, opcode);
+	return;
+
+      refuse:
+	/* the peer writes the next messages in the ring, we can't go on */
+	pw_log_error("connection %p: refused ring of %u bytes", conn, ring_size);
+	shutdown(conn->fd, SHUT_RDWR);
+}
+
 /** Move to the next packet in the connection
  *
  * \param conn the connection
@@ -276,17 +654,31 @@ pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *con
 	size_t len, size;
 	uint8_t *data;
 	struct buffer *buf;
-	uint32_t *p;
+	uint32_t *p, n_fds;
 
 	buf = &impl->in;
 
-	/* move to next packet */
+      next:
+	/* move to next packet, the fds of the previous one are used up */
 	buf->offset += buf->size;
+	buf->size = 0;
+	if (buf->msg_fds > 0) {
+		buf->n_fds -= buf->msg_fds;
+		memmove(buf->fds, buf->fds + buf->msg_fds, buf->n_fds * sizeof(int));
+		buf->msg_fds = 0;
+	}
+
+	if (buf->ring.hdr != NULL && buf->drain) {
+		read_wakeups(impl);
+		buf->drain = false;
+	}
 
       again:
 	if (buf->update) {
-		if (!refill_buffer(conn, buf))
+		if (!refill_buffer(conn, buf)) {
+			buf->drain = true;
 			return false;
+		}
 		buf->update = false;
 	}
 
@@ -297,35 +689,64 @@ pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *con
 	if (buf->offset >= size) {
 		clear_buffer(buf);
 		buf->update = true;
+		if (buf->ring.hdr != NULL)
+			goto again;
 		return false;
 	}
 
 	data += buf->offset;
 	size -= buf->offset;
 
-	if (size < 8) {
-		if (connection_ensure_size(conn, buf, 8) == NULL)
+	if (size < HDR_SIZE) {
+		compact_buffer(buf);
+		if (connection_ensure_size(conn, buf, HDR_SIZE) == NULL)
 			return false;
 		buf->update = true;
 		goto again;
 	}
 	p = (uint32_t *) data;
-	data += 8;
-	size -= 8;
+	data += HDR_SIZE;
+	size -= HDR_SIZE;
+
+	/* a peer with the old 8 byte header has the pod where we expect the
+	 * seq, we can't parse anything it sends */
+	if (p[2] != buf->seq) {
+		pw_log_error("connection %p: message seq %u, expected %u, the peer "
+			     "uses another protocol version, closing", conn, p[2], buf->seq);
+		shutdown(conn->fd, SHUT_RDWR);
+		return false;
+	}
 
 	*dest_id = p[0];
 	*opcode = p[1] >> 24;
 	len = p[1] & 0xffffff;
+	n_fds = p[3];
 
 	if (len > size) {
-		if (connection_ensure_size(conn, buf, len) == NULL)
+		compact_buffer(buf);
+		if (connection_ensure_size(conn, buf, HDR_SIZE + len) == NULL)
 			return false;
 		buf->update = true;
 		goto again;
 	}
+	/* with a ring, the fds were sent before the message was written */
+	if (n_fds > buf->n_fds && buf->ring.hdr != NULL)
+		read_wakeups(impl);
+	if (n_fds > buf->n_fds) {
+		pw_log_error("connection %p: message %u needs %u fds, have %u", conn,
+			     p[2], n_fds, buf->n_fds);
+		n_fds = buf->n_fds;
+	}
 	buf->size = len;
 	buf->data = data;
-	buf->offset += 8;
+	buf->offset += HDR_SIZE;
+	buf->msg_fds = n_fds;
+	buf->seq++;
+
+	if (*dest_id == CONTROL_ID) {
+		handle_control(impl, *opcode, data, len);
+		goto next;
+	}
 
 	*dt = buf->data;
 	*sz = buf->size;
@@ -333,16 +754,53 @@ pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *con
 	return true;
 }
 
-static inline void *begin_write(struct pw_protocol_native_connection *conn, uint32_t size)
+static struct chunk *alloc_chunk(struct out_buffer *buf, size_t size)
+{
+	struct chunk *c;
+
+	if (size <= CHUNK_SIZE && buf->n_free > 0) {
+		c = spa_list_first(&buf->free, struct chunk, link);
+		spa_list_remove(&c->link);
+		buf->n_free--;
+	} else {
+		size = SPA_MAX(size, CHUNK_SIZE);
+		if ((c = malloc(sizeof(struct chunk) + size)) == NULL)
+			return NULL;
+		c->maxsize = size;
+	}
+	c->size = 0;
+	spa_list_append(&buf->chunks, &c->link);
+
+	return c;
+}
+
+/* get room for a message of size bytes in the last chunk. The first
+ * \a copy bytes that were already written for the message are moved when
+ * a new chunk is needed. */
+static inline void *begin_write(struct pw_protocol_native_connection *conn, uint32_t size,
+				const void *data, uint32_t copy)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
-	uint32_t *p;
-	struct buffer *buf = &impl->out;
-	/* 4 for dest_id, 1 for opcode, 3 for size and size for payload */
-	if ((p = connection_ensure_size(conn, buf, 8 + size)) == NULL)
-		return NULL;
+	struct out_buffer *buf = &impl->out;
+	struct chunk *c = NULL;
+	uint8_t *p;
+
+	if (!spa_list_is_empty(&buf->chunks))
+		c = spa_list_last(&buf->chunks, struct chunk, link);
 
-	return p + 2;
+	if (c == NULL || c->size + HDR_SIZE + size > c->maxsize) {
+		if ((c = alloc_chunk(buf, HDR_SIZE + size)) == NULL) {
+			spa_hook_list_call(&conn->listener_list,
+					struct pw_protocol_native_connection_events, error, 0, -ENOMEM);
+			return NULL;
+		}
+		pw_log_trace("connection %p: new chunk %p of %zd bytes", conn, c, c->maxsize);
+	}
+	p = c->data + c->size + HDR_SIZE;
+	if (copy > 0 && p != data)
+		memcpy(p, data, copy);
+
+	return p;
 }
 
 static uint32_t write_pod(struct spa_pod_builder *b, const void *data, uint32_t size)
@@ -350,15 +808,38 @@ static uint32_t write_pod(struct spa_pod_builder *b, const void *data, uint32_t
 	struct impl *impl = SPA_CONTAINER_OF(b, struct impl, builder);
 	uint32_t ref = b->state.offset;
 
-        if (b->size <= ref) {
+        if (b->size < ref + size) {
                 b->size = SPA_ROUND_UP_N(ref + size, 4096);
-                b->data = begin_write(&impl->this, b->size);
+                b->data = begin_write(&impl->this, b->size, b->data, ref);
+		if (b->data == NULL) {
+			b->size = 0;
+			return -1;
+		}
         }
         memcpy(b->data + ref, data, size);
 
         return ref;
 }
 
+static struct spa_pod_builder *
+begin_message(struct impl *impl, uint32_t dest_id, uint8_t opcode)
+{
+	impl->dest_id = dest_id;
+	impl->opcode = opcode;
+	impl->builder = (struct spa_pod_builder) { NULL, 0, write_pod, };
+	impl->out.msg_fds = pw_array_get_len(&impl->out.fds, int);
+
+	return &impl->builder;
+}
+
+struct spa_pod_builder *
+pw_protocol_native_connection_begin(struct pw_protocol_native_connection *conn,
+				    uint32_t dest_id, uint8_t opcode)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	return begin_message(impl, dest_id, opcode);
+}
+
 struct spa_pod_builder *
 pw_protocol_native_connection_begin_resource(struct pw_protocol_native_connection *conn,
 					     struct pw_resource *resource,
@@ -381,11 +862,7 @@ pw_protocol_native_connection_begin_resource(struct pw_protocol_native_connectio
 		pw_core_resource_update_types(client->core_resource, base, types, diff);
 	}
 
-	impl->dest_id = resource->id;
-	impl->opcode = opcode;
-	impl->builder = (struct spa_pod_builder) { NULL, 0, write_pod };
-
-	return &impl->builder;
+	return begin_message(impl, resource->id, opcode);
 }
 
 struct spa_pod_builder *
@@ -410,11 +887,7 @@ pw_protocol_native_connection_begin_proxy(struct pw_protocol_native_connection *
 	        pw_core_proxy_update_types(remote->core_proxy, base, types, diff);
 	}
 
-	impl->dest_id = proxy->id;
-	impl->opcode = opcode;
-	impl->builder = (struct spa_pod_builder) { NULL, 0, write_pod, };
-
-	return &impl->builder;
+	return begin_message(impl, proxy->id, opcode);
 }
 
 void
@@ -422,16 +895,37 @@ pw_protocol_native_connection_end(struct pw_protocol_native_connection *conn,
 				  struct spa_pod_builder *builder)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
-	uint32_t *p, size = builder->state.offset;
-	struct buffer *buf = &impl->out;
+	struct out_buffer *buf = &impl->out;
+	uint32_t *p, size = builder->state.offset, n_fds;
+	struct chunk *c;
+	struct fd_group *g;
 
-	if ((p = connection_ensure_size(conn, buf, 8 + size)) == NULL)
+	if (builder->data == NULL &&
+	    begin_write(conn, 0, NULL, 0) == NULL)
 		return;
 
+	/* the message was written after the last complete message of the last chunk */
+	c = spa_list_last(&buf->chunks, struct chunk, link);
+	p = (uint32_t *) (c->data + c->size);
+
+	n_fds = pw_array_get_len(&buf->fds, int) - buf->msg_fds;
+	if (n_fds > 0) {
+		if ((g = pw_array_add(&buf->groups, sizeof(struct fd_group))) == NULL) {
+			buf->fds.size = buf->msg_fds * sizeof(int);
+			return;
+		}
+		g->pos = buf->queued;
+		g->n_fds = n_fds;
+	}
+
 	*p++ = impl->dest_id;
 	*p++ = (impl->opcode << 24) | (size & 0xffffff);
+	*p++ = buf->seq++;
+	*p++ = n_fds;
 
-	buf->buffer_size += 8 + size;
+	c->size += HDR_SIZE + size;
+	buf->queued += HDR_SIZE + size;
+	buf->msg_fds = pw_array_get_len(&buf->fds, int);
 
 	if (debug_messages) {
 		printf(">>>>>>>>> out: %d %d %d\n", impl->dest_id, impl->opcode, size);
@@ -441,12 +935,183 @@ pw_protocol_native_connection_end(struct pw_protocol_native_connection *conn,
 			struct pw_protocol_native_connection_events, need_flush, 0);
 }
 
+static void array_remove_front(struct pw_array *arr, size_t size)
+{
+	arr->size -= size;
+	memmove(arr->data, SPA_MEMBER(arr->data, size, void), arr->size);
+}
+
+/* make an iovec of the queued data up to *end, *end is updated with the
+ * position of the last byte that fits */
+static uint32_t fill_iov(struct out_buffer *buf, struct iovec *iov, uint64_t *end)
+{
+	struct chunk *c;
+	uint64_t left = *end - buf->sent;
+	size_t offset = buf->offset;
+	uint32_t n_iov = 0;
+
+	spa_list_for_each(c, &buf->chunks, link) {
+		size_t avail = c->size - offset;
+
+		if (left == 0 || n_iov == MAX_IOV)
+			break;
+		if (avail > 0) {
+			iov[n_iov].iov_base = c->data + offset;
+			iov[n_iov].iov_len = SPA_MIN(avail, left);
+			left -= iov[n_iov].iov_len;
+			n_iov++;
+		}
+		offset = 0;
+	}
+	*end -= left;
+
+	return n_iov;
+}
+
+/* remove len sent bytes from the queue */
+static void consume_out(struct out_buffer *buf, size_t len)
+{
+	struct chunk *c, *t;
+
+	buf->sent += len;
+
+	spa_list_for_each_safe(c, t, &buf->chunks, link) {
+		size_t avail = c->size - buf->offset;
+
+		if (len < avail) {
+			buf->offset += len;
+			break;
+		}
+		len -= avail;
+		buf->offset = 0;
+
+		/* keep writing in the last chunk */
+		if (c->link.next == &buf->chunks) {
+			c->size = 0;
+			break;
+		}
+		release_chunk(buf, c);
+	}
+}
+
+/* take the fds of the messages that start before *end. When the fds of
+ * the previous batch are still ahead of the data that the peer read, stop
+ * before the next message with fds so that the peer never has more than
+ * two batches of fds queued. */
+static uint32_t take_fds(struct out_buffer *buf, uint64_t read_pos, uint64_t *end, uint32_t *n_fds)
+{
+	struct fd_group *groups = buf->groups.data;
+	uint32_t i, n_groups = pw_array_get_len(&buf->groups, struct fd_group);
+
+	for (i = 0, *n_fds = 0; i < n_groups && groups[i].pos < *end; i++) {
+		if (read_pos < buf->fds_end || *n_fds + groups[i].n_fds > MAX_FDS) {
+			*end = groups[i].pos;
+			break;
+		}
+		*n_fds += groups[i].n_fds;
+	}
+	return i;
+}
+
+static void release_fds(struct out_buffer *buf, uint32_t n_groups, uint32_t n_fds)
+{
+	struct fd_group *groups = buf->groups.data;
+
+	if (n_groups == 0)
+		return;
+
+	buf->fds_end = groups[n_groups - 1].pos + 1;
+	array_remove_front(&buf->fds, n_fds * sizeof(int));
+	array_remove_front(&buf->groups, n_groups * sizeof(struct fd_group));
+	buf->msg_fds -= n_fds;
+}
+
+static bool flush_ring(struct impl *impl)
+{
+	struct out_buffer *buf = &impl->out;
+	struct ring *r = &buf->ring;
+	struct iovec iov[MAX_IOV];
+	uint32_t i, index, n_iov, n_groups, n_fds;
+	int32_t filled;
+	uint64_t end, limit;
+	bool written = false, waiting = false;
+
+	if (buf->wakeup) {
+		buf->wakeup = false;
+		send_wakeup(&impl->this, NULL, 0);
+	}
+
+	while (buf->sent < buf->queued) {
+		filled = spa_ringbuffer_get_write_index(&r->hdr->rb, &index);
+		if (filled < 0 || filled > (int32_t) r->size) {
+			pw_log_error("connection %p: invalid ring state %d", impl, filled);
+			return false;
+		}
+
+		end = limit = SPA_MIN(buf->queued, buf->sent + r->size - filled);
+		n_iov = fill_iov(buf, iov, &end);
+		n_groups = take_fds(buf, buf->sent - filled, &end, &n_fds);
+		if (end != limit)
+			n_iov = fill_iov(buf, iov, &end);
+
+		if (end == buf->sent) {
+			/* the ring is full or the peer did not read the messages
+			 * of the last fds yet. Ask for a wakeup when it reads and
+			 * check once more. */
+			if (waiting)
+				break;
+			__atomic_store_n(&r->hdr->writer_waiting, 1, __ATOMIC_SEQ_CST);
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			waiting = true;
+			continue;
+		}
+
+		/* the fds go before the messages that use them */
+		if (n_fds > 0) {
+			if (!send_wakeup(&impl->this, buf->fds.data, n_fds)) {
+				buf->blocked = true;
+				break;
+			}
+			release_fds(buf, n_groups, n_fds);
+		}
+
+		for (i = 0; i < n_iov; i++) {
+			spa_ringbuffer_write_data(&r->hdr->rb, r->data, r->size,
+					index & (r->size - 1), iov[i].iov_base, iov[i].iov_len);
+			index += iov[i].iov_len;
+		}
+		spa_ringbuffer_write_update(&r->hdr->rb, index);
+
+		pw_log_trace("connection %p: wrote %"PRIu64" bytes in ring and %u fds",
+			     impl, end - buf->sent, n_fds);
+
+		consume_out(buf, end - buf->sent);
+		written = true;
+	}
+
+	if (written) {
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_exchange_n(&r->hdr->reader_waiting, 0, __ATOMIC_SEQ_CST))
+			send_wakeup(&impl->this, NULL, 0);
+	}
+	return true;
+}
+
 /** Flush the connection object
  *
  * \param conn the connection object
  * \return true on success
  *
- * Write the queued messages on the connection to the socket
+ * Write the queued messages on the connection to the socket. The messages
+ * are written in batches of up to MAX_IOV chunks. The fds of a message
+ * are sent in the same batch as the first byte of the message and a batch
+ * is cut short before a message when it would carry more than MAX_FDS
+ * fds. When the socket is full, the remaining messages stay queued for
+ * the next flush and pw_protocol_native_connection_is_blocked() returns
+ * true until then.
+ *
+ * With a ring, the messages after the one that enabled the ring are
+ * written in the ring and the peer is only woken up when it waits.
  *
  * \memberof pw_protocol_native_connection
  */
@@ -455,57 +1120,68 @@ bool pw_protocol_native_connection_flush(struct pw_protocol_native_connection *c
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
 	ssize_t len;
 	struct msghdr msg = { 0 };
-	struct iovec iov[1];
+	struct iovec iov[MAX_IOV];
 	struct cmsghdr *cmsg;
 	char cmsgbuf[CMSG_SPACE(MAX_FDS * sizeof(int))];
-	int *cm;
-	uint32_t i, fds_len;
-	struct buffer *buf;
+	uint32_t n_groups, n_fds, fds_len;
+	uint64_t end, limit;
+	struct out_buffer *buf;
 
 	buf = &impl->out;
+	buf->blocked = false;
+
+	/* the messages before the ring go over the socket */
+	limit = buf->ring.hdr != NULL ? buf->ring_start : buf->queued;
+
+	while (buf->sent < limit) {
+		end = limit;
+		msg.msg_iov = iov;
+		msg.msg_iovlen = fill_iov(buf, iov, &end);
+
+		n_groups = take_fds(buf, buf->sent, &end, &n_fds);
+		if (end != limit)
+			msg.msg_iovlen = fill_iov(buf, iov, &end);
+		fds_len = n_fds * sizeof(int);
+
+		if (n_fds > 0) {
+			msg.msg_control = cmsgbuf;
+			msg.msg_controllen = CMSG_SPACE(fds_len);
+			cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(fds_len);
+			memcpy(CMSG_DATA(cmsg), buf->fds.data, fds_len);
+			msg.msg_controllen = cmsg->cmsg_len;
+		} else {
+			msg.msg_control = NULL;
+			msg.msg_controllen = 0;
+		}
 
-	if (buf->buffer_size == 0)
-		return true;
-
-	fds_len = buf->n_fds * sizeof(int);
-
-	iov[0].iov_base = buf->buffer_data;
-	iov[0].iov_len = buf->buffer_size;
-	msg.msg_iov = iov;
-	msg.msg_iovlen = 1;
-
-	if (buf->n_fds > 0) {
-		msg.msg_control = cmsgbuf;
-		msg.msg_controllen = CMSG_SPACE(fds_len);
-		cmsg = CMSG_FIRSTHDR(&msg);
-		cmsg->cmsg_level = SOL_SOCKET;
-		cmsg->cmsg_type = SCM_RIGHTS;
-		cmsg->cmsg_len = CMSG_LEN(fds_len);
-		cm = (int *) CMSG_DATA(cmsg);
-		for (i = 0; i < buf->n_fds; i++)
-			cm[i] = buf->fds[i] > 0 ? buf->fds[i] : -buf->fds[i];
-		msg.msg_controllen = cmsg->cmsg_len;
-	} else {
-		msg.msg_control = NULL;
-		msg.msg_controllen = 0;
-	}
-
-	while (true) {
-		len = sendmsg(conn->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
-		if (len < 0) {
-			if (errno == EINTR)
-				continue;
-			else
-				goto send_error;
+		while (true) {
+			len = sendmsg(conn->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (len < 0) {
+				if (errno == EINTR)
+					continue;
+				else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					buf->blocked = true;
+					goto done;
+				}
+				else
+					goto send_error;
+			}
+			break;
 		}
-		break;
-	}
-	pw_log_trace("connection %p: %d written %zd bytes and %u fds", conn, conn->fd, len,
-		     buf->n_fds);
+		pw_log_trace("connection %p: %d written %zd bytes in %zd chunks and %u fds",
+			     conn, conn->fd, len, msg.msg_iovlen, n_fds);
 
-	buf->buffer_size -= len;
-	buf->n_fds = 0;
+		/* the fds went with the first byte */
+		release_fds(buf, n_groups, n_fds);
+		consume_out(buf, len);
+	}
 
+	if (buf->ring.hdr != NULL)
+		return flush_ring(impl);
+      done:
 	return true;
 
 	/* ERRORS */
@@ -514,6 +1190,97 @@ bool pw_protocol_native_connection_flush(struct pw_protocol_native_connection *c
 	return false;
 }
 
+/** Check if the connection waits for the socket
+ *
+ * \param conn the connection object
+ * \return true when the last flush left messages because the socket was
+ *	full. The socket should be watched for SPA_IO_OUT and flushed again
+ *	when it becomes writable.
+ *
+ * \memberof pw_protocol_native_connection
+ */
+bool pw_protocol_native_connection_is_blocked(struct pw_protocol_native_connection *conn)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	return impl->out.blocked;
+}
+
+/** Write the messages to the peer in a shared memory ring
+ *
+ * \param conn the connection object
+ * \param size the size of the ring, rounded up to a power of 2
+ * \return 0 on success, < 0 on error
+ *
+ * The ring is announced to the peer with a message on the socket. The
+ * messages after that are written in the ring and the socket only
+ * carries wakeups and fds. The peer answers with a ring for the other
+ * direction.
+ *
+ * \memberof pw_protocol_native_connection
+ */
+int pw_protocol_native_connection_enable_ring(struct pw_protocol_native_connection *conn,
+					      uint32_t size)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	struct out_buffer *buf = &impl->out;
+	struct pw_memblock *mem;
+	struct spa_pod_builder *b;
+	uint32_t ring_size;
+	int res;
+
+	if (buf->ring.hdr != NULL)
+		return -EEXIST;
+
+	for (ring_size = 4096; ring_size < size && ring_size < MAX_RING_SIZE; ring_size <<= 1);
+
+	if ((res = pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
+				     PW_MEMBLOCK_FLAG_MAP_READWRITE |
+				     PW_MEMBLOCK_FLAG_MAP_POPULATE |
+				     PW_MEMBLOCK_FLAG_SEAL,
+				     RING_DATA_OFFSET + ring_size, &mem)) < 0)
+		return res;
+
+	if ((res = init_ring(&buf->ring, mem, ring_size)) < 0) {
+		pw_memblock_free(mem);
+		return res;
+	}
+	spa_ringbuffer_init(&buf->ring.hdr->rb);
+
+	pw_log_debug("connection %p: enable ring of %u bytes", conn, ring_size);
+
+	b = begin_message(impl, CONTROL_ID, CONTROL_ENABLE_RING);
+	spa_pod_builder_struct(b,
+			       "i", pw_protocol_native_connection_add_fd(conn,
+					pw_memblock_export(mem)),
+			       "i", ring_size);
+	pw_protocol_native_connection_end(conn, b);
+
+	buf->ring_start = buf->queued;
+
+	/* the peer answers with a ring of the same size */
+	impl->max_peer_ring = SPA_MAX(impl->max_peer_ring, ring_size);
+
+	return 0;
+}
+
+/** Accept a ring from the peer
+ *
+ * \param conn the connection object
+ * \param max_size the largest ring to accept, 0 refuses rings
+ *
+ * By default, a connection only accepts the ring that the peer sends in
+ * answer to pw_protocol_native_connection_enable_ring(). The connection is
+ * shut down when the peer enables a ring that is refused.
+ *
+ * \memberof pw_protocol_native_connection
+ */
+void pw_protocol_native_connection_accept_ring(struct pw_protocol_native_connection *conn,
+					       uint32_t max_size)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	impl->max_peer_ring = SPA_MIN(max_size, MAX_RING_SIZE);
+}
+
 /** Clear the connection object
  *
  * \param conn the connection object
@@ -527,8 +1294,10 @@ bool pw_protocol_native_connection_clear(struct pw_protocol_native_connection *c
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
 
-	clear_buffer(&impl->out);
+	clear_out_buffer(&impl->out);
 	clear_buffer(&impl->in);
+	impl->in.n_fds = 0;
+	impl->in.msg_fds = 0;
 	impl->in.update = true;
 
 	return true;
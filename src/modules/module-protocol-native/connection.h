@@ -76,6 +76,10 @@ uint32_t pw_protocol_native_connection_add_fd(struct pw_protocol_native_connecti
 
 int pw_protocol_native_connection_get_fd(struct pw_protocol_native_connection *conn, uint32_t index);
 
+struct spa_pod_builder *
+pw_protocol_native_connection_begin(struct pw_protocol_native_connection *conn,
+				    uint32_t dest_id, uint8_t opcode);
+
 struct spa_pod_builder *
 pw_protocol_native_connection_begin_resource(struct pw_protocol_native_connection *conn,
                                              struct pw_resource *resource,
@@ -92,6 +96,17 @@ pw_protocol_native_connection_end(struct pw_protocol_native_connection *conn,
 bool
 pw_protocol_native_connection_flush(struct pw_protocol_native_connection *conn);
 
+bool
+pw_protocol_native_connection_is_blocked(struct pw_protocol_native_connection *conn);
+
+int
+pw_protocol_native_connection_enable_ring(struct pw_protocol_native_connection *conn,
+					  uint32_t size);
+
+void
+pw_protocol_native_connection_accept_ring(struct pw_protocol_native_connection *conn,
+					  uint32_t max_size);
+
 bool
 pw_protocol_native_connection_clear(struct pw_protocol_native_connection *conn);
 
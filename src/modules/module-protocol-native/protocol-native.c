@@ -30,14 +30,14 @@
 
 #include "connection.h"
 
-static void core_marshal_hello(void *object)
+static void core_marshal_hello(void *object, uint32_t version)
 {
 	struct pw_proxy *proxy = object;
 	struct spa_pod_builder *b;
 
 	b = pw_protocol_native_begin_proxy(proxy, PW_CORE_PROXY_METHOD_HELLO);
 
-	spa_pod_builder_struct(b, "P", NULL);
+	spa_pod_builder_struct(b, "i", version);
 
 	pw_protocol_native_end_proxy(proxy, b);
 }
@@ -292,7 +292,8 @@ static void core_marshal_info(void *object, struct pw_core_info *info)
 
 	b = pw_protocol_native_begin_resource(resource, PW_CORE_PROXY_EVENT_INFO);
 
-	n_items = info->props ? info->props->n_items : 0;
+	/* only the changed properties */
+	n_items = info->change_mask & PW_CORE_CHANGE_MASK_PROPS && info->props ? info->props->n_items : 0;
 
 	spa_pod_builder_add(b,
 			    "[",
@@ -432,13 +433,13 @@ static int core_demarshal_hello(void *object, void *data, size_t size)
 {
 	struct pw_resource *resource = object;
 	struct spa_pod_parser prs;
-	void *ptr;
+	uint32_t version;
 
 	spa_pod_parser_init(&prs, data, size, 0);
-	if (spa_pod_parser_get(&prs, "[P]", &ptr, NULL) < 0)
+	if (spa_pod_parser_get(&prs, "[i]", &version, NULL) < 0)
 		return -EINVAL;
 
-	pw_resource_do(resource, struct pw_core_proxy_methods, hello, 0);
+	pw_resource_do(resource, struct pw_core_proxy_methods, hello, 0, version);
 	return 0;
 }
 
@@ -609,7 +610,8 @@ static void module_marshal_info(void *object, struct pw_module_info *info)
 
 	b = pw_protocol_native_begin_resource(resource, PW_MODULE_PROXY_EVENT_INFO);
 
-	n_items = info->props ? info->props->n_items : 0;
+	/* only the changed properties */
+	n_items = info->change_mask & PW_MODULE_CHANGE_MASK_PROPS && info->props ? info->props->n_items : 0;
 
 	spa_pod_builder_add(b,
 			    "[",
@@ -668,7 +670,8 @@ static void factory_marshal_info(void *object, struct pw_factory_info *info)
 
 	b = pw_protocol_native_begin_resource(resource, PW_FACTORY_PROXY_EVENT_INFO);
 
-	n_items = info->props ? info->props->n_items : 0;
+	/* only the changed properties */
+	n_items = info->change_mask & PW_FACTORY_CHANGE_MASK_PROPS && info->props ? info->props->n_items : 0;
 
 	spa_pod_builder_add(b,
 			    "[",
@@ -728,7 +731,8 @@ static void node_marshal_info(void *object, struct pw_node_info *info)
 
 	b = pw_protocol_native_begin_resource(resource, PW_NODE_PROXY_EVENT_INFO);
 
-	n_items = info->props ? info->props->n_items : 0;
+	/* only the changed properties */
+	n_items = info->change_mask & PW_NODE_CHANGE_MASK_PROPS && info->props ? info->props->n_items : 0;
 
 	spa_pod_builder_add(b,
 			    "[",
@@ -864,7 +868,8 @@ static void port_marshal_info(void *object, struct pw_port_info *info)
 
 	b = pw_protocol_native_begin_resource(resource, PW_PORT_PROXY_EVENT_INFO);
 
-	n_items = info->props ? info->props->n_items : 0;
+	/* only the changed properties */
+	n_items = info->change_mask & PW_PORT_CHANGE_MASK_PROPS && info->props ? info->props->n_items : 0;
 
 	spa_pod_builder_add(b,
 			    "[",
@@ -988,7 +993,8 @@ static void client_marshal_info(void *object, struct pw_client_info *info)
 
 	b = pw_protocol_native_begin_resource(resource, PW_CLIENT_PROXY_EVENT_INFO);
 
-	n_items = info->props ? info->props->n_items : 0;
+	/* only the changed properties */
+	n_items = info->change_mask & PW_CLIENT_CHANGE_MASK_PROPS && info->props ? info->props->n_items : 0;
 
 	spa_pod_builder_add(b,
 			    "[",
@@ -1042,7 +1048,8 @@ static void link_marshal_info(void *object, struct pw_link_info *info)
 
 	b = pw_protocol_native_begin_resource(resource, PW_LINK_PROXY_EVENT_INFO);
 
-	n_items = info->props ? info->props->n_items : 0;
+	/* only the changed properties */
+	n_items = info->change_mask & PW_LINK_CHANGE_MASK_PROPS && info->props ? info->props->n_items : 0;
 
 	spa_pod_builder_add(b,
 			    "[",
@@ -1052,7 +1059,7 @@ static void link_marshal_info(void *object, struct pw_link_info *info)
 			    "i", info->output_port_id,
 			    "i", info->input_node_id,
 			    "i", info->input_port_id,
-			    "P", info->format,
+			    "P", info->change_mask & PW_LINK_CHANGE_MASK_FORMAT ? info->format : NULL,
 			    "i", n_items, NULL);
 
 	for (i = 0; i < n_items; i++) {
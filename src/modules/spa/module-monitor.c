@@ -57,23 +57,33 @@ int pipewire__module_init(struct pw_module *module, const char *args)
 	const char *dir;
 	char **argv;
 	int n_tokens;
+	struct pw_properties *props = NULL;
 	struct pw_spa_monitor *monitor;
 	struct data *data;
 
 	if (args == NULL)
 		goto wrong_arguments;
 
-	argv = pw_split_strv(args, " \t", INT_MAX, &n_tokens);
+	argv = pw_split_strv(args, " \t", 4, &n_tokens);
 	if (n_tokens < 3)
 		goto not_enough_arguments;
 
+	if (n_tokens == 4) {
+		props = pw_properties_new_string(argv[3]);
+		if (props == NULL)
+			return -ENOMEM;
+	}
+
 	if ((dir = getenv("SPA_PLUGIN_DIR")) == NULL)
 		dir = PLUGINDIR;
 
 	monitor = pw_spa_monitor_load(pw_module_get_core(module),
 				      pw_module_get_global(module),
 				      dir, argv[0], argv[1], argv[2],
+				      props,
 				      sizeof(struct data));
+	if (props)
+		pw_properties_free(props);
 	if (monitor == NULL)
 		return -ENOMEM;
 
@@ -89,6 +99,6 @@ int pipewire__module_init(struct pw_module *module, const char *args)
       not_enough_arguments:
 	pw_free_strv(argv);
       wrong_arguments:
-	pw_log_error("usage: module-spa-monitor <plugin> <factory> <name>");
+	pw_log_error("usage: module-spa-monitor <plugin> <factory> <name> [key=value ...]");
 	return -EINVAL;
 }
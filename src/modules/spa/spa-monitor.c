@@ -256,6 +256,7 @@ struct pw_spa_monitor *pw_spa_monitor_load(struct pw_core *core,
 					   const char *lib,
 					   const char *factory_name,
 					   const char *system_name,
+					   struct pw_properties *properties,
 					   size_t user_data_size)
 {
 	struct impl *impl;
@@ -295,7 +296,10 @@ struct pw_spa_monitor *pw_spa_monitor_load(struct pw_core *core,
 	support = pw_core_get_support(core, &n_support);
 	handle = calloc(1, factory->size);
 	if ((res = spa_handle_factory_init(factory,
-					   handle, NULL, support, n_support)) < 0) {
+					   handle,
+					   properties ? &properties->dict : NULL,
+					   support,
+					   n_support)) < 0) {
 		pw_log_error("can't make factory instance: %d", res);
 		goto init_failed;
 	}
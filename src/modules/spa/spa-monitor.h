@@ -46,6 +46,7 @@ pw_spa_monitor_load(struct pw_core *core,
 		    const char *lib,
 		    const char *factory_name,
 		    const char *system_name,
+		    struct pw_properties *properties,
 		    size_t user_data_size);
 void
 pw_spa_monitor_destroy(struct pw_spa_monitor *monitor);
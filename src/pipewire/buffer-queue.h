@@ -0,0 +1,100 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __PIPEWIRE_BUFFER_QUEUE_H__
+#define __PIPEWIRE_BUFFER_QUEUE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <spa/utils/ringbuffer.h>
+
+/** \cond */
+
+#define PW_BUFFER_QUEUE_SIZE	64
+#define PW_BUFFER_QUEUE_MASK	(PW_BUFFER_QUEUE_SIZE - 1)
+
+/** A queue of buffer ids
+ *
+ * One thread can push ids while another thread pops them, without
+ * locks. Both sides move any number of ids with one index update.
+ */
+struct pw_buffer_queue {
+	struct spa_ringbuffer ring;
+	uint32_t ids[PW_BUFFER_QUEUE_SIZE];
+};
+
+static inline void pw_buffer_queue_init(struct pw_buffer_queue *queue)
+{
+	spa_ringbuffer_init(&queue->ring);
+}
+
+/** Push at most \a n_ids ids, returns the number of pushed ids */
+static inline uint32_t pw_buffer_queue_push(struct pw_buffer_queue *queue,
+					    const uint32_t *ids, uint32_t n_ids)
+{
+	uint32_t i, index;
+	int32_t filled;
+
+	filled = spa_ringbuffer_get_write_index(&queue->ring, &index);
+	n_ids = SPA_MIN(n_ids, PW_BUFFER_QUEUE_SIZE - (uint32_t) filled);
+
+	for (i = 0; i < n_ids; i++)
+		queue->ids[(index + i) & PW_BUFFER_QUEUE_MASK] = ids[i];
+
+	if (n_ids > 0)
+		spa_ringbuffer_write_update(&queue->ring, index + n_ids);
+
+	return n_ids;
+}
+
+/** Pop at most \a n_ids ids, returns the number of popped ids */
+static inline uint32_t pw_buffer_queue_pop(struct pw_buffer_queue *queue,
+					   uint32_t *ids, uint32_t n_ids)
+{
+	uint32_t i, index;
+	int32_t avail;
+
+	avail = spa_ringbuffer_get_read_index(&queue->ring, &index);
+	n_ids = SPA_MIN(n_ids, (uint32_t) avail);
+
+	for (i = 0; i < n_ids; i++)
+		ids[i] = queue->ids[(index + i) & PW_BUFFER_QUEUE_MASK];
+
+	if (n_ids > 0)
+		spa_ringbuffer_read_update(&queue->ring, index + n_ids);
+
+	return n_ids;
+}
+
+/** The number of ids in the queue */
+static inline uint32_t pw_buffer_queue_avail(struct pw_buffer_queue *queue)
+{
+	uint32_t index;
+	return spa_ringbuffer_get_read_index(&queue->ring, &index);
+}
+
+/** \endcond */
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* __PIPEWIRE_BUFFER_QUEUE_H__ */
@@ -349,36 +349,40 @@ const struct pw_client_info *pw_client_get_info(struct pw_client *client)
  *
  * Add all properties in \a dict to the client properties. Existing
  * properties are overwritten. Items can be removed by setting the value
- * to NULL.
+ * to NULL. The clients are only sent the properties that changed.
+ *
+ * \return the number of changed properties
  *
  * \memberof pw_client
  */
 int pw_client_update_properties(struct pw_client *client, const struct spa_dict *dict)
 {
 	struct pw_resource *resource;
+	struct pw_client_info info;
+	struct spa_dict_item *items;
+	struct spa_dict changed;
 
-	if (client->properties == NULL) {
-		if (dict)
-			client->properties = pw_properties_new_dict(dict);
-	} else {
-		uint32_t i;
+	if (client->properties == NULL)
+		client->properties = pw_properties_new(NULL, NULL);
 
-		for (i = 0; i < dict->n_items; i++)
-			pw_properties_set(client->properties,
-					  dict->items[i].key, dict->items[i].value);
-	}
+	items = alloca(sizeof(struct spa_dict_item) * dict->n_items);
+	changed = SPA_DICT_INIT(items, pw_properties_update(client->properties, dict, items));
+	if (changed.n_items == 0)
+		return 0;
 
 	client->info.change_mask |= PW_CLIENT_CHANGE_MASK_PROPS;
-	client->info.props = client->properties ? &client->properties->dict : NULL;
+	client->info.props = &client->properties->dict;
 
 	pw_client_events_info_changed(client, &client->info);
 
+	info = client->info;
+	info.props = &changed;
 	spa_list_for_each(resource, &client->resource_list, link)
-		pw_client_resource_info(resource, &client->info);
+		pw_client_resource_info(resource, &info);
 
 	client->info.change_mask = 0;
 
-	return 0;
+	return changed.n_items;
 }
 
 struct permissions_update {
@@ -36,6 +36,7 @@
 #undef spa_debug
 #define spa_debug pw_log_trace
 #include <spa/graph/graph-scheduler6.h>
+#include <spa/graph/graph-parallel.h>
 
 /** \cond */
 struct resource_data {
@@ -102,12 +103,13 @@ static const struct pw_resource_events resource_events = {
 	.destroy = destroy_registry_resource
 };
 
-static void core_hello(void *object)
+static void core_hello(void *object, uint32_t version)
 {
 	struct pw_resource *resource = object;
 	struct pw_core *this = resource->core;
 
-	pw_log_debug("core %p: hello from source %p", this, resource);
+	pw_log_debug("core %p: hello version %u from source %p", this, version, resource);
+
 	resource->client->n_types = 0;
 
 	this->info.change_mask = PW_CORE_CHANGE_MASK_ALL;
@@ -352,6 +354,36 @@ static const struct pw_global_events global_events = {
 	.bind = global_bind,
 };
 
+static void setup_parallel(struct pw_core *this)
+{
+	const char *str;
+	long n_workers, n_cpus;
+	int res;
+
+	if ((str = pw_properties_get(this->properties, PW_CORE_PROP_DATA_WORKERS)) == NULL ||
+	    (n_workers = atol(str)) <= 0)
+		return;
+
+	n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_cpus > 1 && n_workers > n_cpus - 1) {
+		pw_log_warn("core %p: limiting %ld data workers to %ld", this, n_workers, n_cpus - 1);
+		n_workers = n_cpus - 1;
+	}
+
+	this->rt.parallel = calloc(1, sizeof(struct spa_graph_parallel));
+	if (this->rt.parallel == NULL)
+		return;
+
+	spa_graph_parallel_init(this->rt.parallel, &this->rt.graph, n_workers,
+				&spa_graph_impl_default, NULL);
+	if ((res = spa_graph_parallel_start(this->rt.parallel)) < 0)
+		pw_log_warn("core %p: can't start data workers: %s", this, spa_strerror(res));
+
+	spa_graph_set_callbacks(&this->rt.graph, &spa_graph_parallel_callbacks, this->rt.parallel);
+
+	pw_log_info("core %p: %d data workers", this, this->rt.parallel->n_workers);
+}
+
 /** Create a new core object
  *
  * \param main_loop the main loop to use
@@ -363,7 +395,7 @@ static const struct pw_global_events global_events = {
 struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *properties)
 {
 	struct pw_core *this;
-	const char *name;
+	const char *name, *str;
 
 	this = calloc(1, sizeof(struct pw_core));
 	if (this == NULL)
@@ -386,6 +418,10 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 	this->main_loop = main_loop;
 
 	pw_type_init(&this->type);
+	spa_type_media_type_map(this->type.map, &this->audio_type.media_type);
+	spa_type_media_subtype_map(this->type.map, &this->audio_type.media_subtype);
+	spa_type_format_audio_map(this->type.map, &this->audio_type.format_audio);
+	spa_type_audio_format_map(this->type.map, &this->audio_type.audio_format);
 	pw_map_init(&this->globals, 128, 32);
 
 	spa_graph_init(&this->rt.graph);
@@ -401,6 +437,8 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 
 	pw_log_debug("%p", this->support[5].data);
 
+	setup_parallel(this);
+
 	pw_data_loop_start(this->data_loop_impl);
 
 	spa_list_init(&this->protocol_list);
@@ -435,6 +473,12 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 
 	this->sc_pagesize = sysconf(_SC_PAGESIZE);
 
+	if ((str = pw_properties_get(properties, PW_CORE_PROP_DEFAULT_QUANTUM)) != NULL)
+		this->default_quantum = SPA_CLAMP(atoi(str), PW_CORE_QUANTUM_MIN, PW_CORE_QUANTUM_MAX);
+	else
+		this->default_quantum = PW_CORE_QUANTUM_DEFAULT;
+	this->quantum = this->default_quantum;
+
 	this->global = pw_global_new(this,
 				     this->type.core,
 				     PW_VERSION_CORE,
@@ -494,6 +538,11 @@ void pw_core_destroy(struct pw_core *core)
 
 	pw_data_loop_destroy(core->data_loop_impl);
 
+	if (core->rt.parallel) {
+		spa_graph_parallel_stop(core->rt.parallel);
+		free(core->rt.parallel);
+	}
+
 	pw_properties_free(core->properties);
 
 	pw_map_clear(&core->globals);
@@ -536,6 +585,45 @@ struct pw_loop *pw_core_get_main_loop(struct pw_core *core)
 	return core->main_loop;
 }
 
+uint32_t pw_core_get_quantum(struct pw_core *core)
+{
+	return core->quantum;
+}
+
+/** Update the quantum of the graph
+ * \param core a core
+ *
+ * The quantum is the smallest quantum that the nodes ask for or the
+ * default quantum when no node asks for one. The running nodes are told
+ * about the new quantum so that they can change their wakeups.
+ *
+ * \memberof pw_core
+ */
+void pw_core_update_quantum(struct pw_core *core)
+{
+	struct pw_node *node;
+	uint32_t quantum = 0;
+
+	spa_list_for_each(node, &core->node_list, link) {
+		if (node->quantum > 0 && (quantum == 0 || node->quantum < quantum))
+			quantum = node->quantum;
+	}
+	if (quantum == 0)
+		quantum = core->default_quantum;
+	quantum = SPA_CLAMP(quantum, PW_CORE_QUANTUM_MIN, PW_CORE_QUANTUM_MAX);
+
+	if (quantum == core->quantum)
+		return;
+
+	pw_log_debug("core %p: quantum %u -> %u", core, core->quantum, quantum);
+	core->quantum = quantum;
+
+	spa_list_for_each(node, &core->node_list, link) {
+		if (node->info.state == PW_NODE_STATE_RUNNING)
+			pw_node_send_quantum(node);
+	}
+}
+
 const struct pw_properties *pw_core_get_properties(struct pw_core *core)
 {
 	return core->properties;
@@ -545,30 +633,38 @@ const struct pw_properties *pw_core_get_properties(struct pw_core *core)
  *
  * \param core a core
  * \param dict properties to update
+ * \return the number of changed properties
  *
- * Update the core object with the given properties
+ * Update the core object with the given properties. The clients are
+ * only sent the properties that changed.
  *
  * \memberof pw_core
  */
 int pw_core_update_properties(struct pw_core *core, const struct spa_dict *dict)
 {
 	struct pw_resource *resource;
-	uint32_t i;
+	struct pw_core_info info;
+	struct spa_dict_item *items;
+	struct spa_dict changed;
 
-	for (i = 0; i < dict->n_items; i++)
-		pw_properties_set(core->properties, dict->items[i].key, dict->items[i].value);
+	items = alloca(sizeof(struct spa_dict_item) * dict->n_items);
+	changed = SPA_DICT_INIT(items, pw_properties_update(core->properties, dict, items));
+	if (changed.n_items == 0)
+		return 0;
 
 	core->info.change_mask = PW_CORE_CHANGE_MASK_PROPS;
 	core->info.props = &core->properties->dict;
 
 	pw_core_events_info_changed(core, &core->info);
 
+	info = core->info;
+	info.props = &changed;
 	spa_list_for_each(resource, &core->resource_list, link)
-		pw_core_resource_info(resource, &core->info);
+		pw_core_resource_info(resource, &info);
 
 	core->info.change_mask = 0;
 
-	return 0;
+	return changed.n_items;
 }
 
 int pw_core_for_each_global(struct pw_core *core,
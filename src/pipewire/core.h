@@ -110,6 +110,16 @@ struct pw_core_events {
 #define PW_CORE_PROP_VERSION	"pipewire.core.version"
 /** If the core should listen for connections, boolean default false */
 #define PW_CORE_PROP_DAEMON	"pipewire.daemon"
+/** The quantum of the graph in frames at 48000Hz when no node asks for a
+ * lower latency, default 1024 */
+#define PW_CORE_PROP_DEFAULT_QUANTUM	"pipewire.core.default-quantum"
+/** The largest shared memory ring in bytes that a client can enable for
+ * the messages of the native protocol, default 0, rings are refused */
+#define PW_CORE_PROP_PROTOCOL_RING	"pipewire.core.protocol-ring"
+/** Number of extra threads to process the graph with, default 0. With
+ * workers, independent branches of the graph are processed in parallel,
+ * nodes that share a peer node still run one after the other. */
+#define PW_CORE_PROP_DATA_WORKERS	"pipewire.core.data-workers"
 
 /** Make a new core object for a given main_loop. Ownership of the properties is taken */
 struct pw_core * pw_core_new(struct pw_loop *main_loop, struct pw_properties *props);
@@ -132,6 +142,9 @@ const struct pw_core_info *pw_core_get_info(struct pw_core *core);
 /** Get the core global object */
 struct pw_global *pw_core_get_global(struct pw_core *core);
 
+/** Get the quantum of the graph in frames at 48000Hz */
+uint32_t pw_core_get_quantum(struct pw_core *core);
+
 /** Get the core properties */
 const struct pw_properties *pw_core_get_properties(struct pw_core *core);
 
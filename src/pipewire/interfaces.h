@@ -66,7 +66,8 @@ struct pw_link_proxy;
 #define PW_TYPE_INTERFACE__Client	PW_TYPE_INTERFACE_BASE "Client"
 #define PW_TYPE_INTERFACE__Link		PW_TYPE_INTERFACE_BASE "Link"
 
-#define PW_VERSION_CORE				0
+/* version 1: messages have a 16 byte header and hello sends the version */
+#define PW_VERSION_CORE				1
 
 #define PW_CORE_PROXY_METHOD_HELLO		0
 #define PW_CORE_PROXY_METHOD_UPDATE_TYPES	1
@@ -117,8 +118,10 @@ struct pw_core_proxy_methods {
 	/**
 	 * Start a conversation with the server. This will send
 	 * the core info and server types.
+	 *
+	 * \param version the version of the core interface of the client
 	 */
-	void (*hello) (void *object);
+	void (*hello) (void *object, uint32_t version);
 	/**
 	 * Update the type map
 	 *
@@ -196,9 +199,9 @@ struct pw_core_proxy_methods {
 };
 
 static inline void
-pw_core_proxy_hello(struct pw_core_proxy *core)
+pw_core_proxy_hello(struct pw_core_proxy *core, uint32_t version)
 {
-	pw_proxy_do((struct pw_proxy*)core, struct pw_core_proxy_methods, hello);
+	pw_proxy_do((struct pw_proxy*)core, struct pw_core_proxy_methods, hello, version);
 }
 
 static inline void
@@ -86,33 +86,51 @@ static void pw_spa_dict_destroy(struct spa_dict *dict)
 	free(dict);
 }
 
-static struct spa_dict *pw_spa_dict_copy(struct spa_dict *dict)
+/* the properties in an update are the changed properties, a NULL value
+ * removes the property */
+static struct spa_dict *pw_spa_dict_update(struct spa_dict *dict, const struct spa_dict *update)
 {
-	struct spa_dict *copy;
 	struct spa_dict_item *items;
-	uint32_t i;
-
-	if (dict == NULL)
-		return NULL;
+	const struct spa_dict_item *item;
+	uint32_t i, n_items;
 
-	copy = calloc(1, sizeof(struct spa_dict));
-	if (copy == NULL)
-		goto no_mem;
-	copy->items = items = calloc(dict->n_items, sizeof(struct spa_dict_item));
-	if (copy->items == NULL)
-		goto no_items;
-	copy->n_items = dict->n_items;
+	if (update == NULL || update->n_items == 0)
+		return dict;
 
-	for (i = 0; i < dict->n_items; i++) {
-		items[i].key = strdup(dict->items[i].key);
-		items[i].value = dict->items[i].value ? strdup(dict->items[i].value) : NULL;
+	if (dict == NULL) {
+		dict = calloc(1, sizeof(struct spa_dict));
+		if (dict == NULL)
+			return NULL;
 	}
-	return copy;
-
-      no_items:
-	free(copy);
-      no_mem:
-	return NULL;
+	items = realloc((void *) dict->items,
+			(dict->n_items + update->n_items) * sizeof(struct spa_dict_item));
+	if (items == NULL)
+		return dict;
+
+	n_items = dict->n_items;
+	spa_dict_for_each(item, update) {
+		for (i = 0; i < n_items; i++) {
+			if (strcmp(items[i].key, item->key) == 0)
+				break;
+		}
+		if (i < n_items) {
+			free((void *) items[i].value);
+			if (item->value == NULL) {
+				free((void *) items[i].key);
+				items[i] = items[--n_items];
+				continue;
+			}
+		} else if (item->value != NULL) {
+			items[n_items++].key = strdup(item->key);
+		} else
+			continue;
+
+		items[i].value = strdup(item->value);
+	}
+	dict->items = items;
+	dict->n_items = n_items;
+
+	return dict;
 }
 
 struct pw_core_info *pw_core_info_update(struct pw_core_info *info,
@@ -152,9 +170,7 @@ struct pw_core_info *pw_core_info_update(struct pw_core_info *info,
 	if (update->change_mask & PW_CORE_CHANGE_MASK_COOKIE)
 		info->cookie = update->cookie;
 	if (update->change_mask & PW_CORE_CHANGE_MASK_PROPS) {
-		if (info->props)
-			pw_spa_dict_destroy(info->props);
-		info->props = pw_spa_dict_copy(update->props);
+		info->props = pw_spa_dict_update(info->props, update->props);
 	}
 	return info;
 }
@@ -210,9 +226,7 @@ struct pw_node_info *pw_node_info_update(struct pw_node_info *info,
 		info->error = update->error ? strdup(update->error) : NULL;
 	}
 	if (update->change_mask & PW_NODE_CHANGE_MASK_PROPS) {
-		if (info->props)
-			pw_spa_dict_destroy(info->props);
-		info->props = pw_spa_dict_copy(update->props);
+		info->props = pw_spa_dict_update(info->props, update->props);
 	}
 	return info;
 }
@@ -250,9 +264,7 @@ struct pw_port_info *pw_port_info_update(struct pw_port_info *info,
 		info->name = update->name ? strdup(update->name) : NULL;
 	}
 	if (update->change_mask & PW_PORT_CHANGE_MASK_PROPS) {
-		if (info->props)
-			pw_spa_dict_destroy(info->props);
-		info->props = pw_spa_dict_copy(update->props);
+		info->props = pw_spa_dict_update(info->props, update->props);
 	}
 	return info;
 }
@@ -287,9 +299,7 @@ struct pw_factory_info *pw_factory_info_update(struct pw_factory_info *info,
 	info->change_mask = update->change_mask;
 
 	if (update->change_mask & PW_FACTORY_CHANGE_MASK_PROPS) {
-		if (info->props)
-			pw_spa_dict_destroy(info->props);
-		info->props = pw_spa_dict_copy(update->props);
+		info->props = pw_spa_dict_update(info->props, update->props);
 	}
 	return info;
 }
@@ -333,9 +343,7 @@ struct pw_module_info *pw_module_info_update(struct pw_module_info *info,
 		info->args = update->args ? strdup(update->args) : NULL;
 	}
 	if (update->change_mask & PW_MODULE_CHANGE_MASK_PROPS) {
-		if (info->props)
-			pw_spa_dict_destroy(info->props);
-		info->props = pw_spa_dict_copy(update->props);
+		info->props = pw_spa_dict_update(info->props, update->props);
 	}
 	return info;
 }
@@ -369,9 +377,7 @@ struct pw_client_info *pw_client_info_update(struct pw_client_info *info,
 	info->change_mask = update->change_mask;
 
 	if (update->change_mask & PW_CLIENT_CHANGE_MASK_PROPS) {
-		if (info->props)
-			pw_spa_dict_destroy(info->props);
-		info->props = pw_spa_dict_copy(update->props);
+		info->props = pw_spa_dict_update(info->props, update->props);
 	}
 	return info;
 }
@@ -410,6 +416,8 @@ struct pw_link_info *pw_link_info_update(struct pw_link_info *info,
 			free(info->format);
 		info->format = pw_spa_pod_copy(update->format);
 	}
+	if (update->change_mask & PW_LINK_CHANGE_MASK_PROPS)
+		info->props = pw_spa_dict_update(info->props, update->props);
 	return info;
 }
 
@@ -417,5 +425,7 @@ void pw_link_info_free(struct pw_link_info *info)
 {
 	if (info->format)
 		free(info->format);
+	if (info->props)
+		pw_spa_dict_destroy(info->props);
 	free(info);
 }
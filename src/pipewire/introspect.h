@@ -70,6 +70,11 @@ const char * pw_link_state_as_string(enum pw_link_state state);
  *
  * The introspection methods and structures are used to get information
  * about the object in the PipeWire server
+ *
+ * The first info of an object has all fields, the following infos only
+ * have the fields in the change_mask. The props of an update only contain
+ * the properties that changed, a NULL value removes the property. Use the
+ * update functions to keep the complete info.
  */
 
 /**  The core information. Extra information can be added in later versions \memberof pw_introspect */
@@ -38,6 +38,8 @@
 
 #define MAX_BUFFERS     16
 
+#define PREFAULT_SIZE	(4 * 1024 * 1024)
+
 /** \cond */
 struct impl {
 	struct pw_link this;
@@ -49,6 +51,8 @@ struct impl {
 	struct spa_pod *format_filter;
 	struct pw_properties *properties;
 
+	enum pw_memblock_flags mem_flags;	/**< extra flags for the buffer memory */
+
 	struct spa_hook input_port_listener;
 	struct spa_hook input_node_listener;
 	struct spa_hook output_port_listener;
@@ -61,6 +65,14 @@ struct resource_data {
 
 /** \endcond */
 
+/* the link buffers point into the allocation of one of the ports, forget
+ * them when that allocation can go away */
+static void clear_link_buffers(struct pw_link *link)
+{
+	link->buffers = NULL;
+	link->n_buffers = 0;
+}
+
 static void pw_link_update_state(struct pw_link *link, enum pw_link_state state, char *error)
 {
 	enum pw_link_state old = link->state;
@@ -70,6 +82,8 @@ static void pw_link_update_state(struct pw_link *link, enum pw_link_state state,
 			     pw_link_state_as_string(old), pw_link_state_as_string(state), error);
 
 		link->state = state;
+		if (state == PW_LINK_STATE_ERROR || state == PW_LINK_STATE_UNLINKED)
+			clear_link_buffers(link);
 		if (link->error)
 			free(link->error);
 		link->error = error;
@@ -132,6 +146,7 @@ static int do_negotiate(struct pw_link *this, uint32_t in_state, uint32_t out_st
 		return 0;
 
 	pw_link_update_state(this, PW_LINK_STATE_NEGOTIATING, NULL);
+	clear_link_buffers(this);
 
 	input = this->input;
 	output = this->output;
@@ -333,6 +348,8 @@ static int alloc_buffers(struct pw_link *this,
 	struct spa_meta *metas;
 	struct pw_memblock *m;
 	struct pw_type *t = &this->core->type;
+	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
+	enum pw_memblock_flags flags;
 
 	n_metas = data_size = meta_size = 0;
 
@@ -372,9 +389,16 @@ static int alloc_buffers(struct pw_link *this,
 	/* pointer to buffer structures */
 	bp = SPA_MEMBER(buffers, n_buffers * sizeof(struct spa_buffer *), struct spa_buffer);
 
-	if ((res = pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
-				     PW_MEMBLOCK_FLAG_MAP_READWRITE |
-				     PW_MEMBLOCK_FLAG_SEAL, n_buffers * data_size, &m)) < 0)
+	flags = PW_MEMBLOCK_FLAG_WITH_FD |
+		PW_MEMBLOCK_FLAG_MAP_READWRITE |
+		PW_MEMBLOCK_FLAG_SEAL |
+		impl->mem_flags;
+
+	/* make sure the first frames don't have to fault in large buffers */
+	if (n_buffers * data_size >= PREFAULT_SIZE)
+		flags |= PW_MEMBLOCK_FLAG_MAP_POPULATE;
+
+	if ((res = pw_memblock_alloc(flags, n_buffers * data_size, &m)) < 0)
 		return res;
 
 	for (i = 0; i < n_buffers; i++) {
@@ -415,6 +439,7 @@ static int alloc_buffers(struct pw_link *this,
 				d->mapoffset = SPA_PTRDIFF(ddp, m->ptr);
 				d->maxsize = data_sizes[j];
 				d->data = SPA_MEMBER(m->ptr, d->mapoffset, void);
+				d->mapoffset += m->offset;
 				d->chunk->offset = 0;
 				d->chunk->size = 0;
 				d->chunk->stride = data_strides[j];
@@ -429,6 +454,7 @@ static int alloc_buffers(struct pw_link *this,
 	allocation->mem = m;
 	allocation->n_buffers = n_buffers;
 	allocation->buffers = buffers;
+	allocation->refcount = NULL;
 
 	return 0;
 }
@@ -482,6 +508,132 @@ param_filter(struct pw_link *this,
 	return num;
 }
 
+/* when more than one link goes to an input port that can mix, the node of the
+ * input port gets port buffers and the links keep their own buffers. The port
+ * mixes the link buffers into the port buffers. This is also the case when the
+ * input port is already running with the buffers of another link. */
+static bool input_needs_mix(struct pw_link *this, struct pw_port *input)
+{
+	struct pw_link *l;
+
+	if (!pw_port_can_mix(input))
+		return false;
+
+	if (input->mix_allocation.n_buffers > 0)
+		return true;
+
+	spa_list_for_each(l, &input->links, input_link) {
+		if (l != this && l->n_buffers > 0)
+			return true;
+	}
+	return false;
+}
+
+static int setup_input_mix(struct pw_link *this, struct pw_port *input,
+			   struct allocation *link_allocation)
+{
+	struct allocation allocation;
+	struct spa_data *d;
+	size_t data_sizes[1];
+	ssize_t data_strides[1];
+	int res;
+
+	if (input->mix_allocation.n_buffers > 0)
+		return 0;
+
+	/* the other links use the buffers of the input node */
+	if (input->allocated)
+		return -ENOTSUP;
+
+	d = link_allocation->buffers[0]->datas;
+	if (link_allocation->buffers[0]->n_datas != 1 || d[0].maxsize == 0)
+		return -ENOTSUP;
+
+	data_sizes[0] = d[0].maxsize;
+	data_strides[0] = d[0].chunk->stride;
+
+	if ((res = alloc_buffers(this,
+				 link_allocation->n_buffers,
+				 0, NULL,
+				 1,
+				 data_sizes, data_strides,
+				 &allocation)) < 0)
+		return res;
+
+	if ((res = pw_port_setup_mix(input, &allocation)) < 0)
+		free_allocation(&allocation);
+
+	return res;
+}
+
+/* an output port that can work in place can reuse the buffers of the input
+ * of its node, the node then forwards the input buffers. We only do this when
+ * the node has one input port with one link from an output that has no other
+ * links, when mixing, the mix buffers belong to the input port. The allocation of the input link is shared so
+ * that the buffers stay around until both links are done with them. Buffer
+ * data that was allocated by a node can't be shared like that. */
+static bool find_in_place_buffers(struct pw_port *output, struct allocation *allocation)
+{
+	struct pw_port *p, *input = NULL;
+	struct pw_link *l;
+	struct allocation *owner;
+
+	spa_list_for_each(p, &output->node->input_ports, link) {
+		if (input != NULL)
+			return false;
+		input = p;
+	}
+	if (input == NULL || input->mix_allocation.n_buffers > 0 ||
+	    spa_list_is_empty(&input->links))
+		return false;
+
+	l = spa_list_first(&input->links, struct pw_link, input_link);
+	if (l->input_link.next != &input->links || l->n_buffers == 0 ||
+	    l->output->allocated || l->input->allocated)
+		return false;
+
+	/* the other links of the output would see the data of our output */
+	if (l->output->links.next != &l->output_link ||
+	    l->output_link.next != &l->output->links)
+		return false;
+
+	if (l->output->allocation.buffers == l->buffers)
+		owner = &l->output->allocation;
+	else if (l->input->allocation.buffers == l->buffers)
+		owner = &l->input->allocation;
+	else
+		return false;
+
+	return ref_allocation(owner, allocation) >= 0;
+}
+
+/* buffers that are forwarded in place can only be used by the two links of the
+ * node that forwards them. Other links can't reuse the output buffers and the
+ * input of the node can't switch to mix buffers. */
+static bool buffers_in_place(struct pw_link *this, struct pw_port *output, struct pw_port *input)
+{
+	struct pw_link *l;
+	struct pw_port *p;
+
+	if (output->allocation.refcount != NULL && *output->allocation.refcount > 1) {
+		spa_list_for_each(l, &output->links, output_link) {
+			if (l != this && l->n_buffers > 0)
+				return true;
+		}
+	}
+	if (input_needs_mix(this, input)) {
+		spa_list_for_each(l, &input->links, input_link) {
+			if (l == this || l->n_buffers == 0)
+				continue;
+			spa_list_for_each(p, &input->node->output_ports, link) {
+				if (p->allocation.buffers == l->buffers)
+					return true;
+			}
+		}
+	}
+	return false;
+}
+
 static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_state)
 {
 	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
@@ -492,15 +644,21 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 	struct pw_port *input, *output;
 	struct pw_type *t = &this->core->type;
 	struct allocation allocation;
+	bool mix;
 
-	if (in_state != PW_PORT_STATE_READY && out_state != PW_PORT_STATE_READY)
+	input = this->input;
+	output = this->output;
+
+	/* a link to an input that has the buffers of another link needs its own
+	 * buffers, also when both ports are already running */
+	mix = this->n_buffers == 0 && in_state > PW_PORT_STATE_READY &&
+		input_needs_mix(this, input);
+
+	if (in_state != PW_PORT_STATE_READY && out_state != PW_PORT_STATE_READY && !mix)
 		return 0;
 
 	pw_link_update_state(this, PW_LINK_STATE_ALLOCATING, NULL);
 
-	input = this->input;
-	output = this->output;
-
 	pw_log_debug("link %p: doing alloc buffers %p %p", this, output->node, input->node);
 	/* find out what's possible */
 	if ((res = spa_node_port_get_info(output->node->node, output->direction, output->port_id,
@@ -548,6 +706,21 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 	} else if (in_state == PW_PORT_STATE_READY && out_state > PW_PORT_STATE_READY) {
 		out_flags &= ~SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS;
 		in_flags &= ~SPA_PORT_INFO_FLAG_CAN_ALLOC_BUFFERS;
+	} else if (mix) {
+		/* the input node keeps its buffers, the link buffers are mixed
+		 * into the port buffers */
+		in_flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS;
+		if (out_state > PW_PORT_STATE_READY)
+			out_flags = 0;
+		else if (out_flags & SPA_PORT_INFO_FLAG_CAN_ALLOC_BUFFERS)
+			out_flags = SPA_PORT_INFO_FLAG_CAN_ALLOC_BUFFERS;
+		else if (out_flags & SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS)
+			out_flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS;
+		else {
+			asprintf(&error, "no common buffer alloc found");
+			res = -EIO;
+			goto error;
+		}
 	} else if (out_state == PW_PORT_STATE_READY && in_state > PW_PORT_STATE_READY) {
 		in_flags &= ~SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS;
 		out_flags &= ~SPA_PORT_INFO_FLAG_CAN_ALLOC_BUFFERS;
@@ -560,6 +733,12 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 		spa_debug_port_info(2, oinfo);
 		spa_debug_port_info(2, iinfo);
 	}
+	if (buffers_in_place(this, output, input)) {
+		asprintf(&error, "buffers are forwarded in place");
+		res = -EBUSY;
+		goto error_state;
+	}
+
 	if (output->allocation.n_buffers) {
 		out_flags = 0;
 		in_flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS;
@@ -568,7 +747,7 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 
 		pw_log_debug("link %p: reusing %d output buffers %p", this,
 				allocation.n_buffers, allocation.buffers);
-	} else if (input->allocation.n_buffers && input->mix == NULL) {
+	} else if (input->allocation.n_buffers && input->mix == NULL && !mix) {
 		out_flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS;
 		in_flags = 0;
 
@@ -576,6 +755,15 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 
 		pw_log_debug("link %p: reusing %d input buffers %p", this,
 				allocation.n_buffers, allocation.buffers);
+	} else if ((oinfo->flags & SPA_PORT_INFO_FLAG_IN_PLACE) &&
+		   (out_flags & SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS) &&
+		   (iinfo->flags & SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS) &&
+		   find_in_place_buffers(output, &allocation)) {
+		out_flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS;
+		in_flags = 0;
+
+		pw_log_debug("link %p: forwarding %d buffers %p in place", this,
+				allocation.n_buffers, allocation.buffers);
 	} else {
 		struct spa_pod **params, *param;
 		uint8_t buffer[4096];
@@ -693,27 +881,49 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 		move_allocation(&allocation, &output->allocation);
 
 	} else if (in_flags & SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS) {
-		pw_log_debug("link %p: using %d buffers %p on input port", this,
-			     allocation.n_buffers, allocation.buffers);
-		if ((res = pw_port_use_buffers(input,
-					       allocation.buffers,
-					       allocation.n_buffers)) < 0) {
-			asprintf(&error, "error use input buffers: %d", res);
-			goto error;
+		if (!mix && !input_needs_mix(this, input)) {
+			pw_log_debug("link %p: using %d buffers %p on input port", this,
+				     allocation.n_buffers, allocation.buffers);
+			if ((res = pw_port_use_buffers(input,
+						       allocation.buffers,
+						       allocation.n_buffers)) < 0) {
+				asprintf(&error, "error use input buffers: %d", res);
+				goto error;
+			}
+			if (SPA_RESULT_IS_ASYNC(res))
+				pw_work_queue_add(impl->work, input->node, res, complete_paused, input);
+		} else
+			mix = true;
+	} else {
+		asprintf(&error, "no common buffer alloc found");
+		goto error;
+	}
+
+	if (mix) {
+		if ((res = setup_input_mix(this, input, &allocation)) < 0) {
+			asprintf(&error, "error mix input buffers: %d", res);
+			/* the input buffers and, when we reused them, the output
+			 * buffers are used by the other links */
+			if (out_flags != 0)
+				free_allocation(&output->allocation);
+			goto error_state;
 		}
 		if (SPA_RESULT_IS_ASYNC(res))
 			pw_work_queue_add(impl->work, input->node, res, complete_paused, input);
 
-	} else {
-		asprintf(&error, "no common buffer alloc found");
-		goto error;
+		pw_log_debug("link %p: mixing %d buffers %p into input port", this,
+			     allocation.n_buffers, allocation.buffers);
 	}
 
+	this->buffers = allocation.buffers;
+	this->n_buffers = allocation.n_buffers;
+
 	return 0;
 
       error:
 	free_allocation(&output->allocation);
 	free_allocation(&input->allocation);
+      error_state:
 	pw_link_update_state(this, PW_LINK_STATE_ERROR, error);
 	return res;
 }
@@ -743,6 +953,14 @@ static int do_start(struct pw_link *this, uint32_t in_state, uint32_t out_state)
 	input = this->input;
 	output = this->output;
 
+	/* reactivated without a new allocation, pick up the port buffers again */
+	if (this->n_buffers == 0) {
+		struct allocation *a = output->allocation.n_buffers > 0 ?
+			&output->allocation : &input->allocation;
+		this->buffers = a->buffers;
+		this->n_buffers = a->n_buffers;
+	}
+
 	pw_loop_invoke(output->node->data_loop,
 		       do_activate_link, SPA_ID_INVALID, NULL, 0, false, this);
 
@@ -880,6 +1098,7 @@ static void input_remove(struct pw_link *this, struct pw_port *port)
 	spa_list_remove(&this->input_link);
 	pw_port_events_link_removed(this->input, this);
 
+	clear_link_buffers(this);
 	clear_port_buffers(this, port);
 	this->input = NULL;
 }
@@ -909,6 +1128,7 @@ static void output_remove(struct pw_link *this, struct pw_port *port)
 	spa_list_remove(&this->output_link);
 	pw_port_events_link_removed(this->output, this);
 
+	clear_link_buffers(this);
 	clear_port_buffers(this, port);
 	this->output = NULL;
 }
@@ -976,6 +1196,8 @@ int pw_link_deactivate(struct pw_link *this)
 	pw_loop_invoke(this->output->node->data_loop,
 		       do_deactivate_link, SPA_ID_INVALID, NULL, 0, true, this);
 
+	clear_link_buffers(this);
+
 	input_node = this->input->node;
 	output_node = this->output->node;
 
@@ -1135,6 +1357,12 @@ struct pw_link *pw_link_new(struct pw_core *core,
 			input_node->idle_used_input_links++;
 			output_node->idle_used_output_links++;
 		}
+		str = pw_properties_get(properties, PW_LINK_PROP_PREFAULT);
+		if (str && pw_properties_parse_bool(str))
+			impl->mem_flags |= PW_MEMBLOCK_FLAG_MAP_POPULATE;
+		str = pw_properties_get(properties, PW_LINK_PROP_HUGEPAGES);
+		if (str && pw_properties_parse_bool(str))
+			impl->mem_flags |= PW_MEMBLOCK_FLAG_HUGEPAGES;
 	}
 	spa_list_init(&this->resource_list);
 	spa_hook_list_init(&this->listener_list);
@@ -1311,6 +1539,9 @@ void pw_link_destroy(struct pw_link *link)
 	if (link->info.format)
 		free(link->info.format);
 
+	if (link->error)
+		free(link->error);
+
 	free(impl);
 }
 
@@ -75,6 +75,13 @@ struct pw_link_events {
   * set to "1" or "0" */
 #define PW_LINK_PROP_PASSIVE	"pipewire.link.passive"
 
+/** Fault in the buffer memory of the link when it is allocated, set to "1"
+  * or "0". Large buffer memory is always faulted in. */
+#define PW_LINK_PROP_PREFAULT	"pipewire.link.prefault"
+
+/** Use huge pages for the buffer memory of the link, set to "1" or "0" */
+#define PW_LINK_PROP_HUGEPAGES	"pipewire.link.hugepages"
+
 /** Make a new link between two ports \memberof pw_link
  * \return a newly allocated link */
 struct pw_link *
@@ -31,10 +31,12 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <sys/syscall.h>
 
 #include <spa/utils/list.h>
 
+#include <pipewire/array.h>
 #include <pipewire/log.h>
 #include <pipewire/mem.h>
 
@@ -79,15 +81,65 @@ static inline int memfd_create(const char *name, unsigned int flags)
 #define F_SEAL_WRITE    0x0008	/* prevent writes */
 #endif
 
+struct size_class;
+
 struct memblock {
 	struct pw_memblock mem;
 	struct spa_list link;
+	struct size_class *class;	/**< size class of the pool or NULL */
+	bool dirty;		/**< block was used before */
+	bool indexed;		/**< block is in the index */
+	bool exported;		/**< fd was given out, never reuse the memory */
 };
 
-static struct spa_list _memblocks = SPA_LIST_INIT(&_memblocks);
+/* mapped blocks, sorted on ptr */
+static struct pw_array _index = PW_ARRAY_INIT(512);
+static pthread_rwlock_t _index_lock = PTHREAD_RWLOCK_INITIALIZER;
 
 #define USE_MEMFD
 
+/* Allocations of up to POOL_MAX_SIZE bytes are taken from a pool. The pool
+ * has a size class for each power of two between POOL_MIN_SIZE and
+ * POOL_MAX_SIZE. Each block has its own memfd of the class size. Freed
+ * blocks keep their memfd and mapping and are reused by the next allocation
+ * of the class, up to POOL_KEEP_SIZE bytes per class.
+ *
+ * The pool is private to the process: a block whose fd was given out with
+ * pw_memblock_export() is destroyed when it is freed. The other process has
+ * its own reference to the memfd and can map it again at any time, also
+ * after it said that it removed the memory, so there is no point where the
+ * memory could safely be given to another block. This means that the buffers
+ * and transports of client nodes are not recycled. */
+#define POOL_MIN_SHIFT	12
+#define POOL_MAX_SHIFT	20
+#define POOL_MIN_SIZE	(1 << POOL_MIN_SHIFT)
+#define POOL_MAX_SIZE	(1 << POOL_MAX_SHIFT)
+#define POOL_KEEP_SIZE	(1 << 20)
+#define POOL_N_CLASSES	(POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+
+#define POOL_FLAGS	(PW_MEMBLOCK_FLAG_WITH_FD | PW_MEMBLOCK_FLAG_SEAL | \
+			 PW_MEMBLOCK_FLAG_MAP_READWRITE)
+#define NO_POOL_FLAGS	(PW_MEMBLOCK_FLAG_MAP_TWICE | PW_MEMBLOCK_FLAG_MAP_POPULATE | \
+			 PW_MEMBLOCK_FLAG_HUGEPAGES)
+
+#define HUGEPAGE_SIZE	(2 * 1024 * 1024)
+
+struct size_class {
+	size_t size;
+	struct spa_list free;	/**< freed blocks */
+	uint32_t n_free;
+	uint32_t max_free;	/**< freed blocks to keep */
+};
+
+static struct {
+	pthread_mutex_t lock;
+	bool initialized;
+	struct size_class classes[POOL_N_CLASSES];
+	struct pw_memblock_stats stats;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
 /** Map a memblock
  * \param mem a memblock
  * \return 0 on success, < 0 on error
@@ -131,10 +183,18 @@ int pw_memblock_map(struct pw_memblock *mem)
 				return -ENOMEM;
 			}
 		} else {
-			mem->ptr = mmap(NULL, mem->size, prot, MAP_SHARED, mem->fd, 0);
+			int flags = MAP_SHARED;
+
+			if (mem->flags & PW_MEMBLOCK_FLAG_MAP_POPULATE)
+				flags |= MAP_POPULATE;
+
+			mem->ptr = mmap(NULL, mem->size, prot, flags, mem->fd, mem->offset);
 			if (mem->ptr == MAP_FAILED)
 				return -ENOMEM;
 		}
+		if (mem->flags & PW_MEMBLOCK_FLAG_HUGEPAGES &&
+		    madvise(mem->ptr, mem->size, MADV_HUGEPAGE) < 0)
+			pw_log_debug("mem %p: no huge pages: %m", mem);
 	} else {
 		mem->ptr = NULL;
 	}
@@ -142,6 +202,220 @@ int pw_memblock_map(struct pw_memblock *mem)
 	return 0;
 }
 
+/* position of the first block that starts after ptr */
+static uint32_t index_upper_bound(const void *ptr)
+{
+	struct memblock **blocks = _index.data;
+	uint32_t lo = 0, hi = pw_array_get_len(&_index, struct memblock *);
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (blocks[mid]->mem.ptr <= ptr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void index_add(struct memblock *m)
+{
+	struct memblock **blocks;
+	uint32_t pos, len;
+
+	if (m->mem.ptr == NULL || m->mem.size == 0)
+		return;
+
+	pthread_rwlock_wrlock(&_index_lock);
+	pos = index_upper_bound(m->mem.ptr);
+	if (pw_array_add(&_index, sizeof(struct memblock *)) != NULL) {
+		blocks = _index.data;
+		len = pw_array_get_len(&_index, struct memblock *);
+		memmove(&blocks[pos + 1], &blocks[pos], (len - pos - 1) * sizeof(struct memblock *));
+		blocks[pos] = m;
+		m->indexed = true;
+	}
+	pthread_rwlock_unlock(&_index_lock);
+}
+
+static void index_remove(struct memblock *m)
+{
+	struct memblock **blocks;
+	uint32_t pos, len;
+
+	if (!m->indexed)
+		return;
+
+	pthread_rwlock_wrlock(&_index_lock);
+	blocks = _index.data;
+	len = pw_array_get_len(&_index, struct memblock *);
+	for (pos = index_upper_bound(m->mem.ptr); pos > 0; pos--) {
+		if (blocks[pos - 1] == m) {
+			memmove(&blocks[pos - 1], &blocks[pos], (len - pos) * sizeof(struct memblock *));
+			_index.size -= sizeof(struct memblock *);
+			break;
+		}
+	}
+	m->indexed = false;
+	pthread_rwlock_unlock(&_index_lock);
+}
+
+static int create_fd(size_t size, bool seal)
+{
+	int fd;
+
+#ifdef USE_MEMFD
+	fd = memfd_create("pipewire-memfd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd == -1) {
+		pw_log_error("Failed to create memfd: %s\n", strerror(errno));
+		return -errno;
+	}
+#else
+	char filename[] = "/dev/shm/pipewire-tmpfile.XXXXXX";
+	fd = mkostemp(filename, O_CLOEXEC);
+	if (fd == -1) {
+		pw_log_error("Failed to create temporary file: %s\n", strerror(errno));
+		return -errno;
+	}
+	unlink(filename);
+#endif
+
+	if (ftruncate(fd, size) < 0) {
+		int res = -errno;
+		pw_log_warn("Failed to truncate temporary file: %s", strerror(errno));
+		close(fd);
+		return res;
+	}
+#ifdef USE_MEMFD
+	if (seal) {
+		unsigned int seals = F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL;
+		if (fcntl(fd, F_ADD_SEALS, seals) == -1) {
+			pw_log_warn("Failed to add seals: %s", strerror(errno));
+		}
+	}
+#endif
+	return fd;
+}
+
+static struct size_class *pool_get_class(size_t size)
+{
+	uint32_t i;
+
+	if (!pool.initialized) {
+		for (i = 0; i < POOL_N_CLASSES; i++) {
+			struct size_class *c = &pool.classes[i];
+			c->size = POOL_MIN_SIZE << i;
+			c->max_free = SPA_MAX(POOL_KEEP_SIZE / c->size, 1);
+			spa_list_init(&c->free);
+		}
+		pool.initialized = true;
+	}
+	for (i = 0; i < POOL_N_CLASSES; i++) {
+		if (size <= pool.classes[i].size)
+			return &pool.classes[i];
+	}
+	return NULL;
+}
+
+static struct memblock *pool_new_block(struct size_class *class)
+{
+	struct memblock *b;
+
+	b = calloc(1, sizeof(struct memblock));
+	if (b == NULL)
+		return NULL;
+
+	if ((b->mem.fd = create_fd(class->size, true)) < 0)
+		goto error;
+
+	b->mem.ptr = mmap(NULL, class->size, PROT_READ | PROT_WRITE, MAP_SHARED, b->mem.fd, 0);
+	if (b->mem.ptr == MAP_FAILED) {
+		close(b->mem.fd);
+		goto error;
+	}
+	b->class = class;
+
+	pool.stats.n_fds++;
+	pool.stats.resident_size += class->size;
+
+	pw_log_debug("mem: new pool block %p of %zd bytes", b, class->size);
+	return b;
+
+      error:
+	free(b);
+	return NULL;
+}
+
+static void pool_free_block(struct memblock *b)
+{
+	pw_log_debug("mem: free pool block %p", b);
+
+	pool.stats.n_fds--;
+	pool.stats.resident_size -= b->class->size;
+
+	munmap(b->mem.ptr, b->class->size);
+	close(b->mem.fd);
+	free(b);
+}
+
+static struct memblock *pool_alloc(enum pw_memblock_flags flags, size_t size)
+{
+	struct size_class *class;
+	struct memblock *b;
+
+	pthread_mutex_lock(&pool.lock);
+	if ((class = pool_get_class(size)) == NULL)
+		goto error;
+
+	pool.stats.n_allocs++;
+
+	if (!spa_list_is_empty(&class->free)) {
+		b = spa_list_first(&class->free, struct memblock, link);
+		spa_list_remove(&b->link);
+		class->n_free--;
+		pool.stats.n_hits++;
+	} else if ((b = pool_new_block(class)) == NULL)
+		goto error;
+
+	pool.stats.used_size += class->size;
+	pthread_mutex_unlock(&pool.lock);
+
+	/* a new memfd is cleared, do the same for the part of a reused block
+	 * that was used before */
+	if (b->dirty)
+		memset(b->mem.ptr, 0, b->mem.size);
+	b->dirty = true;
+
+	b->mem.flags = flags;
+	b->mem.offset = 0;
+	b->mem.size = size;
+
+	return b;
+
+      error:
+	pthread_mutex_unlock(&pool.lock);
+	return NULL;
+}
+
+static void pool_free(struct memblock *b)
+{
+	struct size_class *class = b->class;
+
+	pthread_mutex_lock(&pool.lock);
+	pool.stats.used_size -= class->size;
+
+	if (b->exported)
+		pool.stats.n_exported++;
+
+	if (b->exported || class->n_free >= class->max_free)
+		pool_free_block(b);
+	else {
+		spa_list_prepend(&class->free, &b->link);
+		class->n_free++;
+	}
+	pthread_mutex_unlock(&pool.lock);
+}
+
 /** Create a new memblock
  * \param flags memblock flags
  * \param size size to allocate
@@ -151,7 +425,7 @@ int pw_memblock_map(struct pw_memblock *mem)
  */
 int pw_memblock_alloc(enum pw_memblock_flags flags, size_t size, struct pw_memblock **mem)
 {
-	struct memblock tmp, *p;
+	struct memblock tmp = { 0, }, *p;
 	struct pw_memblock *m;
 	bool use_fd;
 
@@ -166,36 +440,22 @@ int pw_memblock_alloc(enum pw_memblock_flags flags, size_t size, struct pw_membl
 
 	use_fd = ! !(flags & (PW_MEMBLOCK_FLAG_MAP_TWICE | PW_MEMBLOCK_FLAG_WITH_FD));
 
+	if ((flags & POOL_FLAGS) == POOL_FLAGS &&
+	    !(flags & NO_POOL_FLAGS) &&
+	    size > 0 && size <= POOL_MAX_SIZE) {
+		if ((p = pool_alloc(flags, size)) == NULL)
+			return -ENOMEM;
+		goto done;
+	}
+
 	if (use_fd) {
-#ifdef USE_MEMFD
-		m->fd = memfd_create("pipewire-memfd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
-		if (m->fd == -1) {
-			pw_log_error("Failed to create memfd: %s\n", strerror(errno));
-			return -errno;
-		}
-#else
-		char filename[] = "/dev/shm/pipewire-tmpfile.XXXXXX";
-		m->fd = mkostemp(filename, O_CLOEXEC);
-		if (m->fd == -1) {
-			pw_log_error("Failed to create temporary file: %s\n", strerror(errno));
-			return -errno;
-		}
-		unlink(filename);
-#endif
+		/* use whole huge pages */
+		if (flags & PW_MEMBLOCK_FLAG_HUGEPAGES)
+			m->size = size = SPA_ROUND_UP_N(size, HUGEPAGE_SIZE);
+
+		if ((m->fd = create_fd(size, flags & PW_MEMBLOCK_FLAG_SEAL)) < 0)
+			return m->fd;
 
-		if (ftruncate(m->fd, size) < 0) {
-			pw_log_warn("Failed to truncate temporary file: %s", strerror(errno));
-			close(m->fd);
-			return -errno;
-		}
-#ifdef USE_MEMFD
-		if (flags & PW_MEMBLOCK_FLAG_SEAL) {
-			unsigned int seals = F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL;
-			if (fcntl(m->fd, F_ADD_SEALS, seals) == -1) {
-				pw_log_warn("Failed to add seals: %s", strerror(errno));
-			}
-		}
-#endif
 		if (pw_memblock_map(m) != 0)
 			goto mmap_failed;
 	} else {
@@ -213,7 +473,8 @@ int pw_memblock_alloc(enum pw_memblock_flags flags, size_t size, struct pw_membl
 
 	p = calloc(1, sizeof(struct memblock));
 	*p = tmp;
-	spa_list_append(&_memblocks, &p->link);
+      done:
+	index_add(p);
 	*mem = &p->mem;
 	pw_log_debug("mem %p: alloc", *mem);
 
@@ -241,7 +502,11 @@ pw_memblock_import(enum pw_memblock_flags flags,
 
 	pw_log_debug("mem %p: import", *mem);
 
-	return pw_memblock_map(*mem);
+	if ((res = pw_memblock_map(*mem)) < 0)
+		return res;
+
+	index_add((struct memblock *) *mem);
+	return 0;
 }
 
 /** Free a memblock
@@ -256,6 +521,12 @@ void pw_memblock_free(struct pw_memblock *mem)
 		return;
 
 	pw_log_debug("mem %p: free", mem);
+	index_remove(m);
+
+	if (m->class) {
+		pool_free(m);
+		return;
+	}
 	if (mem->flags & PW_MEMBLOCK_FLAG_WITH_FD) {
 		if (mem->ptr)
 			munmap(mem->ptr, mem->size);
@@ -264,17 +535,56 @@ void pw_memblock_free(struct pw_memblock *mem)
 	} else {
 		free(mem->ptr);
 	}
-	spa_list_remove(&m->link);
 	free(mem);
 }
 
-struct pw_memblock * pw_memblock_find(const void *ptr)
+/** Give out the fd of a memblock
+ * \param mem a memblock
+ * \return the fd of \a mem
+ *
+ * Call this before the fd is sent to another process. The memory of an
+ * exported block is not reused for other blocks after it is freed.
+ *
+ * \memberof pw_memblock
+ */
+int pw_memblock_export(struct pw_memblock *mem)
 {
-	struct memblock *m;
+	((struct memblock *)mem)->exported = true;
+	return mem->fd;
+}
 
-	spa_list_for_each(m, &_memblocks, link) {
-		if (ptr >= m->mem.ptr && ptr < m->mem.ptr + m->mem.size)
-			return &m->mem;
+/** Find the memblock that contains \a ptr
+ * \param ptr a pointer
+ * \return the memblock or NULL when no memblock contains \a ptr
+ *
+ * This function can be called from any thread.
+ *
+ * \memberof pw_memblock
+ */
+struct pw_memblock * pw_memblock_find(const void *ptr)
+{
+	struct memblock *m = NULL;
+	uint32_t pos;
+
+	pthread_rwlock_rdlock(&_index_lock);
+	pos = index_upper_bound(ptr);
+	if (pos > 0) {
+		m = ((struct memblock **) _index.data)[pos - 1];
+		if (ptr >= m->mem.ptr + m->mem.size)
+			m = NULL;
 	}
-	return NULL;
+	pthread_rwlock_unlock(&_index_lock);
+
+	return m ? &m->mem : NULL;
+}
+
+/** Get the statistics of the memblock pool
+ * \param[out] stats the statistics
+ * \memberof pw_memblock
+ */
+void pw_memblock_get_stats(struct pw_memblock_stats *stats)
+{
+	pthread_mutex_lock(&pool.lock);
+	*stats = pool.stats;
+	pthread_mutex_unlock(&pool.lock);
 }
@@ -34,6 +34,8 @@ enum pw_memblock_flags {
 	PW_MEMBLOCK_FLAG_MAP_READ = (1 << 2),
 	PW_MEMBLOCK_FLAG_MAP_WRITE = (1 << 3),
 	PW_MEMBLOCK_FLAG_MAP_TWICE = (1 << 4),
+	PW_MEMBLOCK_FLAG_MAP_POPULATE = (1 << 5),	/**< fault in the memory when mapping */
+	PW_MEMBLOCK_FLAG_HUGEPAGES = (1 << 6),		/**< advise transparent huge pages */
 };
 
 #define PW_MEMBLOCK_FLAG_MAP_READWRITE (PW_MEMBLOCK_FLAG_MAP_READ | PW_MEMBLOCK_FLAG_MAP_WRITE)
@@ -62,9 +64,29 @@ pw_memblock_map(struct pw_memblock *mem);
 void
 pw_memblock_free(struct pw_memblock *mem);
 
+/** Give out the fd of \a mem to another process */
+int pw_memblock_export(struct pw_memblock *mem);
+
 /** Find memblock for given \a ptr */
 struct pw_memblock * pw_memblock_find(const void *ptr);
 
+/** Statistics of the memblock pool. Sealed blocks that are allocated with
+ * an fd and mapped read-write are taken from a pool of memfds. Each block has
+ * its own memfd, freed memfds are reused for the next block of the same size
+ * unless they were exported. */
+struct pw_memblock_stats {
+	uint32_t n_allocs;	/**< number of allocations from the pool */
+	uint32_t n_hits;	/**< allocations that reused memory */
+	uint32_t n_exported;	/**< freed blocks that were not reused because
+				  *  they were exported */
+	uint32_t n_fds;		/**< number of memfds in the pool */
+	size_t resident_size;	/**< size of the memfds in the pool */
+	size_t used_size;	/**< size of the used blocks */
+};
+
+/** Get the statistics of the memblock pool */
+void pw_memblock_get_stats(struct pw_memblock_stats *stats);
+
 /** parameters to map a memory range */
 struct pw_map_range {
 	uint32_t start;		/** offset in first page with start of data */
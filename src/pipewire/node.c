@@ -107,6 +107,11 @@ static int suspend_node(struct pw_node *this)
 	return res;
 }
 
+static int64_t quantum_to_latency(struct pw_core *core)
+{
+	return (int64_t) core->quantum * SPA_NSEC_PER_SEC / PW_CORE_QUANTUM_RATE;
+}
+
 static void send_clock_update(struct pw_node *this)
 {
 	int res;
@@ -123,7 +128,7 @@ static void send_clock_update(struct pw_node *this)
 						(1 << 16) | 1,   /* scale */
 						SPA_CLOCK_STATE_RUNNING, /* state */
 						0,       /* flags */
-						0);      /* latency */
+						quantum_to_latency(this->core));
 
 	if (this->clock && this->live) {
 		cu.body.flags.value = SPA_COMMAND_NODE_CLOCK_UPDATE_FLAG_LIVE;
@@ -137,6 +142,20 @@ static void send_clock_update(struct pw_node *this)
 		pw_log_debug("node %p: send clock update error %s", this, spa_strerror(res));
 }
 
+void pw_node_send_quantum(struct pw_node *node)
+{
+	int res;
+	struct spa_command_node_clock_update cu =
+		SPA_COMMAND_NODE_CLOCK_UPDATE_INIT(node->core->type.command_node.ClockUpdate,
+						SPA_COMMAND_NODE_CLOCK_UPDATE_LATENCY,   /* change_mask */
+						0, 0, 0, 0, 0, 0, 0,
+						quantum_to_latency(node->core));
+
+	res = spa_node_send_command(node->node, (struct spa_command *) &cu);
+	if (res < 0)
+		pw_log_debug("node %p: send quantum error %s", node, spa_strerror(res));
+}
+
 static void node_unbind_func(void *data)
 {
 	struct pw_resource *resource = data;
@@ -355,6 +374,9 @@ int pw_node_register(struct pw_node *this,
 	spa_list_append(&core->node_list, &this->link);
 	this->registered = true;
 
+	if (this->quantum > 0)
+		pw_core_update_quantum(core);
+
 	this->global = pw_global_new(core,
 				     core->type.node, PW_VERSION_NODE,
 				     properties,
@@ -385,11 +407,23 @@ static void check_properties(struct pw_node *node)
 {
 	struct impl *impl = SPA_CONTAINER_OF(node, struct impl, this);
 	const char *str;
+	uint32_t quantum = 0, num, denom;
 
 	if ((str = pw_properties_get(node->properties, "node.pause-on-idle")))
 		impl->pause_on_idle = pw_properties_parse_bool(str);
 	else
 		impl->pause_on_idle = true;
+
+	if ((str = pw_properties_get(node->properties, PW_NODE_PROP_LATENCY)) &&
+	    sscanf(str, "%u/%u", &num, &denom) == 2 && denom > 0)
+		quantum = (uint64_t) num * PW_CORE_QUANTUM_RATE / denom;
+
+	if (node->quantum != quantum) {
+		pw_log_debug("node %p: quantum %u", node, quantum);
+		node->quantum = quantum;
+		if (node->registered)
+			pw_core_update_quantum(node->core);
+	}
 }
 
 struct pw_node *pw_node_new(struct pw_core *core,
@@ -477,10 +511,14 @@ const struct pw_properties *pw_node_get_properties(struct pw_node *node)
 int pw_node_update_properties(struct pw_node *node, const struct spa_dict *dict)
 {
 	struct pw_resource *resource;
-	uint32_t i;
+	struct pw_node_info info;
+	struct spa_dict_item *items;
+	struct spa_dict changed;
 
-	for (i = 0; i < dict->n_items; i++)
-		pw_properties_set(node->properties, dict->items[i].key, dict->items[i].value);
+	items = alloca(sizeof(struct spa_dict_item) * dict->n_items);
+	changed = SPA_DICT_INIT(items, pw_properties_update(node->properties, dict, items));
+	if (changed.n_items == 0)
+		return 0;
 
 	check_properties(node);
 
@@ -489,12 +527,15 @@ int pw_node_update_properties(struct pw_node *node, const struct spa_dict *dict)
 	node->info.change_mask |= PW_NODE_CHANGE_MASK_PROPS;
 	pw_node_events_info_changed(node, &node->info);
 
+	/* the clients only get the changed properties */
+	info = node->info;
+	info.props = &changed;
 	spa_list_for_each(resource, &node->resource_list, link)
-		pw_node_resource_info(resource, &node->info);
+		pw_node_resource_info(resource, &info);
 
 	node->info.change_mask = 0;
 
-	return 0;
+	return changed.n_items;
 }
 
 static void node_done(void *data, int seq, int res)
@@ -617,6 +658,8 @@ void pw_node_destroy(struct pw_node *node)
 	if (node->registered) {
 		pw_loop_invoke(node->data_loop, do_node_remove, 1, NULL, 0, true, node);
 		spa_list_remove(&node->link);
+		if (node->quantum > 0)
+			pw_core_update_quantum(node->core);
 	}
 
 	pw_log_debug("node %p: unlink ports", node);
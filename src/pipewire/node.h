@@ -104,6 +104,9 @@ struct pw_node_events {
 #define PW_NODE_PROP_AUTOCONNECT	"pipewire.autoconnect"
 /** Try to connect the node to this node id */
 #define PW_NODE_PROP_TARGET_NODE	"pipewire.target.node"
+/** The latency the node needs as "<frames>/<rate>", like "256/48000". The
+ * graph runs with the lowest latency that the nodes ask for. */
+#define PW_NODE_PROP_LATENCY		"node.latency"
 
 /** Create a new node \memberof pw_node */
 struct pw_node *
@@ -22,14 +22,23 @@
 #include <errno.h>
 
 #include <spa/pod/parser.h>
+#include <spa/utils/mix-ops.h>
 
 #include "pipewire/pipewire.h"
 #include "pipewire/private.h"
 #include "pipewire/port.h"
 
 /** \cond */
+#define MAX_MIX	64
+#define MAX_MIX_BUFFERS	64
+
 struct impl {
 	struct pw_port this;
+
+	struct spa_mix_ops mix_ops;
+	int mix_fmt;			/**< format of the mix ops or SPA_MIX_FMT_MAX when
+					  *  the port format can't be mixed */
+	uint64_t mix_free;		/**< mask of the port buffers we can mix into */
 };
 
 struct resource_data {
@@ -101,13 +110,135 @@ static const struct spa_node schedule_tee_node = {
 	.port_reuse_buffer = schedule_tee_reuse_buffer,
 };
 
+static inline bool link_has_buffer(struct spa_graph_port *p)
+{
+	struct pw_link *link = p->scheduler_data;
+
+	return !SPA_FLAG_CHECK(p->flags, SPA_GRAPH_PORT_FLAG_DISABLED) &&
+	    p->io->status == SPA_STATUS_HAVE_BUFFER &&
+	    p->io->buffer_id < link->n_buffers;
+}
+
+/* get the data and the size of the buffer on a link */
+static inline uint32_t link_buffer_data(struct spa_graph_port *p, void **data, int32_t *stride)
+{
+	struct pw_link *link = p->scheduler_data;
+	struct spa_data *d = link->buffers[p->io->buffer_id]->datas;
+	uint32_t offset = d[0].chunk->offset % d[0].maxsize;
+
+	*data = SPA_MEMBER(d[0].data, offset, void);
+	*stride = d[0].chunk->stride;
+	return SPA_MIN(d[0].chunk->size, d[0].maxsize - offset);
+}
+
+/* sum the buffers of all the links into the next port buffer and give the
+ * link buffers back to their output port right away. The port buffer gets
+ * the size of the largest link buffer, shorter link buffers are mixed as if
+ * they were followed by silence. */
+static int mix_links(struct impl *impl)
+{
+	struct pw_port *this = &impl->this;
+	struct spa_graph_node *node = &this->rt.mix_node;
+	struct spa_graph_port *p, *pp;
+	struct spa_io_buffers *io = this->rt.mix_port.io;
+	struct spa_data *od;
+	const void *src[MAX_MIX];
+	double scale[MAX_MIX];
+	void *data;
+	uint32_t n_src = 0, n_links = 0, n_bytes = 0, size, buffer_id;
+	int32_t stride = 0;
+
+	/* the consumer did not take or gave back the last buffer */
+	if (io->buffer_id < this->mix_allocation.n_buffers)
+		impl->mix_free |= 1ULL << io->buffer_id;
+
+	if (impl->mix_free == 0) {
+		pw_log_warn("mix %p: no free port buffers", node);
+		io->status = -ENOBUFS;
+		io->buffer_id = SPA_ID_INVALID;
+		return io->status;
+	}
+
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+		if (!link_has_buffer(p))
+			continue;
+		n_bytes = SPA_MAX(n_bytes, link_buffer_data(p, &data, &stride));
+		n_links++;
+	}
+
+	if (n_links == 0) {
+		io->status = SPA_STATUS_NEED_BUFFER;
+		io->buffer_id = SPA_ID_INVALID;
+		return io->status;
+	}
+
+	buffer_id = __builtin_ctzll(impl->mix_free);
+	od = this->mix_allocation.buffers[buffer_id]->datas;
+	n_bytes = SPA_MIN(n_bytes, od[0].maxsize);
+
+	/* mix the links that fill the buffer in one pass */
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+		if (!link_has_buffer(p) || n_src == MAX_MIX)
+			continue;
+		if (link_buffer_data(p, &data, &stride) >= n_bytes) {
+			src[n_src] = data;
+			scale[n_src] = 1.0;
+			n_src++;
+		}
+	}
+	impl->mix_ops.mix_n[impl->mix_fmt](&impl->mix_ops, od[0].data, src, scale, n_src, n_bytes);
+
+	/* add the shorter ones and the ones that did not fit */
+	if (n_src < n_links) {
+		uint32_t n_full = 0;
+
+		spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+			if (!link_has_buffer(p))
+				continue;
+			size = link_buffer_data(p, &data, &stride);
+			if (size >= n_bytes && n_full++ < n_src)
+				continue;
+			impl->mix_ops.add[impl->mix_fmt](od[0].data, data, SPA_MIN(size, n_bytes));
+		}
+	}
+
+	od[0].chunk->offset = 0;
+	od[0].chunk->size = n_bytes;
+	od[0].chunk->stride = stride;
+
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+		struct pw_link *link = p->scheduler_data;
+
+		if (!link_has_buffer(p))
+			continue;
+
+		if ((pp = p->peer) != NULL)
+			spa_node_port_reuse_buffer(pp->node->implementation,
+						   link->output->port_id, p->io->buffer_id);
+		p->io->status = SPA_STATUS_OK;
+		p->io->buffer_id = SPA_ID_INVALID;
+	}
+	pw_log_trace("mix %p: mixed %d links into buffer %d %d", node, n_links, buffer_id, n_bytes);
+
+	impl->mix_free &= ~(1ULL << buffer_id);
+	io->status = SPA_STATUS_HAVE_BUFFER;
+	io->buffer_id = buffer_id;
+
+	return io->status;
+}
+
 static int schedule_mix_input(struct spa_node *data)
 {
 	struct pw_port *this = SPA_CONTAINER_OF(data, struct pw_port, mix_node);
+	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
 	struct spa_graph_node *node = &this->rt.mix_node;
 	struct spa_graph_port *p;
 	struct spa_io_buffers *io = this->rt.mix_port.io;
 
+	if (this->mix_allocation.n_buffers > 0)
+		return mix_links(impl);
+
+	/* one link, pass the buffer of the link to the port */
 	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
 		pw_log_trace("mix %p: input %p %p->%p %d %d", node,
 				p, p->io, io, p->io->status, p->io->buffer_id);
@@ -121,13 +252,23 @@ static int schedule_mix_input(struct spa_node *data)
 static int schedule_mix_output(struct spa_node *data)
 {
 	struct pw_port *this = SPA_CONTAINER_OF(data, struct pw_port, mix_node);
+	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
 	struct spa_graph_node *node = &this->rt.mix_node;
 	struct spa_graph_port *p;
 	struct spa_io_buffers *io = this->rt.mix_port.io;
 
+	if (io->buffer_id < this->mix_allocation.n_buffers) {
+		impl->mix_free |= 1ULL << io->buffer_id;
+		io->buffer_id = SPA_ID_INVALID;
+	}
+
 	if (!spa_list_is_empty(&node->ports[SPA_DIRECTION_INPUT])) {
-		spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link)
-			*p->io = *io;
+		spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+			p->io->status = io->status;
+			/* port buffers don't exist on the links when mixing */
+			p->io->buffer_id = this->mix_allocation.n_buffers > 0 ?
+				SPA_ID_INVALID : io->buffer_id;
+		}
 	}
 	else {
 		io->status = SPA_STATUS_HAVE_BUFFER;
@@ -140,9 +281,20 @@ static int schedule_mix_output(struct spa_node *data)
 static int schedule_mix_reuse_buffer(struct spa_node *data, uint32_t port_id, uint32_t buffer_id)
 {
 	struct pw_port *this = SPA_CONTAINER_OF(data, struct pw_port, mix_node);
+	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
 	struct spa_graph_node *node = &this->rt.mix_node;
 	struct spa_graph_port *p, *pp;
 
+	/* the link buffers were already recycled after mixing, the consumer
+	 * gives back one of the port buffers */
+	if (this->mix_allocation.n_buffers > 0) {
+		if (buffer_id >= this->mix_allocation.n_buffers)
+			return -EINVAL;
+		pw_log_trace("mix %p: reuse port buffer %d", node, buffer_id);
+		impl->mix_free |= 1ULL << buffer_id;
+		return 0;
+	}
+
 	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
 		if ((pp = p->peer) != NULL) {
 			pw_log_trace("mix %p: reuse buffer %d %d", node, port_id, buffer_id);
@@ -210,6 +362,8 @@ struct pw_port *pw_port_new(enum pw_direction direction,
 	this->mix_node = this->direction == PW_DIRECTION_INPUT ?
 				schedule_mix_node :
 				schedule_tee_node;
+	spa_mix_get_ops(&impl->mix_ops, spa_mix_get_cpu_flags());
+	impl->mix_fmt = SPA_MIX_FMT_MAX;
 	spa_graph_node_set_implementation(&this->rt.mix_node, &this->mix_node);
 	pw_map_init(&this->mix_port_map, 64, 64);
 
@@ -247,22 +401,28 @@ const struct pw_properties *pw_port_get_properties(struct pw_port *port)
 int pw_port_update_properties(struct pw_port *port, const struct spa_dict *dict)
 {
 	struct pw_resource *resource;
-	uint32_t i;
+	struct pw_port_info info;
+	struct spa_dict_item *items;
+	struct spa_dict changed;
 
-	for (i = 0; i < dict->n_items; i++)
-		pw_properties_set(port->properties, dict->items[i].key, dict->items[i].value);
+	items = alloca(sizeof(struct spa_dict_item) * dict->n_items);
+	changed = SPA_DICT_INIT(items, pw_properties_update(port->properties, dict, items));
+	if (changed.n_items == 0)
+		return 0;
 
 	port->info.props = &port->properties->dict;
 
 	port->info.change_mask |= PW_PORT_CHANGE_MASK_PROPS;
 	pw_port_events_info_changed(port, &port->info);
 
+	info = port->info;
+	info.props = &changed;
 	spa_list_for_each(resource, &port->resource_list, link)
-		pw_port_resource_info(resource, &port->info);
+		pw_port_resource_info(resource, &info);
 
 	port->info.change_mask = 0;
 
-	return 0;
+	return changed.n_items;
 }
 
 struct pw_node *pw_port_get_node(struct pw_port *port)
@@ -557,6 +717,7 @@ void pw_port_destroy(struct pw_port *port)
 	pw_port_events_free(port);
 
 	free_allocation(&port->allocation);
+	free_allocation(&port->mix_allocation);
 
 	pw_map_clear(&port->mix_port_map);
 
@@ -653,9 +814,91 @@ int pw_port_for_each_filtered_param(struct pw_port *in_port,
 	return res;
 }
 
+static int find_mix_format(struct pw_port *port, const struct spa_pod *format)
+{
+	struct pw_audio_type *t = &port->node->core->audio_type;
+	struct spa_audio_info info = { 0 };
+
+	if (port->direction != PW_DIRECTION_INPUT || format == NULL)
+		return SPA_MIX_FMT_MAX;
+
+	spa_pod_object_parse(format,
+		"I", &info.media_type,
+		"I", &info.media_subtype);
+
+	if (info.media_type != t->media_type.audio ||
+	    info.media_subtype != t->media_subtype.raw)
+		return SPA_MIX_FMT_MAX;
+
+	if (spa_format_audio_raw_parse(format, &info.info.raw, &t->format_audio) < 0)
+		return SPA_MIX_FMT_MAX;
+
+	if (info.info.raw.layout != SPA_AUDIO_LAYOUT_INTERLEAVED)
+		return SPA_MIX_FMT_MAX;
+
+	if (info.info.raw.format == t->audio_format.S16)
+		return SPA_MIX_FMT_S16;
+	else if (info.info.raw.format == t->audio_format.F32)
+		return SPA_MIX_FMT_F32;
+
+	return SPA_MIX_FMT_MAX;
+}
+
+bool pw_port_can_mix(struct pw_port *port)
+{
+	struct impl *impl = SPA_CONTAINER_OF(port, struct impl, this);
+	return impl->mix_fmt != SPA_MIX_FMT_MAX;
+}
+
+static int do_set_mix_allocation(struct spa_loop *loop,
+				 bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct pw_port *this = user_data;
+	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
+	const struct allocation *allocation = data;
+
+	this->mix_allocation = *allocation;
+	impl->mix_free = allocation->n_buffers == 0 ? 0 :
+		UINT64_MAX >> (MAX_MIX_BUFFERS - allocation->n_buffers);
+	return 0;
+}
+
+static void set_mix_allocation(struct pw_port *port, struct allocation *allocation)
+{
+	struct allocation old = port->mix_allocation;
+
+	if (port->rt.graph)
+		pw_loop_invoke(port->node->data_loop, do_set_mix_allocation,
+			       SPA_ID_INVALID, allocation, sizeof(struct allocation), true, port);
+	else
+		do_set_mix_allocation(NULL, false, SPA_ID_INVALID, allocation,
+				      sizeof(struct allocation), port);
+
+	allocation->mem = NULL;
+	free_allocation(&old);
+}
+
+int pw_port_setup_mix(struct pw_port *port, struct allocation *allocation)
+{
+	int res;
+
+	if (!pw_port_can_mix(port) || allocation->n_buffers > MAX_MIX_BUFFERS)
+		return -ENOTSUP;
+
+	pw_log_debug("port %p: mix links into %d buffers", port, allocation->n_buffers);
+
+	if ((res = pw_port_use_buffers(port, allocation->buffers, allocation->n_buffers)) < 0)
+		return res;
+
+	set_mix_allocation(port, allocation);
+
+	return res;
+}
+
 int pw_port_set_param(struct pw_port *port, uint32_t id, uint32_t flags,
 		      const struct spa_pod *param)
 {
+	struct impl *impl = SPA_CONTAINER_OF(port, struct impl, this);
 	int res;
 	struct pw_node *node = port->node;
 	struct pw_core *core = node->core;
@@ -667,12 +910,22 @@ int pw_port_set_param(struct pw_port *port, uint32_t id, uint32_t flags,
 
 	if (id == t->param.idFormat) {
 		if (param == NULL || res < 0) {
+			struct allocation none = { NULL, };
+			set_mix_allocation(port, &none);
+			impl->mix_fmt = SPA_MIX_FMT_MAX;
 			free_allocation(&port->allocation);
 			port->allocated = false;
 			port_update_state (port, PW_PORT_STATE_CONFIGURE);
 		}
-		else if (!SPA_RESULT_IS_ASYNC(res)) {
-			port_update_state (port, PW_PORT_STATE_READY);
+		else {
+			int fmt = find_mix_format(port, param);
+			if (fmt == SPA_MIX_FMT_MAX) {
+				struct allocation none = { NULL, };
+				set_mix_allocation(port, &none);
+			}
+			impl->mix_fmt = fmt;
+			if (!SPA_RESULT_IS_ASYNC(res))
+				port_update_state (port, PW_PORT_STATE_READY);
 		}
 	}
 	return res;
@@ -696,6 +949,11 @@ int pw_port_use_buffers(struct pw_port *port, struct spa_buffer **buffers, uint3
 
 	free_allocation(&port->allocation);
 
+	if (n_buffers == 0 && port->mix_allocation.n_buffers > 0) {
+		struct allocation none = { NULL, };
+		set_mix_allocation(port, &none);
+	}
+
 	if (res < 0) {
 		n_buffers = 0;
 		buffers = NULL;
@@ -37,6 +37,7 @@ extern "C" {
 #endif
 
 #include <spa/graph/graph.h>
+#include <spa/param/audio/format-utils.h>
 
 struct pw_command;
 
@@ -153,6 +154,14 @@ struct pw_global {
 #define pw_core_events_global_added(c,g)	pw_core_events_emit(c, global_added, 0, g)
 #define pw_core_events_global_removed(c,g)	pw_core_events_emit(c, global_removed, 0, g)
 
+/** audio types the port mixers need to check the format */
+struct pw_audio_type {
+	struct spa_type_media_type media_type;
+	struct spa_type_media_subtype media_subtype;
+	struct spa_type_format_audio format_audio;
+	struct spa_type_audio_format audio_format;
+};
+
 struct pw_core {
 	struct pw_global *global;	/**< the global of the core */
 	struct spa_hook global_listener;
@@ -162,6 +171,7 @@ struct pw_core {
 	struct pw_properties *properties;	/**< properties of the core */
 
 	struct pw_type type;			/**< type map and common types */
+	struct pw_audio_type audio_type;	/**< audio types for the port mixers */
 
 	struct pw_map globals;			/**< map of globals */
 
@@ -190,8 +200,12 @@ struct pw_core {
 
 	long sc_pagesize;
 
+	uint32_t default_quantum;	/**< quantum when no node asks for one */
+	uint32_t quantum;		/**< current quantum of the graph */
+
 	struct {
 		struct spa_graph graph;
+		struct spa_graph_parallel *parallel;	/**< parallel scheduler or NULL */
 	} rt;
 };
 
@@ -225,23 +239,44 @@ struct allocation {
 	struct pw_memblock *mem;	/**< allocated buffer memory */
 	struct spa_buffer **buffers;	/**< port buffers */
 	uint32_t n_buffers;		/**< number of port buffers */
+	int *refcount;			/**< users of mem and buffers when shared */
 };
 
 static inline void move_allocation(struct allocation *alloc, struct allocation *dest)
 {
 	*dest = *alloc;
 	alloc->mem = NULL;
+	alloc->refcount = NULL;
+}
+
+/* make dest use the memory and buffers of alloc, they are freed when the
+ * last allocation that uses them is freed */
+static inline int ref_allocation(struct allocation *alloc, struct allocation *dest)
+{
+	if (alloc->mem == NULL)
+		return -EINVAL;
+
+	if (alloc->refcount == NULL) {
+		if ((alloc->refcount = malloc(sizeof(int))) == NULL)
+			return -ENOMEM;
+		*alloc->refcount = 1;
+	}
+	(*alloc->refcount)++;
+	*dest = *alloc;
+	return 0;
 }
 
 static inline void free_allocation(struct allocation *alloc)
 {
-	if (alloc->mem) {
+	if (alloc->mem && (alloc->refcount == NULL || --(*alloc->refcount) == 0)) {
 		pw_memblock_free(alloc->mem);
 		free(alloc->buffers);
+		free(alloc->refcount);
 	}
 	alloc->mem = NULL;
 	alloc->buffers = NULL;
 	alloc->n_buffers = 0;
+	alloc->refcount = NULL;
 }
 
 #define pw_link_events_emit(o,m,v,...) spa_hook_list_call(&o->listener_list, struct pw_link_events, m, v, ##__VA_ARGS__)
@@ -268,6 +303,9 @@ struct pw_link {
 
 	struct spa_io_buffers io;	/**< link io area */
 
+	struct spa_buffer **buffers;	/**< buffers negotiated on the link */
+	uint32_t n_buffers;		/**< number of link buffers */
+
 	struct pw_port *output;		/**< output port */
 	struct spa_list output_link;	/**< link in output port links */
 	struct pw_port *input;		/**< input port */
@@ -335,6 +373,7 @@ struct pw_node {
 	bool enabled;			/**< if the node is enabled */
 	bool active;			/**< if the node is active */
 	bool live;			/**< if the node is live */
+	uint32_t quantum;		/**< quantum the node asks for, 0 for any */
 	struct spa_clock *clock;	/**< handle to SPA clock if any */
 	struct spa_node *node;		/**< SPA node implementation */
 
@@ -405,6 +444,8 @@ struct pw_port {
 	struct spa_node *mix;		/**< optional port buffer mix/split */
 	struct spa_node mix_node;	/**< mix node implementation */
 	struct pw_map mix_port_map;	/**< map from port_id from mixer */
+	struct allocation mix_allocation;	/**< port buffers the input links are
+						  *  mixed into, when mixing */
 
 	struct {
 		struct spa_graph *graph;
@@ -572,6 +613,16 @@ struct pw_control {
 };
 
 
+/** The range of the graph quantum, in frames at PW_CORE_QUANTUM_RATE */
+#define PW_CORE_QUANTUM_RATE	48000
+#define PW_CORE_QUANTUM_MIN	32
+#define PW_CORE_QUANTUM_DEFAULT	1024
+#define PW_CORE_QUANTUM_MAX	8192
+
+/** Recalculate the quantum from the nodes and let the running nodes know
+ * when it changed */
+void pw_core_update_quantum(struct pw_core *core);
+
 /** Find a good format between 2 ports */
 int pw_core_find_format(struct pw_core *core,
 			struct pw_port *output,
@@ -643,6 +694,13 @@ int pw_port_for_each_filtered_param(struct pw_port *in_port,
 int pw_port_set_param(struct pw_port *port, uint32_t id, uint32_t flags,
 		      const struct spa_pod *param);
 
+/** Check if the links of an input port can be mixed \memberof pw_port */
+bool pw_port_can_mix(struct pw_port *port);
+
+/** Start mixing the links of an input port into the buffers of
+ * \a allocation, the port takes ownership of the allocation \memberof pw_port */
+int pw_port_setup_mix(struct pw_port *port, struct allocation *allocation);
+
 /** Use buffers on a port \memberof pw_port */
 int pw_port_use_buffers(struct pw_port *port, struct spa_buffer **buffers, uint32_t n_buffers);
 
@@ -662,6 +720,9 @@ void pw_node_update_state(struct pw_node *node, enum pw_node_state state, char *
 
 int pw_node_update_ports(struct pw_node *node);
 
+/** Send the quantum of the graph to the node */
+void pw_node_send_quantum(struct pw_node *node);
+
 /** Activate a link \memberof pw_link
   * Starts the negotiation of formats and buffers on \a link and then
   * starts data streaming */
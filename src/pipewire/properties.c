@@ -17,51 +17,214 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <errno.h>
 #include <stdio.h>
 
+#include <spa/utils/hash.h>
+
 #include "pipewire/pipewire.h"
 #include "pipewire/properties.h"
 
 /** \cond */
+
+/* Keys and values are refcounted so that copies and merges can share
+ * them. The hash of a key is computed once. */
+struct str {
+	uint32_t ref;
+	uint32_t hash;
+	char data[0];
+};
+
+#define STR_OF(s)	SPA_MEMBER(s, -offsetof(struct str, data), struct str)
+
 struct properties {
 	struct pw_properties this;
 
 	struct pw_array items;
+
+	/* hash index of the items, open addressing with linear probing. An entry
+	 * holds the item index + 1, 0 is an empty slot */
+	uint32_t *index;
+	uint32_t index_mask;
 };
 /** \endcond */
 
+#define MIN_INDEX_SIZE	16
+
+static char *str_alloc(size_t len)
+{
+	struct str *str;
+
+	str = malloc(sizeof(struct str) + len + 1);
+	if (str == NULL)
+		return NULL;
+
+	str->ref = 1;
+	str->hash = 0;
+	str->data[len] = '\0';
+
+	return str->data;
+}
+
+static char *str_new(const char *s, size_t len, bool key)
+{
+	char *data;
+
+	if ((data = str_alloc(len)) == NULL)
+		return NULL;
+
+	memcpy(data, s, len);
+	if (key)
+		STR_OF(data)->hash = spa_hash_string(data);
+
+	return data;
+}
+
+static inline char *str_dup(const char *s, bool key)
+{
+	return s ? str_new(s, strlen(s), key) : NULL;
+}
+
+static inline char *str_ref(const char *s)
+{
+	if (s)
+		__atomic_add_fetch(&STR_OF(s)->ref, 1, __ATOMIC_RELAXED);
+	return (char *) s;
+}
+
+static inline void str_unref(const char *s)
+{
+	if (s && __atomic_sub_fetch(&STR_OF(s)->ref, 1, __ATOMIC_ACQ_REL) == 0)
+		free(STR_OF(s));
+}
+
+static inline uint32_t key_hash(const char *key)
+{
+	return STR_OF(key)->hash;
+}
+
+static inline struct spa_dict_item *get_item(struct properties *impl, uint32_t idx)
+{
+	return pw_array_get_unchecked(&impl->items, idx, struct spa_dict_item);
+}
+
+static inline uint32_t n_items(struct properties *impl)
+{
+	return pw_array_get_len(&impl->items, struct spa_dict_item);
+}
+
+static void index_insert(struct properties *impl, uint32_t idx)
+{
+	uint32_t pos = key_hash(get_item(impl, idx)->key) & impl->index_mask;
+
+	while (impl->index[pos] != 0)
+		pos = (pos + 1) & impl->index_mask;
+	impl->index[pos] = idx + 1;
+}
+
+static int index_resize(struct properties *impl, uint32_t size)
+{
+	uint32_t i, *index;
+
+	index = calloc(size, sizeof(uint32_t));
+	if (index == NULL)
+		return -ENOMEM;
+
+	free(impl->index);
+	impl->index = index;
+	impl->index_mask = size - 1;
+
+	for (i = 0; i < n_items(impl); i++)
+		index_insert(impl, i);
+
+	return 0;
+}
+
+/* slot in the index of the item with key, or of the empty slot where it
+ * should go */
+static uint32_t index_find(struct properties *impl, const char *key, uint32_t hash)
+{
+	uint32_t pos = hash & impl->index_mask, idx;
+
+	while ((idx = impl->index[pos]) != 0) {
+		const char *k = get_item(impl, idx - 1)->key;
+		if (key_hash(k) == hash && strcmp(k, key) == 0)
+			break;
+		pos = (pos + 1) & impl->index_mask;
+	}
+	return pos;
+}
+
+/* remove the slot and move the entries after it back so that the
+ * probe sequences stay unbroken */
+static void index_remove(struct properties *impl, uint32_t pos)
+{
+	uint32_t next = pos, idx, home;
+
+	impl->index[pos] = 0;
+	while (true) {
+		next = (next + 1) & impl->index_mask;
+		if ((idx = impl->index[next]) == 0)
+			break;
+
+		home = key_hash(get_item(impl, idx - 1)->key) & impl->index_mask;
+		if (((next - home) & impl->index_mask) >= ((next - pos) & impl->index_mask)) {
+			impl->index[pos] = idx;
+			impl->index[next] = 0;
+			pos = next;
+		}
+	}
+}
+
+static void update_dict(struct properties *impl)
+{
+	impl->this.dict.items = impl->items.data;
+	impl->this.dict.n_items = n_items(impl);
+}
+
+/* takes ownership of key and value */
 static int add_func(struct pw_properties *this, char *key, char *value)
 {
 	struct spa_dict_item *item;
 	struct properties *impl = SPA_CONTAINER_OF(this, struct properties, this);
 
+	if (key == NULL) {
+		str_unref(value);
+		return -ENOMEM;
+	}
+	if ((n_items(impl) + 1) * 2 > impl->index_mask + 1 &&
+	    index_resize(impl, (impl->index_mask + 1) * 2) < 0)
+		goto no_mem;
+
 	item = pw_array_add(&impl->items, sizeof(struct spa_dict_item));
+	if (item == NULL)
+		goto no_mem;
+
 	item->key = key;
 	item->value = value;
+	index_insert(impl, n_items(impl) - 1);
 
-	this->dict.items = impl->items.data;
-	this->dict.n_items = pw_array_get_len(&impl->items, struct spa_dict_item);
+	update_dict(impl);
 	return 0;
+
+      no_mem:
+	str_unref(key);
+	str_unref(value);
+	return -ENOMEM;
 }
 
 static void clear_item(struct spa_dict_item *item)
 {
-	free((char *) item->key);
-	free((char *) item->value);
+	str_unref(item->key);
+	str_unref(item->value);
 }
 
 static int find_index(const struct pw_properties *this, const char *key)
 {
 	struct properties *impl = SPA_CONTAINER_OF(this, struct properties, this);
-	int i, len = pw_array_get_len(&impl->items, struct spa_dict_item);
+	uint32_t idx = impl->index[index_find(impl, key, spa_hash_string(key))];
 
-	for (i = 0; i < len; i++) {
-		struct spa_dict_item *item =
-		    pw_array_get_unchecked(&impl->items, i, struct spa_dict_item);
-		if (strcmp(item->key, key) == 0)
-			return i;
-	}
-	return -1;
+	return (int) idx - 1;
 }
 
 static struct properties *properties_new(int prealloc)
@@ -74,6 +237,13 @@ static struct properties *properties_new(int prealloc)
 
 	pw_array_init(&impl->items, prealloc);
 
+	impl->index = calloc(MIN_INDEX_SIZE, sizeof(uint32_t));
+	if (impl->index == NULL) {
+		free(impl);
+		return NULL;
+	}
+	impl->index_mask = MIN_INDEX_SIZE - 1;
+
 	return impl;
 }
 
@@ -98,7 +268,7 @@ struct pw_properties *pw_properties_new(const char *key, ...)
 	va_start(varargs, key);
 	while (key != NULL) {
 		value = va_arg(varargs, char *);
-		add_func(&impl->this, strdup(key), value ? strdup(value) : NULL);
+		add_func(&impl->this, str_dup(key, true), str_dup(value, false));
 		key = va_arg(varargs, char *);
 	}
 	va_end(varargs);
@@ -124,8 +294,8 @@ struct pw_properties *pw_properties_new_dict(const struct spa_dict *dict)
 
 	for (i = 0; i < dict->n_items; i++) {
 		if (dict->items[i].key != NULL)
-			add_func(&impl->this, strdup(dict->items[i].key),
-				 dict->items[i].value ? strdup(dict->items[i].value) : NULL);
+			add_func(&impl->this, str_dup(dict->items[i].key, true),
+				 str_dup(dict->items[i].value, false));
 	}
 
 	return &impl->this;
@@ -155,13 +325,12 @@ pw_properties_new_string(const char *str)
 
 	s = pw_split_walk(str, " \t\n\r", &len, &state);
 	while (s) {
-		char *val, *eq;
+		const char *eq;
 
-		val = strndup(s, len);
-		eq = strchr(val, '=');
+		eq = memchr(s, '=', len);
 		if (eq) {
-			*eq = '\0';
-			add_func(&impl->this, val, strdup(eq+1));
+			add_func(&impl->this, str_new(s, eq - s, true),
+				 str_new(eq + 1, len - (eq - s) - 1, false));
 		}
 		s = pw_split_walk(str, " \t\n\r", &len, &state);
 	}
@@ -173,22 +342,86 @@ pw_properties_new_string(const char *str)
  * \param properties properties to copy
  * \return a new properties object
  *
+ * The keys and values are shared with \a properties.
+ *
  * \memberof pw_properties
  */
 struct pw_properties *pw_properties_copy(const struct pw_properties *properties)
 {
 	struct properties *impl = SPA_CONTAINER_OF(properties, struct properties, this);
-	struct pw_properties *copy;
+	struct properties *copy;
 	struct spa_dict_item *item;
+	uint32_t index_size = impl->index_mask + 1;
 
-	copy = pw_properties_new(NULL, NULL);
+	copy = properties_new(impl->items.extend);
 	if (copy == NULL)
 		return NULL;
 
-	pw_array_for_each(item, &impl->items)
-	    add_func(copy, strdup(item->key), item->value ? strdup(item->value) : NULL);
+	if (index_size != MIN_INDEX_SIZE) {
+		free(copy->index);
+		if ((copy->index = malloc(index_size * sizeof(uint32_t))) == NULL)
+			goto no_mem;
+		copy->index_mask = impl->index_mask;
+	}
+	if (!pw_array_ensure_size(&copy->items, impl->items.size))
+		goto no_mem;
+
+	/* same items in the same order, the index can be copied */
+	pw_array_for_each(item, &impl->items) {
+		struct spa_dict_item *i = pw_array_add(&copy->items, sizeof(struct spa_dict_item));
+		i->key = str_ref(item->key);
+		i->value = str_ref(item->value);
+	}
+	memcpy(copy->index, impl->index, index_size * sizeof(uint32_t));
+	update_dict(copy);
+
+	return &copy->this;
 
-	return copy;
+      no_mem:
+	pw_properties_free(&copy->this);
+	return NULL;
+}
+
+/* takes ownership of value. When shared is true, key is a string of one of
+ * our properties and can be referenced */
+static int do_replace(struct pw_properties *properties, const char *key, char *value,
+		      bool shared)
+{
+	struct properties *impl = SPA_CONTAINER_OF(properties, struct properties, this);
+	uint32_t hash = shared ? key_hash(key) : spa_hash_string(key);
+	uint32_t pos = index_find(impl, key, hash), idx = impl->index[pos];
+	struct spa_dict_item *item;
+
+	if (idx == 0) {
+		if (value == NULL)
+			return 0;
+		return add_func(properties, shared ? str_ref(key) : str_dup(key, true), value);
+	}
+
+	item = get_item(impl, idx - 1);
+	if (value == NULL) {
+		uint32_t last = n_items(impl) - 1;
+
+		index_remove(impl, pos);
+		clear_item(item);
+
+		/* move the last item in the hole */
+		if (idx - 1 != last) {
+			struct spa_dict_item *other = get_item(impl, last);
+			pos = index_find(impl, other->key, key_hash(other->key));
+			impl->index[pos] = idx;
+			*item = *other;
+		}
+		impl->items.size -= sizeof(struct spa_dict_item);
+		update_dict(impl);
+	} else if (item->value && strcmp(item->value, value) == 0) {
+		/* keep the old value, it might be shared */
+		str_unref(value);
+	} else {
+		str_unref(item->value);
+		item->value = value;
+	}
+	return 0;
 }
 
 /** Merge properties into one
@@ -215,16 +448,15 @@ struct pw_properties *pw_properties_merge(const struct pw_properties *oldprops,
 	} else if (newprops == NULL) {
 		res = pw_properties_copy(oldprops);
 	} else {
-		const char *key;
-		void *state = NULL;
+		struct properties *impl = SPA_CONTAINER_OF(newprops, struct properties, this);
+		struct spa_dict_item *item;
 
 		res = pw_properties_copy(oldprops);
 		if (res == NULL)
 			return NULL;
 
-		while ((key = pw_properties_iterate(newprops, &state))) {
-			pw_properties_set(res, key, pw_properties_get(newprops, key));
-		}
+		pw_array_for_each(item, &impl->items)
+			do_replace(res, item->key, str_ref(item->value), true);
 	}
 	return res;
 }
@@ -244,36 +476,10 @@ void pw_properties_free(struct pw_properties *properties)
 	    clear_item(item);
 
 	pw_array_clear(&impl->items);
+	free(impl->index);
 	free(impl);
 }
 
-static int do_replace(struct pw_properties *properties, const char *key, char *value)
-{
-	struct properties *impl = SPA_CONTAINER_OF(properties, struct properties, this);
-	int index = find_index(properties, key);
-
-	if (index == -1) {
-		add_func(properties, strdup(key), value);
-	} else {
-		struct spa_dict_item *item =
-		    pw_array_get_unchecked(&impl->items, index, struct spa_dict_item);
-
-		clear_item(item);
-		if (value == NULL) {
-			struct spa_dict_item *other = pw_array_get_unchecked(&impl->items,
-						     pw_array_get_len(&impl->items, struct spa_dict_item) - 1,
-						     struct spa_dict_item);
-			item->key = other->key;
-			item->value = other->value;
-			impl->items.size -= sizeof(struct spa_dict_item);
-		} else {
-			item->key = strdup(key);
-			item->value = value;
-		}
-	}
-	return 0;
-}
-
 /** Set a property value
  *
  * \param properties the properties to change
@@ -288,7 +494,40 @@ static int do_replace(struct pw_properties *properties, const char *key, char *v
  */
 int pw_properties_set(struct pw_properties *properties, const char *key, const char *value)
 {
-	return do_replace(properties, key, value ? strdup(value) : NULL);
+	return do_replace(properties, key, str_dup(value, false), false);
+}
+
+/** Update properties
+ *
+ * \param properties the properties to change
+ * \param dict the new values, a NULL value removes the key
+ * \param changed room for \a dict->n_items changed items or NULL
+ * \return the number of changed properties
+ *
+ * Set all items of \a dict in \a properties. The items that changed
+ * a value are stored in \a changed, they point to the strings in \a dict.
+ *
+ * \memberof pw_properties
+ */
+int pw_properties_update(struct pw_properties *properties, const struct spa_dict *dict,
+			 struct spa_dict_item *changed)
+{
+	const struct spa_dict_item *item;
+	const char *old;
+	int n_changed = 0;
+
+	spa_dict_for_each(item, dict) {
+		old = pw_properties_get(properties, item->key);
+		if (old == item->value ||
+		    (old != NULL && item->value != NULL && strcmp(old, item->value) == 0))
+			continue;
+
+		pw_properties_set(properties, item->key, item->value);
+		if (changed)
+			changed[n_changed] = *item;
+		n_changed++;
+	}
+	return n_changed;
 }
 
 /** Set a property value by format
@@ -307,12 +546,22 @@ int pw_properties_setf(struct pw_properties *properties, const char *key, const
 {
 	va_list varargs;
 	char *value;
+	int len;
+
+	va_start(varargs, format);
+	len = vsnprintf(NULL, 0, format, varargs);
+	va_end(varargs);
+
+	if (len < 0)
+		return -EINVAL;
+	if ((value = str_alloc(len)) == NULL)
+		return -ENOMEM;
 
 	va_start(varargs, format);
-	vasprintf(&value, format, varargs);
+	vsnprintf(value, len + 1, format, varargs);
 	va_end(varargs);
 
-	return do_replace(properties, key, value);
+	return do_replace(properties, key, value, false);
 }
 
 /** Get a property
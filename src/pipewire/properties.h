@@ -61,6 +61,10 @@ pw_properties_free(struct pw_properties *properties);
 int
 pw_properties_set(struct pw_properties *properties, const char *key, const char *value);
 
+int
+pw_properties_update(struct pw_properties *properties, const struct spa_dict *dict,
+		     struct spa_dict_item *changed);
+
 int
 pw_properties_setf(struct pw_properties *properties,
 		   const char *key, const char *format, ...) SPA_PRINTF_FUNC(3, 4);
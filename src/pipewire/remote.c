@@ -64,6 +64,12 @@ struct buffer_id {
 	struct mem_id **mem;
 };
 
+struct peer {
+	struct pw_client_node_transport *trans;	/**< transport of the peer */
+	uint32_t port_id;			/**< port id on the peer */
+	int fd;					/**< fd to wake up the peer */
+};
+
 struct port {
 	struct spa_graph_port output;
 	struct spa_graph_port input;
@@ -72,6 +78,8 @@ struct port {
 
 	struct pw_array buffer_ids;
 	bool in_order;
+
+	struct peer peer;		/**< direct link peer */
 };
 
 struct node_data {
@@ -90,6 +98,7 @@ struct node_data {
 	struct spa_node in_node_impl;
 	struct spa_graph_node in_node;
 	struct port *in_ports;
+	uint32_t n_peers[2];
 
         struct pw_array mem_ids;
 
@@ -355,7 +364,7 @@ static int do_connect(struct pw_remote *remote)
 
 	pw_core_proxy_add_listener(remote->core_proxy, &impl->core_listener, &core_proxy_events, remote);
 
-	pw_core_proxy_hello(remote->core_proxy);
+	pw_core_proxy_hello(remote->core_proxy, PW_VERSION_CORE);
 	pw_core_proxy_client_update(remote->core_proxy, &remote->properties->dict);
 	pw_core_proxy_sync(remote->core_proxy, 0);
 
@@ -535,21 +544,33 @@ on_rtsocket_condition(void *user_data, int fd, enum spa_io mask)
 	}
 
 	if (mask & SPA_IO_IN) {
+		struct pw_client_node_activation *a = data->trans->activation;
 		struct pw_client_node_message message;
+		uint32_t flags = 0;
 		uint64_t cmd;
 
 		if (read(fd, &cmd, sizeof(uint64_t)) != sizeof(uint64_t))
 			pw_log_warn("proxy %p: read failed %m", proxy);
 
-		if (cmd > 1)
-			pw_log_warn("proxy %p: %ld messages", proxy, cmd);
-
-
-		while (pw_client_node_transport_next_message(data->trans, &message) == 1) {
-			struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
-			pw_client_node_transport_parse_message(data->trans, msg);
-			handle_rtnode_message(proxy, msg);
-		}
+		/* without activation record, all messages are in the ringbuffer */
+		if (a)
+			pw_client_node_activation_wakeup(a, PW_CLIENT_NODE_ACTIVATION_CLIENT);
+		do {
+			if (a)
+				flags = pw_client_node_activation_poll(a, PW_CLIENT_NODE_ACTIVATION_CLIENT);
+
+			while (pw_client_node_transport_next_message(data->trans, &message) == 1) {
+				struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
+				pw_client_node_transport_parse_message(data->trans, msg);
+				handle_rtnode_message(proxy, msg);
+			}
+			if (flags & (1 << PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT))
+				handle_rtnode_message(proxy,
+					&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT));
+			if (flags & (1 << PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT))
+				handle_rtnode_message(proxy,
+					&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT));
+		} while (flags != 0);
 	}
 }
 
@@ -613,17 +634,34 @@ static void clear_memid(struct node_data *data, struct mem_id *mid)
 	}
 }
 
+static void clear_peer(struct peer *peer)
+{
+	if (peer->trans) {
+		pw_client_node_transport_destroy(peer->trans);
+		close(peer->fd);
+	}
+	peer->trans = NULL;
+	peer->fd = -1;
+}
+
 static void clean_transport(struct pw_proxy *proxy)
 {
 	struct node_data *data = proxy->user_data;
 	struct pw_port *port;
 	struct mem_id *mid;
+	int i;
 
 	if (data->trans == NULL)
 		return;
 
 	unhandle_socket(proxy);
 
+	for (i = 0; i < data->trans->area->max_input_ports; i++)
+		clear_peer(&data->in_ports[i].peer);
+	for (i = 0; i < data->trans->area->max_output_ports; i++)
+		clear_peer(&data->out_ports[i].peer);
+	data->n_peers[SPA_DIRECTION_INPUT] = data->n_peers[SPA_DIRECTION_OUTPUT] = 0;
+
 	spa_list_for_each(port, &data->node->input_ports, link) {
 		spa_graph_port_remove(&data->in_ports[port->port_id].output);
 		spa_graph_port_remove(&data->in_ports[port->port_id].input);
@@ -650,6 +688,7 @@ static void port_init(struct port *port)
         pw_array_init(&port->buffer_ids, 32);
         pw_array_ensure_size(&port->buffer_ids, sizeof(struct buffer_id) * 64);
 	port->in_order = true;
+	port->peer.fd = -1;
 }
 
 static struct port *find_port(struct node_data *data, enum spa_direction direction, uint32_t port_id)
@@ -763,6 +802,8 @@ static void client_node_transport(void *object, uint32_t node_id,
                                                readfd,
                                                SPA_IO_ERR | SPA_IO_HUP,
                                                true, on_rtsocket_condition, proxy);
+	if (data->rtsocket_source)
+		data->rtsocket_source->priority = SPA_SOURCE_PRIORITY_RT;
 	if (data->node->active)
 		pw_client_node_proxy_set_active(data->node_proxy, true);
 }
@@ -839,22 +880,76 @@ static void client_node_event(void *object, const struct spa_event *event)
 }
 
 
-static void node_need_input(void *data)
+static void signal_server(struct node_data *d, enum pw_client_node_message_type message)
 {
-	struct node_data *d = data;
         uint64_t cmd = 1;
-	pw_client_node_transport_add_message(d->trans,
-				&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_NEED_INPUT));
-        write(d->rtwritefd, &cmd, 8);
+	if (d->trans->activation == NULL)
+		pw_client_node_transport_add_message(d->trans,
+				&PW_CLIENT_NODE_MESSAGE_INIT(message));
+	else if (!pw_client_node_activation_signal(d->trans->activation,
+				PW_CLIENT_NODE_ACTIVATION_SERVER, message))
+		return;
+	write(d->rtwritefd, &cmd, 8);
 }
 
-static void node_have_output(void *data)
+/* pass the io of the ports with a direct link to the peer and signal
+ * \a message to it. Returns true when there are ports left that need
+ * the server. */
+static bool signal_peers(struct node_data *d, enum spa_direction direction,
+			 enum pw_client_node_message_type message)
 {
-	struct node_data *d = data;
+	struct port *ports;
+	struct spa_io_buffers *ios;
+	uint32_t i, n_ports;
+	bool need_server = false;
         uint64_t cmd = 1;
-        pw_client_node_transport_add_message(d->trans,
-                               &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT));
-        write(d->rtwritefd, &cmd, 8);
+
+	if (d->n_peers[direction] == 0)
+		return true;
+
+	if (direction == SPA_DIRECTION_INPUT) {
+		ports = d->in_ports;
+		ios = d->trans->inputs;
+		n_ports = d->trans->area->max_input_ports;
+	} else {
+		ports = d->out_ports;
+		ios = d->trans->outputs;
+		n_ports = d->trans->area->max_output_ports;
+	}
+
+	for (i = 0; i < n_ports; i++) {
+		struct peer *peer = &ports[i].peer;
+
+		if (ports[i].port == NULL)
+			continue;
+
+		if (peer->trans == NULL) {
+			need_server = true;
+			continue;
+		}
+
+		if (direction == SPA_DIRECTION_INPUT)
+			peer->trans->outputs[peer->port_id] = ios[i];
+		else
+			peer->trans->inputs[peer->port_id] = ios[i];
+
+		if (pw_client_node_activation_signal(peer->trans->activation,
+					PW_CLIENT_NODE_ACTIVATION_CLIENT, message))
+			write(peer->fd, &cmd, 8);
+	}
+	return need_server;
+}
+
+static void node_need_input(void *data)
+{
+	if (signal_peers(data, SPA_DIRECTION_INPUT, PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT))
+		signal_server(data, PW_CLIENT_NODE_MESSAGE_NEED_INPUT);
+}
+
+static void node_have_output(void *data)
+{
+	if (signal_peers(data, SPA_DIRECTION_OUTPUT, PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT))
+		signal_server(data, PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT);
 }
 
 static void client_node_command(void *object, uint32_t seq, const struct spa_command *command)
@@ -1195,6 +1290,65 @@ client_node_port_set_io(void *object,
 			     size);
 }
 
+struct set_peer {
+	struct port *port;
+	enum spa_direction direction;
+	struct peer peer;
+};
+
+static int
+do_set_peer(struct spa_loop *loop,
+	    bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct node_data *d = user_data;
+	const struct set_peer *sp = data;
+	struct peer *peer = &sp->port->peer;
+
+	if (peer->trans)
+		d->n_peers[sp->direction]--;
+	*peer = sp->peer;
+	if (peer->trans)
+		d->n_peers[sp->direction]++;
+	return 0;
+}
+
+static void
+client_node_port_set_peer(void *object,
+			  enum spa_direction direction,
+			  uint32_t port_id,
+			  uint32_t peer_port_id,
+			  int signalfd,
+			  struct pw_client_node_transport *transport)
+{
+	struct pw_proxy *proxy = object;
+	struct node_data *data = proxy->user_data;
+	struct set_peer sp = { NULL, direction, { transport, peer_port_id, signalfd } };
+	struct peer old;
+
+	if (data->trans == NULL ||
+	    (sp.port = find_port(data, direction, port_id)) == NULL) {
+		clear_peer(&sp.peer);
+		return;
+	}
+	/* the peer port is on the other side of the link, we signal the peer
+	 * with its activation record */
+	if (transport != NULL &&
+	    (transport->activation == NULL ||
+	     peer_port_id >= (direction == SPA_DIRECTION_OUTPUT ?
+			      transport->area->max_input_ports :
+			      transport->area->max_output_ports))) {
+		pw_log_warn("port %p: invalid peer port %u", sp.port, peer_port_id);
+		clear_peer(&sp.peer);
+		return;
+	}
+
+	pw_log_debug("port %p: set peer %p %u", sp.port, transport, peer_port_id);
+
+	old = sp.port->peer;
+	pw_loop_invoke(data->core->data_loop,
+		       do_set_peer, SPA_ID_INVALID, &sp, sizeof(sp), true, data);
+	clear_peer(&old);
+}
 
 static const struct pw_client_node_proxy_events client_node_events = {
 	PW_VERSION_CLIENT_NODE_PROXY_EVENTS,
@@ -1209,6 +1363,7 @@ static const struct pw_client_node_proxy_events client_node_events = {
 	.port_use_buffers = client_node_port_use_buffers,
 	.port_command = client_node_port_command,
 	.port_set_io = client_node_port_set_io,
+	.port_set_peer = client_node_port_set_peer,
 };
 
 static void do_node_init(struct pw_proxy *proxy)
@@ -142,6 +142,10 @@ struct pw_remote_events {
 #define PW_REMOTE_PROP_PROTOCOL		"pipewire.protocol"
 /** The name of the remote to connect to, default env(PIPEWIRE_REMOTE) or pipewire-0 */
 #define PW_REMOTE_PROP_REMOTE_NAME	"pipewire.remote.name"
+/** Size in bytes of a shared memory ring for the messages of the native
+ * protocol, default 0, the messages go over the socket. The server must
+ * accept rings with PW_CORE_PROP_PROTOCOL_RING or it closes the connection */
+#define PW_REMOTE_PROP_PROTOCOL_RING	"pipewire.protocol.ring"
 
 /** Create a new unconnected remote \memberof pw_remote
  * \return a new unconnected remote */
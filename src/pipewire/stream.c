@@ -30,42 +30,56 @@
 #include "pipewire/private.h"
 #include "pipewire/interfaces.h"
 #include "pipewire/array.h"
+#include "pipewire/data-loop.h"
 #include "pipewire/stream.h"
 #include "pipewire/utils.h"
+#include "pipewire/buffer-queue.h"
 #include "extensions/client-node.h"
 
 /** \cond */
 
-#define MAX_BUFFERS	64
-#define MASK_BUFFERS	(MAX_BUFFERS-1)
+#define MAX_BUFFERS	PW_BUFFER_QUEUE_SIZE
 #define MIN_QUEUED	1
 
 #define MAX_PORTS	1
 
+/* a mapping of a part of the memory, shared by the buffers and io areas
+ * that are inside it */
+struct mapping {
+	struct spa_list link;
+	struct pw_map_range map;
+	int prot;
+	uint32_t ref;
+	void *ptr;
+};
+
 struct mem {
 	uint32_t id;
 	int fd;
 	uint32_t flags;
 	uint32_t ref;
-	struct pw_map_range map;
-	void *ptr;
+	struct spa_list mappings;
+	uint32_t use_offset;	/* the range used by the buffers that */
+	uint32_t use_end;	/* are being added */
+	void *use_ptr;
 };
 
 struct buffer {
 	struct pw_buffer buffer;
 	uint32_t id;
 #define BUFFER_FLAG_MAPPED	(1 << 0)
-#define BUFFER_FLAG_QUEUED	(1 << 1)
 	uint32_t flags;
+	uint32_t queued;	/**< in a queue, changed atomically */
 	void *ptr;
-	struct pw_map_range map;
 	uint32_t n_mem;
-	struct mem **mem;
+	struct mem **mem;	/**< the mem of the buffer and of each data */
 };
 
+/* the dequeue queue has the buffers for the application, the queue has
+ * the buffers from the application. The application and the processing
+ * thread are on the other sides of the queues. */
 struct queue {
-	uint32_t ids[MAX_BUFFERS];
-	struct spa_ringbuffer ring;
+	struct pw_buffer_queue ids;
 	uint64_t incount;
 	uint64_t outcount;
 };
@@ -100,127 +114,177 @@ struct stream {
 
 	struct pw_client_node_transport *trans;
 
+	struct {
+		struct pw_client_node_transport *trans;
+		uint32_t port_id;
+		int fd;
+	} peer;				/**< direct link peer */
+
 	struct spa_source *timeout_source;
 
-	struct pw_array mem_ids;
+	struct pw_array mem_ids;	/**< mem for each mem id */
 
 	struct spa_io_buffers *io;
+	struct mem *io_mem;
 
 	bool client_reuse;
 	struct queue dequeue;
 	struct queue queue;
 	bool in_process;
 
+	struct pw_data_loop *worker;	/**< thread for the process event */
+	struct spa_source *process_event;
+
+	uint32_t cycle_seq;		/**< seqlock of the cycle, written in the realtime thread */
+	uint32_t cycle;			/**< number of started cycles */
+	uint64_t cycle_time;		/**< start of the last cycle */
+	uint64_t period;		/**< time between the last two cycles */
+	uint32_t process_cycle;		/**< last cycle handled by the worker */
+
 	struct buffer buffers[MAX_BUFFERS];
 	int n_buffers;
 
+	uint32_t time_seq;		/**< seqlock of last_time, written in the main loop */
 	struct pw_time last_time;
+	uint32_t process_seq;		/**< seqlock of process_time, written in the
+					  *  thread of the process event */
+	struct pw_process_time process_time;
 };
 /** \endcond */
 
-static struct mem *find_mem(struct pw_stream *stream, uint32_t id)
+static struct mem *find_mem(struct stream *impl, uint32_t id)
 {
-	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
-	struct mem *m;
-
-	pw_array_for_each(m, &impl->mem_ids) {
-		if (m->id == id)
-			return m;
-	}
-	return NULL;
+	if (!pw_array_check_index(&impl->mem_ids, id, struct mem *))
+		return NULL;
+	return *pw_array_get_unchecked(&impl->mem_ids, id, struct mem *);
 }
 
-static void *mem_map(struct pw_stream *stream, struct mem *m, uint32_t offset, uint32_t size)
+static struct mem *add_mem(struct stream *impl, uint32_t id)
 {
-	if (m->ptr == NULL) {
-		pw_map_range_init(&m->map, offset, size, stream->remote->core->sc_pagesize);
+	struct mem *m, **p;
+	uint32_t len = pw_array_get_len(&impl->mem_ids, struct mem *);
 
-		m->ptr = mmap(NULL, m->map.size, PROT_READ|PROT_WRITE,
-				MAP_SHARED, m->fd, m->map.offset);
-
-		if (m->ptr == MAP_FAILED) {
-			pw_log_error("stream %p: Failed to mmap memory %d %p: %m", stream, size, m);
-			m->ptr = NULL;
+	if (id == SPA_ID_INVALID) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (id >= len) {
+		if (!pw_array_ensure_size(&impl->mem_ids, (id + 1 - len) * sizeof(struct mem *)))
 			return NULL;
+		for (; len <= id; len++) {
+			p = pw_array_add(&impl->mem_ids, sizeof(struct mem *));
+			*p = NULL;
 		}
 	}
-	return SPA_MEMBER(m->ptr, m->map.start, void);
+	p = pw_array_get_unchecked(&impl->mem_ids, id, struct mem *);
+	if (*p == NULL) {
+		if ((m = calloc(1, sizeof(struct mem))) == NULL)
+			return NULL;
+		m->id = id;
+		m->fd = -1;
+		spa_list_init(&m->mappings);
+		*p = m;
+	}
+	return *p;
 }
 
-static void mem_unmap(struct stream *impl, struct mem *m)
+/* get a pointer to the memory at offset and size, from an existing mapping
+ * when there is one that contains the memory */
+static void *mem_map(struct stream *impl, struct mem *m, uint32_t offset, uint32_t size, int prot)
 {
-	if (m->ptr != NULL) {
-		if (munmap(m->ptr, m->map.size) < 0)
-			pw_log_warn("stream %p: failed to unmap: %m", impl);
-		m->ptr = NULL;
+	struct mapping *map;
+
+	spa_list_for_each(map, &m->mappings, link) {
+		if ((map->prot & prot) == prot &&
+		    offset >= map->map.offset &&
+		    (uint64_t) offset + size <= (uint64_t) map->map.offset + map->map.size)
+			goto found;
+	}
+
+	if ((map = calloc(1, sizeof(struct mapping))) == NULL)
+		return NULL;
+
+	pw_map_range_init(&map->map, offset, size, impl->this.remote->core->sc_pagesize);
+
+	map->ptr = mmap(NULL, map->map.size, prot, MAP_SHARED, m->fd, map->map.offset);
+	if (map->ptr == MAP_FAILED) {
+		pw_log_error("stream %p: Failed to mmap memory %d %p: %m", impl, size, m);
+		free(map);
+		return NULL;
 	}
+	map->prot = prot;
+	spa_list_append(&m->mappings, &map->link);
+
+	pw_log_debug("stream %p: mem %u mapped %u %u %p", impl, m->id,
+			map->map.offset, map->map.size, map->ptr);
+      found:
+	map->ref++;
+	return SPA_MEMBER(map->ptr, offset - map->map.offset, void);
 }
 
-static void clear_mem(struct stream *impl, struct mem *m)
+static void free_mapping(struct stream *impl, struct mapping *map)
 {
-	if (m->fd != -1) {
-		bool has_ref = false;
-		struct mem *m2;
-		int fd;
+	if (munmap(map->ptr, map->map.size) < 0)
+		pw_log_warn("stream %p: failed to unmap: %m", impl);
+	spa_list_remove(&map->link);
+	free(map);
+}
 
-		fd = m->fd;
-		m->fd = -1;
+static void mem_unmap(struct stream *impl, struct mem *m, void *ptr)
+{
+	struct mapping *map;
 
-		pw_array_for_each(m2, &impl->mem_ids) {
-			if (m2->fd == fd) {
-				has_ref = true;
-				break;
-			}
-		}
-		if (!has_ref) {
-			mem_unmap(impl, m);
-			close(fd);
+	spa_list_for_each(map, &m->mappings, link) {
+		if (ptr >= map->ptr && ptr < SPA_MEMBER(map->ptr, map->map.size, void)) {
+			if (--map->ref == 0)
+				free_mapping(impl, map);
+			return;
 		}
 	}
+	pw_log_warn("stream %p: mem %u has no mapping for %p", impl, m->id, ptr);
 }
 
-static void clear_mems(struct pw_stream *stream)
+/* remember the memory that is going to be used so that it can be mapped
+ * at once */
+static void mem_use(struct mem *m, uint32_t offset, uint32_t size)
 {
-	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
-	struct mem *m;
-
-	pw_array_for_each(m, &impl->mem_ids)
-		clear_mem(impl, m);
-	impl->mem_ids.size = 0;
+	if (m->use_end == 0) {
+		m->use_offset = offset;
+		m->use_end = offset + size;
+	} else {
+		m->use_offset = SPA_MIN(m->use_offset, offset);
+		m->use_end = SPA_MAX(m->use_end, offset + size);
+	}
 }
 
-static int map_data(struct stream *impl, struct spa_data *data, int prot)
+static void clear_mem(struct stream *impl, struct mem *m)
 {
-	void *ptr;
-	struct pw_map_range range;
+	struct mapping *map, *t;
 
-	pw_map_range_init(&range, data->mapoffset, data->maxsize,
-			impl->this.remote->core->sc_pagesize);
+	spa_list_for_each_safe(map, t, &m->mappings, link)
+		free_mapping(impl, map);
 
-	ptr = mmap(NULL, range.size, prot, MAP_SHARED, data->fd, range.offset);
-	if (ptr == MAP_FAILED) {
-		pw_log_error("stream %p: failed to mmap buffer mem: %m", impl);
-		return -errno;
+	/* every add_mem has its own fd */
+	if (m->fd != -1) {
+		close(m->fd);
+		m->fd = -1;
 	}
-	data->data = SPA_MEMBER(ptr, range.start, void);
-	pw_log_debug("stream %p: fd %d mapped %d %d %p", impl, data->fd,
-			range.offset, range.size, data->data);
-	return 0;
+	m->ref = 0;
 }
 
-static int unmap_data(struct stream *impl, struct spa_data *data)
+static void clear_mems(struct pw_stream *stream)
 {
-	struct pw_map_range range;
-
-	pw_map_range_init(&range, data->mapoffset, data->maxsize,
-			impl->this.remote->core->sc_pagesize);
-
-	if (munmap(SPA_MEMBER(data->data, -range.start, void), range.size) < 0)
-		pw_log_warn("failed to unmap: %m");
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct mem **m;
 
-	pw_log_debug("stream %p: fd %d unmapped", impl, data->fd);
-	data->data = NULL;
-	return 0;
+	pw_array_for_each(m, &impl->mem_ids) {
+		if (*m == NULL)
+			continue;
+		clear_mem(impl, *m);
+		free(*m);
+	}
+	impl->mem_ids.size = 0;
+	impl->io_mem = NULL;
 }
 
 static void clear_buffers(struct pw_stream *stream)
@@ -236,42 +300,46 @@ static void clear_buffers(struct pw_stream *stream)
 
 		pw_stream_events_remove_buffer(stream, &b->buffer);
 
-		if (SPA_FLAG_CHECK(b->flags, BUFFER_FLAG_MAPPED)) {
-			for (j = 0; j < b->buffer.buffer->n_datas; j++) {
-				struct spa_data *d = &b->buffer.buffer->datas[j];
-				pw_log_debug("stream %p: clear buffer %d mem",
-						stream, b->id);
-				unmap_data(impl, d);
+		for (j = 1; j < b->n_mem; j++) {
+			struct spa_data *d = &b->buffer.buffer->datas[j - 1];
+			struct mem *m = b->mem[j];
+
+			if (m == NULL)
+				continue;
+			if (SPA_FLAG_CHECK(b->flags, BUFFER_FLAG_MAPPED) && d->data != NULL) {
+				pw_log_debug("stream %p: clear buffer %d mem", stream, b->id);
+				mem_unmap(impl, m, d->data);
+				d->data = NULL;
 			}
+			m->ref--;
+		}
+		if (b->n_mem > 0) {
+			if (b->ptr != NULL)
+				mem_unmap(impl, b->mem[0], b->ptr);
+			b->mem[0]->ref--;
 		}
-
-		if (b->ptr != NULL)
-			if (munmap(b->ptr, b->map.size) < 0)
-				pw_log_warn("failed to unmap buffer: %m");
 		b->ptr = NULL;
+		b->n_mem = 0;
 		free(b->buffer.buffer);
 		b->buffer.buffer = NULL;
 	}
 	impl->n_buffers = 0;
-	spa_ringbuffer_init(&impl->queue.ring);
-	spa_ringbuffer_init(&impl->dequeue.ring);
+	pw_buffer_queue_init(&impl->queue.ids);
+	pw_buffer_queue_init(&impl->dequeue.ids);
 
 }
 
 static inline int push_queue(struct stream *stream, struct queue *queue, struct buffer *buffer)
 {
-	uint32_t index;
-	int32_t filled;
+	uint32_t filled;
 
-	if (SPA_FLAG_CHECK(buffer->flags, BUFFER_FLAG_QUEUED))
+	if (__atomic_exchange_n(&buffer->queued, 1, __ATOMIC_ACQUIRE))
 		return -EINVAL;
 
-	SPA_FLAG_SET(buffer->flags, BUFFER_FLAG_QUEUED);
 	queue->incount += buffer->buffer.size;
 
-	filled = spa_ringbuffer_get_write_index(&queue->ring, &index);
-	queue->ids[index & MASK_BUFFERS] = buffer->id;
-	spa_ringbuffer_write_update(&queue->ring, index + 1);
+	filled = pw_buffer_queue_avail(&queue->ids);
+	pw_buffer_queue_push(&queue->ids, &buffer->id, 1);
 
 	pw_log_trace("stream %p: queued buffer %d %d", stream, buffer->id, filled);
 
@@ -280,21 +348,17 @@ static inline int push_queue(struct stream *stream, struct queue *queue, struct
 
 static inline struct buffer *pop_queue(struct stream *stream, struct queue *queue)
 {
-	int32_t avail;
-	uint32_t index, id;
+	uint32_t id;
 	struct buffer *buffer;
 
-	if ((avail = spa_ringbuffer_get_read_index(&queue->ring, &index)) < MIN_QUEUED)
+	if (pw_buffer_queue_pop(&queue->ids, &id, 1) < MIN_QUEUED)
 		return NULL;
 
-	id = queue->ids[index & MASK_BUFFERS];
-	spa_ringbuffer_read_update(&queue->ring, index + 1);
-
 	buffer = &stream->buffers[id];
 	queue->outcount += buffer->buffer.size;
-	SPA_FLAG_UNSET(buffer->flags, BUFFER_FLAG_QUEUED);
+	__atomic_store_n(&buffer->queued, 0, __ATOMIC_RELEASE);
 
-	pw_log_trace("stream %p: dequeued buffer %d %d", stream, id, avail);
+	pw_log_trace("stream %p: dequeued buffer %d", stream, id);
 
 	return buffer;
 }
@@ -326,29 +390,162 @@ static struct buffer *get_buffer(struct pw_stream *stream, uint32_t id)
 	return NULL;
 }
 
+static inline uint64_t get_monotonic_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_TIME(&ts);
+}
+
+/* the timing is written by one thread and can be read from any thread */
+static inline void seq_write_begin(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seq_write_end(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t seq_read_begin(uint32_t *seq)
+{
+	uint32_t s;
+	while ((s = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1);
+	return s;
+}
+
+static inline bool seq_read_retry(uint32_t *seq, uint32_t s)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(seq, __ATOMIC_RELAXED) != s;
+}
+
+static void begin_cycle(struct stream *impl)
+{
+	uint64_t now = get_monotonic_time();
+
+	seq_write_begin(&impl->cycle_seq);
+	if (impl->cycle_time != 0)
+		impl->period = now - impl->cycle_time;
+	impl->cycle_time = now;
+	impl->cycle++;
+	seq_write_end(&impl->cycle_seq);
+}
+
+static void read_cycle(struct stream *impl, uint32_t *cycle, uint64_t *cycle_time,
+		       uint64_t *period)
+{
+	uint32_t s;
+
+	do {
+		s = seq_read_begin(&impl->cycle_seq);
+		*cycle = impl->cycle;
+		*cycle_time = impl->cycle_time;
+		*period = impl->period;
+	} while (seq_read_retry(&impl->cycle_seq, s));
+}
+
+/* data has the start of the cycle when invoked from the main loop */
 static int
 do_call_process(struct spa_loop *loop,
                  bool async, uint32_t seq, const void *data, size_t size, void *user_data)
 {
 	struct stream *impl = user_data;
 	struct pw_stream *stream = &impl->this;
+	uint64_t cycle_time, period, start, end;
+	uint32_t cycle;
+
+	read_cycle(impl, &cycle, &cycle_time, &period);
+	if (data)
+		cycle_time = *(const uint64_t *) data;
+
+	start = get_monotonic_time();
 	impl->in_process = true;
 	pw_stream_events_process(stream);
 	impl->in_process = false;
+	end = get_monotonic_time();
+
+	seq_write_begin(&impl->process_seq);
+	impl->process_time.period = period;
+	impl->process_time.process_delay = start - cycle_time;
+	impl->process_time.process_time = end - start;
+	if (period != 0 && end - cycle_time > period) {
+		impl->process_time.late++;
+		pw_log_trace("stream %p: process took %"PRIu64" ns, period %"PRIu64" ns",
+				stream, end - cycle_time, period);
+	}
+	seq_write_end(&impl->process_seq);
+
 	return 0;
 }
 
+static void on_process_event(void *data, uint64_t count)
+{
+	struct stream *impl = data;
+	uint64_t cycle_time, period;
+	uint32_t cycle;
+
+	read_cycle(impl, &cycle, &cycle_time, &period);
+
+	/* the signals of all cycles since the last process event are merged */
+	if (impl->process_cycle != 0 && cycle - impl->process_cycle > 1) {
+		seq_write_begin(&impl->process_seq);
+		impl->process_time.skipped += cycle - impl->process_cycle - 1;
+		seq_write_end(&impl->process_seq);
+	}
+	impl->process_cycle = cycle;
+
+	do_call_process(NULL, false, 1, NULL, 0, impl);
+}
+
 static void call_process(struct stream *impl)
 {
 	if (SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_RT_PROCESS)) {
 		do_call_process(NULL, false, 1, NULL, 0, impl);
 	}
+	else if (impl->worker) {
+		pw_loop_signal_event(pw_data_loop_get_loop(impl->worker), impl->process_event);
+	}
 	else {
 		pw_loop_invoke(impl->this.remote->core->main_loop,
-			do_call_process, 1, NULL, 0, false, impl);
+			do_call_process, 1, &impl->cycle_time, sizeof(uint64_t), false, impl);
 	}
 }
 
+static int start_worker(struct stream *impl)
+{
+	struct pw_loop *loop;
+
+	if (impl->worker)
+		return 0;
+
+	if ((impl->worker = pw_data_loop_new(NULL)) == NULL)
+		return -ENOMEM;
+
+	loop = pw_data_loop_get_loop(impl->worker);
+	impl->process_event = pw_loop_add_event(loop, on_process_event, impl);
+	if (impl->process_event == NULL)
+		return -ENOMEM;
+	impl->process_cycle = 0;
+
+	return pw_data_loop_start(impl->worker);
+}
+
+static void stop_worker(struct stream *impl)
+{
+	if (impl->worker == NULL)
+		return;
+
+	pw_data_loop_stop(impl->worker);
+	if (impl->process_event)
+		pw_loop_destroy_source(pw_data_loop_get_loop(impl->worker), impl->process_event);
+	pw_data_loop_destroy(impl->worker);
+	impl->worker = NULL;
+	impl->process_event = NULL;
+}
+
 const char *pw_stream_state_as_string(enum pw_stream_state state)
 {
 	switch (state) {
@@ -398,6 +595,7 @@ struct pw_stream *pw_stream_new(struct pw_remote *remote,
 	this->name = strdup(name);
 	impl->type_client_node = spa_type_map_get_id(remote->core->type.map, PW_TYPE_INTERFACE__ClientNode);
 	impl->rtwritefd = -1;
+	impl->peer.fd = -1;
 
 	str = pw_properties_get(props, "pipewire.client.reuse");
 	impl->client_reuse = str && pw_properties_parse_bool(str);
@@ -407,12 +605,11 @@ struct pw_stream *pw_stream_new(struct pw_remote *remote,
 	this->state = PW_STREAM_STATE_UNCONNECTED;
 
 	pw_array_init(&impl->mem_ids, 64);
-	pw_array_ensure_size(&impl->mem_ids, sizeof(struct mem) * 64);
 
 	impl->pending_seq = SPA_ID_INVALID;
 
-	spa_ringbuffer_init(&impl->queue.ring);
-	spa_ringbuffer_init(&impl->dequeue.ring);
+	pw_buffer_queue_init(&impl->queue.ids);
+	pw_buffer_queue_init(&impl->dequeue.ids);
 
 	spa_list_append(&remote->stream_list, &this->link);
 
@@ -470,6 +667,12 @@ do_remove_sources(struct spa_loop *loop,
 		close(impl->rtwritefd);
 		impl->rtwritefd = -1;
 	}
+	if (impl->peer.trans) {
+		pw_client_node_transport_destroy(impl->peer.trans);
+		close(impl->peer.fd);
+		impl->peer.trans = NULL;
+		impl->peer.fd = -1;
+	}
 	return 0;
 }
 
@@ -609,26 +812,56 @@ static void add_port_update(struct pw_stream *stream, uint32_t change_mask)
 					 &impl->port_info);
 }
 
-static inline void send_need_input(struct pw_stream *stream)
+static inline void signal_server(struct pw_stream *stream, enum pw_client_node_message_type message)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	uint64_t cmd = 1;
 
 	pw_log_trace("send");
-	pw_client_node_transport_add_message(impl->trans,
-			       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_NEED_INPUT));
+	if (impl->trans->activation == NULL)
+		pw_client_node_transport_add_message(impl->trans,
+				&PW_CLIENT_NODE_MESSAGE_INIT(message));
+	else if (!pw_client_node_activation_signal(impl->trans->activation,
+				PW_CLIENT_NODE_ACTIVATION_SERVER, message))
+		return;
 	write(impl->rtwritefd, &cmd, 8);
 }
 
-static inline void send_have_output(struct pw_stream *stream)
+static inline void signal_peer(struct pw_stream *stream, struct spa_io_buffers *peer_io,
+			       struct spa_io_buffers *io, enum pw_client_node_message_type message)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	uint64_t cmd = 1;
 
-	pw_log_trace("send");
-	pw_client_node_transport_add_message(impl->trans,
-			       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT));
-	write(impl->rtwritefd, &cmd, 8);
+	pw_log_trace("send peer");
+	*peer_io = *io;
+	if (pw_client_node_activation_signal(impl->peer.trans->activation,
+				PW_CLIENT_NODE_ACTIVATION_CLIENT, message))
+		write(impl->peer.fd, &cmd, 8);
+}
+
+static inline void send_need_input(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+
+	if (impl->peer.trans)
+		signal_peer(stream, &impl->peer.trans->outputs[impl->peer.port_id],
+			    &impl->trans->inputs[impl->port_id],
+			    PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT);
+	else
+		signal_server(stream, PW_CLIENT_NODE_MESSAGE_NEED_INPUT);
+}
+
+static inline void send_have_output(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+
+	if (impl->peer.trans)
+		signal_peer(stream, &impl->peer.trans->inputs[impl->peer.port_id],
+			    &impl->trans->outputs[impl->port_id],
+			    PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT);
+	else
+		signal_server(stream, PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT);
 }
 
 static inline void send_reuse_buffer(struct pw_stream *stream, uint32_t id)
@@ -690,7 +923,7 @@ static inline void reuse_buffer(struct pw_stream *stream, uint32_t id)
 	struct buffer *b;
 
 	if ((b = get_buffer(stream, id)) &&
-	    !SPA_FLAG_CHECK(b->flags, BUFFER_FLAG_QUEUED)) {
+	    !__atomic_load_n(&b->queued, __ATOMIC_RELAXED)) {
 		pw_log_trace("stream %p: reuse buffer %u", stream, id);
 		push_queue(impl, &impl->dequeue, b);
 	}
@@ -741,7 +974,6 @@ static int process_output(struct pw_stream *stream)
 	for (i = 0; i < impl->trans->area->n_output_ports; i++) {
 		struct spa_io_buffers *io = &impl->trans->outputs[i];
 		struct buffer *b;
-		uint32_t index;
 
 	      again:
 		pw_log_trace("stream %p: process out %d %d", stream,
@@ -766,7 +998,7 @@ static int process_output(struct pw_stream *stream)
 
 		if (!SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_DRIVER)) {
 			call_process(impl);
-			if (spa_ringbuffer_get_read_index(&impl->queue.ring, &index) >= MIN_QUEUED &&
+			if (pw_buffer_queue_avail(&impl->queue.ids) >= MIN_QUEUED &&
 			    io->status == SPA_STATUS_NEED_BUFFER)
 				goto again;
 		}
@@ -784,11 +1016,13 @@ static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_nod
 
 	switch (PW_CLIENT_NODE_MESSAGE_TYPE(message)) {
 	case PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT:
+		begin_cycle(impl);
 		if (process_input(stream) == SPA_STATUS_NEED_BUFFER)
 			send_need_input(stream);
 		break;
 
 	case PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT:
+		begin_cycle(impl);
 		if (process_output(stream) == SPA_STATUS_HAVE_BUFFER)
 			send_have_output(stream);
 		break;
@@ -826,17 +1060,33 @@ on_rtsocket_condition(void *data, int fd, enum spa_io mask)
 	}
 
 	if (mask & SPA_IO_IN) {
+		struct pw_client_node_activation *a = impl->trans->activation;
 		struct pw_client_node_message message;
+		uint32_t flags = 0;
 		uint64_t cmd;
 
 		if (read(fd, &cmd, sizeof(uint64_t)) != sizeof(uint64_t))
 			pw_log_warn("stream %p: read failed %m", impl);
 
-		while (pw_client_node_transport_next_message(impl->trans, &message) == 1) {
-			struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
-			pw_client_node_transport_parse_message(impl->trans, msg);
-			handle_rtnode_message(stream, msg);
-		}
+		/* without activation record, all messages are in the ringbuffer */
+		if (a)
+			pw_client_node_activation_wakeup(a, PW_CLIENT_NODE_ACTIVATION_CLIENT);
+		do {
+			if (a)
+				flags = pw_client_node_activation_poll(a, PW_CLIENT_NODE_ACTIVATION_CLIENT);
+
+			while (pw_client_node_transport_next_message(impl->trans, &message) == 1) {
+				struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
+				pw_client_node_transport_parse_message(impl->trans, msg);
+				handle_rtnode_message(stream, msg);
+			}
+			if (flags & (1 << PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT))
+				handle_rtnode_message(stream,
+					&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT));
+			if (flags & (1 << PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT))
+				handle_rtnode_message(stream,
+					&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT));
+		} while (flags != 0);
 	}
 }
 
@@ -850,6 +1100,8 @@ static void handle_socket(struct pw_stream *stream, int rtreadfd, int rtwritefd)
 					       rtreadfd,
 					       SPA_IO_ERR | SPA_IO_HUP,
 					       true, on_rtsocket_condition, stream);
+	if (impl->rtsocket_source)
+		impl->rtsocket_source->priority = SPA_SOURCE_PRIORITY_RT;
 
 	impl->timeout_source = pw_loop_add_timer(stream->remote->core->main_loop, on_timeout, stream);
 	interval.tv_sec = 0;
@@ -871,6 +1123,21 @@ static void client_node_event(void *data, const struct spa_event *event)
 	pw_log_warn("unhandled node event %d", SPA_EVENT_TYPE(event));
 }
 
+/* start the first cycle of an output stream in the realtime thread */
+static int
+do_start_output(struct spa_loop *loop,
+		bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct stream *impl = user_data;
+
+	seq_write_begin(&impl->cycle_seq);
+	impl->cycle_time = get_monotonic_time();
+	seq_write_end(&impl->cycle_seq);
+
+	call_process(impl);
+	return 0;
+}
+
 static void client_node_command(void *data, uint32_t seq, const struct spa_command *command)
 {
 	struct stream *impl = data;
@@ -906,24 +1173,37 @@ static void client_node_command(void *data, uint32_t seq, const struct spa_comma
 				send_need_input(stream);
 			}
 			else {
-				call_process(impl);
+				pw_loop_invoke(stream->remote->core->data_loop,
+					       do_start_output, SPA_ID_INVALID, NULL, 0, false, impl);
 			}
 			stream_set_state(stream, PW_STREAM_STATE_STREAMING, NULL);
 		}
 	} else if (SPA_COMMAND_TYPE(command) == remote->core->type.command_node.ClockUpdate) {
 		struct spa_command_node_clock_update *cu = (__typeof__(cu)) command;
 
+		if (cu->body.change_mask.value & SPA_COMMAND_NODE_CLOCK_UPDATE_LATENCY)
+			pw_properties_setf(stream->properties,
+					   PW_STREAM_PROP_QUANTUM, "%" PRId64 "/%u",
+					   (int64_t) ((cu->body.latency.value * PW_CORE_QUANTUM_RATE +
+						       SPA_NSEC_PER_SEC / 2) / SPA_NSEC_PER_SEC),
+					   PW_CORE_QUANTUM_RATE);
+
+		if (!(cu->body.change_mask.value & SPA_COMMAND_NODE_CLOCK_UPDATE_TIME))
+			return;
+
 		if (cu->body.flags.value & SPA_COMMAND_NODE_CLOCK_UPDATE_FLAG_LIVE) {
 			pw_properties_set(stream->properties, PW_STREAM_PROP_IS_LIVE, "1");
 			pw_properties_setf(stream->properties,
 					   PW_STREAM_PROP_LATENCY_MIN, "%" PRId64,
 					   cu->body.latency.value);
 		}
+		seq_write_begin(&impl->time_seq);
 		impl->last_time.now = cu->body.monotonic_time.value;
 		impl->last_time.ticks = cu->body.ticks.value;
 		impl->last_time.rate.num = 1;
 		impl->last_time.rate.denom = cu->body.rate.value;
 		impl->last_time.delay = 0;
+		seq_write_end(&impl->time_seq);
 		pw_log_debug("clock update %ld %d %ld", impl->last_time.ticks,
 				impl->last_time.rate.denom, impl->last_time.now);
 	} else {
@@ -992,24 +1272,23 @@ client_node_add_mem(void *data,
 		    uint32_t type, int memfd, uint32_t flags)
 {
 	struct stream *impl = data;
-	struct pw_stream *stream = &impl->this;
 	struct mem *m;
 
-	m = find_mem(stream, mem_id);
-	if (m) {
-		pw_log_debug("update mem %u, fd %d, flags %d",
-			     mem_id, memfd, flags);
-		clear_mem(impl, m);
-	} else {
-		m = pw_array_add(&impl->mem_ids, sizeof(struct mem));
-		pw_log_debug("add mem %u, fd %d, flags %d",
-			     mem_id, memfd, flags);
+	if ((m = add_mem(impl, mem_id)) == NULL) {
+		pw_log_error("stream %p: can't add mem %u: %m", impl, mem_id);
+		close(memfd);
+		return;
+	}
+	pw_log_debug("%s mem %u, fd %d, flags %d", m->fd == -1 ? "add" : "update",
+		     mem_id, memfd, flags);
+
+	if (impl->io_mem == m) {
+		impl->io = NULL;
+		impl->io_mem = NULL;
 	}
-	m->id = mem_id;
+	clear_mem(impl, m);
 	m->fd = memfd;
 	m->flags = flags;
-	m->map = PW_MAP_RANGE_INIT;
-	m->ptr = NULL;
 }
 
 static void
@@ -1025,17 +1304,40 @@ client_node_port_use_buffers(void *data,
 	struct buffer *bid;
 	uint32_t i, j;
 	struct spa_buffer *b;
+	struct mem *m, **mp;
+	bool map_buffers;
 	int prot;
 
 	prot = PROT_READ | (direction == SPA_DIRECTION_OUTPUT ? PROT_WRITE : 0);
+	map_buffers = SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_MAP_BUFFERS);
 
 	/* clear previous buffers */
 	clear_buffers(stream);
 
+	/* map all the memory of the buffers in a mem at once, the buffers
+	 * then share the mapping */
+	for (i = 0; i < n_buffers; i++) {
+		if ((m = find_mem(impl, buffers[i].mem_id)) != NULL)
+			mem_use(m, buffers[i].offset, buffers[i].size);
+
+		for (j = 0; map_buffers && j < buffers[i].buffer->n_datas; j++) {
+			struct spa_data *d = &buffers[i].buffer->datas[j];
+
+			if ((d->type == t->data.MemFd || d->type == t->data.DmaBuf) &&
+			    (m = find_mem(impl, SPA_PTR_TO_UINT32(d->data))) != NULL)
+				mem_use(m, d->mapoffset, d->maxsize);
+		}
+	}
+	pw_array_for_each(mp, &impl->mem_ids) {
+		if ((m = *mp) == NULL || m->use_end == 0)
+			continue;
+		m->use_ptr = mem_map(impl, m, m->use_offset, m->use_end - m->use_offset, prot);
+	}
+
 	for (i = 0; i < n_buffers; i++) {
 		off_t offset;
 
-		struct mem *m = find_mem(stream, buffers[i].mem_id);
+		m = find_mem(impl, buffers[i].mem_id);
 		if (m == NULL) {
 			pw_log_warn("unknown memory id %u", buffers[i].mem_id);
 			continue;
@@ -1044,18 +1346,12 @@ client_node_port_use_buffers(void *data,
 		bid = &impl->buffers[i];
 		bid->id = i;
 		bid->flags = 0;
+		bid->queued = 0;
 		b = buffers[i].buffer;
 
-		pw_map_range_init(&bid->map, buffers[i].offset, buffers[i].size,
-				core->sc_pagesize);
-
-		bid->ptr = mmap(NULL, bid->map.size, prot, MAP_SHARED, m->fd, bid->map.offset);
-		if (bid->ptr == MAP_FAILED) {
-			bid->ptr = NULL;
-			pw_log_warn("Failed to mmap memory %d %p: %s", bid->map.size, m,
-				    strerror(errno));
+		bid->ptr = mem_map(impl, m, buffers[i].offset, buffers[i].size, prot);
+		if (bid->ptr == NULL)
 			continue;
-		}
 
 		{
 			size_t size;
@@ -1084,9 +1380,9 @@ client_node_port_use_buffers(void *data,
 		}
 
 		pw_log_debug("add buffer %d %d %u %u", m->id,
-				b->id, bid->map.offset, bid->map.size);
+				b->id, buffers[i].offset, buffers[i].size);
 
-		offset = bid->map.start;
+		offset = 0;
 		for (j = 0; j < b->n_metas; j++) {
 			struct spa_meta *m = &b->metas[j];
 			memcpy(m, &buffers[i].buffer->metas[j], sizeof(struct spa_meta));
@@ -1101,23 +1397,31 @@ client_node_port_use_buffers(void *data,
 			d->chunk =
 			    SPA_MEMBER(bid->ptr, offset + sizeof(struct spa_chunk) * j,
 				       struct spa_chunk);
+			bid->mem[bid->n_mem++] = NULL;
 
 			if (d->type == t->data.MemFd || d->type == t->data.DmaBuf) {
-				struct mem *bm = find_mem(stream, SPA_PTR_TO_UINT32(d->data));
+				uint32_t mem_id = SPA_PTR_TO_UINT32(d->data);
+				struct mem *bm = find_mem(impl, mem_id);
+
 				d->data = NULL;
+				if (bm == NULL) {
+					pw_log_warn("unknown memory id %u", mem_id);
+					d->fd = -1;
+					continue;
+				}
 				d->fd = bm->fd;
 				bm->ref++;
-				bid->mem[bid->n_mem++] = bm;
+				bid->mem[j + 1] = bm;
 				pw_log_debug(" data %d %u -> fd %d", j, bm->id, bm->fd);
 
-				if (SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_MAP_BUFFERS)) {
-					if (map_data(impl, d, prot) < 0)
-						return;
+				if (map_buffers) {
+					d->data = mem_map(impl, bm, d->mapoffset, d->maxsize, prot);
+					if (d->data == NULL)
+						continue;
 					SPA_FLAG_SET(bid->flags, BUFFER_FLAG_MAPPED);
 				}
 			} else if (d->type == t->data.MemPtr) {
-				d->data = SPA_MEMBER(bid->ptr,
-						bid->map.start + SPA_PTR_TO_INT(d->data), void);
+				d->data = SPA_MEMBER(bid->ptr, SPA_PTR_TO_INT(d->data), void);
 				d->fd = -1;
 				pw_log_debug(" data %d %u -> mem %p", j, b->id, d->data);
 			} else {
@@ -1131,6 +1435,16 @@ client_node_port_use_buffers(void *data,
 		pw_stream_events_add_buffer(stream, &bid->buffer);
 	}
 
+	/* the buffers hold the mappings now */
+	pw_array_for_each(mp, &impl->mem_ids) {
+		if ((m = *mp) == NULL || m->use_end == 0)
+			continue;
+		if (m->use_ptr != NULL)
+			mem_unmap(impl, m, m->use_ptr);
+		m->use_ptr = NULL;
+		m->use_end = 0;
+	}
+
 	add_async_complete(stream, seq, 0);
 
 	impl->n_buffers = n_buffers;
@@ -1190,26 +1504,32 @@ static void client_node_port_set_io(void *data,
 	int res;
 
 	if (mem_id == SPA_ID_INVALID) {
+		m = NULL;
 		ptr = NULL;
 		size = 0;
 	}
 	else {
-		m = find_mem(stream, mem_id);
+		m = find_mem(impl, mem_id);
 		if (m == NULL) {
 			pw_log_warn("unknown memory id %u", mem_id);
 			res = -EINVAL;
 			goto exit;
 		}
-		if ((ptr = mem_map(stream, m, offset, size)) == NULL) {
+		if ((ptr = mem_map(impl, m, offset, size, PROT_READ | PROT_WRITE)) == NULL) {
 			res = -errno;
 			goto exit;
 		}
 	}
 
 	if (id == t->io.Buffers) {
+		if (impl->io_mem != NULL)
+			mem_unmap(impl, impl->io_mem, impl->io);
 		impl->io = ptr;
+		impl->io_mem = m;
 		pw_log_debug("stream %p: set io id %u %p", stream, id, ptr);
 	}
+	else if (m != NULL)
+		mem_unmap(impl, m, ptr);
 
 	res = 0;
 
@@ -1217,6 +1537,58 @@ static void client_node_port_set_io(void *data,
 	add_async_complete(stream, seq, res);
 }
 
+struct set_peer {
+	struct pw_client_node_transport *trans;
+	uint32_t port_id;
+	int fd;
+};
+
+static int
+do_set_peer(struct spa_loop *loop,
+	    bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct stream *impl = user_data;
+	const struct set_peer *peer = data;
+
+	impl->peer.trans = peer->trans;
+	impl->peer.port_id = peer->port_id;
+	impl->peer.fd = peer->fd;
+	return 0;
+}
+
+static void client_node_port_set_peer(void *data,
+				      enum spa_direction direction,
+				      uint32_t port_id,
+				      uint32_t peer_port_id,
+				      int signalfd,
+				      struct pw_client_node_transport *transport)
+{
+	struct stream *impl = data;
+	struct pw_stream *stream = &impl->this;
+	struct set_peer peer = { transport, peer_port_id, signalfd };
+	struct pw_client_node_transport *old_trans = impl->peer.trans;
+	int old_fd = impl->peer.fd;
+
+	/* we signal the peer with its activation record */
+	if (direction != impl->direction || port_id != impl->port_id ||
+	    (transport != NULL &&
+	     (transport->activation == NULL ||
+	      peer_port_id >= (direction == SPA_DIRECTION_OUTPUT ?
+			       transport->area->max_input_ports :
+			       transport->area->max_output_ports)))) {
+		old_trans = transport;
+		old_fd = signalfd;
+	} else {
+		pw_log_debug("stream %p: set peer %p %u", stream, transport, peer_port_id);
+		pw_loop_invoke(stream->remote->core->data_loop,
+			       do_set_peer, SPA_ID_INVALID, &peer, sizeof(peer), true, impl);
+	}
+	if (old_trans) {
+		pw_client_node_transport_destroy(old_trans);
+		close(old_fd);
+	}
+}
+
 static const struct pw_client_node_proxy_events client_node_events = {
 	PW_VERSION_CLIENT_NODE_PROXY_EVENTS,
 	.add_mem = client_node_add_mem,
@@ -1230,6 +1602,7 @@ static const struct pw_client_node_proxy_events client_node_events = {
 	.port_use_buffers = client_node_port_use_buffers,
 	.port_command = client_node_port_command,
 	.port_set_io = client_node_port_set_io,
+	.port_set_peer = client_node_port_set_peer,
 };
 
 static void on_node_proxy_destroy(void *data)
@@ -1264,6 +1637,16 @@ pw_stream_connect(struct pw_stream *stream,
 	impl->port_id = 0;
 	impl->flags = flags;
 
+	if (SPA_FLAG_CHECK(flags, PW_STREAM_FLAG_WORKER_PROCESS) &&
+	    !SPA_FLAG_CHECK(flags, PW_STREAM_FLAG_RT_PROCESS)) {
+		int res;
+		if ((res = start_worker(impl)) < 0) {
+			pw_log_error("stream %p: can't start worker: %s", stream, strerror(-res));
+			stop_worker(impl);
+			return res;
+		}
+	}
+
 	set_init_params(stream, n_params, params);
 
 	stream_set_state(stream, PW_STREAM_STATE_CONNECTING, NULL);
@@ -1336,6 +1719,8 @@ int pw_stream_disconnect(struct pw_stream *stream)
 
 	unhandle_socket(stream);
 
+	stop_worker(impl);
+
 	if (impl->node_proxy) {
 		pw_client_node_proxy_destroy(impl->node_proxy);
 		impl->node_proxy = NULL;
@@ -1362,11 +1747,16 @@ static inline int64_t get_queue_size(struct queue *queue)
 int pw_stream_get_time(struct pw_stream *stream, struct pw_time *time)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	uint32_t s;
 
-	if (impl->last_time.rate.denom == 0)
+	do {
+		s = seq_read_begin(&impl->time_seq);
+		*time = impl->last_time;
+	} while (seq_read_retry(&impl->time_seq, s));
+
+	if (time->rate.denom == 0)
 		return -EAGAIN;
 
-	*time = impl->last_time;
 	if (impl->direction == SPA_DIRECTION_INPUT)
 		time->queued = get_queue_size(&impl->dequeue);
 	else
@@ -1378,6 +1768,19 @@ int pw_stream_get_time(struct pw_stream *stream, struct pw_time *time)
 	return 0;
 }
 
+int pw_stream_get_process_time(struct pw_stream *stream, struct pw_process_time *time)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	uint32_t s;
+
+	do {
+		s = seq_read_begin(&impl->process_seq);
+		*time = impl->process_time;
+	} while (seq_read_retry(&impl->process_seq, s));
+
+	return 0;
+}
+
 int pw_stream_set_control(struct pw_stream *stream, const char *name, float value)
 {
 	return -ENOTSUP;
@@ -1388,43 +1791,101 @@ int pw_stream_get_control(struct pw_stream *stream, const char *name, float *val
 	return -ENOTSUP;
 }
 
-struct pw_buffer *pw_stream_dequeue_buffer(struct pw_stream *stream)
+int pw_stream_dequeue_buffers(struct pw_stream *stream,
+			      struct pw_buffer **buffers, uint32_t n_buffers)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct queue *queue = &impl->dequeue;
+	uint32_t i, ids[MAX_BUFFERS];
 	struct buffer *b;
 
-	if ((b = pop_queue(impl, &impl->dequeue)) == NULL) {
+	n_buffers = pw_buffer_queue_pop(&queue->ids, ids, SPA_MIN(n_buffers, MAX_BUFFERS));
+
+	for (i = 0; i < n_buffers; i++) {
+		b = &impl->buffers[ids[i]];
+		queue->outcount += b->buffer.size;
+		__atomic_store_n(&b->queued, 0, __ATOMIC_RELEASE);
+		buffers[i] = &b->buffer;
+
+		pw_log_trace("stream %p: dequeue buffer %d", stream, b->id);
+	}
+	if (n_buffers == 0)
 		pw_log_trace("stream %p: no more buffers", stream);
+
+	return n_buffers;
+}
+
+struct pw_buffer *pw_stream_dequeue_buffer(struct pw_stream *stream)
+{
+	struct pw_buffer *buffer;
+
+	if (pw_stream_dequeue_buffers(stream, &buffer, 1) < 1)
 		return NULL;
-	}
-	pw_log_trace("stream %p: dequeue buffer %d", stream, b->id);
 
-	return &b->buffer;
+	return buffer;
 }
 
-int pw_stream_queue_buffer(struct pw_stream *stream, struct pw_buffer *buffer)
+static int
+do_flush_queue(struct spa_loop *loop,
+	       bool async, uint32_t seq, const void *data, size_t size, void *user_data)
 {
-	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct stream *impl = user_data;
+	struct pw_stream *stream = &impl->this;
 	struct buffer *b;
-	int res;
 
-	if ((b = get_buffer(stream, buffer->buffer->id)) == NULL)
-		return -EINVAL;
-
-	pw_log_trace("stream %p: queue buffer %d", stream, b->id);
-	if ((res = push_queue(impl, &impl->queue, b)) < 0)
-		return res;
+	/* the stream was disconnected after the buffers were queued */
+	if (impl->rtsocket_source == NULL)
+		return 0;
 
 	if (impl->direction == SPA_DIRECTION_OUTPUT) {
-		if (res == 0 &&
-		    SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_DRIVER) &&
-		    process_output(stream) == SPA_STATUS_HAVE_BUFFER)
+		if (process_output(stream) == SPA_STATUS_HAVE_BUFFER)
 			send_have_output(stream);
 	}
 	else {
-		if (impl->client_reuse)
-			if ((b = pop_queue(impl, &impl->queue)))
-				send_reuse_buffer(stream, b->id);
+		while ((b = pop_queue(impl, &impl->queue)))
+			send_reuse_buffer(stream, b->id);
 	}
 	return 0;
 }
+
+int pw_stream_queue_buffers(struct pw_stream *stream,
+			    struct pw_buffer **buffers, uint32_t n_buffers)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct queue *queue = &impl->queue;
+	uint32_t i, n_ids = 0, filled, ids[MAX_BUFFERS];
+	struct buffer *b;
+	int res = 0;
+
+	for (i = 0; i < n_buffers && n_ids < MAX_BUFFERS; i++) {
+		if ((b = get_buffer(stream, buffers[i]->buffer->id)) == NULL ||
+		    __atomic_exchange_n(&b->queued, 1, __ATOMIC_ACQUIRE)) {
+			res = -EINVAL;
+			break;
+		}
+		queue->incount += b->buffer.size;
+		ids[n_ids++] = b->id;
+
+		pw_log_trace("stream %p: queue buffer %d", stream, b->id);
+	}
+	if (n_ids == 0)
+		return res;
+
+	filled = pw_buffer_queue_avail(&queue->ids);
+	pw_buffer_queue_push(&queue->ids, ids, n_ids);
+
+	/* the queue is popped in the realtime thread only */
+	if ((impl->direction == SPA_DIRECTION_OUTPUT &&
+	     filled == 0 && SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_DRIVER)) ||
+	    (impl->direction == SPA_DIRECTION_INPUT && impl->client_reuse))
+		pw_loop_invoke(stream->remote->core->data_loop,
+			       do_flush_queue, SPA_ID_INVALID, NULL, 0, false, impl);
+
+	return n_ids;
+}
+
+int pw_stream_queue_buffer(struct pw_stream *stream, struct pw_buffer *buffer)
+{
+	int res = pw_stream_queue_buffers(stream, &buffer, 1);
+	return res < 0 ? res : 0;
+}
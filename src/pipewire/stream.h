@@ -131,6 +131,26 @@ extern "C" {
  * The process event is emited when PipeWire has emptied a buffer that
  * can now be refilled.
  *
+ * \ref pw_stream_dequeue_buffers() and \ref pw_stream_queue_buffers()
+ * move several buffers at once. The buffers can be dequeued and queued
+ * from one other thread than the one that processes the stream, without
+ * locking. When queueing must send a buffer to the peer, the stream asks
+ * its realtime thread to do that.
+ *
+ * \subsection ssec_process Process thread
+ *
+ * By default the process event is emited from the main loop. With
+ * \ref PW_STREAM_FLAG_RT_PROCESS it is emited from the realtime thread
+ * and must not block. With \ref PW_STREAM_FLAG_WORKER_PROCESS the stream
+ * emits the event from a thread of its own. When the cycles come faster
+ * than the worker can handle them, the pending cycles are merged into one
+ * process event so the process event should handle all buffers that are
+ * available.
+ *
+ * \ref pw_stream_get_process_time() has the time the last process event
+ * took and the number of process events that did not complete within the
+ * period of the cycle.
+ *
  * \section sec_stream_disconnect Disconnect
  *
  * Use \ref pw_stream_disconnect() to disconnect a stream after use.
@@ -215,6 +235,8 @@ enum pw_stream_flags {
 	PW_STREAM_FLAG_NO_CONVERT	= (1 << 5),	/**< don't convert format */
 	PW_STREAM_FLAG_EXCLUSIVE	= (1 << 6),	/**< require exclusive access to the
 							  *  device */
+	PW_STREAM_FLAG_WORKER_PROCESS	= (1 << 7),	/**< call process from a worker thread
+							  *  of the stream */
 };
 
 /** Create a new unconneced \ref pw_stream \memberof pw_stream
@@ -251,6 +273,9 @@ struct pw_remote *pw_stream_get_remote(struct pw_stream *stream);
 #define PW_STREAM_PROP_LATENCY_MIN	"pipewire.latency.min"
 /** The maximum latency of the stream, int default MAXINT */
 #define PW_STREAM_PROP_LATENCY_MAX	"pipewire.latency.max"
+/** The quantum of the graph in frames, as "frames/rate" like "1024/48000".
+ * Ask for a lower quantum with the "node.latency" property */
+#define PW_STREAM_PROP_QUANTUM		"pipewire.latency.quantum"
 
 const struct pw_properties *pw_stream_get_properties(struct pw_stream *stream);
 
@@ -327,6 +352,23 @@ struct pw_time {
 /** Query the time on the stream \memberof pw_stream */
 int pw_stream_get_time(struct pw_stream *stream, struct pw_time *time);
 
+/** The timing of the process event \memberof pw_stream */
+struct pw_process_time {
+	uint64_t period;		/**< time in nanoseconds between the last two cycles,
+					     the process event should complete in this time */
+	uint64_t process_delay;		/**< time in nanoseconds from the start of the cycle
+					     to the start of the last process event */
+	uint64_t process_time;		/**< time in nanoseconds the last process event took */
+	uint32_t late;			/**< number of process events that completed after
+					     the period */
+	uint32_t skipped;		/**< number of cycles without a process event because
+					     the worker was still busy */
+};
+
+/** Query the timing of the process event, this can be called from any
+ * thread \memberof pw_stream */
+int pw_stream_get_process_time(struct pw_stream *stream, struct pw_process_time *time);
+
 /** Get a buffer that can be filled for playback streams or consumed
  * for capture streams.  */
 struct pw_buffer *pw_stream_dequeue_buffer(struct pw_stream *stream);
@@ -334,6 +376,16 @@ struct pw_buffer *pw_stream_dequeue_buffer(struct pw_stream *stream);
 /** Submit a buffer for playback or recycle a buffer for capture. */
 int pw_stream_queue_buffer(struct pw_stream *stream, struct pw_buffer *buffer);
 
+/** Get at most \a n_buffers buffers with one update of the queue.
+ * \return the number of buffers in \a buffers */
+int pw_stream_dequeue_buffers(struct pw_stream *stream,
+			      struct pw_buffer **buffers, uint32_t n_buffers);
+
+/** Submit \a n_buffers buffers with one update of the queue.
+ * \return the number of queued buffers or < 0 on error */
+int pw_stream_queue_buffers(struct pw_stream *stream,
+			    struct pw_buffer **buffers, uint32_t n_buffers);
+
 
 #ifdef __cplusplus
 }
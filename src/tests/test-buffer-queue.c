@@ -0,0 +1,164 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* A capture thread fills buffers and an application thread takes them
+ * and gives them back, like the two sides of a stream. The buffers go
+ * around through the two queues in batches of different sizes. A mutex
+ * around the queues is used for comparison. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/buffer-queue.h>
+
+#define N_BUFFERS	32
+#define N_ROUNDS	1000000
+
+struct data {
+	struct pw_buffer_queue filled;
+	struct pw_buffer_queue empty;
+	pthread_mutex_t lock;
+	bool locked;
+	uint32_t batch;
+
+	uint64_t seq[N_BUFFERS];
+	uint64_t n_errors;
+};
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_TIME(&ts);
+}
+
+static uint32_t push(struct data *d, struct pw_buffer_queue *queue, uint32_t *ids, uint32_t n_ids)
+{
+	uint32_t res;
+
+	if (d->locked)
+		pthread_mutex_lock(&d->lock);
+	res = pw_buffer_queue_push(queue, ids, n_ids);
+	if (d->locked)
+		pthread_mutex_unlock(&d->lock);
+	return res;
+}
+
+static uint32_t pop(struct data *d, struct pw_buffer_queue *queue, uint32_t *ids, uint32_t n_ids)
+{
+	uint32_t res;
+
+	if (d->locked)
+		pthread_mutex_lock(&d->lock);
+	res = pw_buffer_queue_pop(queue, ids, n_ids);
+	if (d->locked)
+		pthread_mutex_unlock(&d->lock);
+	return res;
+}
+
+/* fills the buffers, the seq must be visible with the buffer */
+static void *capture_thread(void *user_data)
+{
+	struct data *d = user_data;
+	uint32_t ids[N_BUFFERS], i, n, pushed;
+	uint64_t seq = 0;
+
+	while (seq < N_ROUNDS) {
+		if ((n = pop(d, &d->empty, ids, d->batch)) == 0) {
+			sched_yield();
+			continue;
+		}
+		for (i = 0; i < n; i++)
+			d->seq[ids[i]] = seq++;
+		for (pushed = 0; pushed < n;)
+			pushed += push(d, &d->filled, ids + pushed, n - pushed);
+	}
+	return NULL;
+}
+
+static int run(uint32_t batch, bool locked)
+{
+	struct data d;
+	pthread_t thread;
+	uint32_t ids[N_BUFFERS], i, n, pushed;
+	uint64_t seq = 0, start, stop;
+
+	spa_zero(d);
+	pw_buffer_queue_init(&d.filled);
+	pw_buffer_queue_init(&d.empty);
+	pthread_mutex_init(&d.lock, NULL);
+	d.locked = locked;
+	d.batch = batch;
+
+	for (i = 0; i < N_BUFFERS; i++)
+		ids[i] = i;
+	pw_buffer_queue_push(&d.empty, ids, N_BUFFERS);
+
+	start = get_time();
+	pthread_create(&thread, NULL, capture_thread, &d);
+
+	/* the application */
+	while (seq < N_ROUNDS) {
+		if ((n = pop(&d, &d.filled, ids, batch)) == 0) {
+			sched_yield();
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			if (d.seq[ids[i]] != seq++)
+				d.n_errors++;
+		}
+		for (pushed = 0; pushed < n;)
+			pushed += push(&d, &d.empty, ids + pushed, n - pushed);
+	}
+	pthread_join(thread, NULL);
+	stop = get_time();
+
+	printf("%-8s batch %2u: %6.1f ns per buffer, %.2f M buffers/s\n",
+			locked ? "mutex" : "lockfree", batch,
+			(double)(stop - start) / N_ROUNDS,
+			N_ROUNDS * 1000.0 / (stop - start));
+
+	pthread_mutex_destroy(&d.lock);
+
+	if (d.n_errors > 0) {
+		printf("%"PRIu64" buffers out of order\n", d.n_errors);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint32_t batches[] = { 1, 4, 16 };
+	uint32_t i;
+	int res = 0;
+
+	pw_init(&argc, &argv);
+
+	for (i = 0; i < SPA_N_ELEMENTS(batches); i++) {
+		if (run(batches[i], false) < 0 || run(batches[i], true) < 0)
+			res = 1;
+	}
+	return res;
+}
@@ -0,0 +1,293 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Wake-ups with the client-node activation record.
+ *
+ * This does not run the server or the client-node code. Three threads use
+ * the activation record functions and eventfds the way the server and two
+ * clients do. A producer hands a buffer to a consumer and waits until the
+ * consumer gives it back. Through a thread that copies the io between the
+ * clients like the server does, and directly between the clients like a
+ * direct link does. It checks that no message gets lost and prints the
+ * cycle time and the number of eventfd wake-ups.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include <spa/node/io.h>
+
+#include <pipewire/pipewire.h>
+#include <extensions/client-node.h>
+
+#define N_CYCLES	20000
+#define N_BUFFERS	8
+
+enum side {
+	SIDE_PRODUCER,
+	SIDE_CONSUMER,
+};
+
+struct client {
+	struct pw_client_node_activation activation;	/**< shared with the server */
+	struct spa_io_buffers input;
+	struct spa_io_buffers output;
+	int fd;						/**< wakes up the client */
+	struct pw_loop *loop;
+	pthread_t thread;
+};
+
+struct data {
+	bool direct;
+
+	struct client clients[2];
+
+	struct pw_loop *server_loop;
+	int server_fd;
+	pthread_t server_thread;
+
+	bool running;
+	bool done;
+	uint32_t n_wakeups;
+	uint32_t n_errors;
+	uint32_t buffer_id;
+};
+
+static void wakeup(struct data *d, struct pw_client_node_activation *a, int fd,
+		   int side, enum pw_client_node_message_type message)
+{
+	uint64_t cmd = 1;
+
+	if (pw_client_node_activation_signal(a, side, message)) {
+		if (write(fd, &cmd, 8) != 8)
+			fprintf(stderr, "write failed: %m\n");
+		__atomic_add_fetch(&d->n_wakeups, 1, __ATOMIC_RELAXED);
+	}
+}
+
+static void read_fd(int fd)
+{
+	uint64_t cmd;
+
+	if (read(fd, &cmd, sizeof(uint64_t)) != sizeof(uint64_t))
+		fprintf(stderr, "read failed: %m\n");
+}
+
+/* the server copies the io between the links like the client-node does */
+static void on_server_event(void *data, int fd, enum spa_io mask)
+{
+	struct data *d = data;
+	struct client *p = &d->clients[SIDE_PRODUCER], *c = &d->clients[SIDE_CONSUMER];
+	uint32_t flags;
+
+	read_fd(fd);
+
+	pw_client_node_activation_wakeup(&p->activation, PW_CLIENT_NODE_ACTIVATION_SERVER);
+	pw_client_node_activation_wakeup(&c->activation, PW_CLIENT_NODE_ACTIVATION_SERVER);
+	do {
+		flags = pw_client_node_activation_poll(&p->activation, PW_CLIENT_NODE_ACTIVATION_SERVER);
+		if (flags & (1 << PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT)) {
+			c->input = p->output;
+			wakeup(d, &c->activation, c->fd, PW_CLIENT_NODE_ACTIVATION_CLIENT,
+					PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT);
+		}
+		flags |= pw_client_node_activation_poll(&c->activation, PW_CLIENT_NODE_ACTIVATION_SERVER);
+		if (flags & (1 << PW_CLIENT_NODE_MESSAGE_NEED_INPUT)) {
+			p->output = c->input;
+			wakeup(d, &p->activation, p->fd, PW_CLIENT_NODE_ACTIVATION_CLIENT,
+					PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT);
+		}
+	} while (flags != 0);
+}
+
+static void on_consumer_event(void *data, int fd, enum spa_io mask)
+{
+	struct data *d = data;
+	struct client *p = &d->clients[SIDE_PRODUCER], *c = &d->clients[SIDE_CONSUMER];
+	uint32_t flags;
+
+	read_fd(fd);
+
+	pw_client_node_activation_wakeup(&c->activation, PW_CLIENT_NODE_ACTIVATION_CLIENT);
+	do {
+		flags = pw_client_node_activation_poll(&c->activation, PW_CLIENT_NODE_ACTIVATION_CLIENT);
+		if (!(flags & (1 << PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT)))
+			continue;
+
+		if (c->input.status != SPA_STATUS_HAVE_BUFFER)
+			__atomic_add_fetch(&d->n_errors, 1, __ATOMIC_RELAXED);
+
+		/* consume and give the buffer back */
+		c->input.status = SPA_STATUS_NEED_BUFFER;
+
+		if (d->direct) {
+			p->output = c->input;
+			wakeup(d, &p->activation, p->fd, PW_CLIENT_NODE_ACTIVATION_CLIENT,
+					PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT);
+		} else {
+			wakeup(d, &c->activation, d->server_fd, PW_CLIENT_NODE_ACTIVATION_SERVER,
+					PW_CLIENT_NODE_MESSAGE_NEED_INPUT);
+		}
+	} while (flags != 0);
+}
+
+static void on_producer_event(void *data, int fd, enum spa_io mask)
+{
+	struct data *d = data;
+	struct client *p = &d->clients[SIDE_PRODUCER];
+	uint32_t flags;
+
+	read_fd(fd);
+
+	pw_client_node_activation_wakeup(&p->activation, PW_CLIENT_NODE_ACTIVATION_CLIENT);
+	do {
+		flags = pw_client_node_activation_poll(&p->activation, PW_CLIENT_NODE_ACTIVATION_CLIENT);
+		if (!(flags & (1 << PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT)))
+			continue;
+
+		if (p->output.status != SPA_STATUS_NEED_BUFFER ||
+		    p->output.buffer_id != d->buffer_id)
+			__atomic_add_fetch(&d->n_errors, 1, __ATOMIC_RELAXED);
+
+		d->done = true;
+	} while (flags != 0);
+}
+
+static void run_loop(struct data *d, struct pw_loop *loop)
+{
+	pw_loop_enter(loop);
+	while (__atomic_load_n(&d->running, __ATOMIC_ACQUIRE))
+		pw_loop_iterate(loop, -1);
+	pw_loop_leave(loop);
+}
+
+static void *server_thread(void *data)
+{
+	struct data *d = data;
+	run_loop(d, d->server_loop);
+	return NULL;
+}
+
+static void *consumer_thread(void *data)
+{
+	struct data *d = data;
+	run_loop(d, d->clients[SIDE_CONSUMER].loop);
+	return NULL;
+}
+
+static void cycle(struct data *d, uint32_t i)
+{
+	struct client *p = &d->clients[SIDE_PRODUCER], *c = &d->clients[SIDE_CONSUMER];
+
+	d->done = false;
+	d->buffer_id = i % N_BUFFERS;
+	p->output.buffer_id = d->buffer_id;
+	p->output.status = SPA_STATUS_HAVE_BUFFER;
+
+	if (d->direct) {
+		c->input = p->output;
+		wakeup(d, &c->activation, c->fd, PW_CLIENT_NODE_ACTIVATION_CLIENT,
+				PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT);
+	} else {
+		wakeup(d, &p->activation, d->server_fd, PW_CLIENT_NODE_ACTIVATION_SERVER,
+				PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT);
+	}
+	while (!d->done)
+		pw_loop_iterate(p->loop, -1);
+}
+
+static void run_test(struct data *d, bool direct)
+{
+	uint64_t start, stop;
+	uint32_t i;
+
+	d->direct = direct;
+	d->n_wakeups = 0;
+	d->n_errors = 0;
+	spa_zero(d->clients[SIDE_PRODUCER].activation);
+	spa_zero(d->clients[SIDE_CONSUMER].activation);
+
+	start = pw_client_node_activation_get_time();
+	for (i = 0; i < N_CYCLES; i++)
+		cycle(d, i);
+	stop = pw_client_node_activation_get_time();
+
+	printf("%-8s: %8.2f us per cycle, %5.2f wakeups per cycle, %u errors\n",
+			direct ? "direct" : "server",
+			(double)(stop - start) / N_CYCLES / SPA_NSEC_PER_USEC,
+			(double)d->n_wakeups / N_CYCLES, d->n_errors);
+}
+
+static void stop_loop(struct pw_loop *loop, int fd, pthread_t thread)
+{
+	uint64_t cmd = 1;
+
+	if (write(fd, &cmd, 8) != 8)
+		fprintf(stderr, "write failed: %m\n");
+	pthread_join(thread, NULL);
+	pw_loop_destroy(loop);
+	close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { 0, };
+	struct client *p = &data.clients[SIDE_PRODUCER], *c = &data.clients[SIDE_CONSUMER];
+	int res = 0;
+
+	pw_init(&argc, &argv);
+
+	data.running = true;
+
+	data.server_loop = pw_loop_new(NULL);
+	data.server_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	pw_loop_add_io(data.server_loop, data.server_fd, SPA_IO_IN, false, on_server_event, &data);
+
+	p->loop = pw_loop_new(NULL);
+	p->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	pw_loop_add_io(p->loop, p->fd, SPA_IO_IN, false, on_producer_event, &data);
+
+	c->loop = pw_loop_new(NULL);
+	c->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	pw_loop_add_io(c->loop, c->fd, SPA_IO_IN, false, on_consumer_event, &data);
+
+	pthread_create(&data.server_thread, NULL, server_thread, &data);
+	pthread_create(&c->thread, NULL, consumer_thread, &data);
+
+	pw_loop_enter(p->loop);
+	run_test(&data, false);
+	if (data.n_errors > 0)
+		res = -1;
+	run_test(&data, true);
+	if (data.n_errors > 0)
+		res = -1;
+	pw_loop_leave(p->loop);
+
+	__atomic_store_n(&data.running, false, __ATOMIC_RELEASE);
+	stop_loop(data.server_loop, data.server_fd, data.server_thread);
+	stop_loop(c->loop, c->fd, c->thread);
+	pw_loop_destroy(p->loop);
+	close(p->fd);
+
+	return res;
+}
@@ -0,0 +1,194 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Round trip latency between a server and a client node.
+ *
+ * The server signals PROCESS_INPUT to the client and waits for NEED_INPUT
+ * back, both threads sleep in a pw_loop like the daemon and the clients do.
+ * This compares always waking up the peer with an eventfd (like the
+ * transport messages) against the activation record.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include <pipewire/pipewire.h>
+#include <extensions/client-node.h>
+
+#define N_CYCLES	20000
+
+enum mode {
+	MODE_EVENTFD,
+	MODE_ACTIVATION,
+};
+
+static const char *mode_names[] = { "eventfd", "activation" };
+
+struct data {
+	enum mode mode;
+	struct pw_client_node_activation activation;
+
+	struct pw_loop *server_loop;
+	struct pw_loop *client_loop;
+	int server_fd;
+	int client_fd;
+
+	pthread_t thread;
+	bool running;
+
+	bool done;
+	uint32_t n_wakeups;
+};
+
+static void wakeup(struct data *d, int fd, int peer, enum pw_client_node_message_type message)
+{
+	uint64_t cmd = 1;
+
+	if (pw_client_node_activation_signal(&d->activation, peer, message) ||
+	    d->mode == MODE_EVENTFD) {
+		if (write(fd, &cmd, 8) != 8)
+			fprintf(stderr, "write failed: %m\n");
+		__atomic_add_fetch(&d->n_wakeups, 1, __ATOMIC_RELAXED);
+	}
+}
+
+static void read_fd(int fd)
+{
+	uint64_t cmd;
+
+	if (read(fd, &cmd, sizeof(uint64_t)) != sizeof(uint64_t))
+		fprintf(stderr, "read failed: %m\n");
+}
+
+static void process_server(struct data *d)
+{
+	struct pw_client_node_activation *a = &d->activation;
+	uint32_t flags;
+
+	pw_client_node_activation_wakeup(a, PW_CLIENT_NODE_ACTIVATION_SERVER);
+	do {
+		flags = pw_client_node_activation_poll(a, PW_CLIENT_NODE_ACTIVATION_SERVER);
+		if (flags & (1 << PW_CLIENT_NODE_MESSAGE_NEED_INPUT))
+			d->done = true;
+	} while (flags != 0);
+}
+
+static void on_server_event(void *data, int fd, enum spa_io mask)
+{
+	read_fd(fd);
+	process_server(data);
+}
+
+static void on_client_event(void *data, int fd, enum spa_io mask)
+{
+	struct data *d = data;
+	struct pw_client_node_activation *a = &d->activation;
+	uint32_t flags;
+
+	read_fd(fd);
+
+	pw_client_node_activation_wakeup(a, PW_CLIENT_NODE_ACTIVATION_CLIENT);
+	do {
+		flags = pw_client_node_activation_poll(a, PW_CLIENT_NODE_ACTIVATION_CLIENT);
+		if (flags & (1 << PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT))
+			wakeup(d, d->server_fd, PW_CLIENT_NODE_ACTIVATION_SERVER,
+					PW_CLIENT_NODE_MESSAGE_NEED_INPUT);
+	} while (flags != 0);
+}
+
+static void *client_thread(void *data)
+{
+	struct data *d = data;
+
+	pw_loop_enter(d->client_loop);
+	while (__atomic_load_n(&d->running, __ATOMIC_ACQUIRE))
+		pw_loop_iterate(d->client_loop, -1);
+	pw_loop_leave(d->client_loop);
+
+	return NULL;
+}
+
+static void cycle(struct data *d)
+{
+	d->done = false;
+	wakeup(d, d->client_fd, PW_CLIENT_NODE_ACTIVATION_CLIENT,
+			PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT);
+
+	while (!d->done)
+		pw_loop_iterate(d->server_loop, -1);
+}
+
+static void run_test(struct data *d, enum mode mode)
+{
+	uint64_t start, stop;
+	uint32_t i;
+
+	d->mode = mode;
+	d->n_wakeups = 0;
+	spa_zero(d->activation);
+
+	start = pw_client_node_activation_get_time();
+	for (i = 0; i < N_CYCLES; i++)
+		cycle(d);
+	stop = pw_client_node_activation_get_time();
+
+	printf("%-16s: %8.2f us round trip, %5.2f wakeups per cycle\n", mode_names[mode],
+			(double)(stop - start) / N_CYCLES / SPA_NSEC_PER_USEC,
+			(double)d->n_wakeups / N_CYCLES);
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { 0, };
+	uint64_t cmd = 1;
+
+	pw_init(&argc, &argv);
+
+	data.server_loop = pw_loop_new(NULL);
+	data.client_loop = pw_loop_new(NULL);
+	data.server_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	data.client_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	pw_loop_add_io(data.server_loop, data.server_fd, SPA_IO_IN, false, on_server_event, &data);
+	pw_loop_add_io(data.client_loop, data.client_fd, SPA_IO_IN, false, on_client_event, &data);
+
+	data.running = true;
+	pthread_create(&data.thread, NULL, client_thread, &data);
+
+	pw_loop_enter(data.server_loop);
+	run_test(&data, MODE_EVENTFD);
+	run_test(&data, MODE_ACTIVATION);
+	pw_loop_leave(data.server_loop);
+
+	__atomic_store_n(&data.running, false, __ATOMIC_RELEASE);
+	if (write(data.client_fd, &cmd, 8) != 8)
+		fprintf(stderr, "write failed: %m\n");
+	pthread_join(data.thread, NULL);
+
+	pw_loop_destroy(data.client_loop);
+	pw_loop_destroy(data.server_loop);
+	close(data.server_fd);
+	close(data.client_fd);
+
+	return 0;
+}
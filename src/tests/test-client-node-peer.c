@@ -0,0 +1,537 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* A direct link between two client nodes.
+ *
+ * A child process runs a server with the native protocol, the client-node
+ * and the link-factory modules. Two streams connect to it and get linked
+ * by the link-factory. The server should then hand each of them the
+ * transport and the eventfd of the other with port_set_peer. The producer
+ * numbers its buffers and the consumer checks that they arrive in order.
+ * When the consumer disconnects, the producer should get its peer cleared
+ * again.
+ *
+ * The modules are loaded from PIPEWIRE_MODULE_DIR when it is set.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <spa/param/audio/format-utils.h>
+#include <spa/param/buffers.h>
+
+#include <pipewire/pipewire.h>
+#include <extensions/client-node.h>
+#include "pipewire/private.h"
+
+#define N_SAMPLES	256
+#define N_CHECK		64
+#define TIMEOUT_SEC	10
+
+struct type {
+	struct spa_type_media_type media_type;
+	struct spa_type_media_subtype media_subtype;
+	struct spa_type_format_audio format_audio;
+	struct spa_type_audio_format audio_format;
+};
+
+static inline void init_type(struct type *type, struct spa_type_map *map)
+{
+	spa_type_media_type_map(map, &type->media_type);
+	spa_type_media_subtype_map(map, &type->media_subtype);
+	spa_type_format_audio_map(map, &type->format_audio);
+	spa_type_audio_format_map(map, &type->audio_format);
+}
+
+struct data;
+
+/* what the server told one client node about its peer */
+struct peer {
+	struct data *data;
+	struct spa_hook listener;
+	uint32_t n_set;
+	uint32_t n_cleared;
+	bool bad_peer;
+};
+
+struct data {
+	struct type type;
+	struct pw_main_loop *loop;
+	struct pw_core *core;
+	struct pw_type *t;
+	struct pw_remote *remote;
+	struct spa_hook remote_listener;
+	struct spa_source *timer;
+	struct spa_source *timeout;
+
+	struct pw_stream *producer;
+	struct spa_hook producer_listener;
+	struct pw_stream *consumer;
+	struct spa_hook consumer_listener;
+	struct pw_proxy *link;
+
+	struct peer peers[2];		/**< indexed by direction */
+
+	uint32_t seq;
+	uint32_t last_seq;
+	uint32_t n_received;
+	uint32_t n_errors;
+	bool disconnected;
+	bool failed;
+};
+
+static const char *direction_name(enum spa_direction direction)
+{
+	return direction == SPA_DIRECTION_INPUT ? "input" : "output";
+}
+
+static void stop(struct data *data, bool failed)
+{
+	data->failed |= failed;
+	pw_main_loop_quit(data->loop);
+}
+
+static void client_node_port_set_peer(void *_data,
+				      enum spa_direction direction,
+				      uint32_t port_id,
+				      uint32_t peer_port_id,
+				      int signalfd,
+				      struct pw_client_node_transport *transport)
+{
+	struct data *data = _data;
+	struct peer *p = &data->peers[direction];
+
+	printf("%s port %u: peer %s %u fd %d\n", direction_name(direction), port_id,
+	       transport ? "set to" : "cleared", peer_port_id, signalfd);
+
+	if (transport == NULL) {
+		p->n_cleared++;
+		if (signalfd != -1)
+			p->bad_peer = true;
+		if (data->disconnected && direction == SPA_DIRECTION_OUTPUT)
+			stop(data, false);
+		return;
+	}
+	p->n_set++;
+
+	/* the peer transport is the shared memory of the other client node */
+	if (signalfd < 0 || transport->activation == NULL ||
+	    peer_port_id >= (direction == SPA_DIRECTION_OUTPUT ?
+			     transport->area->max_input_ports :
+			     transport->area->max_output_ports))
+		p->bad_peer = true;
+}
+
+static const struct pw_client_node_proxy_events client_node_events = {
+	PW_VERSION_CLIENT_NODE_PROXY_EVENTS,
+	.port_set_peer = client_node_port_set_peer,
+};
+
+/* run before the stream listener, the stream closes a peer it does not use */
+static void watch_client_nodes(struct data *data)
+{
+	struct pw_proxy *proxy;
+	int i = 0;
+
+	spa_list_for_each(proxy, &data->remote->proxy_list, link) {
+		if (strcmp(pw_proxy_get_marshal(proxy)->type, PW_TYPE_INTERFACE__ClientNode) != 0)
+			continue;
+		spa_hook_list_prepend(pw_proxy_get_proxy_listeners(proxy),
+				      &data->peers[i++].listener, &client_node_events, data);
+	}
+}
+
+static void on_timer(void *_data, uint64_t expirations)
+{
+	struct data *data = _data;
+	struct pw_buffer *buf;
+	struct spa_buffer *b;
+	float *p;
+	int i;
+
+	if ((buf = pw_stream_dequeue_buffer(data->producer)) == NULL)
+		return;
+
+	b = buf->buffer;
+	if ((p = b->datas[0].data) != NULL) {
+		data->seq++;
+		for (i = 0; i < N_SAMPLES; i++)
+			p[i] = data->seq;
+		b->datas[0].chunk->offset = 0;
+		b->datas[0].chunk->size = N_SAMPLES * sizeof(float);
+		b->datas[0].chunk->stride = sizeof(float);
+	}
+	pw_stream_queue_buffer(data->producer, buf);
+}
+
+static void on_timeout(void *_data, uint64_t expirations)
+{
+	struct data *data = _data;
+
+	printf("timeout: received %u buffers, peers set %u %u cleared %u\n",
+	       data->n_received,
+	       data->peers[SPA_DIRECTION_OUTPUT].n_set,
+	       data->peers[SPA_DIRECTION_INPUT].n_set,
+	       data->peers[SPA_DIRECTION_OUTPUT].n_cleared);
+	stop(data, true);
+}
+
+static void link_streams(struct data *data)
+{
+	char out_id[16], in_id[16];
+	struct spa_dict_item items[] = {
+		SPA_DICT_ITEM_INIT(PW_LINK_OUTPUT_NODE_ID, out_id),
+		SPA_DICT_ITEM_INIT(PW_LINK_INPUT_NODE_ID, in_id),
+	};
+
+	snprintf(out_id, sizeof(out_id), "%u", pw_stream_get_node_id(data->producer));
+	snprintf(in_id, sizeof(in_id), "%u", pw_stream_get_node_id(data->consumer));
+
+	printf("link node %s to node %s\n", out_id, in_id);
+
+	data->link = pw_core_proxy_create_object(pw_remote_get_core_proxy(data->remote),
+						 "link-factory",
+						 data->t->link,
+						 PW_VERSION_LINK,
+						 &SPA_DICT_INIT(items, SPA_N_ELEMENTS(items)), 0);
+}
+
+/* link the streams when the server knows the ports of both of them */
+static void maybe_link(struct data *data)
+{
+	if (data->link == NULL &&
+	    pw_stream_get_state(data->producer, NULL) == PW_STREAM_STATE_CONFIGURE &&
+	    pw_stream_get_state(data->consumer, NULL) == PW_STREAM_STATE_CONFIGURE)
+		link_streams(data);
+}
+
+static void on_producer_state_changed(void *_data, enum pw_stream_state old,
+				      enum pw_stream_state state, const char *error)
+{
+	struct data *data = _data;
+	struct timespec value = { 0, 1 }, interval = { 0, SPA_NSEC_PER_MSEC };
+
+	printf("producer: %s\n", pw_stream_state_as_string(state));
+
+	if (state == PW_STREAM_STATE_ERROR)
+		stop(data, true);
+	else if (state == PW_STREAM_STATE_CONFIGURE)
+		maybe_link(data);
+	else if (state == PW_STREAM_STATE_STREAMING)
+		pw_loop_update_timer(pw_main_loop_get_loop(data->loop),
+				     data->timer, &value, &interval, false);
+}
+
+static void on_consumer_state_changed(void *_data, enum pw_stream_state old,
+				      enum pw_stream_state state, const char *error)
+{
+	struct data *data = _data;
+
+	printf("consumer: %s\n", pw_stream_state_as_string(state));
+
+	if (state == PW_STREAM_STATE_ERROR)
+		stop(data, true);
+	else if (state == PW_STREAM_STATE_CONFIGURE)
+		maybe_link(data);
+}
+
+static void on_format_changed(struct data *data, struct pw_stream *stream,
+			      const struct spa_pod *format)
+{
+	struct pw_type *t = data->t;
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	const struct spa_pod *params[1];
+
+	if (format == NULL) {
+		pw_stream_finish_format(stream, 0, NULL, 0);
+		return;
+	}
+
+	params[0] = spa_pod_builder_object(&b,
+		t->param.idBuffers, t->param_buffers.Buffers,
+		":", t->param_buffers.size,    "i", N_SAMPLES * sizeof(float),
+		":", t->param_buffers.stride,  "i", sizeof(float),
+		":", t->param_buffers.buffers, "iru", 4,
+			SPA_POD_PROP_MIN_MAX(2, 16),
+		":", t->param_buffers.align,   "i", 16);
+
+	pw_stream_finish_format(stream, 0, params, 1);
+}
+
+static void on_producer_format_changed(void *_data, const struct spa_pod *format)
+{
+	struct data *data = _data;
+	on_format_changed(data, data->producer, format);
+}
+
+static void on_consumer_format_changed(void *_data, const struct spa_pod *format)
+{
+	struct data *data = _data;
+	on_format_changed(data, data->consumer, format);
+}
+
+static void on_consumer_process(void *_data)
+{
+	struct data *data = _data;
+	struct pw_buffer *buf;
+	struct spa_buffer *b;
+	float *p;
+	uint32_t i, seq;
+
+	while ((buf = pw_stream_dequeue_buffer(data->consumer)) != NULL) {
+		b = buf->buffer;
+		p = b->datas[0].data;
+
+		if (p == NULL || b->datas[0].chunk->size != N_SAMPLES * sizeof(float)) {
+			data->n_errors++;
+			goto done;
+		}
+		seq = p[0];
+		for (i = 1; i < N_SAMPLES; i++)
+			if (p[i] != seq)
+				break;
+		if (i < N_SAMPLES || seq <= data->last_seq) {
+			printf("buffer %u after %u is wrong\n", seq, data->last_seq);
+			data->n_errors++;
+		}
+		data->last_seq = seq;
+		data->n_received++;
+
+	      done:
+		pw_stream_queue_buffer(data->consumer, buf);
+	}
+
+	if (data->n_received == N_CHECK && !data->disconnected) {
+		data->disconnected = true;
+		printf("received %u buffers, disconnect\n", data->n_received);
+		pw_stream_disconnect(data->consumer);
+	}
+}
+
+static const struct pw_stream_events producer_events = {
+	PW_VERSION_STREAM_EVENTS,
+	.state_changed = on_producer_state_changed,
+	.format_changed = on_producer_format_changed,
+};
+
+static const struct pw_stream_events consumer_events = {
+	PW_VERSION_STREAM_EVENTS,
+	.state_changed = on_consumer_state_changed,
+	.format_changed = on_consumer_format_changed,
+	.process = on_consumer_process,
+};
+
+static struct pw_stream *connect_stream(struct data *data, const char *name,
+					enum pw_direction direction, enum pw_stream_flags flags,
+					struct spa_hook *listener,
+					const struct pw_stream_events *events)
+{
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	const struct spa_pod *params[1];
+	struct pw_stream *stream;
+
+	stream = pw_stream_new(data->remote, name,
+			pw_properties_new("pipewire.client.direct", "1", NULL));
+	pw_stream_add_listener(stream, listener, events, data);
+
+	params[0] = spa_pod_builder_object(&b,
+		data->t->param.idEnumFormat, data->t->spa_format,
+		"I", data->type.media_type.audio,
+		"I", data->type.media_subtype.raw,
+		":", data->type.format_audio.format,   "I", data->type.audio_format.F32,
+		":", data->type.format_audio.layout,   "i", SPA_AUDIO_LAYOUT_INTERLEAVED,
+		":", data->type.format_audio.rate,     "i", 48000,
+		":", data->type.format_audio.channels, "i", 1);
+
+	pw_stream_connect(stream, direction, NULL,
+			  flags | PW_STREAM_FLAG_MAP_BUFFERS, params, 1);
+	return stream;
+}
+
+static void on_remote_state_changed(void *_data, enum pw_remote_state old,
+				    enum pw_remote_state state, const char *error)
+{
+	struct data *data = _data;
+
+	switch (state) {
+	case PW_REMOTE_STATE_ERROR:
+		printf("remote error: %s\n", error);
+		stop(data, true);
+		break;
+
+	case PW_REMOTE_STATE_CONNECTED:
+		data->producer = connect_stream(data, "producer", PW_DIRECTION_OUTPUT,
+						PW_STREAM_FLAG_DRIVER,
+						&data->producer_listener, &producer_events);
+		data->consumer = connect_stream(data, "consumer", PW_DIRECTION_INPUT,
+						PW_STREAM_FLAG_NONE,
+						&data->consumer_listener, &consumer_events);
+		watch_client_nodes(data);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static const struct pw_remote_events remote_events = {
+	PW_VERSION_REMOTE_EVENTS,
+	.state_changed = on_remote_state_changed,
+};
+
+static void do_quit(void *data, int signal_number)
+{
+	pw_main_loop_quit(data);
+}
+
+static int run_server(const char *name, int ready_fd)
+{
+	struct pw_main_loop *loop;
+	struct pw_core *core;
+	const char *modules[] = {
+		"libpipewire-module-protocol-native",
+		"libpipewire-module-client-node",
+		"libpipewire-module-link-factory",
+	};
+	uint32_t i;
+	char c = 1;
+
+	loop = pw_main_loop_new(NULL);
+	pw_loop_add_signal(pw_main_loop_get_loop(loop), SIGTERM, do_quit, loop);
+
+	core = pw_core_new(pw_main_loop_get_loop(loop),
+			   pw_properties_new(PW_CORE_PROP_DAEMON, "1",
+					     PW_CORE_PROP_NAME, name, NULL));
+
+	for (i = 0; i < SPA_N_ELEMENTS(modules); i++) {
+		if (pw_module_load(core, modules[i], NULL, NULL, NULL, NULL) == NULL) {
+			printf("can't load %s\n", modules[i]);
+			return 1;
+		}
+	}
+	write(ready_fd, &c, 1);
+	close(ready_fd);
+
+	pw_main_loop_run(loop);
+
+	pw_core_destroy(core);
+	pw_main_loop_destroy(loop);
+	return 0;
+}
+
+static int run_client(void)
+{
+	struct data data = { 0, };
+	struct pw_loop *l;
+	struct timespec timeout = { TIMEOUT_SEC, 0 };
+	int i;
+
+	data.loop = pw_main_loop_new(NULL);
+	l = pw_main_loop_get_loop(data.loop);
+	data.core = pw_core_new(l, NULL);
+	data.t = pw_core_get_type(data.core);
+	init_type(&data.type, data.t->map);
+	for (i = 0; i < 2; i++)
+		data.peers[i].data = &data;
+
+	data.timer = pw_loop_add_timer(l, on_timer, &data);
+	data.timeout = pw_loop_add_timer(l, on_timeout, &data);
+	pw_loop_update_timer(l, data.timeout, &timeout, NULL, false);
+
+	data.remote = pw_remote_new(data.core, NULL, 0);
+	pw_remote_add_listener(data.remote, &data.remote_listener, &remote_events, &data);
+	pw_remote_connect(data.remote);
+
+	pw_main_loop_run(data.loop);
+
+	for (i = 0; i < 2; i++) {
+		if (data.peers[i].bad_peer) {
+			printf("%s peer is not usable\n", direction_name(i));
+			data.failed = true;
+		}
+	}
+	if (data.peers[SPA_DIRECTION_OUTPUT].n_set == 0 ||
+	    data.peers[SPA_DIRECTION_INPUT].n_set == 0 ||
+	    data.peers[SPA_DIRECTION_OUTPUT].n_cleared == 0 ||
+	    data.n_received < N_CHECK || data.n_errors > 0)
+		data.failed = true;
+
+	printf("peers set %u %u, output peer cleared %u, %u errors\n",
+	       data.peers[SPA_DIRECTION_OUTPUT].n_set,
+	       data.peers[SPA_DIRECTION_INPUT].n_set,
+	       data.peers[SPA_DIRECTION_OUTPUT].n_cleared, data.n_errors);
+
+	if (data.producer)
+		pw_stream_destroy(data.producer);
+	if (data.consumer)
+		pw_stream_destroy(data.consumer);
+	pw_remote_destroy(data.remote);
+	pw_core_destroy(data.core);
+	pw_main_loop_destroy(data.loop);
+
+	return data.failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char dir[] = "/tmp/test-client-node-peer-XXXXXX";
+	char name[64];
+	int fds[2], status, res;
+	pid_t pid;
+	char c;
+
+	pw_init(&argc, &argv);
+
+	if (mkdtemp(dir) == NULL || pipe(fds) < 0) {
+		perror("setup");
+		return 1;
+	}
+	snprintf(name, sizeof(name), "pipewire-test-%d", getpid());
+	setenv("XDG_RUNTIME_DIR", dir, 1);
+	setenv("PIPEWIRE_REMOTE", name, 1);
+
+	if ((pid = fork()) == 0) {
+		close(fds[0]);
+		exit(run_server(name, fds[1]));
+	}
+	close(fds[1]);
+
+	if (pid < 0 || read(fds[0], &c, 1) != 1) {
+		printf("server did not start\n");
+		res = 1;
+	}
+	else
+		res = run_client();
+	close(fds[0]);
+
+	if (pid > 0) {
+		kill(pid, SIGTERM);
+		waitpid(pid, &status, 0);
+	}
+	rmdir(dir);
+
+	printf("%s\n", res == 0 ? "OK" : "FAILED");
+	return res;
+}
@@ -0,0 +1,119 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* A client keeps a copy of the node info with the updates that only
+ * contain the changed properties, like a monitor does. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/introspect.h>
+#include <pipewire/properties.h>
+
+#define N_UPDATES	100000
+
+static const char *keys[] = {
+	"media.class", "media.name", "media.role", "node.name", "node.description",
+	"node.latency", "device.api", "device.name", "application.name",
+	"application.process.id", "volume", "mute",
+};
+
+static const char *values[] = {
+	"0.5", "1.0", "true", "false", "Audio/Sink", "256/48000", NULL,
+};
+
+static int compare(const struct pw_properties *props, const struct spa_dict *dict)
+{
+	const struct spa_dict_item *item;
+	uint32_t n_items = dict ? dict->n_items : 0;
+
+	if (props->dict.n_items != n_items)
+		return -1;
+	if (dict == NULL)
+		return 0;
+
+	spa_dict_for_each(item, dict) {
+		const char *value = pw_properties_get(props, item->key);
+		if (value == NULL || item->value == NULL || strcmp(value, item->value) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct pw_properties *props;
+	struct pw_node_info *info = NULL, update;
+	struct spa_dict_item items[2], changed_items[2];
+	struct spa_dict dict, changed;
+	uint32_t i, n_keys = SPA_N_ELEMENTS(keys), n_values = SPA_N_ELEMENTS(values);
+	uint64_t n_sent = 0, n_full = 0;
+	int res = 0;
+
+	pw_init(&argc, &argv);
+
+	props = pw_properties_new("node.name", "test", "media.class", "Audio/Sink", NULL);
+
+	/* the first info has all properties */
+	spa_zero(update);
+	update.change_mask = ~0;
+	update.name = "test";
+	update.props = &props->dict;
+	info = pw_node_info_update(info, &update);
+
+	for (i = 0; i < N_UPDATES && res == 0; i++) {
+		items[0] = SPA_DICT_ITEM_INIT(keys[rand() % n_keys], values[rand() % n_values]);
+		items[1] = SPA_DICT_ITEM_INIT(keys[rand() % n_keys], values[rand() % n_values]);
+		dict = SPA_DICT_INIT(items, 1 + rand() % 2);
+
+		changed = SPA_DICT_INIT(changed_items,
+				pw_properties_update(props, &dict, changed_items));
+
+		spa_zero(update);
+		if (changed.n_items > 0) {
+			update.change_mask = PW_NODE_CHANGE_MASK_PROPS;
+			update.props = &changed;
+			n_sent += changed.n_items;
+			n_full += props->dict.n_items;
+		}
+		else {
+			/* a state change does not touch the properties */
+			update.change_mask = PW_NODE_CHANGE_MASK_STATE;
+			update.state = PW_NODE_STATE_RUNNING;
+		}
+		info = pw_node_info_update(info, &update);
+
+		if (compare(props, info->props) < 0) {
+			printf("mismatch after %u updates\n", i);
+			res = -1;
+		}
+	}
+	if (info->state != PW_NODE_STATE_RUNNING || strcmp(info->name, "test") != 0)
+		res = -1;
+
+	printf("%u updates: sent %"PRIu64" changed properties, %"PRIu64" with full updates\n",
+			i, n_sent, n_full);
+
+	pw_node_info_free(info);
+	pw_properties_free(props);
+
+	return res < 0 ? 1 : 0;
+}
@@ -0,0 +1,522 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Links between nodes in the same process: the buffers they get, the
+ * mixing of the links of an input port and the buffers that a node
+ * forwards in place. */
+
+#include <errno.h>
+#include <stdio.h>
+
+#include <spa/param/audio/format-utils.h>
+#include <spa/param/buffers.h>
+#include <spa/pod/filter.h>
+
+#include <pipewire/pipewire.h>
+#include "pipewire/private.h"
+
+#define N_SAMPLES	256
+#define N_BUFFERS	2
+
+struct test_port {
+	struct spa_port_info info;
+	bool have_format;
+	struct spa_io_buffers *io;
+	struct spa_buffer **buffers;
+	uint32_t n_buffers;
+	uint32_t n_reused;
+};
+
+struct test_node {
+	struct spa_node node;
+	struct pw_type *t;
+	struct pw_audio_type *a;
+	struct test_port ports[2];	/**< indexed by direction */
+	bool has_port[2];
+};
+
+static int n_failed;
+
+#define GET_PORT(n,d,p)	((p) == 0 && (n)->has_port[d] ? &(n)->ports[d] : NULL)
+
+static int node_send_command(struct spa_node *node, const struct spa_command *command)
+{
+	return 0;
+}
+
+static int node_set_callbacks(struct spa_node *node,
+			      const struct spa_node_callbacks *callbacks, void *data)
+{
+	return 0;
+}
+
+static int node_get_n_ports(struct spa_node *node,
+			    uint32_t *n_input_ports, uint32_t *max_input_ports,
+			    uint32_t *n_output_ports, uint32_t *max_output_ports)
+{
+	struct test_node *n = SPA_CONTAINER_OF(node, struct test_node, node);
+
+	*n_input_ports = *max_input_ports = n->has_port[SPA_DIRECTION_INPUT] ? 1 : 0;
+	*n_output_ports = *max_output_ports = n->has_port[SPA_DIRECTION_OUTPUT] ? 1 : 0;
+	return 0;
+}
+
+static int node_get_port_ids(struct spa_node *node,
+			     uint32_t *input_ids, uint32_t n_input_ids,
+			     uint32_t *output_ids, uint32_t n_output_ids)
+{
+	if (n_input_ids > 0)
+		input_ids[0] = 0;
+	if (n_output_ids > 0)
+		output_ids[0] = 0;
+	return 0;
+}
+
+static int node_port_get_info(struct spa_node *node,
+			      enum spa_direction direction, uint32_t port_id,
+			      const struct spa_port_info **info)
+{
+	struct test_node *n = SPA_CONTAINER_OF(node, struct test_node, node);
+	struct test_port *p = GET_PORT(n, direction, port_id);
+
+	if (p == NULL)
+		return -EINVAL;
+
+	*info = &p->info;
+	return 0;
+}
+
+static int node_port_enum_params(struct spa_node *node,
+				 enum spa_direction direction, uint32_t port_id,
+				 uint32_t id, uint32_t *index,
+				 const struct spa_pod *filter,
+				 struct spa_pod **result,
+				 struct spa_pod_builder *builder)
+{
+	struct test_node *n = SPA_CONTAINER_OF(node, struct test_node, node);
+	struct test_port *p = GET_PORT(n, direction, port_id);
+	struct pw_type *t = n->t;
+	struct pw_audio_type *a = n->a;
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	struct spa_pod *param;
+
+	if (p == NULL)
+		return -EINVAL;
+
+	if (*index > 0)
+		return 0;
+
+	if (id == t->param.idEnumFormat || id == t->param.idFormat) {
+		if (id == t->param.idFormat && !p->have_format)
+			return 0;
+		param = spa_pod_builder_object(&b,
+			id, t->spa_format,
+			"I", a->media_type.audio,
+			"I", a->media_subtype.raw,
+			":", a->format_audio.format,   "I", a->audio_format.F32,
+			":", a->format_audio.layout,   "i", SPA_AUDIO_LAYOUT_INTERLEAVED,
+			":", a->format_audio.rate,     "i", 48000,
+			":", a->format_audio.channels, "i", 1);
+	}
+	else if (id == t->param.idBuffers) {
+		param = spa_pod_builder_object(&b,
+			id, t->param_buffers.Buffers,
+			":", t->param_buffers.size,    "i", N_SAMPLES * sizeof(float),
+			":", t->param_buffers.stride,  "i", sizeof(float),
+			":", t->param_buffers.buffers, "i", N_BUFFERS,
+			":", t->param_buffers.align,   "i", 16);
+	}
+	else
+		return 0;
+
+	(*index)++;
+
+	return spa_pod_filter(builder, result, param, filter) < 0 ? 0 : 1;
+}
+
+static int node_port_set_param(struct spa_node *node,
+			       enum spa_direction direction, uint32_t port_id,
+			       uint32_t id, uint32_t flags,
+			       const struct spa_pod *param)
+{
+	struct test_node *n = SPA_CONTAINER_OF(node, struct test_node, node);
+	struct test_port *p = GET_PORT(n, direction, port_id);
+
+	if (p == NULL)
+		return -EINVAL;
+
+	if (id == n->t->param.idFormat) {
+		p->have_format = param != NULL;
+		if (param == NULL)
+			p->n_buffers = 0;
+		return 0;
+	}
+	return -ENOENT;
+}
+
+static int node_port_use_buffers(struct spa_node *node,
+				 enum spa_direction direction, uint32_t port_id,
+				 struct spa_buffer **buffers, uint32_t n_buffers)
+{
+	struct test_node *n = SPA_CONTAINER_OF(node, struct test_node, node);
+	struct test_port *p = GET_PORT(n, direction, port_id);
+
+	if (p == NULL)
+		return -EINVAL;
+
+	p->buffers = buffers;
+	p->n_buffers = n_buffers;
+	return 0;
+}
+
+static int node_port_set_io(struct spa_node *node,
+			    enum spa_direction direction, uint32_t port_id,
+			    uint32_t id, void *data, size_t size)
+{
+	struct test_node *n = SPA_CONTAINER_OF(node, struct test_node, node);
+	struct test_port *p = GET_PORT(n, direction, port_id);
+
+	if (p == NULL)
+		return -EINVAL;
+
+	if (id == n->t->io.Buffers)
+		p->io = data;
+	return 0;
+}
+
+static int node_port_reuse_buffer(struct spa_node *node, uint32_t port_id, uint32_t buffer_id)
+{
+	struct test_node *n = SPA_CONTAINER_OF(node, struct test_node, node);
+
+	n->ports[SPA_DIRECTION_OUTPUT].n_reused++;
+	return 0;
+}
+
+static int node_process(struct spa_node *node)
+{
+	return SPA_STATUS_OK;
+}
+
+static const struct spa_node node_impl = {
+	SPA_VERSION_NODE,
+	NULL,
+	.send_command = node_send_command,
+	.set_callbacks = node_set_callbacks,
+	.get_n_ports = node_get_n_ports,
+	.get_port_ids = node_get_port_ids,
+	.port_get_info = node_port_get_info,
+	.port_enum_params = node_port_enum_params,
+	.port_set_param = node_port_set_param,
+	.port_use_buffers = node_port_use_buffers,
+	.port_set_io = node_port_set_io,
+	.port_reuse_buffer = node_port_reuse_buffer,
+	.process_input = node_process,
+	.process_output = node_process,
+};
+
+static struct pw_node *make_node(struct pw_core *core, const char *name,
+				 uint32_t input_flags, uint32_t output_flags)
+{
+	struct pw_node *node;
+	struct test_node *n;
+
+	node = pw_node_new(core, name, NULL, sizeof(struct test_node));
+	n = pw_node_get_user_data(node);
+	n->node = node_impl;
+	n->t = pw_core_get_type(core);
+	n->a = &core->audio_type;
+	n->has_port[SPA_DIRECTION_INPUT] = input_flags != 0;
+	n->ports[SPA_DIRECTION_INPUT].info.flags = input_flags;
+	n->has_port[SPA_DIRECTION_OUTPUT] = output_flags != 0;
+	n->ports[SPA_DIRECTION_OUTPUT].info.flags = output_flags;
+	pw_node_set_implementation(node, &n->node);
+	pw_node_register(node, NULL, NULL, NULL);
+	pw_node_set_active(node, true);
+
+	return node;
+}
+
+static struct pw_port *get_port(struct pw_node *node, enum pw_direction direction)
+{
+	return pw_node_find_port(node, direction, 0);
+}
+
+static void iterate(struct pw_main_loop *loop)
+{
+	int i;
+	for (i = 0; i < 20; i++)
+		pw_loop_iterate(pw_main_loop_get_loop(loop), 0);
+}
+
+static struct pw_link *make_link(struct pw_main_loop *loop, struct pw_core *core,
+				 struct pw_node *output, struct pw_node *input)
+{
+	struct pw_link *link;
+	char *error = NULL;
+
+	link = pw_link_new(core, get_port(output, PW_DIRECTION_OUTPUT),
+			   get_port(input, PW_DIRECTION_INPUT), NULL, NULL, &error, 0);
+	if (link == NULL) {
+		printf("FAIL: can't make link: %s\n", error);
+		free(error);
+		n_failed++;
+		return NULL;
+	}
+	pw_link_register(link, NULL, NULL, NULL);
+	iterate(loop);
+
+	return link;
+}
+
+static void check(const char *what, bool ok)
+{
+	printf("%s: %s\n", what, ok ? "ok" : "FAIL");
+	if (!ok)
+		n_failed++;
+}
+
+static bool link_ready(struct pw_link *link)
+{
+	return link != NULL && link->state >= PW_LINK_STATE_PAUSED && link->n_buffers > 0;
+}
+
+/* put a buffer of n_samples samples with value v on the link, like the output
+ * port does before the mixer runs */
+static void fill_link(struct pw_link *link, float v, uint32_t n_samples)
+{
+	struct spa_data *d = link->buffers[0]->datas;
+	float *s = d[0].data;
+	uint32_t i;
+
+	for (i = 0; i < n_samples; i++)
+		s[i] = v;
+	d[0].chunk->offset = 0;
+	d[0].chunk->size = n_samples * sizeof(float);
+	d[0].chunk->stride = sizeof(float);
+
+	link->io.status = SPA_STATUS_HAVE_BUFFER;
+	link->io.buffer_id = 0;
+}
+
+static int
+do_mix(struct spa_loop *loop,
+       bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct pw_port *port = user_data;
+	return spa_node_process_input(&port->mix_node);
+}
+
+/* run the mixer of the input port and check the samples it made */
+static void check_mix(const char *what, struct pw_core *core, struct pw_port *port,
+		      float v1, uint32_t n1, float v2, uint32_t n2)
+{
+	struct spa_data *d;
+	const float *s;
+	uint32_t i, n_samples = SPA_MAX(n1, n2), n_wrong = 0;
+	int res;
+
+	res = pw_loop_invoke(core->data_loop, do_mix, SPA_ID_INVALID, NULL, 0, true, port);
+	if (res != SPA_STATUS_HAVE_BUFFER || port->io.buffer_id >= port->mix_allocation.n_buffers) {
+		printf("%s: FAIL: mixer status %d, buffer %u\n", what, res, port->io.buffer_id);
+		n_failed++;
+		return;
+	}
+
+	d = port->mix_allocation.buffers[port->io.buffer_id]->datas;
+	s = d[0].data;
+
+	for (i = 0; i < n_samples; i++) {
+		float expected = (i < n1 ? v1 : 0.0f) + (i < n2 ? v2 : 0.0f);
+		if (s[i] != expected)
+			n_wrong++;
+	}
+	printf("%s: %u samples, %u wrong, size %u\n", what, n_samples, n_wrong, d[0].chunk->size);
+	if (n_wrong > 0 || d[0].chunk->size != n_samples * sizeof(float))
+		n_failed++;
+
+	/* the consumer gives back the port buffer */
+	spa_node_port_reuse_buffer(&port->mix_node, 0, port->io.buffer_id);
+	port->io.status = SPA_STATUS_NEED_BUFFER;
+	port->io.buffer_id = SPA_ID_INVALID;
+}
+
+static void test_mix(struct pw_main_loop *loop, struct pw_core *core)
+{
+	struct pw_node *src1, *src2, *sink;
+	struct pw_link *l1, *l2;
+	struct pw_port *input;
+	struct test_node *t1, *t2, *ts;
+
+	src1 = make_node(core, "src1", 0, SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS);
+	src2 = make_node(core, "src2", 0, SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS);
+	sink = make_node(core, "sink", SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS, 0);
+	t1 = pw_node_get_user_data(src1);
+	t2 = pw_node_get_user_data(src2);
+	ts = pw_node_get_user_data(sink);
+	input = get_port(sink, PW_DIRECTION_INPUT);
+
+	l1 = make_link(loop, core, src1, sink);
+	check("first link", link_ready(l1) && input->state >= PW_PORT_STATE_PAUSED &&
+	      ts->ports[SPA_DIRECTION_INPUT].buffers == l1->buffers &&
+	      input->mix_allocation.n_buffers == 0);
+
+	/* the input is running with the buffers of the first link */
+	l2 = make_link(loop, core, src2, sink);
+	check("second link to a running input", link_ready(l2) &&
+	      l2->buffers != l1->buffers &&
+	      input->mix_allocation.n_buffers > 0 &&
+	      ts->ports[SPA_DIRECTION_INPUT].buffers == input->mix_allocation.buffers);
+
+	if (!link_ready(l1) || !link_ready(l2) || input->mix_allocation.n_buffers == 0)
+		goto done;
+
+	fill_link(l1, 0.25f, N_SAMPLES);
+	fill_link(l2, 0.5f, N_SAMPLES);
+	check_mix("mix two links", core, input, 0.25f, N_SAMPLES, 0.5f, N_SAMPLES);
+
+	check("link buffers given back", t1->ports[SPA_DIRECTION_OUTPUT].n_reused == 1 &&
+	      t2->ports[SPA_DIRECTION_OUTPUT].n_reused == 1);
+
+	/* the short link is mixed as if silence follows */
+	fill_link(l1, 0.25f, N_SAMPLES);
+	fill_link(l2, 0.5f, N_SAMPLES / 2);
+	check_mix("mix a shorter link", core, input, 0.25f, N_SAMPLES, 0.5f, N_SAMPLES / 2);
+
+	fill_link(l1, 0.25f, N_SAMPLES / 4);
+	l2->io.status = SPA_STATUS_NEED_BUFFER;
+	check_mix("mix one link", core, input, 0.25f, N_SAMPLES / 4, 0.0f, 0);
+
+      done:
+	pw_node_destroy(src1);
+	pw_node_destroy(src2);
+	pw_node_destroy(sink);
+	iterate(loop);
+}
+
+static int refcount(struct allocation *allocation)
+{
+	return allocation->refcount ? *allocation->refcount : allocation->mem ? 1 : 0;
+}
+
+static void test_in_place(struct pw_main_loop *loop, struct pw_core *core)
+{
+	struct pw_node *src, *src2, *vol, *sink, *sink2;
+	struct pw_link *l1, *l2, *l3;
+	struct pw_port *vol_out;
+	struct test_node *ts;
+	float *s;
+
+	src = make_node(core, "src", 0, SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS);
+	src2 = make_node(core, "src2", 0, SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS);
+	vol = make_node(core, "vol", SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS,
+			SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS | SPA_PORT_INFO_FLAG_IN_PLACE);
+	sink = make_node(core, "sink", SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS, 0);
+	sink2 = make_node(core, "sink2", SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS, 0);
+	ts = pw_node_get_user_data(sink);
+	vol_out = get_port(vol, PW_DIRECTION_OUTPUT);
+
+	l1 = make_link(loop, core, src, vol);
+	l2 = make_link(loop, core, vol, sink);
+	check("forward in place", link_ready(l1) && link_ready(l2) &&
+	      l2->buffers == l1->buffers &&
+	      ts->ports[SPA_DIRECTION_INPUT].buffers == l1->buffers &&
+	      get_port(src, PW_DIRECTION_OUTPUT)->allocation.mem == vol_out->allocation.mem &&
+	      refcount(&vol_out->allocation) == 2);
+
+	/* the other links would see the data of vol */
+	l3 = make_link(loop, core, src, sink2);
+	check("no tee of buffers forwarded in place",
+	      l3 != NULL && l3->state == PW_LINK_STATE_ERROR && l3->n_buffers == 0 &&
+	      refcount(&vol_out->allocation) == 2);
+	if (l3)
+		pw_link_destroy(l3);
+
+	/* vol would forward buffers that are not the ones of its input */
+	l3 = make_link(loop, core, src2, vol);
+	check("no mix into buffers forwarded in place",
+	      l3 != NULL && l3->state == PW_LINK_STATE_ERROR && l3->n_buffers == 0 &&
+	      link_ready(l1) && link_ready(l2) && refcount(&vol_out->allocation) == 2);
+	if (l3)
+		pw_link_destroy(l3);
+
+	/* the buffers stay around for the link that still uses them */
+	pw_node_destroy(src);
+	iterate(loop);
+	check("destroy the owner of the forwarded buffers",
+	      refcount(&vol_out->allocation) == 1 && link_ready(l2));
+	if (link_ready(l2)) {
+		s = l2->buffers[0]->datas[0].data;
+		s[0] = s[N_SAMPLES - 1] = 1.0f;
+	}
+
+	pw_node_destroy(src2);
+	pw_node_destroy(vol);
+	pw_node_destroy(sink);
+	pw_node_destroy(sink2);
+	iterate(loop);
+}
+
+static void test_in_place_tee(struct pw_main_loop *loop, struct pw_core *core)
+{
+	struct pw_node *src, *vol, *sink, *sink2;
+	struct pw_link *l1, *l2, *l3;
+
+	src = make_node(core, "src", 0, SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS);
+	vol = make_node(core, "vol", SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS,
+			SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS | SPA_PORT_INFO_FLAG_IN_PLACE);
+	sink = make_node(core, "sink", SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS, 0);
+	sink2 = make_node(core, "sink2", SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS, 0);
+
+	/* the output of src goes to two nodes, vol can't work in place */
+	l1 = make_link(loop, core, src, vol);
+	l2 = make_link(loop, core, src, sink2);
+	l3 = make_link(loop, core, vol, sink);
+	check("no in place after a tee", link_ready(l1) && link_ready(l2) && link_ready(l3) &&
+	      l2->buffers == l1->buffers && l3->buffers != l1->buffers &&
+	      get_port(vol, PW_DIRECTION_OUTPUT)->allocation.refcount == NULL);
+
+	pw_node_destroy(src);
+	pw_node_destroy(vol);
+	pw_node_destroy(sink);
+	pw_node_destroy(sink2);
+	iterate(loop);
+}
+
+int main(int argc, char *argv[])
+{
+	struct pw_main_loop *loop;
+	struct pw_core *core;
+
+	pw_init(&argc, &argv);
+
+	loop = pw_main_loop_new(NULL);
+	core = pw_core_new(pw_main_loop_get_loop(loop), NULL);
+
+	test_mix(loop, core);
+	test_in_place(loop, core);
+	test_in_place_tee(loop, core);
+
+	pw_core_destroy(core);
+	pw_main_loop_destroy(loop);
+
+	printf("%s\n", n_failed > 0 ? "FAILED" : "OK");
+
+	return n_failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Latency of the first frames written into a freshly allocated pool of
+ * 4K video buffers, with and without prefaulting and huge pages. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/mem.h>
+
+#define N_BUFFERS	4
+#define FRAME_SIZE	(3840 * 2160 * 2)
+
+#define FLAGS	(PW_MEMBLOCK_FLAG_WITH_FD | PW_MEMBLOCK_FLAG_MAP_READWRITE | PW_MEMBLOCK_FLAG_SEAL)
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_TIME(&ts);
+}
+
+static long get_faults(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_minflt + usage.ru_majflt;
+}
+
+static int open_tlb_counter(void)
+{
+	struct perf_event_attr attr;
+
+	spa_zero(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_DTLB |
+		(PERF_COUNT_HW_CACHE_OP_WRITE << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void run(const char *name, enum pw_memblock_flags flags, int tlb_fd)
+{
+	struct pw_memblock *mem;
+	uint64_t t1, t2, t3, tlb_misses = 0;
+	long faults;
+	uint32_t i;
+
+	t1 = get_time();
+	if (pw_memblock_alloc(FLAGS | flags, N_BUFFERS * FRAME_SIZE, &mem) < 0) {
+		printf("%-20s: alloc failed\n", name);
+		return;
+	}
+	t2 = get_time();
+
+	faults = get_faults();
+	if (tlb_fd != -1) {
+		ioctl(tlb_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(tlb_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	/* produce a frame in each buffer */
+	for (i = 0; i < N_BUFFERS; i++)
+		memset(SPA_MEMBER(mem->ptr, i * FRAME_SIZE, void), i, FRAME_SIZE);
+
+	if (tlb_fd != -1) {
+		ioctl(tlb_fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(tlb_fd, &tlb_misses, sizeof(uint64_t)) != sizeof(uint64_t))
+			tlb_misses = 0;
+	}
+	faults = get_faults() - faults;
+	t3 = get_time();
+
+	printf("%-20s: alloc %8.3f ms, first frames %8.3f ms, %6ld faults",
+			name, (t2 - t1) / 1000000.0, (t3 - t2) / 1000000.0 / N_BUFFERS, faults);
+	if (tlb_fd != -1)
+		printf(", %8"PRIu64" dTLB misses", tlb_misses);
+	printf("\n");
+
+	pw_memblock_free(mem);
+}
+
+int main(int argc, char *argv[])
+{
+	int tlb_fd;
+
+	pw_init(&argc, &argv);
+
+	if ((tlb_fd = open_tlb_counter()) < 0)
+		printf("no dTLB counter: %m\n");
+
+	run("default", 0, tlb_fd);
+	run("prefault", PW_MEMBLOCK_FLAG_MAP_POPULATE, tlb_fd);
+	run("hugepages", PW_MEMBLOCK_FLAG_HUGEPAGES, tlb_fd);
+	run("prefault+hugepages", PW_MEMBLOCK_FLAG_MAP_POPULATE |
+			PW_MEMBLOCK_FLAG_HUGEPAGES, tlb_fd);
+
+	if (tlb_fd != -1)
+		close(tlb_fd);
+
+	return 0;
+}
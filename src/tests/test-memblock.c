@@ -0,0 +1,340 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/mem.h>
+
+#define N_RENEGOTIATIONS	2000
+#define N_BLOCKS		4
+
+#define N_THREADS		4
+#define N_THREAD_ALLOCS		5000
+
+#define N_FIND_BLOCKS		4096
+#define N_LOOKUPS		100000
+
+#define FLAGS	(PW_MEMBLOCK_FLAG_WITH_FD | PW_MEMBLOCK_FLAG_MAP_READWRITE | PW_MEMBLOCK_FLAG_SEAL)
+
+/* sizes of the buffer memory of a few links */
+static const size_t sizes[N_BLOCKS] = { 3000, 16384, 70000, 2 * 1024 * 1024 };
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_TIME(&ts);
+}
+
+static bool is_zero(const uint8_t *p, size_t size)
+{
+	size_t i;
+	for (i = 0; i < size; i++)
+		if (p[i] != 0)
+			return false;
+	return true;
+}
+
+/* the memory must be the same when mapped from the fd and offset, like
+ * a client would do */
+static bool check_fd(struct pw_memblock *mem)
+{
+	struct pw_map_range range;
+	void *ptr;
+	bool res;
+
+	pw_map_range_init(&range, mem->offset, mem->size, sysconf(_SC_PAGESIZE));
+
+	ptr = mmap(NULL, range.size, PROT_READ, MAP_SHARED, mem->fd, range.offset);
+	if (ptr == MAP_FAILED)
+		return false;
+
+	res = memcmp(SPA_MEMBER(ptr, range.start, void), mem->ptr, mem->size) == 0;
+	munmap(ptr, range.size);
+
+	return res;
+}
+
+/* blocks are sent to different clients, they must not share memory */
+static bool check_separate(struct pw_memblock **mem, uint32_t n_mem)
+{
+	struct stat st[n_mem];
+	uint32_t i, j;
+
+	for (i = 0; i < n_mem; i++) {
+		if (fstat(mem[i]->fd, &st[i]) < 0)
+			return false;
+		for (j = 0; j < i; j++)
+			if (st[i].st_dev == st[j].st_dev && st[i].st_ino == st[j].st_ino)
+				return false;
+	}
+	return true;
+}
+
+/* what pw_memblock_find used to do */
+static struct pw_memblock *find_linear(struct pw_memblock **blocks, uint32_t n_blocks,
+				       const void *ptr)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_blocks; i++) {
+		if (blocks[i] && ptr >= blocks[i]->ptr && ptr < blocks[i]->ptr + blocks[i]->size)
+			return blocks[i];
+	}
+	return NULL;
+}
+
+static const void *random_ptr(struct pw_memblock **blocks, uint32_t n_blocks)
+{
+	static int not_a_block;
+	struct pw_memblock *m = blocks[rand() % n_blocks];
+
+	if (m == NULL)
+		return &not_a_block;
+
+	/* inside, at the edges and just outside the block */
+	switch (rand() % 4) {
+	case 0:
+		return SPA_MEMBER(m->ptr, rand() % m->size, void);
+	case 1:
+		return m->ptr;
+	case 2:
+		return SPA_MEMBER(m->ptr, m->size - 1, void);
+	default:
+		return SPA_MEMBER(m->ptr, m->size, void);
+	}
+}
+
+static uint32_t test_find(void)
+{
+	struct pw_memblock **blocks;
+	const void **ptrs;
+	uint64_t t1, t2, t3;
+	uint32_t i, n_found = 0, n_errors = 0;
+
+	blocks = calloc(N_FIND_BLOCKS, sizeof(struct pw_memblock *));
+	ptrs = calloc(N_LOOKUPS, sizeof(void *));
+
+	for (i = 0; i < N_FIND_BLOCKS; i++) {
+		/* a mix of shared and malloc memory */
+		if (pw_memblock_alloc(i & 1 ? FLAGS : PW_MEMBLOCK_FLAG_NONE,
+					64 + (rand() % 8192), &blocks[i]) < 0)
+			return 1;
+	}
+	/* free some so that there are holes */
+	for (i = 0; i < N_FIND_BLOCKS; i += 3) {
+		pw_memblock_free(blocks[i]);
+		blocks[i] = NULL;
+	}
+
+	for (i = 0; i < N_LOOKUPS; i++)
+		ptrs[i] = random_ptr(blocks, N_FIND_BLOCKS);
+
+	t1 = get_time();
+	for (i = 0; i < N_LOOKUPS; i++)
+		n_found += pw_memblock_find(ptrs[i]) != NULL;
+	t2 = get_time();
+	for (i = 0; i < N_LOOKUPS; i++)
+		n_found -= find_linear(blocks, N_FIND_BLOCKS, ptrs[i]) != NULL;
+	t3 = get_time();
+
+	if (n_found != 0)
+		n_errors++;
+
+	for (i = 0; i < N_LOOKUPS; i++) {
+		if (pw_memblock_find(ptrs[i]) != find_linear(blocks, N_FIND_BLOCKS, ptrs[i]))
+			n_errors++;
+	}
+
+	printf("find in %u blocks: index %6.1f ns, list walk %8.1f ns per lookup\n",
+			N_FIND_BLOCKS - (N_FIND_BLOCKS + 2) / 3,
+			(double)(t2 - t1) / N_LOOKUPS, (double)(t3 - t2) / N_LOOKUPS);
+
+	for (i = 0; i < N_FIND_BLOCKS; i++)
+		pw_memblock_free(blocks[i]);
+
+	if (pw_memblock_find(ptrs[0]) != NULL)
+		n_errors++;
+
+	free(ptrs);
+	free(blocks);
+
+	return n_errors;
+}
+
+static bool same_file(int fd, const struct stat *st)
+{
+	struct stat st2;
+	return fstat(fd, &st2) == 0 && st->st_dev == st2.st_dev && st->st_ino == st2.st_ino;
+}
+
+/* the memory of a block that was sent to a client must never be given to
+ * another block, blocks are only sealed when asked for */
+static uint32_t test_export(void)
+{
+	struct pw_memblock *mem;
+	struct pw_memblock_stats stats;
+	struct stat st;
+	uint32_t n_errors = 0, n_exported;
+	int seals;
+
+	pw_memblock_get_stats(&stats);
+	n_exported = stats.n_exported;
+
+	if (pw_memblock_alloc(FLAGS, 8192, &mem) < 0)
+		return 1;
+	if (fstat(pw_memblock_export(mem), &st) < 0)
+		n_errors++;
+	pw_memblock_free(mem);
+
+	pw_memblock_get_stats(&stats);
+	if (stats.n_exported != n_exported + 1)
+		n_errors++;
+
+	if (pw_memblock_alloc(FLAGS, 8192, &mem) < 0)
+		return n_errors + 1;
+	if (same_file(mem->fd, &st))
+		n_errors++;
+	/* not exported, goes back to the pool */
+	if (fstat(mem->fd, &st) < 0)
+		n_errors++;
+	pw_memblock_free(mem);
+
+	if (pw_memblock_alloc(FLAGS & ~PW_MEMBLOCK_FLAG_SEAL, 8192, &mem) < 0)
+		return n_errors + 1;
+	if (same_file(mem->fd, &st))
+		n_errors++;
+	seals = fcntl(mem->fd, F_GET_SEALS);
+	if (seals != 0 && seals != -1)
+		n_errors++;
+	pw_memblock_free(mem);
+
+	if (pw_memblock_alloc(FLAGS, 8192, &mem) < 0)
+		return n_errors + 1;
+	if (!same_file(mem->fd, &st))
+		n_errors++;
+	pw_memblock_free(mem);
+
+	printf("export: %u errors\n", n_errors);
+
+	return n_errors;
+}
+
+static void *alloc_thread(void *data)
+{
+	uint32_t i, *n_errors = data;
+	struct pw_memblock *mem;
+
+	for (i = 0; i < N_THREAD_ALLOCS; i++) {
+		if (pw_memblock_alloc(FLAGS, sizes[i % 3], &mem) < 0) {
+			(*n_errors)++;
+			continue;
+		}
+		if (pw_memblock_find(mem->ptr) != mem)
+			(*n_errors)++;
+		pw_memblock_free(mem);
+	}
+	return NULL;
+}
+
+/* the pool is used from the main and the data threads */
+static uint32_t test_threads(void)
+{
+	pthread_t threads[N_THREADS];
+	uint32_t i, errors[N_THREADS] = { 0, }, n_errors = 0;
+	struct pw_memblock_stats stats;
+
+	for (i = 0; i < N_THREADS; i++)
+		pthread_create(&threads[i], NULL, alloc_thread, &errors[i]);
+	for (i = 0; i < N_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+		n_errors += errors[i];
+	}
+
+	pw_memblock_get_stats(&stats);
+	if (stats.used_size != 0)
+		n_errors++;
+
+	printf("%u threads, %u allocs each: %u errors\n", N_THREADS, N_THREAD_ALLOCS, n_errors);
+
+	return n_errors;
+}
+
+int main(int argc, char *argv[])
+{
+	struct pw_memblock *mem[N_BLOCKS];
+	struct pw_memblock_stats stats;
+	uint64_t start, stop;
+	uint32_t i, j, n_errors = 0;
+
+	pw_init(&argc, &argv);
+
+	start = get_time();
+	for (i = 0; i < N_RENEGOTIATIONS; i++) {
+		for (j = 0; j < N_BLOCKS; j++) {
+			if (pw_memblock_alloc(FLAGS, sizes[j], &mem[j]) < 0) {
+				fprintf(stderr, "alloc failed\n");
+				return 1;
+			}
+			if (i == 0 || i == N_RENEGOTIATIONS - 1) {
+				if (!is_zero(mem[j]->ptr, mem[j]->size))
+					n_errors++;
+				memset(mem[j]->ptr, j + 1, mem[j]->size);
+				if (!check_fd(mem[j]))
+					n_errors++;
+				if (pw_memblock_find(SPA_MEMBER(mem[j]->ptr, mem[j]->size - 1, void)) != mem[j])
+					n_errors++;
+			}
+		}
+		if (i == 0 && !check_separate(mem, N_BLOCKS))
+			n_errors++;
+		for (j = 0; j < N_BLOCKS; j++)
+			pw_memblock_free(mem[j]);
+	}
+	stop = get_time();
+
+	pw_memblock_get_stats(&stats);
+
+	printf("%u renegotiations: %8.2f us each\n", N_RENEGOTIATIONS,
+			(double)(stop - start) / N_RENEGOTIATIONS / SPA_NSEC_PER_USEC);
+	printf("pool: %u allocs, %u hits (%.1f%%), %u fds, %zd resident, %zd used\n",
+			stats.n_allocs, stats.n_hits,
+			stats.n_allocs ? 100.0 * stats.n_hits / stats.n_allocs : 0.0,
+			stats.n_fds, stats.resident_size, stats.used_size);
+
+	if (stats.used_size != 0)
+		n_errors++;
+
+	n_errors += test_export();
+	n_errors += test_threads();
+	n_errors += test_find();
+	if (n_errors > 0)
+		printf("%u errors\n", n_errors);
+
+	return n_errors > 0 ? 1 : 0;
+}
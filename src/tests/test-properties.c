@@ -0,0 +1,326 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/properties.h>
+
+#define N_OBJECTS	2000
+#define N_KEYS		24
+#define N_ROUNDS	20
+
+static const char *keys[] = {
+	"media.class", "media.name", "media.role", "media.type", "media.category",
+	"node.name", "node.description", "node.nick", "node.latency", "node.driver",
+	"device.api", "device.name", "device.description", "device.bus-path",
+	"application.name", "application.process.id", "application.process.binary",
+	"application.process.user", "application.process.host", "application.language",
+	"pipewire.client.reuse", "pipewire.autoconnect", "stream.capture.sink",
+	"object.path", "port.name", "port.direction", "format.dsp",
+};
+
+/* the implementation we had before, a strcmp on all keys and a copy of
+ * all strings */
+struct old_props {
+	struct spa_dict dict;
+	struct pw_array items;
+};
+
+static struct old_props *old_new(void)
+{
+	struct old_props *p = calloc(1, sizeof(struct old_props));
+	pw_array_init(&p->items, 16);
+	return p;
+}
+
+static int old_find(struct old_props *p, const char *key)
+{
+	int i, len = pw_array_get_len(&p->items, struct spa_dict_item);
+
+	for (i = 0; i < len; i++) {
+		struct spa_dict_item *item = pw_array_get_unchecked(&p->items, i, struct spa_dict_item);
+		if (strcmp(item->key, key) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static const char *old_get(struct old_props *p, const char *key)
+{
+	int index = old_find(p, key);
+	return index == -1 ? NULL :
+		pw_array_get_unchecked(&p->items, index, struct spa_dict_item)->value;
+}
+
+static void old_set(struct old_props *p, const char *key, const char *value)
+{
+	int index = old_find(p, key);
+	struct spa_dict_item *item;
+
+	if (index == -1) {
+		if (value == NULL)
+			return;
+		item = pw_array_add(&p->items, sizeof(struct spa_dict_item));
+		item->key = strdup(key);
+		item->value = strdup(value);
+	} else {
+		item = pw_array_get_unchecked(&p->items, index, struct spa_dict_item);
+		free((char *) item->key);
+		free((char *) item->value);
+		if (value == NULL) {
+			*item = *(struct spa_dict_item *) pw_array_get_unchecked(&p->items,
+					pw_array_get_len(&p->items, struct spa_dict_item) - 1,
+					struct spa_dict_item);
+			p->items.size -= sizeof(struct spa_dict_item);
+		} else {
+			item->key = strdup(key);
+			item->value = strdup(value);
+		}
+	}
+	p->dict.items = p->items.data;
+	p->dict.n_items = pw_array_get_len(&p->items, struct spa_dict_item);
+}
+
+static struct old_props *old_copy(struct old_props *p)
+{
+	struct old_props *copy = old_new();
+	struct spa_dict_item *item;
+
+	pw_array_for_each(item, &p->items)
+		old_set(copy, item->key, item->value);
+	return copy;
+}
+
+static struct old_props *old_merge(struct old_props *p, struct old_props *n)
+{
+	struct old_props *res = old_copy(p);
+	struct spa_dict_item *item;
+
+	pw_array_for_each(item, &n->items)
+		old_set(res, item->key, item->value);
+	return res;
+}
+
+static void old_free(struct old_props *p)
+{
+	struct spa_dict_item *item;
+
+	pw_array_for_each(item, &p->items) {
+		free((char *) item->key);
+		free((char *) item->value);
+	}
+	pw_array_clear(&p->items);
+	free(p);
+}
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_TIME(&ts);
+}
+
+static void fill(uint32_t obj, char *value, size_t size, uint32_t key)
+{
+	snprintf(value, size, "value-%u-%u", obj, key);
+}
+
+/* what a session manager does with the properties of each object: look up
+ * a few keys, copy them and merge in an update */
+static void bench(void)
+{
+	static struct pw_properties *props[N_OBJECTS], *update;
+	static struct old_props *old[N_OBJECTS], *old_update;
+	uint64_t t1, t2, t3, t4, t5, t6, t7;
+	uint32_t i, j, r, n_found = 0, n_keys = SPA_N_ELEMENTS(keys);
+	char value[64];
+
+	for (i = 0; i < N_OBJECTS; i++) {
+		props[i] = pw_properties_new(NULL, NULL);
+		old[i] = old_new();
+		for (j = 0; j < N_KEYS; j++) {
+			fill(i, value, sizeof(value), j);
+			pw_properties_set(props[i], keys[(i + j) % n_keys], value);
+			old_set(old[i], keys[(i + j) % n_keys], value);
+		}
+	}
+	update = pw_properties_new("node.latency", "256/48000", "media.role", "Communication", NULL);
+	old_update = old_new();
+	old_set(old_update, "node.latency", "256/48000");
+	old_set(old_update, "media.role", "Communication");
+
+	t1 = get_time();
+	for (r = 0; r < N_ROUNDS; r++)
+		for (i = 0; i < N_OBJECTS; i++)
+			for (j = 0; j < n_keys; j++)
+				n_found += pw_properties_get(props[i], keys[j]) != NULL;
+	t2 = get_time();
+	for (r = 0; r < N_ROUNDS; r++)
+		for (i = 0; i < N_OBJECTS; i++)
+			for (j = 0; j < n_keys; j++)
+				n_found -= old_get(old[i], keys[j]) != NULL;
+	t3 = get_time();
+
+	for (r = 0; r < N_ROUNDS; r++)
+		for (i = 0; i < N_OBJECTS; i++)
+			pw_properties_free(pw_properties_copy(props[i]));
+	t4 = get_time();
+	for (r = 0; r < N_ROUNDS; r++)
+		for (i = 0; i < N_OBJECTS; i++)
+			old_free(old_copy(old[i]));
+	t5 = get_time();
+
+	for (r = 0; r < N_ROUNDS; r++)
+		for (i = 0; i < N_OBJECTS; i++)
+			pw_properties_free(pw_properties_merge(props[i], update));
+	t6 = get_time();
+	for (r = 0; r < N_ROUNDS; r++)
+		for (i = 0; i < N_OBJECTS; i++)
+			old_free(old_merge(old[i], old_update));
+	t7 = get_time();
+
+#define PER_OP(t,n)	((double)(t) / (N_ROUNDS * N_OBJECTS * (n)))
+	printf("get   : hashed %7.1f ns, old %7.1f ns%s\n",
+			PER_OP(t2 - t1, n_keys), PER_OP(t3 - t2, n_keys),
+			n_found != 0 ? " MISMATCH" : "");
+	printf("copy  : hashed %7.1f ns, old %7.1f ns\n",
+			PER_OP(t4 - t3, 1), PER_OP(t5 - t4, 1));
+	printf("merge : hashed %7.1f ns, old %7.1f ns\n",
+			PER_OP(t6 - t5, 1), PER_OP(t7 - t6, 1));
+
+	for (i = 0; i < N_OBJECTS; i++) {
+		pw_properties_free(props[i]);
+		old_free(old[i]);
+	}
+	pw_properties_free(update);
+	old_free(old_update);
+}
+
+static int compare(struct pw_properties *props, struct old_props *old)
+{
+	uint32_t i;
+
+	if (props->dict.n_items != old->dict.n_items)
+		return -1;
+
+	for (i = 0; i < SPA_N_ELEMENTS(keys); i++) {
+		const char *v1 = pw_properties_get(props, keys[i]);
+		const char *v2 = old_get(old, keys[i]);
+		if ((v1 == NULL) != (v2 == NULL) || (v1 && strcmp(v1, v2) != 0))
+			return -1;
+	}
+	for (i = 0; i < props->dict.n_items; i++) {
+		const struct spa_dict_item *item = &props->dict.items[i];
+		if (strcmp(spa_dict_lookup(&props->dict, item->key), item->value) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+static void update_props(struct pw_properties **props, struct pw_properties *new)
+{
+	pw_properties_free(*props);
+	*props = new;
+}
+
+static void update_old(struct old_props **old, struct old_props *new)
+{
+	old_free(*old);
+	*old = new;
+}
+
+/* random sets, removes, copies and merges must give the same result as
+ * the old implementation */
+static int check(void)
+{
+	struct pw_properties *props, *tmp;
+	struct old_props *old, *otmp;
+	uint32_t i, n_keys = SPA_N_ELEMENTS(keys);
+	char value[64];
+	int res = 0;
+
+	props = pw_properties_new(NULL, NULL);
+	old = old_new();
+
+	for (i = 0; i < 100000 && res == 0; i++) {
+		const char *key = keys[rand() % n_keys];
+
+		switch (rand() % 8) {
+		case 0:
+			pw_properties_set(props, key, NULL);
+			old_set(old, key, NULL);
+			break;
+		case 1:
+			update_props(&props, pw_properties_copy(props));
+			break;
+		case 2:
+		{
+			const char *v = rand() % 4 ? "merged" : NULL;
+
+			tmp = pw_properties_new(key, v, NULL);
+			otmp = old_new();
+			old_set(otmp, key, v);
+
+			update_props(&props, pw_properties_merge(props, tmp));
+			update_old(&old, old_merge(old, otmp));
+			/* a NULL value in the update removes the key */
+			if (v == NULL)
+				old_set(old, key, NULL);
+
+			pw_properties_free(tmp);
+			old_free(otmp);
+			break;
+		}
+		case 3:
+			pw_properties_setf(props, key, "value-%d", i);
+			snprintf(value, sizeof(value), "value-%d", i);
+			old_set(old, key, value);
+			break;
+		default:
+			fill(i, value, sizeof(value), rand() % 4);
+			pw_properties_set(props, key, value);
+			old_set(old, key, value);
+			break;
+		}
+		res = compare(props, old);
+	}
+	if (res < 0)
+		printf("mismatch after %u operations\n", i);
+
+	pw_properties_free(props);
+	old_free(old);
+
+	return res;
+}
+
+int main(int argc, char *argv[])
+{
+	int res;
+
+	pw_init(&argc, &argv);
+
+	res = check();
+	bench();
+
+	return res < 0 ? 1 : 0;
+}
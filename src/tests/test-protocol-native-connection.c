@@ -0,0 +1,484 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Send a registry dump of many globals over a connection, like the server
+ * does when a client enumerates the registry. Some messages carry fds and
+ * some are larger than a chunk. Everything must arrive in order with the
+ * right fds, over the socket and over a shared memory ring.
+ *
+ * Then a client that sends small messages one by one, each with a flush,
+ * to a server in another thread. This compares the messages per second of
+ * the socket and the ring.
+ *
+ * Last, a ring that the peer did not accept and a peer that sends the old
+ * 8 byte header must close the connection. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#include <spa/pod/builder.h>
+#include <spa/pod/parser.h>
+
+#include <pipewire/pipewire.h>
+
+#include "modules/module-protocol-native/connection.h"
+
+#define N_GLOBALS	10000
+#define N_ITEMS		8
+#define N_POOL_FDS	64
+#define FDS_EVERY	50
+#define LARGE_EVERY	1000
+#define LARGE_SIZE	(40 * 1024)
+
+#define REGISTRY_ID	2
+#define EVENT_GLOBAL	0
+
+#define N_PARAMS	200000
+#define NODE_ID		3
+#define METHOD_SET_PARAM 1
+
+#define RING_SIZE	(256 * 1024)
+
+struct data {
+	struct pw_protocol_native_connection *out, *in;
+	int pool[N_POOL_FDS];
+	ino_t pool_ino[N_POOL_FDS];
+	char *large;
+
+	uint32_t n_received;
+	uint32_t n_errors;
+	size_t n_bytes;
+};
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_TIME(&ts);
+}
+
+static ino_t get_ino(int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		return 0;
+	return st.st_ino;
+}
+
+static uint32_t n_fds_of(uint32_t id)
+{
+	return (id % FDS_EVERY) == 0 ? 3 : 0;
+}
+
+static void send_global(struct data *d, uint32_t id)
+{
+	struct spa_pod_builder *b;
+	char key[64], value[64];
+	uint32_t i, n_fds = n_fds_of(id);
+
+	b = pw_protocol_native_connection_begin(d->out, REGISTRY_ID, EVENT_GLOBAL);
+
+	spa_pod_builder_add(b,
+			    "[",
+			    "i", id,
+			    "i", 0,
+			    "i", 0x7,
+			    "I", 42,
+			    "i", 0,
+			    "i", N_ITEMS, NULL);
+
+	for (i = 0; i < N_ITEMS; i++) {
+		snprintf(key, sizeof(key), "object.key-%u", i);
+		snprintf(value, sizeof(value), "value of global %u item %u", id, i);
+		spa_pod_builder_add(b,
+				    "s", key,
+				    "s", i == 0 && (id % LARGE_EVERY) == 0 ? d->large : value, NULL);
+	}
+	/* the fds, the first one twice */
+	spa_pod_builder_add(b, "i", n_fds, NULL);
+	for (i = 0; i < n_fds; i++)
+		spa_pod_builder_add(b, "i", pw_protocol_native_connection_add_fd(d->out,
+						d->pool[(id + i) % N_POOL_FDS]), NULL);
+	if (n_fds > 0)
+		spa_pod_builder_add(b, "i", pw_protocol_native_connection_add_fd(d->out,
+						d->pool[id % N_POOL_FDS]), NULL);
+	spa_pod_builder_add(b, "]", NULL);
+
+	pw_protocol_native_connection_end(d->out, b);
+}
+
+static int receive_global(struct data *d, uint32_t dest_id, uint8_t opcode, void *data, uint32_t size)
+{
+	struct spa_pod_parser prs;
+	uint32_t id, parent_id, permissions, type, version, n_items, n_fds, i, index;
+	const char *key, *value;
+	char expected[64];
+	int fd;
+
+	if (dest_id != REGISTRY_ID || opcode != EVENT_GLOBAL)
+		return -1;
+
+	spa_pod_parser_init(&prs, data, size, 0);
+	if (spa_pod_parser_get(&prs,
+			"["
+			"i", &id,
+			"i", &parent_id,
+			"i", &permissions,
+			"I", &type,
+			"i", &version,
+			"i", &n_items, NULL) < 0)
+		return -1;
+
+	if (id != d->n_received || n_items != N_ITEMS || type != 42)
+		return -1;
+
+	for (i = 0; i < n_items; i++) {
+		if (spa_pod_parser_get(&prs, "s", &key, "s", &value, NULL) < 0)
+			return -1;
+		if (i == 0 && (id % LARGE_EVERY) == 0) {
+			if (strcmp(value, d->large) != 0)
+				return -1;
+			continue;
+		}
+		snprintf(expected, sizeof(expected), "value of global %u item %u", id, i);
+		if (strcmp(value, expected) != 0)
+			return -1;
+	}
+
+	if (spa_pod_parser_get(&prs, "i", &n_fds, NULL) < 0 || n_fds != n_fds_of(id))
+		return -1;
+
+	for (i = 0; i < n_fds + (n_fds > 0 ? 1 : 0); i++) {
+		if (spa_pod_parser_get(&prs, "i", &index, NULL) < 0)
+			return -1;
+		if ((fd = pw_protocol_native_connection_get_fd(d->in, index)) < 0)
+			return -1;
+		if (get_ino(fd) != d->pool_ino[(id + (i % n_fds)) % N_POOL_FDS])
+			return -1;
+	}
+	for (i = 0; i < n_fds; i++)
+		close(pw_protocol_native_connection_get_fd(d->in, i));
+
+	return 0;
+}
+
+static void receive_all(struct data *d)
+{
+	uint8_t opcode;
+	uint32_t dest_id, size;
+	void *message;
+
+	while (pw_protocol_native_connection_get_next(d->in, &opcode, &dest_id, &message, &size)) {
+		if (receive_global(d, dest_id, opcode, message, size) < 0) {
+			if (d->n_errors++ == 0)
+				printf("bad message %u\n", d->n_received);
+		}
+		d->n_received++;
+		d->n_bytes += size;
+	}
+}
+
+/* read the wakeups and control messages of the peer */
+static void drain(struct pw_protocol_native_connection *conn)
+{
+	uint8_t opcode;
+	uint32_t dest_id, size;
+	void *message;
+
+	while (pw_protocol_native_connection_get_next(conn, &opcode, &dest_id, &message, &size));
+}
+
+static int test_dump(uint32_t ring_size)
+{
+	struct data data = { 0, };
+	uint64_t start, queued, stop;
+	uint32_t i, n_blocked = 0;
+	int fds[2], res = 0;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+		perror("socketpair");
+		return -1;
+	}
+	data.out = pw_protocol_native_connection_new(NULL, fds[0]);
+	data.in = pw_protocol_native_connection_new(NULL, fds[1]);
+
+	for (i = 0; i < N_POOL_FDS; i++) {
+		data.pool[i] = eventfd(0, EFD_CLOEXEC);
+		data.pool_ino[i] = get_ino(data.pool[i]);
+	}
+	data.large = malloc(LARGE_SIZE);
+	memset(data.large, 'x', LARGE_SIZE - 1);
+	data.large[LARGE_SIZE - 1] = '\0';
+
+	if (ring_size > 0) {
+		pw_protocol_native_connection_accept_ring(data.in, ring_size);
+		pw_protocol_native_connection_enable_ring(data.out, ring_size);
+	}
+
+	start = get_time();
+	for (i = 0; i < N_GLOBALS; i++)
+		send_global(&data, i);
+	queued = get_time();
+
+	while (data.n_received < N_GLOBALS && data.n_errors == 0) {
+		if (!pw_protocol_native_connection_flush(data.out))
+			break;
+		if (pw_protocol_native_connection_is_blocked(data.out))
+			n_blocked++;
+		receive_all(&data);
+		pw_protocol_native_connection_flush(data.in);
+		drain(data.out);
+	}
+	stop = get_time();
+
+	printf("%-6s: %u globals, %zd bytes: marshal %.3f ms, transfer %.3f ms, "
+			"%.0f globals/s %.1f MB/s\n", ring_size ? "ring" : "socket",
+			data.n_received, data.n_bytes,
+			(queued - start) / 1000000.0, (stop - queued) / 1000000.0,
+			data.n_received * (double) SPA_NSEC_PER_SEC / (stop - start),
+			data.n_bytes * 1000.0 / (stop - start));
+
+	if (data.n_received != N_GLOBALS || data.n_errors > 0) {
+		printf("received %u/%u, %u errors\n", data.n_received, N_GLOBALS, data.n_errors);
+		res = -1;
+	}
+	/* the dump does not fit in the socket, the sender must know when it
+	 * has to wait for the socket and when it is done */
+	if ((ring_size == 0 && n_blocked == 0) ||
+	    pw_protocol_native_connection_is_blocked(data.out)) {
+		printf("blocked %u times, blocked at the end %d\n", n_blocked,
+				pw_protocol_native_connection_is_blocked(data.out));
+		res = -1;
+	}
+
+	pw_protocol_native_connection_destroy(data.out);
+	pw_protocol_native_connection_destroy(data.in);
+	for (i = 0; i < N_POOL_FDS; i++)
+		close(data.pool[i]);
+	close(fds[0]);
+	close(fds[1]);
+	free(data.large);
+
+	return res;
+}
+
+struct churn {
+	struct pw_protocol_native_connection *client, *server;
+	int client_fd, server_fd;
+	uint32_t n_received;
+	uint32_t n_errors;
+	uint32_t n_wakeups;
+};
+
+static void *server_thread(void *user_data)
+{
+	struct churn *c = user_data;
+	struct pollfd pfd = { c->server_fd, POLLIN, 0 };
+	uint8_t opcode;
+	uint32_t dest_id, size, value;
+	void *message;
+	struct spa_pod_parser prs;
+
+	while (__atomic_load_n(&c->n_received, __ATOMIC_RELAXED) < N_PARAMS) {
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		c->n_wakeups++;
+
+		while (pw_protocol_native_connection_get_next(c->server, &opcode, &dest_id, &message, &size)) {
+			spa_pod_parser_init(&prs, message, size, 0);
+			if (dest_id != NODE_ID || opcode != METHOD_SET_PARAM ||
+			    spa_pod_parser_get(&prs, "[ i", &value, NULL) < 0 ||
+			    value != c->n_received)
+				c->n_errors++;
+			__atomic_store_n(&c->n_received, c->n_received + 1, __ATOMIC_RELAXED);
+		}
+		/* the answer to the ring and the wakeups of the client */
+		pw_protocol_native_connection_flush(c->server);
+	}
+	return NULL;
+}
+
+static void send_param(struct churn *c, uint32_t value)
+{
+	struct spa_pod_builder *b;
+
+	b = pw_protocol_native_connection_begin(c->client, NODE_ID, METHOD_SET_PARAM);
+	spa_pod_builder_struct(b,
+			"i", value,
+			"i", 2,
+			"f", 0.5f,
+			"f", 0.25f,
+			"l", (int64_t) value * 1000,
+			"s", "Spa:POD:Object:Props:volume");
+	pw_protocol_native_connection_end(c->client, b);
+}
+
+static int test_churn(uint32_t ring_size)
+{
+	struct churn c = { 0, };
+	struct pollfd pfd;
+	pthread_t thread;
+	uint64_t start, stop;
+	uint32_t i;
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+		perror("socketpair");
+		return -1;
+	}
+	c.client_fd = fds[0];
+	c.server_fd = fds[1];
+	c.client = pw_protocol_native_connection_new(NULL, c.client_fd);
+	c.server = pw_protocol_native_connection_new(NULL, c.server_fd);
+
+	if (ring_size > 0) {
+		pw_protocol_native_connection_accept_ring(c.server, ring_size);
+		pw_protocol_native_connection_enable_ring(c.client, ring_size);
+	}
+
+	pfd.fd = c.client_fd;
+	pfd.events = POLLIN;
+
+	pthread_create(&thread, NULL, server_thread, &c);
+
+	start = get_time();
+	for (i = 0; i < N_PARAMS; i++) {
+		send_param(&c, i);
+		pw_protocol_native_connection_flush(c.client);
+
+		/* wakeups when the server made room */
+		if ((i & 63) == 0 && poll(&pfd, 1, 0) > 0)
+			drain(c.client);
+	}
+	while (__atomic_load_n(&c.n_received, __ATOMIC_RELAXED) < N_PARAMS) {
+		if (poll(&pfd, 1, 10) > 0)
+			drain(c.client);
+		pw_protocol_native_connection_flush(c.client);
+	}
+	stop = get_time();
+
+	pthread_join(thread, NULL);
+
+	printf("%-6s: %u params: %.0f messages/s, %u server wakeups\n",
+			ring_size ? "ring" : "socket", c.n_received,
+			c.n_received * (double) SPA_NSEC_PER_SEC / (stop - start),
+			c.n_wakeups);
+
+	pw_protocol_native_connection_destroy(c.client);
+	pw_protocol_native_connection_destroy(c.server);
+	close(fds[0]);
+	close(fds[1]);
+
+	return c.n_errors > 0 ? -1 : 0;
+}
+
+/* a peer that did not accept rings closes the connection */
+static int test_refuse_ring(void)
+{
+	struct pw_protocol_native_connection *out, *in;
+	int fds[2], res = 0;
+	uint8_t b;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+		perror("socketpair");
+		return -1;
+	}
+	out = pw_protocol_native_connection_new(NULL, fds[0]);
+	in = pw_protocol_native_connection_new(NULL, fds[1]);
+
+	pw_protocol_native_connection_enable_ring(out, RING_SIZE);
+	pw_protocol_native_connection_flush(out);
+	drain(in);
+
+	if (recv(fds[0], &b, 1, MSG_DONTWAIT) != 0) {
+		printf("ring was not refused\n");
+		res = -1;
+	}
+
+	pw_protocol_native_connection_destroy(out);
+	pw_protocol_native_connection_destroy(in);
+	close(fds[0]);
+	close(fds[1]);
+
+	return res;
+}
+
+/* a hello with the old 8 byte header closes the connection */
+static int test_old_header(void)
+{
+	struct pw_protocol_native_connection *in;
+	int fds[2], res = 0;
+	uint8_t b, opcode;
+	uint32_t dest_id, size;
+	void *message;
+	uint32_t hello[] = {
+		0, (0 << 24) | 16,		/* id 0, opcode 0, 16 bytes */
+		8, SPA_POD_TYPE_STRUCT,		/* struct with an int version */
+		4, SPA_POD_TYPE_INT, 0, 0,
+	};
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+		perror("socketpair");
+		return -1;
+	}
+	in = pw_protocol_native_connection_new(NULL, fds[1]);
+
+	if (write(fds[0], hello, sizeof(hello)) != sizeof(hello)) {
+		perror("write");
+		res = -1;
+	}
+	if (pw_protocol_native_connection_get_next(in, &opcode, &dest_id, &message, &size)) {
+		printf("old header was parsed\n");
+		res = -1;
+	}
+	if (recv(fds[0], &b, 1, MSG_DONTWAIT) != 0) {
+		printf("old header did not close the connection\n");
+		res = -1;
+	}
+
+	pw_protocol_native_connection_destroy(in);
+	close(fds[0]);
+	close(fds[1]);
+
+	return res;
+}
+
+int main(int argc, char *argv[])
+{
+	int res = 0;
+
+	pw_init(&argc, &argv);
+
+	if (test_dump(0) < 0 || test_dump(RING_SIZE) < 0)
+		res = 1;
+	if (test_churn(0) < 0 || test_churn(RING_SIZE) < 0)
+		res = 1;
+	if (test_refuse_ring() < 0 || test_old_header() < 0)
+		res = 1;
+
+	return res;
+}
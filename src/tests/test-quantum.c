@@ -0,0 +1,199 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* The quantum of the graph follows the lowest latency that the nodes ask
+ * for and the running nodes get the new quantum when it changes. */
+
+#include <errno.h>
+#include <stdio.h>
+
+#include <pipewire/pipewire.h>
+#include "pipewire/private.h"
+
+struct test_node {
+	struct spa_node node;
+	struct pw_type *t;
+	int64_t latency;
+	uint32_t n_updates;
+};
+
+static int n_failed;
+
+static int node_send_command(struct spa_node *node, const struct spa_command *command)
+{
+	struct test_node *n = SPA_CONTAINER_OF(node, struct test_node, node);
+
+	if (SPA_COMMAND_TYPE(command) == n->t->command_node.ClockUpdate) {
+		struct spa_command_node_clock_update *cu = (__typeof__(cu)) command;
+
+		if (cu->body.change_mask.value & SPA_COMMAND_NODE_CLOCK_UPDATE_LATENCY) {
+			n->latency = cu->body.latency.value;
+			n->n_updates++;
+		}
+	}
+	return 0;
+}
+
+static int node_set_callbacks(struct spa_node *node,
+			      const struct spa_node_callbacks *callbacks, void *data)
+{
+	return 0;
+}
+
+static int node_get_n_ports(struct spa_node *node,
+			    uint32_t *n_input_ports, uint32_t *max_input_ports,
+			    uint32_t *n_output_ports, uint32_t *max_output_ports)
+{
+	*n_input_ports = *max_input_ports = 0;
+	*n_output_ports = *max_output_ports = 0;
+	return 0;
+}
+
+static int node_get_port_ids(struct spa_node *node,
+			     uint32_t *input_ids, uint32_t n_input_ids,
+			     uint32_t *output_ids, uint32_t n_output_ids)
+{
+	return 0;
+}
+
+static const struct spa_node node_impl = {
+	SPA_VERSION_NODE,
+	NULL,
+	.send_command = node_send_command,
+	.set_callbacks = node_set_callbacks,
+	.get_n_ports = node_get_n_ports,
+	.get_port_ids = node_get_port_ids,
+};
+
+static struct pw_node *make_node(struct pw_core *core, const char *latency)
+{
+	struct pw_node *node;
+	struct test_node *n;
+
+	node = pw_node_new(core, "test",
+			   latency ? pw_properties_new(PW_NODE_PROP_LATENCY, latency, NULL) : NULL,
+			   sizeof(struct test_node));
+	n = pw_node_get_user_data(node);
+	n->node = node_impl;
+	n->t = pw_core_get_type(core);
+	pw_node_set_implementation(node, &n->node);
+	pw_node_register(node, NULL, NULL, NULL);
+
+	return node;
+}
+
+static void set_latency(struct pw_node *node, const char *latency)
+{
+	struct spa_dict_item items[1] = { SPA_DICT_ITEM_INIT(PW_NODE_PROP_LATENCY, latency) };
+	pw_node_update_properties(node, &SPA_DICT_INIT(items, 1));
+}
+
+static void check(const char *what, struct pw_core *core, uint32_t quantum)
+{
+	uint32_t q = pw_core_get_quantum(core);
+
+	printf("%s: quantum %u\n", what, q);
+
+	if (q == quantum)
+		return;
+
+	printf("FAIL: %s: quantum %u, expected %u\n", what, q, quantum);
+	n_failed++;
+}
+
+static void check_latency(const char *what, struct test_node *n, uint32_t quantum)
+{
+	printf("%s: latency %" PRIi64 "ns\n", what, n->latency);
+
+	if (n->latency == (int64_t) quantum * SPA_NSEC_PER_SEC / PW_CORE_QUANTUM_RATE)
+		return;
+
+	printf("FAIL: %s: latency %" PRIi64 "ns, expected a quantum of %u\n",
+	       what, n->latency, quantum);
+	n_failed++;
+}
+
+int main(int argc, char *argv[])
+{
+	struct pw_main_loop *loop;
+	struct pw_core *core;
+	struct pw_node *n1, *n2, *n3;
+	struct test_node *t1;
+	int i;
+
+	pw_init(&argc, &argv);
+
+	loop = pw_main_loop_new(NULL);
+	core = pw_core_new(pw_main_loop_get_loop(loop), NULL);
+
+	check("start", core, PW_CORE_QUANTUM_DEFAULT);
+
+	n1 = make_node(core, NULL);
+	check("no latency", core, PW_CORE_QUANTUM_DEFAULT);
+
+	/* let n1 run so that it gets the updates */
+	pw_node_set_active(n1, true);
+	pw_node_set_state(n1, PW_NODE_STATE_RUNNING);
+	for (i = 0; i < 10; i++)
+		pw_loop_iterate(pw_main_loop_get_loop(loop), 0);
+
+	t1 = pw_node_get_user_data(n1);
+	if (n1->info.state != PW_NODE_STATE_RUNNING) {
+		printf("FAIL: node is not running\n");
+		n_failed++;
+	}
+	check_latency("running node", t1, PW_CORE_QUANTUM_DEFAULT);
+
+	n2 = make_node(core, "256/48000");
+	check("low latency client joins", core, 256);
+
+	n3 = make_node(core, "64/44100");
+	check("lower latency at 44100", core, 69);
+
+	set_latency(n3, "4096/48000");
+	check("latency raised", core, 256);
+
+	check_latency("running node updated", t1, 256);
+
+	pw_node_destroy(n2);
+	check("low latency client leaves", core, 4096);
+
+	set_latency(n3, "16/48000");
+	check("clamp min", core, PW_CORE_QUANTUM_MIN);
+
+	set_latency(n3, "100000/48000");
+	check("clamp max", core, PW_CORE_QUANTUM_MAX);
+
+	pw_node_destroy(n3);
+	check("all left", core, PW_CORE_QUANTUM_DEFAULT);
+
+	printf("running node got %u updates\n", t1->n_updates);
+	if (t1->n_updates != 8) {
+		printf("FAIL: expected 8 updates\n");
+		n_failed++;
+	}
+
+	pw_node_destroy(n1);
+	pw_core_destroy(core);
+	pw_main_loop_destroy(loop);
+
+	printf("%s\n", n_failed > 0 ? "FAILED" : "OK");
+
+	return n_failed > 0 ? 1 : 0;
+}